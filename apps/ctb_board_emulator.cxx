@@ -0,0 +1,413 @@
+/**
+ * @file ctb_board_emulator.cxx
+ *
+ * Emulates the Central Trigger Board control and readout protocols, so that
+ * the CTBModule can be run and load tested without the hardware.
+ *
+ * The control port accepts the JSON messages sent by CTBModule::send_message
+ * (board configuration, StartRun, StopRun, HardReset) and answers with a
+ * "feedback" array. After StartRun the emulator connects to the receiver
+ * socket from the configuration and streams tcp_header_t framed packets,
+ * either generated synthetically or replayed from calibration files.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBPacketContent.hpp"
+#include "CTBWordCodec.hpp"
+#include "CTBWordGenerator.hpp"
+#include "CalibrationFileReader.hpp"
+
+#include "ers/Issue.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bpo = boost::program_options;
+using boost::asio::ip::tcp;
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace {
+
+struct EmulatorConfig
+{
+  unsigned short control_port = 8991;
+  std::string receiver_host; ///< overrides the host in the board configuration
+  std::vector<std::string> replay_files;
+  bool max_speed = false;
+  CTBWordGenerator::Config generator;
+  uint64_t packet_period_us = 1000;
+  std::size_t max_packet_words = 256;
+  uint8_t format_version = 2;
+};
+
+class BoardEmulator
+{
+public:
+  explicit BoardEmulator(const EmulatorConfig& config)
+    : m_config(config)
+  {}
+
+  ~BoardEmulator() { stop_run(); }
+
+  /// Serves control connections, one at a time, until the process is killed
+  void serve()
+  {
+    tcp::acceptor acceptor(m_control_ios, tcp::endpoint(tcp::v4(), m_config.control_port));
+    std::cout << "Waiting for control connections on port " << m_config.control_port << std::endl;
+
+    while (true) {
+      tcp::socket socket(m_control_ios);
+      acceptor.accept(socket);
+      std::cout << "Control connection from " << socket.remote_endpoint() << std::endl;
+      serve_connection(socket);
+    }
+  }
+
+private:
+  void serve_connection(tcp::socket& socket)
+  {
+    std::string pending;
+    std::array<char, 4096> buffer;
+    boost::system::error_code error;
+
+    while (true) {
+      std::size_t n = socket.read_some(boost::asio::buffer(buffer), error);
+      if (error) {
+        std::cout << "Control connection closed: " << error.message() << std::endl;
+        return;
+      }
+      pending.append(buffer.data(), n);
+
+      // messages are not delimited: wait until a full JSON document arrived
+      if (!nlohmann::json::accept(pending)) {
+        continue;
+      }
+
+      nlohmann::json reply = handle(nlohmann::json::parse(pending));
+      pending.clear();
+      boost::asio::write(socket, boost::asio::buffer(reply.dump()), error);
+      if (error) {
+        std::cout << "Control connection closed: " << error.message() << std::endl;
+        return;
+      }
+    }
+  }
+
+  static nlohmann::json feedback(const std::string& type, const std::string& message)
+  {
+    nlohmann::json reply;
+    reply["feedback"].push_back({ { "type", type }, { "message", message } });
+    return reply;
+  }
+
+  nlohmann::json handle(const nlohmann::json& message)
+  {
+    if (message.contains("ctb")) {
+      if (m_running) {
+        return feedback("error", "Cannot configure while running");
+      }
+      m_board_config = message;
+      return feedback("info", "Configuration applied");
+    }
+
+    const std::string command = message.value("command", "");
+
+    if (command == "StartRun") {
+      if (m_board_config.is_null()) {
+        return feedback("error", "Board is not configured");
+      }
+      if (m_running) {
+        return feedback("warning", "Run already started");
+      }
+      start_run();
+      return feedback("info", "Run started");
+    }
+
+    if (command == "StopRun") {
+      if (!m_running) {
+        return feedback("warning", "No run in progress");
+      }
+      stop_run();
+      return feedback("info", "Run stopped");
+    }
+
+    if (command == "HardReset") {
+      stop_run();
+      m_board_config = nlohmann::json();
+      return feedback("info", "Board reset");
+    }
+
+    return feedback("error", "Unknown command: " + message.dump());
+  }
+
+  void start_run()
+  {
+    const auto& receiver = m_board_config["ctb"]["sockets"]["receiver"];
+    m_receiver_host = m_config.receiver_host.empty() ? receiver.value("host", "localhost") : m_config.receiver_host;
+    m_receiver_port = receiver.value("port", 8992);
+
+    m_running = true;
+    m_stream_thread = std::thread(&BoardEmulator::stream, this);
+  }
+
+  void stop_run()
+  {
+    m_running = false;
+    if (m_stream_thread.joinable()) {
+      m_stream_thread.join();
+    }
+  }
+
+  void stream()
+  {
+    boost::asio::io_service ios;
+    tcp::socket socket(ios);
+    boost::system::error_code error;
+
+    tcp::resolver resolver(ios);
+    auto endpoints = resolver.resolve(m_receiver_host, std::to_string(m_receiver_port), error);
+    if (!error) {
+      boost::asio::connect(socket, endpoints, error);
+    }
+    if (error) {
+      std::cerr << "Unable to connect to " << m_receiver_host << ':' << m_receiver_port << ": " << error.message()
+                << std::endl;
+      return;
+    }
+    std::cout << "Streaming to " << socket.remote_endpoint() << std::endl;
+
+    m_sequence_id = 0;
+    m_n_words_sent = 0;
+    if (m_config.replay_files.empty()) {
+      stream_synthetic(socket);
+    } else {
+      stream_replay(socket);
+    }
+
+    std::cout << "Stopped streaming after " << m_n_words_sent << " words" << std::endl;
+    socket.close(error);
+  }
+
+  void stream_synthetic(tcp::socket& socket)
+  {
+    CTBWordGenerator::Config generator_config = m_config.generator;
+    if (generator_config.start_timestamp == 0) {
+      generator_config.start_timestamp = now_timestamp();
+    }
+    CTBWordGenerator generator(generator_config);
+
+    const uint64_t period_ticks = m_config.packet_period_us * CTBWordGenerator::s_clock_frequency / 1e6;
+    uint64_t end_timestamp = generator_config.start_timestamp;
+    std::vector<content::word::word_t> words;
+    Pacer pacer(generator_config.start_timestamp, m_config.max_speed);
+
+    while (m_running) {
+      end_timestamp += period_ticks;
+      words.clear();
+      generator.generate_until(end_timestamp, words);
+      pacer.wait_for(end_timestamp);
+      if (!send(socket, reinterpret_cast<const uint8_t*>(words.data()), words.size())) {
+        return;
+      }
+    }
+  }
+
+  void stream_replay(tcp::socket& socket)
+  {
+    for (const auto& file_name : m_config.replay_files) {
+      std::unique_ptr<CalibrationFileReader> reader;
+      try {
+        reader = std::make_unique<CalibrationFileReader>(file_name);
+      } catch (const ers::Issue& issue) {
+        std::cerr << issue.what() << std::endl;
+        continue;
+      }
+      std::cout << "Replaying " << file_name << std::endl;
+
+      const uint8_t* words = reader->data();
+      std::size_t n_words = reader->size() / content::word::word_t::size_bytes;
+      std::vector<uint8_t> decoded;
+      if (reader->encoding() != calibration::Encoding::kRawWords) {
+        reader->decode(0, reader->size(), decoded);
+        words = decoded.data();
+        n_words = decoded.size() / content::word::word_t::size_bytes;
+      }
+
+      std::unique_ptr<Pacer> pacer;
+      std::size_t first = 0;
+      while (first < n_words && m_running) {
+        std::size_t last = std::min(first + m_config.max_packet_words, n_words);
+        if (!m_config.max_speed) {
+          uint64_t timestamp = last_full_timestamp(words, first, last);
+          if (timestamp != 0) {
+            if (!pacer) {
+              pacer = std::make_unique<Pacer>(timestamp, false);
+            }
+            pacer->wait_for(timestamp);
+          }
+        }
+        if (!send(socket, words + first * content::word::word_t::size_bytes, last - first)) {
+          return;
+        }
+        first = last;
+      }
+    }
+
+    // keep the connection open until the run is stopped, like the board does
+    while (m_running) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  // Splits words in packets of at most max_packet_words
+  bool send(tcp::socket& socket, const uint8_t* words, std::size_t n_words)
+  {
+    boost::system::error_code error;
+
+    for (std::size_t first = 0; first < n_words; first += m_config.max_packet_words) {
+      const std::size_t n = std::min(m_config.max_packet_words, n_words - first);
+
+      content::tcp_header_t header;
+      header.packet_size = n * content::word::word_t::size_bytes;
+      header.sequence_id = m_sequence_id++;
+      header.format_version = m_config.format_version;
+
+      std::array<boost::asio::const_buffer, 2> packet = {
+        boost::asio::buffer(&header, sizeof(header)),
+        boost::asio::buffer(words + first * content::word::word_t::size_bytes, header.packet_size)
+      };
+      boost::asio::write(socket, packet, error);
+      if (error) {
+        std::cerr << "Streaming failed: " << error.message() << std::endl;
+        return false;
+      }
+      m_n_words_sent += n;
+    }
+
+    return true;
+  }
+
+  static uint64_t last_full_timestamp(const uint8_t* words, std::size_t first, std::size_t last)
+  {
+    for (std::size_t i = last; i > first; --i) {
+      const auto word = codec::CTBWord::load(words + (i - 1) * codec::CTBWord::size_bytes);
+      if (word.word_type() != content::word::t_ch) {
+        return word.timestamp();
+      }
+    }
+    return 0;
+  }
+
+  /// CTB timestamps are 62.5 MHz ticks since the epoch
+  static uint64_t now_timestamp()
+  {
+    auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch).count() / 16;
+  }
+
+  /// Sleeps so that CTB time advances at wall clock speed
+  class Pacer
+  {
+  public:
+    Pacer(uint64_t start_timestamp, bool max_speed)
+      : m_start_timestamp(start_timestamp)
+      , m_start(std::chrono::steady_clock::now())
+      , m_max_speed(max_speed)
+    {}
+
+    void wait_for(uint64_t timestamp) const
+    {
+      if (m_max_speed || timestamp < m_start_timestamp) {
+        return;
+      }
+      std::this_thread::sleep_until(m_start + std::chrono::nanoseconds((timestamp - m_start_timestamp) * 16));
+    }
+
+  private:
+    uint64_t m_start_timestamp;
+    std::chrono::steady_clock::time_point m_start;
+    bool m_max_speed;
+  };
+
+  EmulatorConfig m_config;
+  boost::asio::io_service m_control_ios;
+  nlohmann::json m_board_config;
+
+  std::atomic<bool> m_running{ false };
+  std::thread m_stream_thread;
+  std::string m_receiver_host;
+  unsigned short m_receiver_port = 0;
+  uint8_t m_sequence_id = 0;
+  uint64_t m_n_words_sent = 0;
+};
+
+} // namespace
+} // namespace ctbmodules
+} // namespace dunedaq
+
+int
+main(int argc, char* argv[])
+{
+  dunedaq::ctbmodules::EmulatorConfig config;
+  std::string speed;
+  unsigned format_version;
+
+  bpo::options_description desc("Emulates a Central Trigger Board for the CTBModule");
+  desc.add_options()("help,h", "produce help message")(
+    "control-port", bpo::value(&config.control_port)->default_value(8991), "port receiving the control messages")(
+    "receiver-host", bpo::value(&config.receiver_host), "stream to this host instead of the configured one")(
+    "replay", bpo::value(&config.replay_files)->multitoken(), "calibration files to replay instead of generating words")(
+    "speed", bpo::value(&speed)->default_value("original"), "original: follow the CTB timestamps, max: no pacing")(
+    "ts-rate", bpo::value(&config.generator.ts_rate)->default_value(1000.), "timestamp word rate (Hz)")(
+    "channel-status-rate", bpo::value(&config.generator.channel_status_rate)->default_value(0.), "standalone channel status word rate (Hz)")(
+    "llt-rate", bpo::value(&config.generator.llt_rate)->default_value(100.), "LLT rate (Hz)")(
+    "hlt-rate", bpo::value(&config.generator.hlt_rate)->default_value(10.), "HLT rate (Hz)")(
+    "match-failure-fraction", bpo::value(&config.generator.match_failure_fraction)->default_value(0.), "fraction of triggers without their cause")(
+    "seed", bpo::value(&config.generator.seed)->default_value(0), "random seed")(
+    "packet-period", bpo::value(&config.packet_period_us)->default_value(1000), "CTB time covered by a packet (us)")(
+    "max-packet-words", bpo::value(&config.max_packet_words)->default_value(256), "maximum number of words in a packet")(
+    "format-version", bpo::value(&format_version)->default_value(2), "tcp_header_t format version");
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return 1;
+  }
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  if (speed != "original" && speed != "max") {
+    std::cerr << "Unknown speed " << speed << std::endl << desc << std::endl;
+    return 1;
+  }
+  // a packet of 0 words would never move on to the next words
+  if (config.max_packet_words == 0) {
+    std::cerr << "max-packet-words must be at least 1" << std::endl << desc << std::endl;
+    return 1;
+  }
+  config.max_speed = speed == "max";
+  config.format_version = format_version;
+
+  dunedaq::ctbmodules::BoardEmulator emulator(config);
+  emulator.serve();
+  return 0;
+}
@@ -0,0 +1,398 @@
+/**
+ * @file ctb_calib_convert.cxx
+ *
+ * Converts CTB calibration stream files to columnar tables, one per word type,
+ * decoding each file in parallel chunks.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBPacketContent.hpp"
+#include "CTBStreamDecoder.hpp"
+#include "CalibrationFileReader.hpp"
+
+#include "ers/Issue.hpp"
+
+#include <boost/program_options.hpp>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bpo = boost::program_options;
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace {
+
+// one vector of uint64_t per column, the columns of a table are consecutive
+enum Column : unsigned
+{
+  kTsTimestamp,
+  kFeedbackTimestamp,
+  kFeedbackCode,
+  kFeedbackSource,
+  kChannelTimestamp,
+  kChannelBeam,
+  kChannelCrt,
+  kChannelPds,
+  kLltTimestamp,
+  kLltTriggerWord,
+  kLltChannelPayload,
+  kHltTimestamp,
+  kHltTriggerWord,
+  kHltLltPayload,
+  kNColumns
+};
+
+struct Table
+{
+  const char* name;
+  unsigned first;
+  std::vector<const char*> columns;
+};
+
+const std::array<Table, 5> s_tables = { {
+  { "timestamp", kTsTimestamp, { "timestamp" } },
+  { "feedback", kFeedbackTimestamp, { "timestamp", "code", "source" } },
+  { "channel_status", kChannelTimestamp, { "timestamp", "beam", "crt", "pds" } },
+  { "llt", kLltTimestamp, { "timestamp", "trigger_word", "channel_payload" } },
+  { "hlt", kHltTimestamp, { "timestamp", "trigger_word", "llt_payload" } },
+} };
+
+using Columns = std::array<std::vector<uint64_t>, kNColumns>;
+
+/// Fills the columns of a chunk
+struct ColumnHandler
+{
+  Columns& columns;
+  uint64_t last_timestamp = 0;
+
+  bool stop_requested() const { return false; }
+
+  void on_ts_word(const codec::CTBWord& w)
+  {
+    last_timestamp = w.timestamp();
+    columns[kTsTimestamp].push_back(w.timestamp());
+  }
+
+  void on_feedback_word(const codec::CTBWord& w)
+  {
+    columns[kFeedbackTimestamp].push_back(w.timestamp());
+    columns[kFeedbackCode].push_back(w.feedback_code());
+    columns[kFeedbackSource].push_back(w.feedback_source());
+  }
+
+  void on_channel_status(const codec::CTBWord& w)
+  {
+    // 60 bit timestamp, completed from the last timestamp word like the decoder does
+    columns[kChannelTimestamp].push_back((last_timestamp & 0xF000000000000000) | w.ch_timestamp());
+    columns[kChannelBeam].push_back(w.ch_beam());
+    columns[kChannelCrt].push_back(w.ch_crt());
+    columns[kChannelPds].push_back(w.ch_pds());
+  }
+
+  void on_llt(const codec::CTBWord& w, uint64_t channel_payload)
+  {
+    columns[kLltTimestamp].push_back(w.timestamp());
+    columns[kLltTriggerWord].push_back(w.trigger_word());
+    columns[kLltChannelPayload].push_back(channel_payload);
+  }
+
+  void on_hlt(const codec::CTBWord& w, uint64_t llt_payload)
+  {
+    columns[kHltTimestamp].push_back(w.timestamp());
+    columns[kHltTriggerWord].push_back(w.trigger_word());
+    columns[kHltLltPayload].push_back(llt_payload);
+  }
+};
+
+struct Options
+{
+  std::string output;
+  std::size_t n_threads = 1;
+  std::size_t chunk_bytes = 0;
+  MatchWindow::Config matching;
+};
+
+/**
+ * @brief Converts one file
+ *
+ * The file is split in units of about s_unit_bytes, whole words or blocks, and
+ * the units are grouped in chunks of chunk_bytes. The threads take the chunks in
+ * order and prime the decoder with the unit before each one, so that the triggers
+ * at the start of a chunk find their inputs in the match windows. The calling thread
+ * appends the columns of the chunks to the files in the order of the chunks;
+ * at most two chunks per thread are decoded ahead of it.
+ */
+class FileConverter
+{
+public:
+  static constexpr std::size_t s_unit_bytes = 64 * 1024;
+  static constexpr std::size_t s_packet_words = 4096; // decode_packet() calls, like the pipelined readout
+
+  FileConverter(const CalibrationFileReader& reader, const Options& options)
+    : m_reader(reader)
+    , m_options(options)
+    , m_units(reader.split(s_unit_bytes))
+  {
+    // chunks: indexes in m_units of their first unit, the last entry is the end
+    const std::size_t units_per_chunk = std::max<std::size_t>(options.chunk_bytes / s_unit_bytes, 1);
+    for (std::size_t u = 0; u + 1 < m_units.size(); u += units_per_chunk) {
+      m_chunks.push_back(u);
+    }
+    m_chunks.push_back(m_units.size() - 1);
+    m_results.resize(n_chunks());
+  }
+
+  std::size_t n_chunks() const noexcept { return m_chunks.size() - 1; }
+
+  void run(const std::filesystem::path& directory)
+  {
+    std::array<std::ofstream, kNColumns> files;
+    for (const auto& table : s_tables) {
+      for (unsigned c = 0; c < table.columns.size(); ++c) {
+        const auto path = directory / (std::string(table.name) + '.' + table.columns[c] + ".u64");
+        files[table.first + c].open(path, std::ios::binary | std::ios::trunc);
+        if (!files[table.first + c]) {
+          throw std::runtime_error("Unable to open " + path.string());
+        }
+      }
+    }
+
+    std::vector<std::thread> threads;
+    const std::size_t n_threads = std::min(m_options.n_threads, std::max<std::size_t>(n_chunks(), 1));
+    for (std::size_t t = 0; t < n_threads; ++t) {
+      threads.emplace_back([this] { work(); });
+    }
+
+    for (std::size_t k = 0; k < n_chunks(); ++k) {
+      std::unique_ptr<Columns> columns;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] { return m_results[k] != nullptr; });
+        columns = std::move(m_results[k]);
+        m_written = k + 1;
+      }
+      m_cv.notify_all();
+
+      for (unsigned c = 0; c < kNColumns; ++c) {
+        const auto& column = (*columns)[c];
+        files[c].write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(uint64_t));
+        m_rows[c] += column.size();
+      }
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto& file : files) {
+      file.close();
+      if (!file) {
+        throw std::runtime_error("Unable to write the tables of " + m_reader.file_name());
+      }
+    }
+  }
+
+  uint64_t rows(unsigned column) const noexcept { return m_rows[column]; }
+  uint64_t n_words() const noexcept { return m_n_words.load(); }
+  uint64_t unmatched_llts() const noexcept { return m_unmatched_llts.load(); }
+  uint64_t unmatched_hlts() const noexcept { return m_unmatched_hlts.load(); }
+
+private:
+  void work()
+  {
+    CTBStreamDecoder decoder;
+    std::vector<uint8_t> words;
+
+    for (std::size_t k = m_next.fetch_add(1); k < n_chunks(); k = m_next.fetch_add(1)) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] { return k < m_written + 2 * m_options.n_threads; });
+      }
+
+      auto columns = std::make_unique<Columns>();
+      decoder.reset();
+      decoder.configure_matching(m_options.matching);
+      ColumnHandler handler{ *columns };
+
+      const std::size_t first = m_units[m_chunks[k]];
+      const std::size_t end = m_units[m_chunks[k + 1]];
+      if (k > 0) {
+        prime(decoder, handler, m_units[m_chunks[k] - 1], first, words);
+        decoder.channel_window().take_stats();
+        decoder.llt_window().take_stats();
+      }
+      m_n_words += decode(decoder, handler, first, end, words);
+      m_unmatched_llts += decoder.channel_window().take_stats().unmatched;
+      m_unmatched_hlts += decoder.llt_window().take_stats().unmatched;
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_results[k] = std::move(columns);
+      }
+      m_cv.notify_all();
+    }
+  }
+
+  /// The words of data() from begin to end, decoded into words with the compact encoding
+  std::pair<const uint8_t*, std::size_t> words_of(std::size_t begin, std::size_t end, std::vector<uint8_t>& words) const
+  {
+    if (m_reader.encoding() != calibration::Encoding::kCompactBlocks) {
+      return { m_reader.data() + begin, (end - begin) / codec::CTBWord::size_bytes };
+    }
+    words.clear();
+    m_reader.decode(begin, end - begin, words);
+    return { words.data(), words.size() / codec::CTBWord::size_bytes };
+  }
+
+  /// The unit before a chunk: its inputs and timestamp for the first triggers of the chunk
+  void prime(CTBStreamDecoder& decoder, ColumnHandler& handler, std::size_t begin, std::size_t end, std::vector<uint8_t>& words) const
+  {
+    const auto [data, n_words] = words_of(begin, end, words);
+    decoder.prime(data, n_words);
+    for (std::size_t i = n_words; i-- > 0;) {
+      const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+      if (CTBStreamDecoder::IsTSWord(word)) {
+        handler.last_timestamp = word.timestamp();
+        break;
+      }
+    }
+  }
+
+  std::size_t decode(CTBStreamDecoder& decoder,
+                     ColumnHandler& handler,
+                     std::size_t begin,
+                     std::size_t end,
+                     std::vector<uint8_t>& words) const
+  {
+    const auto [data, n_words] = words_of(begin, end, words);
+    for (std::size_t i = 0; i < n_words; i += s_packet_words) {
+      const std::size_t n = std::min(s_packet_words, n_words - i);
+      decoder.decode_packet(data + i * codec::CTBWord::size_bytes, n, handler);
+    }
+    return n_words;
+  }
+
+  const CalibrationFileReader& m_reader;
+  const Options& m_options;
+  std::vector<std::size_t> m_units;
+  std::vector<std::size_t> m_chunks;
+
+  std::atomic<std::size_t> m_next{ 0 };
+  std::atomic<uint64_t> m_n_words{ 0 };
+  std::atomic<uint64_t> m_unmatched_llts{ 0 }; // without their channel status word
+  std::atomic<uint64_t> m_unmatched_hlts{ 0 }; // without their LLT
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::vector<std::unique_ptr<Columns>> m_results; // of the chunks not written yet
+  std::size_t m_written = 0;                       // chunks written
+
+  std::array<uint64_t, kNColumns> m_rows = {};
+};
+
+/// Tables of file_name in output/<file stem>/, described by tables.json
+void
+convert(const std::string& file_name, const Options& options)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  CalibrationFileReader reader(file_name);
+  const std::filesystem::path directory =
+    std::filesystem::path(options.output) / std::filesystem::path(file_name).stem();
+  std::filesystem::create_directories(directory);
+
+  FileConverter converter(reader, options);
+  converter.run(directory);
+
+  nlohmann::json manifest;
+  manifest["source"] = file_name;
+  manifest["run"] = reader.header().run_number;
+  manifest["config_hash"] = reader.header().config_hash;
+  manifest["words"] = converter.n_words();
+  manifest["unmatched_llts"] = converter.unmatched_llts();
+  manifest["unmatched_hlts"] = converter.unmatched_hlts();
+  manifest["type"] = "uint64 little endian";
+  for (const auto& table : s_tables) {
+    nlohmann::json columns = nlohmann::json::array();
+    for (unsigned c = 0; c < table.columns.size(); ++c) {
+      columns.push_back(std::string(table.name) + '.' + table.columns[c] + ".u64");
+    }
+    manifest["tables"][table.name] = { { "rows", converter.rows(table.first) }, { "columns", columns } };
+  }
+  std::ofstream(directory / "tables.json") << manifest.dump(2) << std::endl;
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << file_name << ": " << converter.n_words() << " words in " << converter.n_chunks() << " chunks, "
+            << seconds << " s, " << reader.size() / seconds / 1e9 << " GB/s" << std::endl;
+}
+
+} // namespace
+} // namespace ctbmodules
+} // namespace dunedaq
+
+int
+main(int argc, char* argv[])
+{
+  using namespace dunedaq::ctbmodules;
+
+  std::vector<std::string> file_names;
+  Options options;
+  std::size_t chunk_mb = 16;
+
+  bpo::options_description desc("Converts CTB calibration stream files to columnar tables, one directory per file");
+  desc.add_options()("help,h", "produce help message")(
+    "file", bpo::value(&file_names)->multitoken()->required(), "calibration stream files")(
+    "output,o", bpo::value(&options.output)->required(), "output directory")(
+    "threads,j", bpo::value(&options.n_threads)->default_value(std::max(1u, std::thread::hardware_concurrency())), "decoding threads")(
+    "chunk-size", bpo::value(&chunk_mb)->default_value(chunk_mb), "MB of file data decoded by a thread at a time")(
+    "match-window-depth", bpo::value(&options.matching.depth)->default_value(options.matching.depth), "inputs kept to match the triggers")(
+    "match-tolerance", bpo::value(&options.matching.tolerance)->default_value(options.matching.tolerance), "ticks between a trigger and its input");
+
+  bpo::positional_options_description positional;
+  positional.add("file", -1);
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return 1;
+  }
+  options.n_threads = std::max<std::size_t>(options.n_threads, 1);
+  options.chunk_bytes = chunk_mb << 20;
+
+  try {
+    for (const auto& file_name : file_names) {
+      convert(file_name, options);
+    }
+  } catch (const ers::Issue& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
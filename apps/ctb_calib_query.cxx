@@ -0,0 +1,183 @@
+/**
+ * @file ctb_calib_query.cxx
+ *
+ * Prints the words of a time range found in CTB calibration stream files, in
+ * timestamp order, one per line.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBPacketContent.hpp"
+#include "CalibrationQuery.hpp"
+
+#include "ers/Issue.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bpo = boost::program_options;
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace {
+
+const std::map<std::string, unsigned> s_word_types = {
+  { "feedback", content::word::t_fback }, { "llt", content::word::t_lt },         { "hlt", content::word::t_gt },
+  { "channel_status", content::word::t_ch }, { "checksum", content::word::t_chksum }, { "timestamp", content::word::t_ts },
+};
+
+void
+print(const calibration::Match& match, const std::string& file_name)
+{
+  const codec::CTBWord& word = match.word;
+  std::cout << match.timestamp << '\t';
+
+  switch (word.word_type()) {
+    case content::word::t_ts:
+      std::cout << "timestamp";
+      break;
+    case content::word::t_fback:
+      std::cout << "feedback" << std::hex << "\tcode=0x" << word.feedback_code() << " source=0x" << word.feedback_source()
+                << std::dec;
+      break;
+    case content::word::t_ch:
+      std::cout << "channel_status" << std::hex << "\tbeam=0x" << word.ch_beam() << " crt=0x" << word.ch_crt()
+                << " pds=0x" << word.ch_pds() << std::dec;
+      break;
+    case content::word::t_lt:
+    case content::word::t_gt:
+      std::cout << (word.word_type() == content::word::t_gt ? "hlt" : "llt") << std::hex << "\ttrigger=0x"
+                << word.trigger_word() << std::dec;
+      break;
+    default:
+      std::cout << "type_" << word.word_type() << std::hex << "\tpayload=0x" << word.payload() << std::dec;
+      break;
+  }
+  std::cout << '\t' << file_name << '\n';
+}
+
+uint64_t
+bits_of(const std::vector<unsigned>& bits)
+{
+  uint64_t mask = 0;
+  for (unsigned bit : bits) {
+    if (bit >= 64) {
+      throw bpo::validation_error(bpo::validation_error::invalid_option_value, "bit", std::to_string(bit));
+    }
+    mask |= uint64_t(1) << bit;
+  }
+  return mask;
+}
+
+} // namespace
+} // namespace ctbmodules
+} // namespace dunedaq
+
+int
+main(int argc, char* argv[])
+{
+  using namespace dunedaq::ctbmodules;
+
+  std::vector<std::string> inputs;
+  std::string prefix;
+  std::string begin = "0";
+  std::string end = "0xFFFFFFFFFFFFFFFF";
+  std::vector<std::string> types;
+  std::vector<unsigned> hlt_bits;
+  std::vector<unsigned> llt_bits;
+  std::size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t limit = 0;
+
+  bpo::options_description desc("Prints the words of calibration stream files within a time range, in timestamp order");
+  desc.add_options()("help,h", "produce help message")(
+    "input", bpo::value(&inputs)->multitoken()->required(), "calibration stream files, or directories of them")(
+    "prefix", bpo::value(&prefix), "only the files of the directories starting with prefix, like run101_")(
+    "begin,b", bpo::value(&begin)->default_value(begin), "first CTB timestamp")(
+    "end,e", bpo::value(&end)->default_value(end), "last CTB timestamp")(
+    "type,t", bpo::value(&types)->multitoken(), "word types: timestamp, feedback, channel_status, llt, hlt, checksum (default all)")(
+    "hlt", bpo::value(&hlt_bits)->multitoken(), "only the HLTs with one of these bits")(
+    "llt", bpo::value(&llt_bits)->multitoken(), "only the LLTs with one of these bits")(
+    "threads,j", bpo::value(&n_threads)->default_value(n_threads), "scanning threads")(
+    "limit,n", bpo::value(&limit)->default_value(limit), "stop after this many words, 0 for all")(
+    "stats", "print what was scanned to stderr");
+
+  bpo::positional_options_description positional;
+  positional.add("input", -1);
+
+  calibration::Query query;
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+    bpo::notify(vm);
+
+    try {
+      query.begin = std::stoull(begin, nullptr, 0);
+      query.end = std::stoull(end, nullptr, 0);
+    } catch (const std::exception&) {
+      throw bpo::validation_error(bpo::validation_error::invalid_option_value, "begin/end");
+    }
+    if (!types.empty()) {
+      query.word_types = 0;
+      for (const auto& type : types) {
+        const auto it = s_word_types.find(type);
+        if (it == s_word_types.end()) {
+          throw bpo::validation_error(bpo::validation_error::invalid_option_value, "type", type);
+        }
+        query.word_types |= 1 << it->second;
+      }
+    }
+    query.hlt_bits = bits_of(hlt_bits);
+    query.llt_bits = bits_of(llt_bits);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return 1;
+  }
+
+  try {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::string> file_names;
+    for (const auto& input : inputs) {
+      if (std::filesystem::is_directory(input)) {
+        const auto listed = CalibrationQuery::list_files(input, prefix);
+        file_names.insert(file_names.end(), listed.begin(), listed.end());
+      } else {
+        file_names.push_back(input);
+      }
+    }
+
+    const CalibrationQuery calibration_query(file_names);
+    uint64_t n_printed = 0;
+    const auto stats = calibration_query.run(query, n_threads, [&](const calibration::Match& match) {
+      print(match, calibration_query.file_name(match.file));
+      return limit == 0 || ++n_printed < limit;
+    });
+    std::cout.flush();
+
+    if (vm.count("stats")) {
+      const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cerr << calibration_query.n_files() << " files, " << stats.files_skipped << " out of range, "
+                << stats.files_scanned << " scanned in " << stats.tasks << " tasks, " << stats.bytes_scanned
+                << " bytes, " << stats.matches << " words, " << seconds << " s" << std::endl;
+    }
+  } catch (const ers::Issue& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,449 @@
+/**
+ * @file ctb_decoder_benchmark.cxx
+ *
+ * Microbenchmarks of the CTB readout hot path: word classification, trigger
+ * matching and HSI frame formation, as done by CTBModule::do_hsi_work, and of
+ * the compact encoding of the calibration stream.
+ *
+ * The word streams are generated in memory with CTBWordGenerator, no sockets
+ * are involved. Calibration stream files can be given as well, their words are
+ * then used for the encoding benchmarks. Each result is printed on stdout as one JSON object per line,
+ * so that the numbers can be collected and compared between releases.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBPacketContent.hpp"
+#include "CTBStreamDecoder.hpp"
+#include "CTBWordCodec.hpp"
+#include "CTBWordGenerator.hpp"
+#include "CalibrationCodec.hpp"
+#include "CalibrationFileReader.hpp"
+#include "MatchWindow.hpp"
+
+#include "ers/Issue.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bpo = boost::program_options;
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace {
+
+/// Handler that only counts the decoded words: measures classification and matching
+struct CountingHandler
+{
+  uint64_t n_ts = 0, n_feedback = 0, n_hlt = 0, n_llt = 0, n_channel_status = 0;
+  uint64_t checksum = 0;
+
+  bool stop_requested() const noexcept { return false; }
+  void on_ts_word(const codec::CTBWord&) noexcept { ++n_ts; }
+  void on_feedback_word(const codec::CTBWord&) noexcept { ++n_feedback; }
+  void on_hlt(const codec::CTBWord&, uint64_t llt_payload) noexcept
+  {
+    ++n_hlt;
+    checksum += llt_payload;
+  }
+  void on_llt(const codec::CTBWord&, uint64_t channel_payload) noexcept
+  {
+    ++n_llt;
+    checksum += channel_payload;
+  }
+  void on_channel_status(const codec::CTBWord&) noexcept { ++n_channel_status; }
+};
+
+/// Handler that also forms the HSI frames the module sends, like CTBModule does
+struct FrameHandler : CountingHandler
+{
+  void on_hlt(const codec::CTBWord& hlt, uint64_t llt_payload) noexcept
+  {
+    CountingHandler::on_hlt(hlt, llt_payload);
+    sink(CTBStreamDecoder::make_hlt_frame(hlt, llt_payload, n_hlt));
+  }
+  void on_llt(const codec::CTBWord& llt, uint64_t channel_payload) noexcept
+  {
+    CountingHandler::on_llt(llt, channel_payload);
+    sink(CTBStreamDecoder::make_llt_frame(llt, channel_payload, n_llt));
+  }
+  void sink(const CTBStreamDecoder::hsi_frame_t& frame) noexcept
+  {
+    for (auto w : frame) {
+      checksum = checksum * 31 + w;
+    }
+  }
+};
+
+/// Extracts the fields of every word with the bitfield structs of CTBPacketContent.hpp
+struct StructExtractor
+{
+  static uint64_t extract(const uint8_t* bytes) noexcept
+  {
+    content::word::word_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    if (word.word_type == content::word::t_ch) {
+      content::word::ch_status_t ch;
+      std::memcpy(&ch, bytes, sizeof(ch));
+      return ch.timestamp ^ ch.get_beam() ^ ch.get_crt() ^ ch.get_pds();
+    }
+    return word.timestamp ^ word.payload ^ word.word_type;
+  }
+};
+
+/// Extracts the same fields with the CTBWord codec
+struct CodecExtractor
+{
+  static uint64_t extract(const uint8_t* bytes) noexcept
+  {
+    const auto word = codec::CTBWord::load(bytes);
+    if (word.word_type() == content::word::t_ch) {
+      return word.ch_timestamp() ^ word.ch_beam() ^ word.ch_crt() ^ word.ch_pds();
+    }
+    return word.timestamp() ^ word.payload() ^ word.word_type();
+  }
+};
+
+/// Realistic mixes of words, see the CTBWordGenerator documentation
+std::map<std::string, CTBWordGenerator::Config>
+make_streams()
+{
+  std::map<std::string, CTBWordGenerator::Config> streams;
+
+  CTBWordGenerator::Config beam_spill;
+  beam_spill.ts_rate = 1000.;
+  beam_spill.channel_status_rate = 10000.;
+  beam_spill.llt_rate = 100000.;
+  beam_spill.hlt_rate = 20000.;
+  streams["beam_spill"] = beam_spill;
+
+  CTBWordGenerator::Config channel_status_heavy;
+  channel_status_heavy.ts_rate = 1000.;
+  channel_status_heavy.channel_status_rate = 1000000.;
+  channel_status_heavy.llt_rate = 1000.;
+  channel_status_heavy.hlt_rate = 100.;
+  streams["channel_status_heavy"] = channel_status_heavy;
+
+  // dense interleaving of every word type, hard on branch prediction
+  CTBWordGenerator::Config mixed_spill;
+  mixed_spill.ts_rate = 50000.;
+  mixed_spill.channel_status_rate = 100000.;
+  mixed_spill.llt_rate = 100000.;
+  mixed_spill.hlt_rate = 50000.;
+  streams["mixed_spill"] = mixed_spill;
+
+  // LLTs in bursts of 4, their channel status words all come first
+  CTBWordGenerator::Config burst = beam_spill;
+  burst.burst_size = 4;
+  streams["burst"] = burst;
+
+  // every LLT and HLT misses its cause, each one goes through the error path
+  CTBWordGenerator::Config match_failure = beam_spill;
+  match_failure.match_failure_fraction = 1.;
+  streams["match_failure"] = match_failure;
+
+  return streams;
+}
+
+struct Result
+{
+  double best_ns_per_word;
+  double median_ns_per_word;
+  uint64_t checksum;
+};
+
+/// Decodes the stream packet by packet, iterations times, and returns the timings
+template<typename Handler>
+Result
+run(const std::vector<content::word::word_t>& words,
+    std::size_t packet_words,
+    unsigned iterations,
+    bool batch,
+    const MatchWindow::Config& matching,
+    CTBStreamDecoder::Dispatch dispatch = CTBStreamDecoder::Dispatch::kGrouped)
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(words.data());
+  const std::size_t word_size = content::word::word_t::size_bytes;
+
+  std::vector<double> ns_per_word;
+  uint64_t checksum = 0;
+
+  for (unsigned it = 0; it < iterations; ++it) {
+    CTBStreamDecoder decoder;
+    decoder.configure_matching(matching);
+    Handler handler;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t first = 0; first < words.size(); first += packet_words) {
+      const std::size_t n = std::min(packet_words, words.size() - first);
+      if (batch) {
+        decoder.decode_packet(data + first * word_size, n, handler, dispatch);
+      } else {
+        decoder.decode(data + first * word_size, n, handler);
+      }
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    ns_per_word.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / words.size());
+    checksum = handler.checksum + handler.n_ts + handler.n_channel_status;
+  }
+
+  std::sort(ns_per_word.begin(), ns_per_word.end());
+  return { ns_per_word.front(), ns_per_word[ns_per_word.size() / 2], checksum };
+}
+
+/// Field extraction only, to compare the word layouts
+template<typename Extractor>
+Result
+run_extraction(const std::vector<content::word::word_t>& words, unsigned iterations)
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(words.data());
+  const std::size_t word_size = content::word::word_t::size_bytes;
+
+  std::vector<double> ns_per_word;
+  uint64_t checksum = 0;
+
+  for (unsigned it = 0; it < iterations; ++it) {
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < words.size(); ++i) {
+      sum += Extractor::extract(data + i * word_size);
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    ns_per_word.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / words.size());
+    checksum = sum;
+  }
+
+  std::sort(ns_per_word.begin(), ns_per_word.end());
+  return { ns_per_word.front(), ns_per_word[ns_per_word.size() / 2], checksum };
+}
+
+/// Word type classification only
+Result
+run_classification(const std::vector<content::word::word_t>& words, unsigned iterations, bool simd)
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(words.data());
+  std::vector<uint64_t> planes(3 * ((words.size() + 63) / 64));
+
+  std::vector<double> ns_per_word;
+  uint64_t checksum = 0;
+
+  for (unsigned it = 0; it < iterations; ++it) {
+    auto start = std::chrono::steady_clock::now();
+    if (simd) {
+      CTBStreamDecoder::classify(data, words.size(), planes.data());
+    } else {
+      CTBStreamDecoder::classify_scalar(data, words.size(), planes.data());
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    ns_per_word.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / words.size());
+    checksum = 0;
+    for (auto p : planes) {
+      checksum = checksum * 31 + p;
+    }
+  }
+
+  std::sort(ns_per_word.begin(), ns_per_word.end());
+  return { ns_per_word.front(), ns_per_word[ns_per_word.size() / 2], checksum };
+}
+
+/// Compact encoding of the calibration stream, in packets of packet_words as the writer gets them
+Result
+run_encoding(const std::vector<uint8_t>& words, std::size_t packet_words, unsigned iterations, std::size_t& encoded_size)
+{
+  const std::size_t word_size = codec::CTBWord::size_bytes;
+  const std::size_t n_words = words.size() / word_size;
+
+  std::vector<double> ns_per_word;
+  std::vector<uint8_t> encoded;
+  encoded.reserve(words.size());
+
+  for (unsigned it = 0; it < iterations; ++it) {
+    encoded.clear();
+    calibration::BlockEncoder encoder;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t first = 0; first < n_words; first += packet_words) {
+      encoder.add(words.data() + first * word_size, std::min(packet_words, n_words - first), encoded);
+    }
+    encoder.finish(encoded);
+    auto stop = std::chrono::steady_clock::now();
+
+    ns_per_word.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / n_words);
+  }
+
+  encoded_size = encoded.size();
+  uint64_t checksum = 0;
+  for (auto b : encoded) {
+    checksum = checksum * 31 + b;
+  }
+
+  std::sort(ns_per_word.begin(), ns_per_word.end());
+  return { ns_per_word.front(), ns_per_word[ns_per_word.size() / 2], checksum };
+}
+
+/// Decoding of the compact encoding; the result is checked against the words
+Result
+run_decoding(const std::vector<uint8_t>& words, unsigned iterations)
+{
+  std::vector<uint8_t> encoded;
+  calibration::BlockEncoder encoder;
+  encoder.add(words.data(), words.size() / codec::CTBWord::size_bytes, encoded);
+  encoder.finish(encoded);
+
+  std::vector<double> ns_per_word;
+  std::vector<uint8_t> decoded;
+  decoded.reserve(words.size());
+
+  for (unsigned it = 0; it < iterations; ++it) {
+    decoded.clear();
+    auto start = std::chrono::steady_clock::now();
+    calibration::decode_blocks(encoded.data(), encoded.size(), decoded);
+    auto stop = std::chrono::steady_clock::now();
+
+    ns_per_word.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / (words.size() / codec::CTBWord::size_bytes));
+  }
+
+  std::sort(ns_per_word.begin(), ns_per_word.end());
+  // a checksum of 1 means the round trip is lossless
+  return { ns_per_word.front(), ns_per_word[ns_per_word.size() / 2], uint64_t(decoded == words) };
+}
+
+void
+report(const std::string& benchmark, const std::string& stream, std::size_t n_words, unsigned iterations, const Result& result)
+{
+  std::cout << "{\"benchmark\": \"" << benchmark << "\", \"stream\": \"" << stream << "\", \"n_words\": " << n_words
+            << ", \"iterations\": " << iterations << ", \"ns_per_word\": " << result.best_ns_per_word
+            << ", \"median_ns_per_word\": " << result.median_ns_per_word
+            << ", \"words_per_second\": " << 1e9 / result.best_ns_per_word << ", \"checksum\": " << result.checksum
+            << "}" << std::endl;
+}
+
+void
+report_compression(const std::string& stream, std::size_t raw_size, std::size_t encoded_size)
+{
+  std::cout << "{\"benchmark\": \"compression\", \"stream\": \"" << stream << "\", \"raw_bytes\": " << raw_size
+            << ", \"encoded_bytes\": " << encoded_size << ", \"ratio\": " << double(raw_size) / encoded_size
+            << ", \"bytes_per_word\": " << double(encoded_size) * codec::CTBWord::size_bytes / raw_size << "}"
+            << std::endl;
+}
+
+void
+run_codec(const std::string& stream, const std::vector<uint8_t>& words, std::size_t packet_words, unsigned iterations)
+{
+  const std::size_t n_words = words.size() / codec::CTBWord::size_bytes;
+  std::size_t encoded_size = 0;
+  report("encode_compact", stream, n_words, iterations, run_encoding(words, packet_words, iterations, encoded_size));
+  report("decode_compact", stream, n_words, iterations, run_decoding(words, iterations));
+  report_compression(stream, words.size(), encoded_size);
+}
+
+} // namespace
+} // namespace ctbmodules
+} // namespace dunedaq
+
+int
+main(int argc, char* argv[])
+{
+  using namespace dunedaq::ctbmodules;
+
+  std::size_t n_words;
+  std::size_t packet_words;
+  unsigned iterations;
+  MatchWindow::Config matching;
+  std::vector<std::string> selected;
+  std::vector<std::string> calibration_files;
+
+  bpo::options_description desc("Benchmarks the CTB word decoding and HSI frame formation");
+  desc.add_options()("help,h", "produce help message")(
+    "words", bpo::value(&n_words)->default_value(1 << 22), "number of words in each stream")(
+    "packet-words", bpo::value(&packet_words)->default_value(256), "number of words decoded per call, as in a CTB packet")(
+    "iterations", bpo::value(&iterations)->default_value(10), "number of passes over each stream")(
+    "match-window-depth", bpo::value(&matching.depth)->default_value(matching.depth), "inputs kept to match the triggers to")(
+    "stream", bpo::value(&selected)->multitoken(), "streams to run: beam_spill, burst, channel_status_heavy, mixed_spill, match_failure (default: all)")(
+    "calibration-file", bpo::value(&calibration_files)->multitoken(), "calibration stream files to run the encoding benchmarks on, instead of the streams");
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::parse_command_line(argc, argv, desc), vm);
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return 1;
+  }
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  if (n_words == 0 || packet_words == 0 || iterations == 0 || matching.depth == 0) {
+    std::cerr << "words, packet-words, iterations and match-window-depth must be positive" << std::endl;
+    return 1;
+  }
+
+  for (auto& file_name : calibration_files) {
+    std::vector<uint8_t> words;
+    try {
+      CalibrationFileReader reader(file_name);
+      reader.decode(0, reader.size(), words);
+    } catch (const ers::Issue& issue) {
+      std::cerr << issue.what() << std::endl;
+      return 1;
+    }
+    if (words.empty()) {
+      std::cerr << file_name << " has no words" << std::endl;
+      return 1;
+    }
+    run_codec(file_name, words, packet_words, iterations);
+  }
+  if (!calibration_files.empty()) {
+    return 0;
+  }
+
+  auto streams = make_streams();
+  if (selected.empty()) {
+    for (auto& s : streams) {
+      selected.push_back(s.first);
+    }
+  }
+
+  for (auto& name : selected) {
+    auto it = streams.find(name);
+    if (it == streams.end()) {
+      std::cerr << "Unknown stream " << name << std::endl << desc << std::endl;
+      return 1;
+    }
+
+    std::vector<dunedaq::ctbmodules::content::word::word_t> words;
+    words.reserve(n_words);
+    CTBWordGenerator(it->second).generate(n_words, words);
+
+    report("extract_structs", name, n_words, iterations, run_extraction<StructExtractor>(words, iterations));
+    report("extract_codec", name, n_words, iterations, run_extraction<CodecExtractor>(words, iterations));
+    report("classify_scalar", name, n_words, iterations, run_classification(words, iterations, false));
+    if (CTBStreamDecoder::has_avx2()) {
+      report("classify_avx2", name, n_words, iterations, run_classification(words, iterations, true));
+    }
+    report("decode", name, n_words, iterations, run<CountingHandler>(words, packet_words, iterations, false, matching));
+    report("decode_and_frame", name, n_words, iterations, run<FrameHandler>(words, packet_words, iterations, false, matching));
+    report("decode_packet", name, n_words, iterations, run<CountingHandler>(words, packet_words, iterations, true, matching));
+    report("decode_packet_and_frame", name, n_words, iterations, run<FrameHandler>(words, packet_words, iterations, true, matching));
+    report("decode_packet_ordered", name, n_words, iterations, run<FrameHandler>(words, packet_words, iterations, true, matching, CTBStreamDecoder::Dispatch::kStreamOrder));
+
+    const auto* bytes = reinterpret_cast<const uint8_t*>(words.data());
+    run_codec(name, std::vector<uint8_t>(bytes, bytes + words.size() * content::word::word_t::size_bytes), packet_words, iterations);
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * @file ctb_flight_dump.cxx
+ *
+ * Prints the content of a CTBModule flight recorder dump, one record per
+ * line, oldest first.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBPacketContent.hpp"
+#include "FlightRecorder.hpp"
+
+#include "ers/Issue.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace bpo = boost::program_options;
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace {
+
+void
+print(const flight::Record& record)
+{
+  const codec::CTBWord word = record.word();
+  std::cout << record.sequence() << '\t' << flight::to_string(record.event());
+
+  switch (record.event()) {
+    case flight::Event::kPacket:
+      std::cout << "\twords=" << record.value;
+      break;
+    case flight::Event::kTimestamp:
+      std::cout << "\tts=" << word.timestamp();
+      break;
+    case flight::Event::kFeedback:
+      std::cout << "\tts=" << word.timestamp() << std::hex << " code=0x" << word.feedback_code() << " source=0x"
+                << word.feedback_source() << std::dec;
+      break;
+    case flight::Event::kChannelStatus:
+      std::cout << "\tts=" << word.ch_timestamp() << std::hex << " beam=0x" << word.ch_beam() << " crt=0x"
+                << word.ch_crt() << " pds=0x" << word.ch_pds() << std::dec;
+      break;
+    case flight::Event::kLLT:
+    case flight::Event::kHLT:
+      std::cout << "\tts=" << word.timestamp() << std::hex << " trigger=0x" << word.trigger_word() << " payload=0x"
+                << record.value << std::dec;
+      break;
+  }
+  std::cout << '\n';
+}
+
+} // namespace
+} // namespace ctbmodules
+} // namespace dunedaq
+
+int
+main(int argc, char* argv[])
+{
+  using namespace dunedaq::ctbmodules;
+
+  std::string file_name;
+
+  bpo::options_description desc("Prints a CTBModule flight recorder dump");
+  desc.add_options()("help,h", "produce help message")("file", bpo::value(&file_name)->required(), "dump file");
+
+  bpo::positional_options_description positional;
+  positional.add("file", 1);
+
+  bpo::variables_map vm;
+  try {
+    bpo::store(bpo::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    if (vm.count("help")) {
+      std::cout << desc << std::endl;
+      return 0;
+    }
+    bpo::notify(vm);
+  } catch (const bpo::error& e) {
+    std::cerr << e.what() << std::endl << desc << std::endl;
+    return 1;
+  }
+
+  try {
+    flight::DumpHeader header;
+    const std::vector<flight::Record> records = FlightRecorder::read_dump(file_name, header);
+
+    const std::time_t creation_time = header.creation_time;
+    std::cout << "# run " << header.run_number << ", "
+              << flight::to_string(static_cast<flight::Reason>(header.reason)) << ", " << records.size()
+              << " records, written " << std::ctime(&creation_time);
+
+    for (const auto& record : records) {
+      print(record);
+    }
+  } catch (const ers::Issue& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -15,7 +15,9 @@
 #include "logging/Logging.hpp"
 #include "rcif/cmd/Nljs.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <string>
 #include <thread>
 #include <vector>
@@ -36,19 +38,28 @@ CTBModule::CTBModule(const std::string& name)
   , m_stop_requested(false)
   , m_is_configured(false)
   , m_error_state(false)
-  , m_total_hlt_counter(0)
   , m_ts_word_counter(0) 
-  , m_hlt_trigger_counter()
-  , m_llt_trigger_counter()
   , m_control_ios()
   , m_receiver_ios()
-  , m_control_socket(m_control_ios)
+  , m_control_client(m_control_ios)
+  , m_receiver_acceptor(m_receiver_ios)
   , m_receiver_socket(m_receiver_ios)
+  , m_receiver_reader(m_receiver_socket)
   , m_thread_(std::bind(&CTBModule::do_hsi_work, this, std::placeholders::_1))
+  , m_received_word_counter(0)
+  , m_decode_thread_(std::bind(&CTBModule::do_decode_work, this, std::placeholders::_1))
+  , m_packet_ring_high_water(0)
+  , m_packet_ring_full_waits(0)
+  , m_decoded_packet_counter(0)
   , m_has_calibration_stream( false )
+  , m_dump_thread_(std::bind(&CTBModule::do_dump_work, this, std::placeholders::_1))
   , m_run_HLT_counter(0)
   , m_run_LLT_counter(0)
   , m_run_channel_status_counter(0)
+  , m_last_packet_time(0)
+  , m_run_start_time(0)
+  , m_start_to_connection(0)
+  , m_start_to_first_word(0)
   , m_num_control_messages_sent(0)
   , m_num_control_responses_received(0)
   , m_last_readout_hlt_timestamp(0)
@@ -56,6 +67,7 @@ CTBModule::CTBModule(const std::string& name)
   register_command("conf", &CTBModule::do_configure);
   register_command("start", &CTBModule::do_start);
   register_command("stop", &CTBModule::do_stop);
+  register_command("dump_flight_recorder", &CTBModule::do_dump_flight_recorder);
 }
 
 CTBModule::~CTBModule(){
@@ -64,8 +76,10 @@ CTBModule::~CTBModule(){
     const nlohmann::json stopobj;
     do_stop(stopobj);
   } 
-  m_control_socket.close() ;
+  m_control_client.close() ;
 
+  boost::system::error_code closing_error;
+  m_receiver_acceptor.close( closing_error ) ;
 }
 
 void
@@ -88,6 +102,8 @@ CTBModule::do_configure(const data_t& args)
   m_cfg = args.get<ctbmodule::Conf>();
   m_receiver_port = m_cfg.board_config.ctb.sockets.receiver.port;  
   m_timeout = std::chrono::microseconds( m_cfg.receiver_connection_timeout ) ;
+  m_control_timeout = std::chrono::milliseconds( m_cfg.control_timeout ) ;
+  m_control_config_timeout = std::chrono::milliseconds( m_cfg.control_config_timeout ) ;
 
   TLOG_DEBUG(0) << get_name() << ": Board receiver network location " << m_cfg.board_config.ctb.sockets.receiver.host << ':' << m_cfg.board_config.ctb.sockets.receiver.port << std::endl;
 
@@ -97,41 +113,137 @@ CTBModule::do_configure(const data_t& args)
   m_ts_word_counter = 0;
 
   std::map<std::string, size_t> id_to_idx;
-  for(size_t i = 0; i < m_hlt_range; i++) id_to_idx["HLT_" + std::to_string(i)] = i;
-  for(size_t i = 0; i < m_llt_range; i++) id_to_idx["LLT_" + std::to_string(i)] = i;
+  for(size_t i = 0; i < s_hlt_range; i++) id_to_idx["HLT_" + std::to_string(i)] = i;
+  for(size_t i = 0; i < s_llt_range; i++) id_to_idx["LLT_" + std::to_string(i)] = i;
+
+  // bits of the enabled triggers, unknown ids are ignored
+  auto enabled_bits = [&id_to_idx]( const nlohmann::json & trigger_array ) {
+    uint64_t mask = 0 ;
+    for (const auto& trigger : trigger_array) {
+      auto it = id_to_idx.find(trigger["id"]);
+      if (trigger["enable"] && it != id_to_idx.end()) mask |= uint64_t(1) << it->second;
+    }
+    return mask ;
+  };
 
   nlohmann::json random_triggers = m_cfg.board_config.ctb.misc;
 
   // HLTs
   // 0th HLT is random trigger that's not in HLT array
-  if (random_triggers["randomtrigger_1"]["enable"]) m_hlt_trigger_counter[0] = 0;
-  nlohmann::json trigger_array = m_cfg.board_config.ctb.HLT.trigger;
-  for (const auto& trigger : trigger_array) { if (trigger["enable"]) m_hlt_trigger_counter[id_to_idx[trigger["id"]]] = 0; }
+  uint64_t hlt_mask = random_triggers["randomtrigger_1"]["enable"] ? 0x1 : 0x0;
+  hlt_mask |= enabled_bits( m_cfg.board_config.ctb.HLT.trigger );
+  m_hlt_counters.set_enabled( hlt_mask );
 
   // LLTs: Beam and CRT
   // 0th LLT is random trigger that's not in HLT array
-  if (random_triggers["randomtrigger_2"]["enable"]) m_llt_trigger_counter[0] = 0;
-  trigger_array = m_cfg.board_config.ctb.subsystems.crt.triggers;
-  for (const auto& trigger : trigger_array) { if (trigger["enable"]) m_llt_trigger_counter[id_to_idx[trigger["id"]]] = 0; }
+  uint64_t llt_mask = random_triggers["randomtrigger_2"]["enable"] ? 0x1 : 0x0;
+  llt_mask |= enabled_bits( m_cfg.board_config.ctb.subsystems.crt.triggers );
+  llt_mask |= enabled_bits( m_cfg.board_config.ctb.subsystems.beam.triggers );
+  m_llt_counters.set_enabled( llt_mask );
+
+  const std::chrono::milliseconds rate_short_window( m_cfg.rate_short_window ) ;
+  const std::chrono::milliseconds rate_long_window( m_cfg.rate_long_window ) ;
+  m_hlt_rates.configure( rate_short_window, rate_long_window, m_cfg.spill_gate_mask ) ;
+  m_llt_rates.configure( rate_short_window, rate_long_window, m_cfg.spill_gate_mask ) ;
+
+  // channels masked on the board are not reported stuck off, a mask the board would refuse leaves them all enabled
+  const auto & subsystems = m_cfg.board_config.ctb.subsystems ;
+  const std::array<std::string, occupancy::s_subsystems.size()> channel_masks = {
+    subsystems.beam.channel_mask, subsystems.crt.channel_mask, subsystems.pds.channel_mask } ;
+  for ( size_t i = 0; i < occupancy::s_subsystems.size(); ++i ) {
+    try {
+      m_enabled_channels[i] = std::stoull( channel_masks[i], nullptr, 16 ) & occupancy::s_subsystems[i].mask() ;
+    } catch ( const std::exception & ) {
+      m_enabled_channels[i] = occupancy::s_subsystems[i].mask() ;
+    }
+  }
 
-  trigger_array = m_cfg.board_config.ctb.subsystems.beam.triggers;
-  for (const auto& trigger : trigger_array) { if (trigger["enable"]) m_llt_trigger_counter[id_to_idx[trigger["id"]]] = 0; }
+  MatchWindow::Config matching;
+  matching.depth = m_cfg.match_window_depth;
+  matching.tolerance = m_cfg.match_tolerance;
+  matching.late_policy = MatchWindow::parse_late_policy( m_cfg.match_late_policy );
+  m_decoder.configure_matching( matching );
 
-  // network connection to ctb hardware control
-  boost::asio::ip::tcp::resolver resolver( m_control_ios ); 
-  boost::asio::ip::tcp::resolver::query query(m_cfg.ctb_hostname, std::to_string(m_cfg.control_connection_port) ) ; //"np04-ctb-1", 8991
-  boost::asio::ip::tcp::resolver::iterator iter = resolver.resolve(query) ;
+  if ( m_flight_recorder.capacity() != m_cfg.flight_recorder_size ) {
+    m_flight_recorder.resize( m_cfg.flight_recorder_size ) ;
+  }
+  m_flight_recorder_dir = m_cfg.flight_recorder_output ;
+  if ( ! m_flight_recorder_dir.empty() && m_flight_recorder_dir.back() != '/' ) m_flight_recorder_dir += '/' ;
+  m_flight_recorder_max_dumps = m_cfg.flight_recorder_max_dumps ;
+
+  const auto & profile = m_cfg.board_config.ctb.sockets.receiver.profile ;
+  ReceiverSocketReader::Profile socket_profile ;
+  socket_profile.receive_buffer = profile.receive_buffer ;
+  socket_profile.low_watermark = profile.low_watermark ;
+  socket_profile.no_delay = profile.no_delay ;
+  socket_profile.quick_ack = profile.quick_ack ;
+  socket_profile.busy_poll = profile.busy_poll ;
+  socket_profile.rx_timestamps = profile.rx_timestamps ;
+  // also the profile of the boards for get_info
+  m_receiver_reader.configure( socket_profile ) ;
+
+  if ( m_cfg.boards.empty() ) {
+    {
+      std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+      m_boards.clear() ;
+    }
+
+    // network connection to ctb hardware control
+    m_endpoint = resolve( m_cfg.ctb_hostname, m_cfg.control_connection_port ) ; //"np04-ctb-1", 8991
+    m_control_client.set_endpoint( m_endpoint ) ;
 
-  m_endpoint = iter->endpoint(); 
- 
-  // TODO should we put this into a try?
-  m_control_socket.connect( m_endpoint );
+    if ( const auto ec = m_control_client.connect( m_control_timeout ) ) {
+      throw CTBCommunicationError(ERS_HERE, "Unable to connect to the CTB control port: " + ec.message());
+    }
 
-  // if necessary, set the calibration stream
-  if ( m_cfg.calibration_stream_output != "")  {
-    m_has_calibration_stream = true ; 
+    open_receiver_acceptor( m_receiver_acceptor, m_receiver_port, m_receiver_reader );
+  }
+  else {
+    m_control_client.close() ;
+    boost::system::error_code closing_error ;
+    m_receiver_acceptor.close( closing_error ) ;
+    configure_boards( matching, socket_profile ) ;
+  }
+
+  // if necessary, set the calibration stream; nothing is kept from a previous configuration
+  {
+    std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+    m_has_calibration_stream = false ;
+    m_calibration_writer.reset() ;
+  }
+  if ( m_cfg.calibration_stream_output != "" && ! m_boards.empty() ) {
+    ers::warning(CTBCalibrationStreamError(ERS_HERE, "No calibration stream in multi-board mode"));
+  }
+  else if ( m_cfg.calibration_stream_output != "")  {
     m_calibration_dir = m_cfg.calibration_stream_output ;
-    m_calibration_file_interval = std::chrono::minutes(m_cfg.calibration_update); 
+    auto calibration_writer = std::make_unique<CalibrationWriter>( m_cfg.calibration_queue_size,
+                                                                   CalibrationWriter::parse_sync_policy( m_cfg.calibration_fsync ),
+                                                                   std::chrono::milliseconds( m_cfg.calibration_fsync_interval ),
+                                                                   m_cfg.calibration_index_stride,
+                                                                   CalibrationWriter::parse_encoding( m_cfg.calibration_encoding ) ) ;
+    CalibrationWriter::Rotation rotation ;
+    rotation.interval_ticks = uint64_t( m_cfg.calibration_update ) * 60 * 62500000 ; // 62.5 MHz CTB clock
+    rotation.max_file_bytes = m_cfg.calibration_max_file_size ;
+    rotation.max_files = m_cfg.calibration_max_files ;
+    rotation.max_total_bytes = m_cfg.calibration_max_total_size ;
+    calibration_writer->configure_rotation( rotation ) ;
+
+    std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+    m_calibration_writer = std::move( calibration_writer ) ;
+    m_has_calibration_stream = true ;
+  }
+
+  // the multi-board readout decodes as it reads
+  if ( m_cfg.pipelined_readout && m_boards.empty() ) {
+    if ( ! m_packet_ring || m_packet_ring->capacity() < m_cfg.packet_ring_size ) {
+      auto packet_ring = std::make_unique<SPSCRing<ReceivedPacket>>( m_cfg.packet_ring_size ) ;
+      std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+      m_packet_ring = std::move( packet_ring ) ;
+    }
+  }
+  else if ( m_packet_ring ) {
+    std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+    m_packet_ring.reset() ;
   }
 
   if ( m_cfg.run_trigger_output != "" ) {
@@ -143,9 +255,13 @@ CTBModule::do_configure(const data_t& args)
   // create the json string
   nlohmann::json config;
   to_json(config, m_cfg.board_config);
+  // the socket profile is for the module side of the connection
+  config["ctb"]["sockets"]["receiver"].erase("profile");
   //TLOG() << "CONF TEST: " << config.dump();
 
-  send_config(config.dump());
+  m_config_hash = calibration::config_hash( config.dump() ) ;
+
+  send_config(config);
 }
 
 void
@@ -160,18 +276,59 @@ CTBModule::do_start(const nlohmann::json& startobj)
   auto start_params = startobj.get<rcif::cmd::StartParams>();
   m_run_number.store(start_params.run);
 
-  m_total_hlt_counter.store(0);
-
-  TLOG_DEBUG(0) << get_name() << ": Sending start of run command";
-  m_thread_.start_working_thread();
+  m_hlt_counters.start_run();
+  m_llt_counters.start_run();
+  m_run_summary.start_run( start_params.run, m_cfg.spill_gate_mask );
+  m_hlt_rates.clear();
+  m_llt_rates.clear();
+  m_automatic_dumps.store( 0 );
+  m_channel_occupancy.start_run();
+  count_unmatched( m_run_start_unmatched_hlts, m_run_start_unmatched_llts );
 
   if ( m_has_calibration_stream ) {
     std::stringstream run;
     run << "run" << start_params.run;
     SetCalibrationStream(run.str()) ;
+    // every run starts its own calibration file
+    m_calibration_writer->set_output( m_calibration_dir, m_calibration_prefix ) ;
+    m_calibration_writer->set_run_info( start_params.run, m_config_hash ) ;
+    m_calibration_writer->start() ;
+  }
+
+  m_decoder.reset();
+  for ( auto & board : m_boards ) board->decoder.reset();
+  m_batch_decoding = m_cfg.batch_decoding;
+
+  HSIFrameBatcher::Config batching;
+  batching.max_frames = m_cfg.hsi_batch_size;
+  batching.max_ticks = m_cfg.hsi_batch_max_ticks;
+  batching.max_delay = std::chrono::microseconds( m_cfg.hsi_batch_max_delay );
+  m_llt_batcher.configure( batching );
+  m_hlt_batcher.configure( batching );
+
+  HSIFrameMerger::Config merging;
+  merging.window_ticks = m_cfg.merge_window_ticks;
+  merging.max_frames = m_cfg.merge_max_frames;
+  merging.max_delay = std::chrono::microseconds( m_cfg.merge_max_delay );
+  {
+    // get_info reads the progress of each board, which is made again
+    std::lock_guard<std::mutex> lock( m_info_mutex );
+    m_hlt_merger.configure( m_boards.size(), merging );
   }
+  m_merged_hlt_counter = 0;
 
-  if ( send_message( "{\"command\":\"StartRun\"}" )  ) {
+  m_dump_thread_.start_working_thread();
+  if ( m_packet_ring ) {
+    m_decode_thread_.start_working_thread();
+  }
+
+  TLOG_DEBUG(0) << get_name() << ": Sending start of run command";
+  m_start_to_connection.store( 0 ) ;
+  m_start_to_first_word.store( 0 ) ;
+  m_run_start_time.store( steady_ns() ) ;
+  m_thread_.start_working_thread();
+
+  if ( send_message( "{\"command\":\"StartRun\"}", ControlCommand::kStart )  ) {
     m_is_running.store(true);
     TLOG_DEBUG(1) << get_name() << ": successfully started";
   }
@@ -195,16 +352,38 @@ CTBModule::do_stop(const nlohmann::json& /*stopobj*/)
   m_stop_requested.store(true);
   std::this_thread::sleep_for(std::chrono::milliseconds(2));
 
-  if(send_message( "{\"command\":\"StopRun\"}" ) ){
+  if(send_message( "{\"command\":\"StopRun\"}", ControlCommand::kStop ) ){
     TLOG_DEBUG(1) << get_name() << ": successfully stopped";
     m_is_running.store( false ) ;
   }
   else{
     throw CTBCommunicationError(ERS_HERE, "Unable to stop CTB");
   }
-  store_run_trigger_counters( m_run_number ) ; 
   m_thread_.stop_working_thread();
 
+  // the decoding thread finishes the packets already received before stopping
+  if ( m_decode_thread_.thread_running() ) {
+    m_decode_thread_.stop_working_thread();
+  }
+
+  // after the dumps requested by the readout
+  if ( m_dump_thread_.thread_running() ) {
+    m_dump_thread_.stop_working_thread();
+  }
+
+  // the frames of the last packets
+  flush_llt_frames();
+  flush_hlt_frames();
+
+  // all the words of the run are counted now
+  m_channel_occupancy.flush() ;
+  store_run_trigger_counters( m_run_number ) ; 
+  store_run_summary( m_run_number ) ;
+
+  if ( m_calibration_writer ) {
+    m_calibration_writer->stop() ;
+  }
+
   m_run_HLT_counter=0;
   m_run_LLT_counter=0;
   m_run_channel_status_counter=0;
@@ -215,6 +394,11 @@ CTBModule::do_stop(const nlohmann::json& /*stopobj*/)
 void
 CTBModule::do_hsi_work(std::atomic<bool>& running_flag)
 {
+  if ( ! m_boards.empty() ) {
+    do_multi_board_work( running_flag ) ;
+    return ;
+  }
+
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_work() method";
 
   std::size_t n_bytes = 0 ;
@@ -225,180 +409,77 @@ CTBModule::do_hsi_work(std::atomic<bool>& running_flag)
 
   TLOG_DEBUG(TLVL_CTB_MODULE) << get_name() <<  ": Header size: " << header_size << std::endl << "Word size: " << word_size << std::endl;
 
-  //connect to socket
-  boost::asio::ip::tcp::acceptor acceptor(m_receiver_ios, boost::asio::ip::tcp::endpoint( boost::asio::ip::tcp::v4(), m_receiver_port ) );
-  TLOG_DEBUG(0) << get_name() << ": Waiting for an incoming connection on port " << m_receiver_port << std::endl;
-
-  std::future<void> accepting = async( std::launch::async, [&]{ acceptor.accept(m_receiver_socket) ; } ) ;
-
-  while ( running_flag.load() && !m_stop_requested.load() ) {
-    if ( accepting.wait_for( m_timeout ) == std::future_status::ready ){
-      break ;
-    }
+  if ( ! accept_receiver_connection( running_flag ) ) {
+    TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_work() method without a connection";
+    return ;
   }
 
   TLOG_DEBUG(0) << get_name() <<  ": Connection received: start reading" << std::endl;
 
   content::tcp_header_t head ;
   head.packet_size = 0;
-  content::word::word_t temp_word ;
-  boost::system::error_code receiving_error;
   bool connection_closed = false ;
-  uint64_t ch_stat_beam, ch_stat_crt, ch_stat_pds;
-  uint64_t llt_payload, channel_payload;
-  uint64_t prev_timestamp = 0;
-  std::pair<uint64_t,uint64_t> prev_channel, prev_prev_channel, prev_llt, prev_prev_llt; // pair<timestamp, trigger_payload>
 
-  while (running_flag.load() && !m_stop_requested.load()) {
+  WordHandler handler{ *this, & running_flag } ;
+
+  m_receive_buffer.clear();
 
-    update_calibration_file();
+  while (running_flag.load() && !m_stop_requested.load()) {
 
-    if ( ! read( head ) ) {
+    const uint64_t reads_before_header = m_receiver_reader.n_reads() ;
+    if ( ! receive( header_size ) ) {
       connection_closed = true ;
       break;
     }
 
-    n_bytes = head.packet_size ;
-    // extract n_words
-
-    n_words = n_bytes / word_size ;
-    // read n words as requested from the header
-    
-    update_buffer_counts(n_words);
+    std::memcpy( & head, m_receive_buffer.data(), header_size ) ;
+    m_receive_buffer.consume( header_size ) ;
+    const int64_t header_received = steady_ns() ;
 
-    for ( unsigned int i = 0 ; i < n_words ; ++i ) {
-      
-      if (!running_flag.load() || m_stop_requested.load()) {
-        break;
+    if ( m_receiver_reader.profile().rx_timestamps ) {
+      // a header already in the buffer came with an earlier read: its timestamp would include our own decoding
+      if ( m_receiver_reader.n_reads() != reads_before_header ) {
+        record_kernel_latency( m_receiver_reader ) ;
       }
+      m_kernel_queue.record( m_receiver_reader.queued_bytes() ) ;
+    }
 
-      //read a word
-      if ( ! read( temp_word ) ) {
-        connection_closed = true ;
-        break ;
-      }
-      // put it in the calibration stream
-      if ( m_has_calibration_stream ) {
-        m_calibration_file.write( reinterpret_cast<const char*>( & temp_word ), word_size ) ;
-        m_calibration_file.flush() ;
-      }          // word printing in calibration stream
-      
-      //check if it is a TS word and increment the counter
-      if ( IsTSWord( temp_word ) ) {
-        ++m_ts_word_counter;
-        TLOG_DEBUG(9) << "Received timestamp word! TS: "+temp_word.timestamp;
-        prev_timestamp = temp_word.timestamp;
-      }
+    n_bytes = head.packet_size ;
+    // extract n_words
 
-      else if ( IsFeedbackWord( temp_word ) ) {
-        m_error_state.store( true ) ;
-        content::word::feedback_t * feedback = reinterpret_cast<content::word::feedback_t*>( & temp_word ) ;
-        TLOG_DEBUG(7) << "Received feedback word!";
-
-        TLOG_DEBUG(8) << get_name() << ": Feedback word: " << std::endl
-                                                  << std::hex 
-                                                  << " \t Type -> " << feedback -> word_type << std::endl 
-                                                  << " \t TS -> " << feedback -> timestamp << std::endl
-                                                  << " \t Code -> " << feedback -> code << std::endl
-                                                  << " \t Source -> " << feedback -> source << std::endl
-                                                  << " \t Padding -> " << feedback -> padding << std::dec << std::endl ;
-      } else if (temp_word.word_type == content::word::t_gt)
-      {
-        TLOG_DEBUG(3) << "Received HLT word!";
-        ++m_run_HLT_counter;
-        content::word::trigger_t * hlt_word = reinterpret_cast<content::word::trigger_t*>( & temp_word ) ;
-
-        m_last_readout_hlt_timestamp = hlt_word->timestamp;
-        // Now find the associated LLT
-        llt_payload = MatchTriggerInput( hlt_word->timestamp, prev_llt, prev_prev_llt, true );
-    
-        // Send HSI data to a DLH 
-        std::array<uint32_t, 7> hsi_struct;
-        hsi_struct[0] = (0x1 << 26) | (0x1 << 6) | 0x1; // DAQHeader, frame version: 1, det id: 1, link for low level 0, link for high level 1, leave slot and crate as 0
-        hsi_struct[1] = hlt_word->timestamp;       // ts low
-        hsi_struct[2] = hlt_word->timestamp >> 32; // ts high
-        hsi_struct[3] = llt_payload;               // lower 32b 
-        hsi_struct[4] = 0x0;                       // max 32 llts so these bits will always be 0x0
-        hsi_struct[5] = hlt_word->trigger_word;    // trigger_map;
-        hsi_struct[6] = m_run_HLT_counter;         // m_generated_counter;
-  
-        TLOG_DEBUG(4) << get_name() << ": Formed HSI_FRAME_STRUCT for hlt "
-              << std::hex 
-              << "0x"   << hsi_struct[0]
-              << ", 0x" << hsi_struct[1]
-              << ", 0x" << hsi_struct[2]
-              << ", 0x" << hsi_struct[3]
-              << ", 0x" << hsi_struct[4]
-              << ", 0x" << hsi_struct[5]
-              << ", 0x" << hsi_struct[6]
-              << "\n";
-  
-        send_raw_hsi_data(hsi_struct, m_hlt_hsi_data_sender.get());
+    n_words = n_bytes / word_size ;
+    m_received_word_counter += n_words ;
 
-        // TODO properly fill device id
-        dfmessages::HSIEvent event = dfmessages::HSIEvent(0x1, hlt_word->trigger_word, hlt_word->timestamp, m_run_HLT_counter, m_run_number);
-        send_hsi_event(event);
+    // receive the whole packet at once, the words are then decoded in place
+    if ( ! receive( n_bytes ) ) {
+      connection_closed = true ;
+      break;
+    }
 
-        // Count the total HLTs and each specific one
-        ++m_total_hlt_counter;
-        for (auto &hlt : m_hlt_trigger_counter) { if( (hlt_word->trigger_word >> hlt.first) & 0x1 ) ++hlt.second; }
-      }
-      else if (temp_word.word_type == content::word::t_lt)
-      {
-        TLOG_DEBUG(5) << "Received LLT word!";
-        ++m_run_LLT_counter;
-        content::word::trigger_t * llt_word = reinterpret_cast<content::word::trigger_t*>( & temp_word ) ;
-
-        // Find the matching channel status word
-        channel_payload = MatchTriggerInput( llt_word->timestamp, prev_channel, prev_prev_channel, false );
-  
-        // Send HSI data to a DLH 
-        std::array<uint32_t, 7> hsi_struct;
-        hsi_struct[0] = (0x1 << 6) | 0x1; // DAQHeader, frame version: 1, det id: 1, link for low level 0, link for high level 1, leave slot and crate as 0
-        hsi_struct[1] = llt_word->timestamp;       // ts low
-        hsi_struct[2] = llt_word->timestamp >> 32; // ts high
-        hsi_struct[3] = channel_payload;           // channel raw input lower 32b
-        hsi_struct[4] = channel_payload >> 32;     // channelraw input upper 32b
-        hsi_struct[5] = llt_word->trigger_word;    // trigger_map;
-        hsi_struct[6] = m_run_LLT_counter;         // m_generated_counter;
-  
-        TLOG_DEBUG(6) << get_name() << ": Formed HSI_FRAME_STRUCT for llt "
-              << std::hex 
-              << "0x"   << hsi_struct[0]
-              << ", 0x" << hsi_struct[1]
-              << ", 0x" << hsi_struct[2]
-              << ", 0x" << hsi_struct[3]
-              << ", 0x" << hsi_struct[4]
-              << ", 0x" << hsi_struct[5]
-              << ", 0x" << hsi_struct[6]
-              << "\n";
-
-        send_raw_hsi_data(hsi_struct, m_llt_hsi_data_sender.get());
-
-        // store the previous 2 LLTs so we can match to the HLT
-        prev_prev_llt = prev_llt;
-        prev_llt = { llt_word->timestamp, (llt_word->trigger_word & 0xFFFFFFFF) };
-
-        for (auto &llt : m_llt_trigger_counter) { if( (llt_word->trigger_word >> llt.first) & 0x1 ) ++llt.second; }
-      }
-      else if (temp_word.word_type == content::word::t_ch)
-      {
+    const uint8_t* packet = m_receive_buffer.data() ;
+    const int64_t packet_received = steady_ns() ;
+    m_receive_latency.record( packet_received - header_received ) ;
+    if ( m_start_to_first_word.load( std::memory_order_relaxed ) == 0 ) {
+      m_start_to_first_word.store( header_received - m_run_start_time.load(), std::memory_order_relaxed ) ;
+    }
 
-        TLOG_DEBUG(5) << "Received Channel Status word!";
-        ++m_run_channel_status_counter;
-        content::word::ch_status_t * ch_stat_word = reinterpret_cast<content::word::ch_status_t*>( & temp_word ) ;
+    // hand the packet over to the calibration stream
+    if ( m_has_calibration_stream ) {
+      m_calibration_writer->write( packet, n_words * word_size, head.format_version ) ;
+    }
 
-        ch_stat_beam = ch_stat_word->get_beam();
-        ch_stat_crt  = ch_stat_word->get_crt();
-        ch_stat_pds  = ch_stat_word->get_pds();
+    update_buffer_counts(n_words);
 
-        // Previous 2 channel status words. The channel status only has 60b TS so complete the upper 4b
-        // from the TS Word. (fyi 60b rolls over >500yr @ 62.5MHz) 
-        prev_prev_channel = prev_channel;
-        prev_channel = { ((prev_timestamp & 0xF000000000000000) | ch_stat_word->timestamp),  ((ch_stat_pds << 48) | (ch_stat_crt << 16) | ch_stat_beam) };
+    if ( m_packet_ring ) {
+      if ( ! push_packet( packet, n_words * word_size, packet_received, running_flag ) ) {
+        break ;
       }
+    }
+    else {
+      decode( packet, n_words, handler, packet_received ) ;
+    }
 
-    } // n_words loop
+    m_receive_buffer.consume( n_bytes ) ;
 
     if ( connection_closed ){
       break ;
@@ -440,110 +521,627 @@ CTBModule::do_hsi_work(std::atomic<bool>& running_flag)
 }
 
 
-template<typename T>
-bool CTBModule::read( T &obj) {
+boost::asio::ip::tcp::endpoint
+CTBModule::resolve( const std::string & host, unsigned int port )
+{
+  boost::asio::ip::tcp::resolver resolver( m_control_ios ); 
+  boost::asio::ip::tcp::resolver::query query( host, std::to_string( port ) ) ;
+  boost::asio::ip::tcp::resolver::iterator iter = resolver.resolve(query) ;
+  return iter->endpoint() ;
+}
 
-  boost::system::error_code receiving_error;
-  boost::asio::read( m_receiver_socket, boost::asio::buffer( &obj, sizeof(T) ), receiving_error ) ;
+void
+CTBModule::open_receiver_acceptor( boost::asio::ip::tcp::acceptor & acceptor, unsigned int port, const ReceiverSocketReader & reader )
+{
+  const boost::asio::ip::tcp::endpoint endpoint( boost::asio::ip::tcp::v4(), port ) ;
 
-  if ( ! receiving_error ) {
-    return true ;
+  if ( acceptor.is_open() ) {
+    boost::system::error_code error ;
+    if ( acceptor.local_endpoint( error ) == endpoint && ! error ) {
+      reader.apply_listen_options( acceptor ) ;
+      return ;
+    }
+    acceptor.close( error ) ;
   }
 
-  if ( receiving_error == boost::asio::error::eof) {
-    std::string error_message = "Socket closed: " + receiving_error.message();
-    ers::error(CTBCommunicationError(ERS_HERE, error_message));
-    return false ;
+  // bound once, so that starting a run only waits for the board
+  try {
+    acceptor.open( endpoint.protocol() ) ;
+    acceptor.set_option( boost::asio::ip::tcp::acceptor::reuse_address( true ) ) ;
+    reader.apply_listen_options( acceptor ) ;
+    acceptor.bind( endpoint ) ;
+    acceptor.listen() ;
+  } catch ( const boost::system::system_error & e ) {
+    boost::system::error_code error ;
+    acceptor.close( error ) ;
+    throw CTBCommunicationError(ERS_HERE, "Unable to listen on port " + std::to_string(port) + ": " + e.code().message());
   }
 
-  if ( receiving_error ) {
-    std::string error_message = "Read failure: " + receiving_error.message();
-    ers::error(CTBCommunicationError(ERS_HERE, error_message));
+  TLOG_DEBUG(0) << get_name() << ": Listening for the CTB on port " << port ;
+}
+
+void
+CTBModule::configure_boards( const MatchWindow::Config & matching, const ReceiverSocketReader::Profile & profile )
+{
+  // the boards are made again at every configuration, their ports may have changed:
+  // the old ones go first, so that their ports can be bound again
+  {
+    std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+    m_boards.clear() ;
+  }
+
+  std::vector<std::unique_ptr<Board>> boards ;
+  for ( std::size_t i = 0 ; i < m_cfg.boards.size() ; ++i ) {
+    const auto & board_cfg = m_cfg.boards[i] ;
+    auto board = std::make_unique<Board>( i, m_control_ios, m_receiver_ios ) ;
+    board->name = board_cfg.name.empty() ? "board_" + std::to_string(i) : board_cfg.name ;
+    board->receiver_port = board_cfg.receiver_port ;
+
+    board->control.set_endpoint( resolve( board_cfg.ctb_hostname, board_cfg.control_connection_port ) ) ;
+    if ( const auto ec = board->control.connect( m_control_timeout ) ) {
+      throw CTBCommunicationError(ERS_HERE, "Unable to connect to the control port of " + board->name + ": " + ec.message());
+    }
+
+    board->reader.configure( profile ) ;
+    open_receiver_acceptor( board->acceptor, board->receiver_port, board->reader ) ;
+    board->decoder.configure_matching( matching ) ;
+
+    boards.push_back( std::move( board ) ) ;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock( m_info_mutex ) ;
+    m_boards = std::move( boards ) ;
+  }
+
+  TLOG_DEBUG(0) << get_name() << ": Multi-board mode with " << m_boards.size() << " boards" ;
+}
+
+bool
+CTBModule::accept_receiver_connection(std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(0) << get_name() << ": Waiting for an incoming connection on port " << m_receiver_port << std::endl;
+
+  bool accepted = false ;
+  boost::system::error_code accept_error ;
+  m_receiver_acceptor.async_accept( m_receiver_socket, [&]( const boost::system::error_code & error ) {
+    accepted = true ;
+    accept_error = error ;
+  } ) ;
+
+  // the handler runs on this thread, which checks for a stop every m_timeout
+  m_receiver_ios.restart() ;
+  while ( ! accepted ) {
+    m_receiver_ios.run_one_for( m_timeout ) ;
+    if ( ! accepted && ( ! running_flag.load() || m_stop_requested.load() ) ) {
+      boost::system::error_code error ;
+      m_receiver_acceptor.cancel( error ) ;
+      m_receiver_ios.run() ;
+      return false ;
+    }
+  }
+
+  if ( accept_error ) {
+    ers::error(CTBCommunicationError(ERS_HERE, "Accept failure: " + accept_error.message()));
     return false ;
   }
 
+  m_start_to_connection.store( steady_ns() - m_run_start_time.load() ) ;
+  m_receiver_reader.apply_options() ;
   return true ;
 }
 
-uint64_t CTBModule::MatchTriggerInput( const uint64_t trigger_ts, const std::pair<uint64_t,uint64_t> &prev_input, const std::pair<uint64_t,uint64_t> &prev_prev_input, bool hlt_matching) noexcept {
- 
-  // The first condition should be true the majority of the time and the "else" should never happen.
-  // Find the matching word whcih caused the LLT or HLT and return its payload
+void
+CTBModule::do_multi_board_work(std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_multi_board_work() method";
+
+  m_receiver_ios.restart() ;
+  m_boards_stopping = false ;
+  for ( auto & board : m_boards ) {
+    board->buffer.clear() ;
+    accept_board( *board ) ;
+  }
 
-  if ( trigger_ts == prev_input.first + 1 ) { 
-    return prev_input.second; 
-  } 
-  else if( trigger_ts == prev_prev_input.first + 1 ) { 
-    return prev_prev_input.second; 
+  // all the handlers run on this thread, which checks for a stop every m_timeout
+  while ( running_flag.load() && ! m_stop_requested.load() ) {
+    m_receiver_ios.run_one_for( m_timeout ) ;
+    release_merged_hlt_frames() ;
+    flush_expired_hsi_frames() ;
+  }
+
+  // Make sure CTB runs stop before closing the sockets
+  while ( m_is_running.load() ) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
   } 
-  else {
-    std::stringstream msg;
-    if ( hlt_matching ) { 
-      msg << "No LLT match found for HLT TS " << trigger_ts << " (LLT TS prev=" 
-          << prev_input.first << " prev_prev=" << prev_prev_input.first << ")";
-    } 
+
+  // completions already queued, like the end of a connection closed by a board after
+  // StopRun, must not start new operations: run() would never return
+  m_boards_stopping = true ;
+  boost::system::error_code closing_error ;
+  for ( auto & board : m_boards ) {
+    board->acceptor.cancel( closing_error ) ;
+    board->socket.close( closing_error ) ;
+    board->connected = false ;
+  }
+  // completes the cancelled operations
+  m_receiver_ios.run() ;
+
+  release_merged_hlt_frames( true ) ;
+
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_multi_board_work() method";
+}
+
+void
+CTBModule::accept_board( Board & board )
+{
+  if ( m_boards_stopping ) return ;
+
+  board.acceptor.async_accept( board.socket, [this, &board]( const boost::system::error_code & error ) {
+    if ( error ) {
+      if ( error != boost::asio::error::operation_aborted ) {
+        ers::error(CTBCommunicationError(ERS_HERE, board.name + ": Accept failure: " + error.message()));
+      }
+      return ;
+    }
+
+    if ( m_boards_stopping ) {
+      boost::system::error_code closing_error ;
+      board.socket.close( closing_error ) ;
+      return ;
+    }
+
+    TLOG_DEBUG(0) << get_name() << ": Connection received from " << board.name << ": start reading" ;
+    board.reader.apply_options() ;
+    board.connected = true ;
+    read_board( board ) ;
+  } ) ;
+}
+
+void
+CTBModule::read_board( Board & board )
+{
+  if ( m_boards_stopping ) return ;
+
+  const size_t header_size = sizeof( content::tcp_header_t ) ;
+
+  // room for the header, then for the whole packet
+  std::size_t n_bytes = header_size ;
+  if ( board.buffer.size() >= header_size ) {
+    content::tcp_header_t head ;
+    std::memcpy( & head, board.buffer.data(), header_size ) ;
+    n_bytes += head.packet_size ;
+  }
+
+  // the data is read through the reader of the board, which applies its socket profile
+  board.socket.async_wait( boost::asio::ip::tcp::socket::wait_read,
+                           [this, &board, n_bytes]( const boost::system::error_code & error ) {
+                             if ( error ) {
+                               on_board_data( board, error, 0 ) ;
+                               return ;
+                             }
+                             boost::system::error_code read_error ;
+                             const std::size_t received = board.reader.read_some( board.buffer.prepare( n_bytes ), read_error ) ;
+                             if ( read_error == boost::asio::error::would_block || read_error == boost::asio::error::try_again ) {
+                               read_board( board ) ;
+                               return ;
+                             }
+                             on_board_data( board, read_error, received ) ;
+                           } ) ;
+}
+
+void
+CTBModule::record_kernel_latency( const ReceiverSocketReader & reader )
+{
+  if ( const int64_t rx_timestamp = reader.last_rx_timestamp() ) {
+    m_kernel_latency.record( std::max<int64_t>( ReceiverSocketReader::realtime_ns() - rx_timestamp, 0 ) ) ;
+  }
+}
+
+void
+CTBModule::on_board_data( Board & board, const boost::system::error_code & error, std::size_t n_bytes )
+{
+  if ( error ) {
+    if ( error == boost::asio::error::operation_aborted ) return ;
+
+    if ( error == boost::asio::error::eof ) {
+      // the boards close their connection once stopped
+      if ( ! m_boards_stopping ) {
+        ers::error(CTBCommunicationError(ERS_HERE, board.name + ": Socket closed: " + error.message()));
+      }
+    }
     else {
-      msg << "No Channel Status match found for LLT TS " << trigger_ts << " (Channel Status TS prev=" 
-          << prev_input.first << " prev_prev=" << prev_prev_input.first << ")";
+      ers::error(CTBCommunicationError(ERS_HERE, board.name + ": Read failure: " + error.message()));
+      dump_flight_recorder( flight::Reason::kSocketError ) ;
+    }
+
+    // the board can connect again
+    boost::system::error_code closing_error ;
+    board.socket.close( closing_error ) ;
+    board.connected = false ;
+    board.buffer.clear() ;
+    accept_board( board ) ;
+    return ;
+  }
+
+  // bytes received before this read
+  const std::size_t buffered = board.buffer.size() ;
+  board.buffer.commit( n_bytes ) ;
+
+  const size_t header_size = sizeof( content::tcp_header_t ) ;
+  const size_t word_size = content::word::word_t::size_bytes ;
+  const int64_t received = steady_ns() ;
+
+  // the words of each board go through its own decoder, the HLTs then through m_hlt_merger
+  WordHandler handler{ *this, nullptr, &board } ;
+
+  std::size_t consumed = 0 ;
+  while ( board.buffer.size() >= header_size ) {
+    content::tcp_header_t head ;
+    std::memcpy( & head, board.buffer.data(), header_size ) ;
+    if ( board.buffer.size() < header_size + head.packet_size ) break ;
+
+    if ( board.reader.profile().rx_timestamps ) {
+      // as in do_hsi_work, only the headers that came with this read
+      if ( consumed + header_size > buffered ) {
+        record_kernel_latency( board.reader ) ;
+      }
+      m_kernel_queue.record( board.reader.queued_bytes() ) ;
     }
-    ers::error(CTBWordMatchError(ERS_HERE, msg.str()));
-    return 0;
+
+    const std::size_t n_words = head.packet_size / word_size ;
+    m_received_word_counter += n_words ;
+    board.received_words.store( board.received_words.load( std::memory_order_relaxed ) + n_words, std::memory_order_relaxed ) ;
+    update_buffer_counts( n_words ) ;
+
+    decode( board.buffer.data() + header_size, n_words, handler, received ) ;
+    board.buffer.consume( header_size + head.packet_size ) ;
+    consumed += header_size + head.packet_size ;
   }
 
+  read_board( board ) ;
 }
 
-bool CTBModule::IsTSWord( const content::word::word_t &w ) noexcept {
+void
+CTBModule::do_decode_work(std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_decode_work() method";
+
+  const size_t word_size = content::word::word_t::size_bytes ;
+
+  // every packet pushed by do_hsi_work is decoded: this thread is stopped after it
+  WordHandler handler{ *this, nullptr } ;
+
+  while ( true ) {
 
-  if ( w.word_type == content::word::t_ts ) {
-    return true;
+    ReceivedPacket* packet = m_packet_ring->read_slot() ;
+
+    if ( ! packet ) {
+      if ( ! running_flag.load() ) {
+        // the producer is gone, so an empty ring now stays empty
+        if ( ! ( packet = m_packet_ring->read_slot() ) ) break ;
+      }
+      else {
+        // no packet: partial HSI batches are still sent at their wall time deadline
+        flush_expired_hsi_frames() ;
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+        continue ;
+      }
+    }
+
+    decode( packet->data.data(), packet->data.size() / word_size, handler, packet->received ) ;
+    m_packet_ring->commit_read() ;
+    ++m_decoded_packet_counter ;
   }
-  return false;
 
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_decode_work() method";
 }
 
-bool CTBModule::IsFeedbackWord( const content::word::word_t &w ) noexcept {
+bool CTBModule::push_packet( const uint8_t* packet, std::size_t n_bytes, int64_t received, std::atomic<bool>& running_flag ) {
+
+  ReceivedPacket* slot = m_packet_ring->write_slot() ;
 
-  if ( w.word_type == content::word::t_fback ) {
-    return true;
+  if ( ! slot ) {
+    // the decoding thread is behind: wait for it rather than dropping triggers
+    ++m_packet_ring_full_waits ;
+    while ( ! ( slot = m_packet_ring->write_slot() ) ) {
+      if ( ! running_flag.load() || m_stop_requested.load() ) {
+        return false ;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
   }
-  return false;
 
+  slot->data.assign( packet, packet + n_bytes ) ;
+  slot->received = received ;
+  m_packet_ring->commit_write() ;
+
+  const uint64_t occupancy = m_packet_ring->size() ;
+  if ( occupancy > m_packet_ring_high_water.load( std::memory_order_relaxed ) ) {
+    m_packet_ring_high_water.store( occupancy, std::memory_order_relaxed ) ;
+  }
+
+  return true ;
 }
 
-void CTBModule::init_calibration_file() {
+bool CTBModule::receive( std::size_t n_bytes ) {
+
+  boost::system::error_code receiving_error;
 
-  if ( ! m_has_calibration_stream ){
+  // while the socket is idle, partial HSI batches are still sent at their wall time deadline;
+  // the pipelined readout leaves that to the decoding thread, which owns the batchers
+  while ( ! m_packet_ring && m_receive_buffer.size() < n_bytes && ( ! m_llt_batcher.empty() || ! m_hlt_batcher.empty() ) ) {
+    auto deadline = HSIFrameBatcher::clock::time_point::max() ;
+    if ( ! m_llt_batcher.empty() ) deadline = std::min( deadline, m_llt_batcher.deadline() ) ;
+    if ( ! m_hlt_batcher.empty() ) deadline = std::min( deadline, m_hlt_batcher.deadline() ) ;
+    const auto timeout = std::max( deadline - HSIFrameBatcher::clock::now(), HSIFrameBatcher::clock::duration::zero() ) ;
+    if ( m_receiver_reader.wait_readable( timeout ) ) break ;
+    flush_expired_hsi_frames() ;
+  }
+
+  if ( m_receive_buffer.fill( m_receiver_reader, n_bytes, receiving_error ) ) {
+    return true ;
+  }
+
+  if ( receiving_error == boost::asio::error::eof) {
+    std::string error_message = "Socket closed: " + receiving_error.message();
+    ers::error(CTBCommunicationError(ERS_HERE, error_message));
+    return false ;
+  }
+
+  std::string error_message = "Read failure: " + receiving_error.message();
+  ers::error(CTBCommunicationError(ERS_HERE, error_message));
+  dump_flight_recorder( flight::Reason::kSocketError ) ;
+  return false ;
+}
+
+void CTBModule::on_ts_word( const codec::CTBWord & word ) {
+
+  ++m_ts_word_counter;
+  m_flight_recorder.record( flight::Event::kTimestamp, word ) ;
+  m_run_summary.on_timestamp( word.timestamp() ) ;
+  m_hlt_rates.advance( word.timestamp() ) ;
+  m_llt_rates.advance( word.timestamp() ) ;
+  m_channel_occupancy.flush() ;
+#ifdef CTBMODULES_HOT_PATH_TLOG
+  TLOG_DEBUG(9) << "Received timestamp word! TS: " << word.timestamp();
+#endif
+
+  // the heartbeat bounds the CTB time a frame can wait in a batch
+  if ( m_llt_batcher.due( word.timestamp() ) ) flush_llt_frames();
+  if ( m_hlt_batcher.due( word.timestamp() ) ) flush_hlt_frames();
+}
+
+void CTBModule::on_feedback_word( const codec::CTBWord & feedback ) {
+
+  m_error_state.store( true ) ;
+  m_flight_recorder.record( flight::Event::kFeedback, feedback ) ;
+  m_run_summary.on_feedback( feedback.timestamp() ) ;
+  TLOG_DEBUG(7) << "Received feedback word!";
+
+  TLOG_DEBUG(8) << get_name() << ": Feedback word: " << std::endl
+                                            << std::hex 
+                                            << " \t Type -> " << feedback.word_type() << std::endl 
+                                            << " \t TS -> " << feedback.timestamp() << std::endl
+                                            << " \t Code -> " << feedback.feedback_code() << std::endl
+                                            << " \t Source -> " << feedback.feedback_source() << std::endl
+                                            << " \t Padding -> " << feedback.feedback_padding() << std::dec << std::endl ;
+
+  dump_flight_recorder( flight::Reason::kFeedback ) ;
+}
+
+void CTBModule::on_hlt( const codec::CTBWord & hlt_word, uint64_t llt_payload, Board * board ) {
+
+  m_flight_recorder.record( flight::Event::kHLT, hlt_word, llt_payload ) ;
+  ++m_run_HLT_counter;
+
+  m_last_readout_hlt_timestamp = hlt_word.timestamp();
+
+  // Send HSI data to a DLH 
+  std::array<uint32_t, 7> hsi_struct = CTBStreamDecoder::make_hlt_frame( hlt_word, llt_payload, m_run_HLT_counter ) ;
+
+#ifdef CTBMODULES_HOT_PATH_TLOG
+  TLOG_DEBUG(3) << "Received HLT word!";
+  TLOG_DEBUG(4) << get_name() << ": Formed HSI_FRAME_STRUCT for hlt "
+        << std::hex 
+        << "0x"   << hsi_struct[0]
+        << ", 0x" << hsi_struct[1]
+        << ", 0x" << hsi_struct[2]
+        << ", 0x" << hsi_struct[3]
+        << ", 0x" << hsi_struct[4]
+        << ", 0x" << hsi_struct[5]
+        << ", 0x" << hsi_struct[6]
+        << "\n";
+#endif
+
+  if ( board ) {
+    board->hlts.store( board->hlts.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed ) ;
+    m_hlt_merger.push( board->index, hsi_struct ) ;
+  }
+  else if ( m_hlt_batcher.add( hsi_struct ) || m_hlt_batcher.due( hlt_word.timestamp() ) ) {
+    flush_hlt_frames();
+  }
+
+  // Count the total HLTs and each specific one
+  m_hlt_counters.count( hlt_word.trigger_word() );
+  m_run_summary.on_hlt( hlt_word.timestamp(), hlt_word.trigger_word() );
+  m_hlt_rates.count( hlt_word.timestamp(), hlt_word.trigger_word() );
+}
+
+void CTBModule::on_llt( const codec::CTBWord & llt_word, uint64_t channel_payload ) {
+
+  m_flight_recorder.record( flight::Event::kLLT, llt_word, channel_payload ) ;
+  ++m_run_LLT_counter;
+
+  // Send HSI data to a DLH 
+  std::array<uint32_t, 7> hsi_struct = CTBStreamDecoder::make_llt_frame( llt_word, channel_payload, m_run_LLT_counter ) ;
+
+#ifdef CTBMODULES_HOT_PATH_TLOG
+  TLOG_DEBUG(5) << "Received LLT word!";
+  TLOG_DEBUG(6) << get_name() << ": Formed HSI_FRAME_STRUCT for llt "
+        << std::hex 
+        << "0x"   << hsi_struct[0]
+        << ", 0x" << hsi_struct[1]
+        << ", 0x" << hsi_struct[2]
+        << ", 0x" << hsi_struct[3]
+        << ", 0x" << hsi_struct[4]
+        << ", 0x" << hsi_struct[5]
+        << ", 0x" << hsi_struct[6]
+        << "\n";
+#endif
+
+  if ( m_llt_batcher.add( hsi_struct ) || m_llt_batcher.due( llt_word.timestamp() ) ) {
+    flush_llt_frames();
+  }
+
+  m_llt_counters.count( llt_word.trigger_word() );
+  m_run_summary.on_llt( llt_word.timestamp(), llt_word.trigger_word() );
+  m_llt_rates.count( llt_word.timestamp(), llt_word.trigger_word() );
+}
+
+void CTBModule::flush_llt_frames() {
+
+  if ( m_llt_batcher.empty() ) return ;
+
+  const int64_t start = steady_ns() ;
+  m_llt_batcher.flush( [this]( const HSIFrameBatcher::hsi_frame_t & frame ) {
+    send_raw_hsi_data(frame, m_llt_hsi_data_sender.get());
+  } ) ;
+  m_send_latency.record( steady_ns() - start ) ;
+}
+
+void CTBModule::flush_hlt_frames() {
+
+  if ( m_hlt_batcher.empty() ) return ;
+
+  // CTB timestamps are 62.5 MHz ticks since the epoch
+  const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::system_clock::now().time_since_epoch() ).count() ;
+
+  const int64_t start = steady_ns() ;
+  m_hlt_batcher.flush( [this, now]( const HSIFrameBatcher::hsi_frame_t & frame ) {
+    send_raw_hsi_data(frame, m_hlt_hsi_data_sender.get());
+
+    // TODO properly fill device id
+    dfmessages::HSIEvent event = dfmessages::HSIEvent(0x1, frame[5], HSIFrameBatcher::timestamp( frame ), frame[6], m_run_number);
+    send_hsi_event(event);
+
+    const int64_t age = now - int64_t( HSIFrameBatcher::timestamp( frame ) * 16 ) ;
+    m_hlt_age.record( age > 0 ? age : 0 ) ;
+  } ) ;
+  m_send_latency.record( steady_ns() - start ) ;
+}
+
+void CTBModule::release_merged_hlt_frames( bool all ) {
+
+  if ( m_hlt_merger.empty() ) return ;
+
+  // the frames were numbered as they arrived from each board, they are numbered again in merged order
+  auto to_batcher = [this]( const HSIFrameBatcher::hsi_frame_t & merged ) {
+    HSIFrameBatcher::hsi_frame_t frame = merged ;
+    frame[6] = ++m_merged_hlt_counter ;
+    if ( m_hlt_batcher.add( frame ) || m_hlt_batcher.due( HSIFrameBatcher::timestamp( frame ) ) ) {
+      flush_hlt_frames();
+    }
+  } ;
+
+  if ( all ) m_hlt_merger.drain( to_batcher ) ;
+  else m_hlt_merger.release( to_batcher ) ;
+}
+
+void CTBModule::flush_expired_hsi_frames() {
+
+  if ( m_llt_batcher.empty() && m_hlt_batcher.empty() ) {
     return ;
-  } 
-  char file_name[200] = "" ;
-  time_t rawtime;
-  time( & rawtime ) ;
-  struct tm * timeinfo = localtime( & rawtime ) ;
-  strftime( file_name, sizeof(file_name), "%F_%H.%M.%S.calib", timeinfo );
-  std::string global_name = m_calibration_dir + m_calibration_prefix + file_name ;
-  m_calibration_file.open( global_name, std::ofstream::binary ) ;
-  m_last_calibration_file_update = std::chrono::steady_clock::now();
-  // _calibration_file.setf ( std::ios::hex, std::ios::basefield );
-  // _calibration_file.unsetf ( std::ios::showbase );
-  TLOG_DEBUG(0) << get_name() << ": New Calibration Stream file: " << global_name << std::endl ;
+  }
+
+  const auto now = HSIFrameBatcher::clock::now() ;
+  if ( m_llt_batcher.due( now ) ) flush_llt_frames();
+  if ( m_hlt_batcher.due( now ) ) flush_hlt_frames();
+}
 
+void CTBModule::check_match_errors() {
+
+  // the errors themselves are reported by the decoder
+  uint64_t unmatched = m_decoder.channel_window().total_unmatched() + m_decoder.llt_window().total_unmatched() ;
+  for ( const auto & board : m_boards ) {
+    unmatched += board->decoder.channel_window().total_unmatched() + board->decoder.llt_window().total_unmatched() ;
+  }
+  if ( unmatched != m_reported_unmatched ) {
+    m_reported_unmatched = unmatched ;
+    dump_flight_recorder( flight::Reason::kMatchError ) ;
+  }
 }
 
-void CTBModule::update_calibration_file() {
+void CTBModule::dump_flight_recorder( flight::Reason reason ) {
 
-  if ( ! m_has_calibration_stream ) {
+  if ( m_flight_recorder_dir.empty() ) {
+    if ( reason == flight::Reason::kOnDemand ) {
+      ers::warning(CTBFlightRecorderError(ERS_HERE, "No flight_recorder_output directory configured"));
+    }
     return ;
   }
-  
-  std::chrono::steady_clock::time_point check_point = std::chrono::steady_clock::now();
-  
-  if ( check_point - m_last_calibration_file_update < m_calibration_file_interval ) {
+
+  // automatic dumps are rate limited and capped per run, an error storm would otherwise fill the disk
+  static constexpr std::chrono::seconds s_min_dump_interval( 10 ) ;
+  if ( reason != flight::Reason::kOnDemand ) {
+    if ( m_flight_recorder_max_dumps && m_automatic_dumps.load() >= m_flight_recorder_max_dumps ) return ;
+    const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count() ;
+    int64_t last = m_last_flight_recorder_dump.load() ;
+    do {
+      if ( last && now - last < std::chrono::nanoseconds( s_min_dump_interval ).count() ) return ;
+    } while ( ! m_last_flight_recorder_dump.compare_exchange_weak( last, now ) ) ;
+    const uint64_t n_dumps = m_automatic_dumps.fetch_add( 1 ) + 1 ;
+    if ( m_flight_recorder_max_dumps && n_dumps > m_flight_recorder_max_dumps ) return ;
+    if ( n_dumps == m_flight_recorder_max_dumps ) {
+      ers::warning(CTBFlightRecorderError(ERS_HERE, "Last automatic dump of the run, flight_recorder_max_dumps reached"));
+    }
+  }
+
+  // the readout threads only queue the request
+  if ( m_dump_thread_.thread_running() ) {
+    {
+      std::lock_guard<std::mutex> lock( m_dump_mutex ) ;
+      m_dump_requests.push_back( reason ) ;
+    }
+    m_dump_cv.notify_one() ;
     return ;
   }
 
-  m_calibration_file.close() ;
-  init_calibration_file() ;
+  write_flight_recorder_dump( reason ) ;
+}
+
+void CTBModule::do_dump_work(std::atomic<bool>& running_flag) {
 
+  std::unique_lock<std::mutex> lock( m_dump_mutex ) ;
+  while ( true ) {
+    // the requests left at the stop are still written
+    m_dump_cv.wait_for( lock, std::chrono::milliseconds( 100 ), [&] { return ! m_dump_requests.empty() || ! running_flag.load() ; } ) ;
+    if ( m_dump_requests.empty() ) {
+      if ( ! running_flag.load() ) break ;
+      continue ;
+    }
+
+    const flight::Reason reason = m_dump_requests.front() ;
+    m_dump_requests.pop_front() ;
+    lock.unlock() ;
+    write_flight_recorder_dump( reason ) ;
+    lock.lock() ;
+  }
+}
+
+void CTBModule::write_flight_recorder_dump( flight::Reason reason ) {
+
+  char time_stamp[32] = "" ;
+  time_t rawtime;
+  time( & rawtime ) ;
+  strftime( time_stamp, sizeof(time_stamp), "%F_%H.%M.%S", localtime( & rawtime ) ) ;
+
+  std::stringstream file_name ;
+  file_name << m_flight_recorder_dir << "ctb_flight_run" << m_run_number.load() << '_' << time_stamp << '_' << flight::to_string( reason ) << ".bin" ;
+
+  if ( m_flight_recorder.dump( file_name.str(), reason, m_run_number.load() ) ) {
+    TLOG() << get_name() << ": Flight recorder dumped to " << file_name.str() ;
+  }
 }
 
 bool CTBModule::SetCalibrationStream( const std::string & prefix ) {
@@ -560,7 +1158,7 @@ bool CTBModule::SetCalibrationStream( const std::string & prefix ) {
 
 }
 
-bool CTBModule::store_run_trigger_counters( unsigned int run_number, const std::string & prefix) const {
+bool CTBModule::store_run_trigger_counters( unsigned int run_number, const std::string & prefix) {
 
   if ( ! m_has_run_trigger_report ) {
     return false ;
@@ -569,19 +1167,62 @@ bool CTBModule::store_run_trigger_counters( unsigned int run_number, const std::
   std::stringstream out_name ;
   out_name << m_run_trigger_dir << prefix << "run_" << run_number << "_triggers.txt";
   std::ofstream out( out_name.str() ) ;
+  const auto hlts = m_hlt_counters.run_snapshot() ;
+  const auto llts = m_llt_counters.run_snapshot() ;
+
   out << "Good Part\t " << m_run_gool_part_counter << std::endl 
-      << "Total HLT\t " << m_run_HLT_counter << std::endl ;
+      << "Total HLT\t " << hlts.run_words << std::endl ;
+
+  for ( unsigned int i = 0; i < s_hlt_range ; ++i ) {
+    out << "HLT " << i << " \t " << hlts.run[i] << std::endl ;
+  }
 
-  for ( unsigned int i = 0; i < m_metric_HLT_names.size() ; ++i ) {
-    out << "HLT " << i << " \t " << m_run_HLT_counters[i] << std::endl ;
+  out << "Total LLT\t " << llts.run_words << std::endl ;
+
+  for ( unsigned int i = 0; i < s_llt_range ; ++i ) {
+    out << "LLT " << i << " \t " << llts.run[i] << std::endl ;
   }
 
   return true; 
 
 }
 
+void CTBModule::store_run_summary( unsigned int run_number, const std::string & prefix) {
+
+  if ( ! m_has_run_trigger_report ) {
+    return ;
+  }
+
+  uint64_t unmatched_hlts, unmatched_llts ;
+  count_unmatched( unmatched_hlts, unmatched_llts ) ;
+  m_run_summary.set_unmatched( unmatched_hlts - m_run_start_unmatched_hlts, unmatched_llts - m_run_start_unmatched_llts ) ;
+
+  std::stringstream base_name ;
+  base_name << m_run_trigger_dir << prefix << "run_" << run_number << "_summary" ;
+
+  std::ofstream json_out( base_name.str() + ".json" ) ;
+  json_out << m_run_summary.to_json().dump( 2 ) << std::endl ;
+
+  std::ofstream binary_out( base_name.str() + ".bin", std::ios::binary ) ;
+  m_run_summary.write_binary( binary_out ) ;
+
+  if ( ! json_out || ! binary_out ) {
+    ers::warning(CTBRunSummaryError(ERS_HERE, base_name.str()));
+  }
+}
+
+void CTBModule::count_unmatched( uint64_t & hlts, uint64_t & llts ) {
 
-void CTBModule::send_config( const std::string & config ) {
+  llts = m_decoder.channel_window().total_unmatched() ;
+  hlts = m_decoder.llt_window().total_unmatched() ;
+  for ( const auto & board : m_boards ) {
+    llts += board->decoder.channel_window().total_unmatched() ;
+    hlts += board->decoder.llt_window().total_unmatched() ;
+  }
+}
+
+
+void CTBModule::send_config( const nlohmann::json & config ) {
 
   if ( m_is_configured.load() ) {
 
@@ -592,7 +1233,21 @@ void CTBModule::send_config( const std::string & config ) {
 
   TLOG_DEBUG(1) << get_name() << ": Sending config" << std::endl;
 
-  if ( send_message( config ) ) {
+  bool configured = true ;
+  if ( m_boards.empty() ) {
+    configured = send_message( config.dump(), ControlCommand::kConfig ) ;
+  }
+  else {
+    // each board streams to its own port
+    for ( auto & board : m_boards ) {
+      nlohmann::json board_config = config ;
+      board_config["ctb"]["sockets"]["receiver"]["host"] = m_cfg.boards[board->index].receiver_host ;
+      board_config["ctb"]["sockets"]["receiver"]["port"] = board->receiver_port ;
+      configured = send_message( board->control, board_config.dump(), ControlCommand::kConfig ) && configured ;
+    }
+  }
+
+  if ( configured ) {
 
     m_is_configured.store(true) ;
 
@@ -606,7 +1261,7 @@ void CTBModule::send_reset() {
 
   TLOG_DEBUG(1) << get_name() << ": Sending a reset" << std::endl;
 
-  if(send_message( "{\"command\":\"HardReset\"}" )){
+  if(send_message( "{\"command\":\"HardReset\"}", ControlCommand::kReset )){
 
     m_is_running.store(false);
     m_is_configured.store(false);
@@ -618,23 +1273,44 @@ void CTBModule::send_reset() {
 
 }
 
-bool CTBModule::send_message( const std::string & msg ) {
+bool CTBModule::send_message( const std::string & msg, ControlCommand command ) {
 
-  //add error options                                                                                                
+  if ( m_boards.empty() ) {
+    return send_message( m_control_client, msg, command ) ;
+  }
+
+  bool ret = true ;
+  for ( auto & board : m_boards ) {
+    ret = send_message( board->control, msg, command ) && ret ;
+  }
+  return ret ;
+}
+
+bool CTBModule::send_message( CTBControlClient & client, const std::string & msg, ControlCommand command ) {
 
-  boost::system::error_code error;
   TLOG_DEBUG(1) << get_name() << ": Sending message: " << msg;
 
   m_num_control_messages_sent++;
 
-  boost::asio::write( m_control_socket, boost::asio::buffer( msg ), error ) ;
-  boost::array<char, 1024> reply_buf{" "} ;
-  m_control_socket.read_some( boost::asio::buffer(reply_buf ), error);
-  std::stringstream raw_answer( std::string(reply_buf .begin(), reply_buf .end() ) ) ;
-  TLOG_DEBUG(1) << get_name() << ": Unformatted answer: " << raw_answer.str(); 
+  // the board checks the whole configuration before answering
+  const auto timeout = command == ControlCommand::kConfig ? m_control_config_timeout : m_control_timeout ;
+
+  std::string raw_answer ;
+  const int64_t start = steady_ns() ;
+  if ( const auto ec = client.transact( msg, raw_answer, timeout ) ) {
+    ers::error(CTBCommunicationError(ERS_HERE, "No answer from the CTB: " + ec.message()));
+    return false ;
+  }
+  m_control_latency[static_cast<size_t>(command)].record( steady_ns() - start ) ;
+  TLOG_DEBUG(1) << get_name() << ": Unformatted answer: " << raw_answer; 
 
   nlohmann::json answer ;
-  raw_answer >> answer ;
+  try {
+    answer = nlohmann::json::parse( raw_answer ) ;
+  } catch ( const nlohmann::json::exception & e ) {
+    ers::error(CTBCommunicationError(ERS_HERE, "Unreadable answer from the CTB: " + std::string(e.what())));
+    return false ;
+  }
   nlohmann::json & messages = answer["feedback"] ;
   TLOG_DEBUG(1) << get_name() << ": Received messages: " << messages.size();
 
@@ -668,64 +1344,260 @@ bool CTBModule::send_message( const std::string & msg ) {
 void
 CTBModule::update_buffer_counts(uint new_count) // NOLINT(build/unsigned)
 {
-  std::unique_lock mon_data_lock(m_buffer_counts_mutex);
-  if (m_buffer_counts.size() > 1000)
-    m_buffer_counts.pop_front();
-  m_buffer_counts.push_back(new_count);
-}
-
-double
-CTBModule::read_average_buffer_counts()
-{
-  std::unique_lock mon_data_lock(m_buffer_counts_mutex);
-
-  double total_counts;
-  uint32_t number_of_counts; // NOLINT(build/unsigned)
-
-  total_counts = 0;
-  number_of_counts = m_buffer_counts.size();
-
-  if (number_of_counts) {
-    for (uint i = 0; i < number_of_counts; ++i) { // NOLINT(build/unsigned)
-      total_counts = total_counts + m_buffer_counts.at(i);
-    }
-    return total_counts / number_of_counts;
-  } else {
-    return 0;
-  }
+  m_buffer_counts.record(new_count);
+  m_last_packet_time.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
 }
 
 void CTBModule::get_info(opmonlib::InfoCollector& ci, int /*level*/)
 {
+  std::lock_guard<std::mutex> lock( m_info_mutex );
+
   dunedaq::ctbmodules::ctbmoduleinfo::CTBModuleInfo module_info;
 
   module_info.num_control_messages_sent = m_num_control_messages_sent.load();
   module_info.num_control_responses_received = m_num_control_responses_received.load();
+  // every client connects once at configuration
+  std::vector<const CTBControlClient*> control_clients{ &m_control_client };
+  for ( const auto& board : m_boards ) control_clients.push_back( &board->control );
+  module_info.num_control_reconnections = 0;
+  module_info.num_control_timeouts = 0;
+  for ( const auto* client : control_clients ) {
+    const uint64_t n_control_connections = client->connections();
+    module_info.num_control_reconnections += n_control_connections ? n_control_connections - 1 : 0;
+    module_info.num_control_timeouts += client->timeouts();
+  }
+  module_info.start_to_connection_time = m_start_to_connection.load() / 1e6;
+  module_info.start_to_first_word_time = m_start_to_first_word.load( std::memory_order_relaxed ) / 1e6;
   module_info.ctb_hardware_run_status = m_is_running; 
   module_info.ctb_hardware_configuration_status = m_is_configured;
     
   module_info.last_readout_timestamp = m_last_readout_hlt_timestamp.load();
   module_info.failed_to_send_hsi_events_counter = m_failed_to_send_counter.load();
   module_info.last_sent_timestamp = m_last_sent_timestamp.load();
-  module_info.average_buffer_occupancy = read_average_buffer_counts();
-
-  module_info.total_hlt_count = m_total_hlt_counter.load();
+  const AtomicHistogram::Summary buffer_counts = m_buffer_counts.take_summary();
+  module_info.average_buffer_occupancy = buffer_counts.mean;
+  module_info.buffer_occupancy_p50 = buffer_counts.p50;
+  module_info.buffer_occupancy_p99 = buffer_counts.p99;
+  module_info.buffer_occupancy_max = buffer_counts.max;
+  const int64_t last_packet_time = m_last_packet_time.load(std::memory_order_relaxed);
+  module_info.time_since_last_packet = last_packet_time ? ( std::chrono::steady_clock::now().time_since_epoch().count() - last_packet_time ) / 1e6 : 0.;
+
+  const auto hlts = m_hlt_counters.take_snapshot();
+  const auto llts = m_llt_counters.take_snapshot();
+  const auto hlt_rates = m_hlt_rates.rates();
+  const auto llt_rates = m_llt_rates.rates();
+
+  module_info.total_hlt_count = hlts.run_words;
   module_info.ts_word_count = m_ts_word_counter.exchange(0);
+  module_info.hlt_rate = hlt_rates[s_hlt_range].short_window;
+  module_info.llt_rate = llt_rates[s_llt_range].short_window;
+
+  uint64_t n_receives = m_receive_buffer.take_receive_count();
+  uint64_t n_received_bytes = m_receive_buffer.take_received_bytes();
+  for ( auto& board : m_boards ) {
+    const uint64_t board_receives = board->buffer.take_receive_count();
+    const uint64_t board_bytes = board->buffer.take_received_bytes();
+    n_receives += board_receives;
+    n_received_bytes += board_bytes;
 
-  for (auto &hlt : m_hlt_trigger_counter) {
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::BoardInfo bi;
+    bi.connected = board->connected.load();
+    bi.num_receive_calls = board_receives;
+    bi.received_bytes = board_bytes;
+    bi.received_words = board->received_words.exchange(0);
+    bi.hlt_count = board->hlts.exchange(0);
+    bi.lag = board->index < m_hlt_merger.n_sources() ? m_hlt_merger.lag( board->index ) : 0;
+    tmp_ic.add(bi);
+    ci.add(board->name, tmp_ic);
+  }
+  const uint64_t n_received_words = m_received_word_counter.exchange(0);
+  module_info.num_receive_calls = n_receives;
+  module_info.bytes_per_receive = n_receives ? double(n_received_bytes) / n_receives : 0.;
+  module_info.receive_calls_per_word = n_received_words ? double(n_receives) / n_received_words : 0.;
+
+  for (size_t i = 0; i < s_hlt_range; ++i) {
+    if ( ! m_hlt_counters.is_enabled(i) ) continue;
     opmonlib::InfoCollector tmp_ic;
     dunedaq::ctbmodules::ctbmoduleinfo::LevelTriggerInfo ti;
-    ti.count = hlt.second.exchange(0);
+    ti.count = hlts.interval[i];
+    ti.rate = hlt_rates[i].instantaneous;
+    ti.short_window_rate = hlt_rates[i].short_window;
+    ti.long_window_rate = hlt_rates[i].long_window;
+    ti.last_spill_rate = hlt_rates[i].last_spill;
     tmp_ic.add(ti);
-    ci.add("hlt_" + std::to_string(hlt.first), tmp_ic);
+    ci.add("hlt_" + std::to_string(i), tmp_ic);
   }
 
-  for (auto &llt : m_llt_trigger_counter) {
+  for (size_t i = 0; i < s_llt_range; ++i) {
+    if ( ! m_llt_counters.is_enabled(i) ) continue;
     opmonlib::InfoCollector tmp_ic;
     dunedaq::ctbmodules::ctbmoduleinfo::LevelTriggerInfo ti;
-    ti.count = llt.second.exchange(0);
+    ti.count = llts.interval[i];
+    ti.rate = llt_rates[i].instantaneous;
+    ti.short_window_rate = llt_rates[i].short_window;
+    ti.long_window_rate = llt_rates[i].long_window;
+    ti.last_spill_rate = llt_rates[i].last_spill;
     tmp_ic.add(ti);
-    ci.add("llt_" + std::to_string(llt.first), tmp_ic);
+    ci.add("llt_" + std::to_string(i), tmp_ic);
+  }
+
+  // one child per subsystem, with one child per enabled channel
+  const auto occupancy = m_channel_occupancy.take_snapshot();
+  auto fraction = []( uint64_t count, uint64_t words ) { return words ? double(count) / words : 0. ; } ;
+  for ( size_t s = 0; s < occupancy::s_subsystems.size(); ++s ) {
+    const auto & subsystem = occupancy::s_subsystems[s];
+    opmonlib::InfoCollector subsystem_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::SubsystemOccupancyInfo si;
+    si.channel_status_words = occupancy.interval_words;
+    si.stuck_on_channels = occupancy.stuck_on( subsystem, m_cfg.occupancy_min_words );
+    si.stuck_off_channels = occupancy.stuck_off( subsystem, m_enabled_channels[s], m_cfg.occupancy_min_words );
+    si.num_stuck_on = __builtin_popcountll( si.stuck_on_channels );
+    si.num_stuck_off = __builtin_popcountll( si.stuck_off_channels );
+    si.active_channels = 0;
+    si.max_occupancy = 0.;
+    double occupancy_sum = 0.;
+    for ( size_t i = 0; i < subsystem.size; ++i ) {
+      const uint64_t count = occupancy.interval[subsystem.first + i];
+      const double channel_occupancy = fraction( count, occupancy.interval_words );
+      if ( count ) ++si.active_channels;
+      si.max_occupancy = std::max( si.max_occupancy, channel_occupancy );
+      if ( ! ( ( m_enabled_channels[s] >> i ) & 0x1 ) ) continue;
+      occupancy_sum += channel_occupancy;
+
+      opmonlib::InfoCollector tmp_ic;
+      dunedaq::ctbmodules::ctbmoduleinfo::ChannelOccupancyInfo oi;
+      oi.count = count;
+      oi.occupancy = channel_occupancy;
+      oi.run_occupancy = fraction( occupancy.run[subsystem.first + i], occupancy.run_words );
+      tmp_ic.add(oi);
+      subsystem_ic.add("channel_" + std::to_string(i), tmp_ic);
+    }
+    const int n_enabled = __builtin_popcountll( m_enabled_channels[s] );
+    si.mean_occupancy = n_enabled ? occupancy_sum / n_enabled : 0.;
+    subsystem_ic.add(si);
+    ci.add(std::string(subsystem.name) + "_occupancy", subsystem_ic);
+  }
+
+  if ( m_calibration_writer ) {
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::CalibrationWriterInfo wi;
+    wi.queue_depth = m_calibration_writer->queue_depth();
+    wi.queue_capacity = m_calibration_writer->queue_capacity();
+    wi.bytes_written = m_calibration_writer->take_bytes_written();
+    wi.bytes_received = m_calibration_writer->take_bytes_received();
+    wi.num_writes = m_calibration_writer->take_num_writes();
+    const uint64_t write_time_ns = m_calibration_writer->take_write_time_ns();
+    wi.average_write_latency = wi.num_writes ? write_time_ns / 1000. / wi.num_writes : 0.;
+    wi.max_write_latency = m_calibration_writer->take_max_write_time_ns() / 1000.;
+    wi.dropped_packets = m_calibration_writer->take_dropped_packets();
+    wi.num_files_opened = m_calibration_writer->take_files_opened();
+    wi.num_files_removed = m_calibration_writer->take_files_removed();
+    tmp_ic.add(wi);
+    ci.add("calibration_writer", tmp_ic);
+  }
+
+  // LLTs are matched to channel status words, HLTs to LLTs, by the decoder of each board
+  std::vector<std::pair<std::string, MatchWindow*>> windows;
+  if ( m_boards.empty() ) {
+    windows = { { "llt_matching", &m_decoder.channel_window() }, { "hlt_matching", &m_decoder.llt_window() } };
+  }
+  for ( const auto& board : m_boards ) {
+    windows.emplace_back( board->name + "_llt_matching", &board->decoder.channel_window() );
+    windows.emplace_back( board->name + "_hlt_matching", &board->decoder.llt_window() );
+  }
+  for ( const auto& w : windows ) {
+    const MatchWindow::Stats stats = w.second->take_stats();
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::TriggerMatchingInfo mi;
+    mi.matched = stats.matched;
+    mi.unmatched = stats.unmatched;
+    mi.late_inserted = stats.late_inserted;
+    mi.late_dropped = stats.late_dropped;
+    mi.average_offset = stats.offsets.mean;
+    mi.offset_p99 = stats.offsets.p99;
+    mi.max_offset = stats.offsets.max;
+    tmp_ic.add(mi);
+    ci.add(w.first, tmp_ic);
+  }
+
+  const std::pair<const char*, HSIFrameBatcher*> batchers[] = { { "llt_output_batching", &m_llt_batcher },
+                                                                { "hlt_output_batching", &m_hlt_batcher } };
+  for ( const auto& b : batchers ) {
+    const HSIFrameBatcher::Stats stats = b.second->take_stats();
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::HSIBatchingInfo bi;
+    bi.num_batches = stats.batch_sizes.count;
+    bi.average_batch_size = stats.batch_sizes.mean;
+    bi.batch_size_p99 = stats.batch_sizes.p99;
+    bi.max_batch_size = stats.batch_sizes.max;
+    bi.flush_latency_p50 = stats.flush_latencies.p50 / 1000.;
+    bi.flush_latency_p99 = stats.flush_latencies.p99 / 1000.;
+    bi.max_flush_latency = stats.flush_latencies.max / 1000.;
+    bi.late_frames = stats.late_frames;
+    tmp_ic.add(bi);
+    ci.add(b.first, tmp_ic);
+  }
+
+  const std::pair<const char*, AtomicHistogram*> latencies[] = { { "latency_receive", &m_receive_latency },
+                                                                 { "latency_queue", &m_queue_latency },
+                                                                 { "latency_decode", &m_decode_latency },
+                                                                 { "latency_send", &m_send_latency },
+                                                                 { "hlt_age", &m_hlt_age },
+                                                                 { "latency_kernel", &m_kernel_latency },
+                                                                 { "control_config", &m_control_latency[0] },
+                                                                 { "control_start", &m_control_latency[1] },
+                                                                 { "control_stop", &m_control_latency[2] },
+                                                                 { "control_reset", &m_control_latency[3] } };
+  for ( const auto& l : latencies ) {
+    const AtomicHistogram::Summary summary = l.second->take_summary();
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::LatencyInfo li;
+    li.count = summary.count;
+    li.mean = summary.mean / 1000.;
+    li.p50 = summary.p50 / 1000.;
+    li.p99 = summary.p99 / 1000.;
+    li.max = summary.max / 1000.;
+    tmp_ic.add(li);
+    ci.add(l.first, tmp_ic);
+  }
+
+  if ( ! m_boards.empty() ) {
+    const HSIFrameMerger::Stats stats = m_hlt_merger.take_stats();
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::HLTMergingInfo mi;
+    mi.num_frames = stats.delays.count;
+    mi.forced_frames = stats.forced_frames;
+    mi.late_frames = stats.late_frames;
+    mi.delay_p50 = stats.delays.p50 / 1000.;
+    mi.delay_p99 = stats.delays.p99 / 1000.;
+    mi.max_delay = stats.delays.max / 1000.;
+    tmp_ic.add(mi);
+    ci.add("hlt_merging", tmp_ic);
+  }
+
+  if ( m_receiver_reader.profile().rx_timestamps ) {
+    const AtomicHistogram::Summary queue = m_kernel_queue.take_summary();
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::KernelQueueInfo qi;
+    qi.count = queue.count;
+    qi.average_queued_bytes = queue.mean;
+    qi.queued_bytes_p99 = queue.p99;
+    qi.max_queued_bytes = queue.max;
+    tmp_ic.add(qi);
+    ci.add("kernel_queue", tmp_ic);
+  }
+
+  if ( m_packet_ring ) {
+    opmonlib::InfoCollector tmp_ic;
+    dunedaq::ctbmodules::ctbmoduleinfo::ReadoutPipelineInfo pi;
+    pi.ring_occupancy = m_packet_ring->size();
+    pi.ring_capacity = m_packet_ring->capacity();
+    pi.ring_high_water = m_packet_ring_high_water.exchange(0);
+    pi.ring_full_waits = m_packet_ring_full_waits.exchange(0);
+    pi.decoded_packets = m_decoded_packet_counter.exchange(0);
+    tmp_ic.add(pi);
+    ci.add("readout_pipeline", tmp_ic);
   }
 
   ci.add(module_info);
@@ -21,16 +21,33 @@
 
 #include <ers/Issue.hpp>
 
+#include "AtomicHistogram.hpp"
+#include "CTBControlClient.hpp"
 #include "CTBPacketContent.hpp"
+#include "CTBReceiveBuffer.hpp"
+#include "CTBStreamDecoder.hpp"
+#include "CalibrationWriter.hpp"
+#include "ChannelOccupancy.hpp"
+#include "FlightRecorder.hpp"
+#include "HSIFrameBatcher.hpp"
+#include "HSIFrameMerger.hpp"
+#include "ReceiverSocketReader.hpp"
+#include "RunSummary.hpp"
+#include "SPSCRing.hpp"
+#include "TriggerCounters.hpp"
+#include "TriggerRates.hpp"
 
 #include "ctbmodules/ctbmodule/Nljs.hpp"
 #include "ctbmodules/ctbmoduleinfo/InfoNljs.hpp"
 
+#include <array>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <fstream>
-#include <shared_mutex>
 #include <map>
 
 #include <boost/asio.hpp>
@@ -59,9 +76,6 @@ public:
 
   void init(const nlohmann::json& iniobj) override;
 
-  static uint64_t MatchTriggerInput(const uint64_t trigger_ts, const std::pair<uint64_t,uint64_t> &prev_input, const std::pair<uint64_t,uint64_t> &prev_prev_input, bool hlt_matching) noexcept;
-  static bool IsTSWord( const content::word::word_t &w ) noexcept;
-  static bool IsFeedbackWord( const content::word::word_t &w ) noexcept;
   bool ErrorState() const { return m_error_state.load() ; } 
 
   void get_info(opmonlib::InfoCollector& ci, int level) override;
@@ -79,18 +93,27 @@ private:
   std::atomic<unsigned int> m_n_TS_words;
   std::atomic<bool> m_error_state;
 
-  std::atomic<unsigned int> m_total_hlt_counter;
   std::atomic<unsigned int> m_ts_word_counter;
 
-  size_t m_hlt_range = 20;
-  size_t m_llt_range = 25;
-  std::map<size_t, std::atomic<unsigned int>> m_hlt_trigger_counter;
-  std::map<size_t, std::atomic<unsigned int>> m_llt_trigger_counter;
+  // HLT_0 to HLT_19 and LLT_0 to LLT_26, bit i of the trigger word is trigger i
+  static constexpr size_t s_hlt_range = 20;
+  static constexpr size_t s_llt_range = 27;
+  TriggerCounters<s_hlt_range> m_hlt_counters;
+  TriggerCounters<s_llt_range> m_llt_counters;
+  RunSummary<s_hlt_range, s_llt_range> m_run_summary;
+  TriggerRates<s_hlt_range> m_hlt_rates;
+  TriggerRates<s_llt_range> m_llt_rates;
+
+  // inputs of the channel status words, the enabled ones per subsystem, from the channel masks
+  ChannelOccupancy m_channel_occupancy;
+  std::array<uint64_t, occupancy::s_subsystems.size()> m_enabled_channels = {};
 
   boost::asio::io_service m_control_ios;
   boost::asio::io_service m_receiver_ios;
-  boost::asio::ip::tcp::socket m_control_socket;
+  CTBControlClient m_control_client;
+  boost::asio::ip::tcp::acceptor m_receiver_acceptor; // listening from configure on, across runs
   boost::asio::ip::tcp::socket m_receiver_socket;
+  ReceiverSocketReader m_receiver_reader;
   boost::asio::ip::tcp::endpoint m_endpoint;
 
   std::shared_ptr<dunedaq::hsilibs::HSIEventSender::raw_sender_ct> m_llt_hsi_data_sender;
@@ -103,9 +126,23 @@ private:
   void do_stop(const nlohmann::json& obj);
   void do_scrap(const nlohmann::json& /*obj*/){}
 
+  // the control messages, each with its round trip latency histogram
+  enum class ControlCommand { kConfig = 0, kStart, kStop, kReset };
+  static constexpr size_t s_n_control_commands = 4;
+
   void send_reset() ;
-  void send_config(const std::string & config);
-  bool send_message(const std::string & msg);
+  void send_config(const nlohmann::json & config);
+  // to the board, or to all the boards in multi-board mode
+  bool send_message(const std::string & msg, ControlCommand command);
+  bool send_message(CTBControlClient & client, const std::string & msg, ControlCommand command);
+
+  // the board connects to the receiver port after StartRun
+  boost::asio::ip::tcp::endpoint resolve( const std::string & host, unsigned int port );
+  void open_receiver_acceptor( boost::asio::ip::tcp::acceptor & acceptor, unsigned int port, const ReceiverSocketReader & reader );
+  void configure_boards( const MatchWindow::Config & matching, const ReceiverSocketReader::Profile & profile );
+  bool accept_receiver_connection(std::atomic<bool>& running_flag);
+  std::chrono::milliseconds m_control_timeout;
+  std::chrono::milliseconds m_control_config_timeout;
 
   // Configuration
   dunedaq::ctbmodules::ctbmodule::Conf m_cfg;
@@ -115,53 +152,181 @@ private:
   dunedaq::utilities::WorkerThread m_thread_;
   void do_hsi_work(std::atomic<bool>&);
 
-  template<typename T>
-  bool read(T &obj);
+  // Multi-board mode: do_hsi_work serves all the boards from m_receiver_ios,
+  // each with its own connections and decoding state
+  struct Board {
+    Board( std::size_t i, boost::asio::io_service & control_ios, boost::asio::io_service & receiver_ios )
+      : index( i ), control( control_ios ), acceptor( receiver_ios ), socket( receiver_ios ), reader( socket ) {}
+    const std::size_t index ; // source of m_hlt_merger
+    std::string name ;
+    unsigned short receiver_port = 0 ;
+    CTBControlClient control ;
+    boost::asio::ip::tcp::acceptor acceptor ;
+    boost::asio::ip::tcp::socket socket ;
+    ReceiverSocketReader reader ; // applies the socket profile
+    CTBReceiveBuffer buffer ;
+    CTBStreamDecoder decoder ;
+    // read by get_info
+    std::atomic<bool> connected{ false } ;
+    std::atomic<uint64_t> received_words{ 0 } ;
+    std::atomic<uint64_t> hlts{ 0 } ;
+  };
+  std::vector<std::unique_ptr<Board>> m_boards ;
+  HSIFrameMerger m_hlt_merger ; // HLT frames of all the boards, in timestamp order
+  uint32_t m_merged_hlt_counter = 0 ;
+  bool m_boards_stopping = false ; // by do_multi_board_work: the sockets are closing, no handler starts another operation
+  void do_multi_board_work(std::atomic<bool>&);
+  void accept_board( Board & board );
+  void read_board( Board & board );
+  void record_kernel_latency( const ReceiverSocketReader & reader );
+  void on_board_data( Board & board, const boost::system::error_code & error, std::size_t n_bytes );
+  void release_merged_hlt_frames( bool all = false );
+
+  // Decoding, the handlers are called by m_decoder, or the decoder of a board, for each word
+  struct WordHandler {
+    CTBModule & module ;
+    const std::atomic<bool> * running_flag ; // nullptr: never stop, the whole input is decoded
+    Board * board = nullptr ; // multi-board mode
+    bool stop_requested() const { return running_flag && ( ! running_flag->load() || module.m_stop_requested.load() ) ; }
+    void on_ts_word( const codec::CTBWord & w ) {
+      module.on_ts_word( w ) ;
+      if ( board ) module.m_hlt_merger.advance( board->index, w.timestamp() ) ;
+    }
+    void on_feedback_word( const codec::CTBWord & w ) { module.on_feedback_word( w ) ; }
+    void on_hlt( const codec::CTBWord & w, uint64_t llt_payload ) { module.on_hlt( w, llt_payload, board ) ; }
+    void on_llt( const codec::CTBWord & w, uint64_t channel_payload ) { module.on_llt( w, channel_payload ) ; }
+    void on_channel_status( const codec::CTBWord & w ) {
+      module.m_flight_recorder.record( flight::Event::kChannelStatus, w ) ;
+      module.m_run_summary.on_channel_status( w.ch_beam() ) ;
+      module.m_hlt_rates.on_channel_status( w.ch_beam() ) ;
+      module.m_llt_rates.on_channel_status( w.ch_beam() ) ;
+      module.m_channel_occupancy.count( w ) ;
+      ++module.m_run_channel_status_counter ;
+    }
+  };
+  CTBStreamDecoder m_decoder;
+  bool m_batch_decoding = false;
+  // received: steady_ns() when the packet was read from the socket
+  void decode( const uint8_t* packet, std::size_t n_words, WordHandler & handler, int64_t received ) {
+    const int64_t start = steady_ns() ;
+    if ( m_packet_ring ) m_queue_latency.record( start - received ) ;
+    m_flight_recorder.record( flight::Event::kPacket, codec::CTBWord(), n_words ) ;
+    CTBStreamDecoder & decoder = handler.board ? handler.board->decoder : m_decoder ;
+    // the run summary, the rates and the flight recorder need the words in stream order
+    if ( m_batch_decoding ) decoder.decode_packet( packet, n_words, handler, CTBStreamDecoder::Dispatch::kStreamOrder ) ;
+    else decoder.decode( packet, n_words, handler ) ;
+    if ( handler.board ) release_merged_hlt_frames() ;
+    m_decode_latency.record( steady_ns() - start ) ;
+    flush_expired_hsi_frames() ;
+    check_match_errors() ;
+  }
+  void on_ts_word( const codec::CTBWord & word );
+  void on_feedback_word( const codec::CTBWord & feedback );
+  void on_hlt( const codec::CTBWord & hlt_word, uint64_t llt_payload, Board * board = nullptr );
+  void on_llt( const codec::CTBWord & llt_word, uint64_t channel_payload );
+
+  // HSI frames are sent in batches, by the thread that decodes the words
+  HSIFrameBatcher m_llt_batcher;
+  HSIFrameBatcher m_hlt_batcher;
+  void flush_llt_frames();
+  void flush_hlt_frames();
+  void flush_expired_hsi_frames();
+
+  // Makes sure at least n_bytes are available in m_receive_buffer
+  bool receive(std::size_t n_bytes);
+  CTBReceiveBuffer m_receive_buffer;
+  std::atomic<uint64_t> m_received_word_counter;
+
+  // Pipelined readout: do_hsi_work only drains the socket and hands the packets
+  // to do_decode_work through m_packet_ring, whose slots are reused from run to run
+  struct ReceivedPacket {
+    std::vector<uint8_t> data ;
+    int64_t received = 0 ; // steady_ns()
+  };
+  dunedaq::utilities::WorkerThread m_decode_thread_;
+  void do_decode_work(std::atomic<bool>&);
+  bool push_packet( const uint8_t* packet, std::size_t n_bytes, int64_t received, std::atomic<bool>& running_flag );
+  std::unique_ptr<SPSCRing<ReceivedPacket>> m_packet_ring;
+  std::atomic<uint64_t> m_packet_ring_high_water;
+  std::atomic<uint64_t> m_packet_ring_full_waits;
+  std::atomic<uint64_t> m_decoded_packet_counter;
 
   // members related to calibration stream
 
-  void update_calibration_file();
-  void init_calibration_file();
   bool SetCalibrationStream( const std::string &prefix = "" );
 
   bool m_has_calibration_stream = false; 
   std::string m_calibration_dir = ""; 
   std::string m_calibration_prefix = ""; 
-  std::chrono::minutes m_calibration_file_interval;  
-  std::ofstream m_calibration_file;
-  std::chrono::steady_clock::time_point m_last_calibration_file_update;
+  // the files are opened, rotated and removed by the writer thread
+  std::unique_ptr<CalibrationWriter> m_calibration_writer;
+  uint64_t m_config_hash = 0; // of the board configuration, recorded in the calibration files
+
+  // Flight recorder: the last words and decode decisions, dumped on feedback words,
+  // match errors, socket errors and on the dump_flight_recorder command
+  FlightRecorder m_flight_recorder{ 1 };
+  std::string m_flight_recorder_dir = "";
+  std::atomic<int64_t> m_last_flight_recorder_dump{ 0 }; // steady_clock, ns
+  uint64_t m_flight_recorder_max_dumps = 0; // automatic dumps per run, 0 for no limit
+  std::atomic<uint64_t> m_automatic_dumps{ 0 }; // in this run
+  uint64_t m_reported_unmatched = 0; // by the decoding thread
+  void check_match_errors();
+  void dump_flight_recorder( flight::Reason reason );
+  void write_flight_recorder_dump( flight::Reason reason );
+
+  // during a run the dumps are written by their own thread, away from the readout
+  dunedaq::utilities::WorkerThread m_dump_thread_;
+  void do_dump_work(std::atomic<bool>&);
+  std::mutex m_dump_mutex;
+  std::condition_variable m_dump_cv;
+  std::deque<flight::Reason> m_dump_requests;
+  void do_dump_flight_recorder(const nlohmann::json& /*obj*/) { dump_flight_recorder( flight::Reason::kOnDemand ) ; }
 
   // members related to run trigger report
 
   bool m_has_run_trigger_report = false;
   std::string m_run_trigger_dir = "";
-  bool store_run_trigger_counters( unsigned int run_number, const std::string & prefix = "" ) const;
+  bool store_run_trigger_counters( unsigned int run_number, const std::string & prefix = "" );
+  void store_run_summary( unsigned int run_number, const std::string & prefix = "" );
+  // HLTs without their LLT and LLTs without their channel status word, since the configuration
+  void count_unmatched( uint64_t & hlts, uint64_t & llts ) ;
+  uint64_t m_run_start_unmatched_hlts = 0;
+  uint64_t m_run_start_unmatched_llts = 0;
 
 
   std::atomic<unsigned long> m_run_gool_part_counter = 0;
   std::atomic<unsigned long> m_run_HLT_counter = 0;
-  // TODO should be atomic?
-  unsigned long m_run_HLT_counters[8] = {0};
   std::atomic<unsigned long> m_run_LLT_counter;
   std::atomic<unsigned long> m_run_channel_status_counter = 0;
-  // metric utilities
-
-  const std::array<std::string, 8> m_metric_HLT_names  = { "CTB_HLT_0_rate",
-                                                            "CTB_HLT_1_rate", 
-                                                            "CTB_HLT_2_rate",
-                                                            "CTB_HLT_3_rate",
-                                                            "CTB_HLT_4_rate",
-                                                            "CTB_HLT_5_rate",
-                                                            "CTB_HLT_6_rate",
-                                                            "CTB_HLT_7_rate" };
-
 
   // monitoring
 
-  std::deque<uint> m_buffer_counts; // NOLINT(build/unsigned)
-  std::shared_mutex m_buffer_counts_mutex;
+  // words per packet, filled by do_hsi_work and read by get_info without locking
+  AtomicHistogram m_buffer_counts;
+  std::atomic<int64_t> m_last_packet_time; // steady_clock, ns
   void update_buffer_counts(uint new_count); // NOLINT(build/unsigned)
-  double read_average_buffer_counts();
+
+  // Latency of the trigger path, in ns. Receive is filled by do_hsi_work, the
+  // others by the thread decoding the words
+  static int64_t steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count() ;
+  }
+  AtomicHistogram m_receive_latency; // from the packet header to the whole packet in memory
+  AtomicHistogram m_queue_latency;   // in the ring of the pipelined readout
+  AtomicHistogram m_decode_latency;  // decoding, matching and framing of a packet
+  AtomicHistogram m_send_latency;    // sending of a batch of HSI frames and events
+  AtomicHistogram m_hlt_age;         // from the HLT timestamp to its sending, wall clock
+  AtomicHistogram m_kernel_latency;  // from the kernel receive timestamp to a packet header it came with, wall clock
+  AtomicHistogram m_kernel_queue;    // bytes left in the kernel socket queue at each packet header
+  std::array<AtomicHistogram, s_n_control_commands> m_control_latency; // round trip of the control messages, by ControlCommand
+
+  // from the StartRun message of the last run to its readout connection and first word, ns
+  std::atomic<int64_t> m_run_start_time; // steady_clock
+  std::atomic<int64_t> m_start_to_connection;
+  std::atomic<int64_t> m_start_to_first_word;
+
+  // held by get_info, and by the commands while they replace what it reads
+  std::mutex m_info_mutex;
 
   std::atomic<int> m_num_control_messages_sent;
   std::atomic<int> m_num_control_responses_received;
@@ -0,0 +1,246 @@
+/**
+ * @file ReceiverSocketReader.hpp
+ *
+ * ReceiverSocketReader reads the CTB readout socket, applying the configured
+ * socket options and collecting the kernel receive timestamps. Only the
+ * CTBModule reads sockets, so it is kept out of the ctbmodules library.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_PLUGINS_RECEIVERSOCKETREADER_HPP_
+#define CTBMODULES_PLUGINS_RECEIVERSOCKETREADER_HPP_
+
+#include "CTBModuleIssues.hpp"
+
+#include <boost/asio.hpp>
+
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Read side of the receiver socket
+ *
+ * Models the SyncReadStream used by CTBReceiveBuffer::fill. With rx_timestamps
+ * on, reads go through recvmsg to get the SO_TIMESTAMPING software receive
+ * time of the data, i.e. when the kernel got the newest segment returned.
+ */
+class ReceiverSocketReader
+{
+public:
+  struct Profile
+  {
+    int receive_buffer = 0; ///< SO_RCVBUF in bytes, 0 keeps the kernel default
+    int low_watermark = 0;  ///< SO_RCVLOWAT in bytes, 0 keeps the kernel default
+    bool no_delay = false;  ///< TCP_NODELAY
+    bool quick_ack = false; ///< TCP_QUICKACK, set again after every read as the kernel clears it
+    int busy_poll = 0;      ///< SO_BUSY_POLL in us, 0 is off
+    bool rx_timestamps = false;
+  };
+
+  explicit ReceiverSocketReader(boost::asio::ip::tcp::socket& socket)
+    : m_socket(socket)
+  {}
+
+  ReceiverSocketReader(const ReceiverSocketReader&) = delete;            ///< ReceiverSocketReader is not copy-constructible
+  ReceiverSocketReader& operator=(const ReceiverSocketReader&) = delete; ///< ReceiverSocketReader is not copy-assignable
+  ReceiverSocketReader(ReceiverSocketReader&&) = delete;                 ///< ReceiverSocketReader is not move-constructible
+  ReceiverSocketReader& operator=(ReceiverSocketReader&&) = delete;      ///< ReceiverSocketReader is not move-assignable
+
+  void configure(const Profile& profile) noexcept { m_profile = profile; }
+  const Profile& profile() const noexcept { return m_profile; }
+
+  /// Sets the receive buffer size on a listening socket, inherited by the accepted ones
+  void apply_listen_options(boost::asio::ip::tcp::acceptor& acceptor) const;
+
+  /// Sets the profile on the connected socket; options that fail are reported as warnings
+  void apply_options();
+
+  std::size_t read_some(const boost::asio::mutable_buffer& buffer, boost::system::error_code& error);
+
+  /// Waits at most timeout for data; @return false on timeout, true when a read would not block or fail
+  bool wait_readable(std::chrono::nanoseconds timeout) const noexcept;
+
+  /// Kernel receive time of the data returned by the last read, CLOCK_REALTIME ns, 0 if unknown
+  int64_t last_rx_timestamp() const noexcept { return m_last_rx_timestamp; }
+
+  /// Number of reads that returned data, tells whether some data came with the last read
+  uint64_t n_reads() const noexcept { return m_n_reads; }
+
+  /// Bytes received by the kernel and not read yet (SIOCINQ)
+  std::size_t queued_bytes() const noexcept;
+
+  /// The current time on the clock of last_rx_timestamp()
+  static int64_t realtime_ns() noexcept;
+
+private:
+  static void set_option(int fd, int level, int name, int value, const char* option_name);
+  static void rearm_quick_ack(int fd) noexcept;
+
+  boost::asio::ip::tcp::socket& m_socket;
+  Profile m_profile;
+  int64_t m_last_rx_timestamp = 0;
+  uint64_t m_n_reads = 0;
+};
+
+inline void
+ReceiverSocketReader::set_option(int fd, int level, int name, int value, const char* option_name)
+{
+  if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+    ers::warning(CTBSocketOptionWarning(ERS_HERE, option_name, std::strerror(errno)));
+  }
+}
+
+// the kernel leaves quick ack mode on its own, so it is set again after every read
+inline void
+ReceiverSocketReader::rearm_quick_ack(int fd) noexcept
+{
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+}
+
+inline void
+ReceiverSocketReader::apply_listen_options(boost::asio::ip::tcp::acceptor& acceptor) const
+{
+  // the window scale is negotiated with the SYN, so the buffer size must be set before
+  if (m_profile.receive_buffer > 0) {
+    set_option(acceptor.native_handle(), SOL_SOCKET, SO_RCVBUF, m_profile.receive_buffer, "SO_RCVBUF");
+  }
+}
+
+inline void
+ReceiverSocketReader::apply_options()
+{
+  const int fd = m_socket.native_handle();
+  m_last_rx_timestamp = 0;
+
+  if (m_profile.receive_buffer > 0) {
+    set_option(fd, SOL_SOCKET, SO_RCVBUF, m_profile.receive_buffer, "SO_RCVBUF");
+  }
+  if (m_profile.low_watermark > 0) {
+    set_option(fd, SOL_SOCKET, SO_RCVLOWAT, m_profile.low_watermark, "SO_RCVLOWAT");
+  }
+  if (m_profile.no_delay) {
+    set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  }
+  if (m_profile.quick_ack) {
+    set_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+  }
+  if (m_profile.busy_poll > 0) {
+    set_option(fd, SOL_SOCKET, SO_BUSY_POLL, m_profile.busy_poll, "SO_BUSY_POLL");
+  }
+  if (m_profile.rx_timestamps) {
+    set_option(fd,
+               SOL_SOCKET,
+               SO_TIMESTAMPING,
+               SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE,
+               "SO_TIMESTAMPING");
+  }
+}
+
+inline std::size_t
+ReceiverSocketReader::read_some(const boost::asio::mutable_buffer& buffer, boost::system::error_code& error)
+{
+  if (!m_profile.rx_timestamps) {
+    const std::size_t n_bytes = m_socket.read_some(buffer, error);
+    if (n_bytes > 0) {
+      ++m_n_reads;
+    }
+    if (m_profile.quick_ack) {
+      rearm_quick_ack(m_socket.native_handle());
+    }
+    return n_bytes;
+  }
+
+  iovec iov{ buffer.data(), buffer.size() };
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))];
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  ssize_t n_bytes;
+  do {
+    n_bytes = recvmsg(m_socket.native_handle(), &message, 0);
+  } while (n_bytes < 0 && errno == EINTR);
+
+  if (n_bytes < 0) {
+    error = boost::system::error_code(errno, boost::asio::error::get_system_category());
+    return 0;
+  }
+  if (n_bytes == 0 && buffer.size() > 0) {
+    error = boost::asio::error::eof;
+    return 0;
+  }
+  error = boost::system::error_code();
+  ++m_n_reads;
+
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+      scm_timestamping timestamps;
+      std::memcpy(&timestamps, CMSG_DATA(cmsg), sizeof(timestamps));
+      m_last_rx_timestamp = int64_t(timestamps.ts[0].tv_sec) * 1000000000 + timestamps.ts[0].tv_nsec;
+    }
+  }
+
+  if (m_profile.quick_ack) {
+    rearm_quick_ack(m_socket.native_handle());
+  }
+
+  return n_bytes;
+}
+
+inline bool
+ReceiverSocketReader::wait_readable(std::chrono::nanoseconds timeout) const noexcept
+{
+  pollfd fd{ m_socket.native_handle(), POLLIN, 0 };
+  const timespec ts{ time_t(timeout.count() / 1000000000), long(timeout.count() % 1000000000) };
+  int n_ready;
+  do {
+    n_ready = ppoll(&fd, 1, &ts, nullptr);
+  } while (n_ready < 0 && errno == EINTR);
+  // errors and hang ups are left to the read to report
+  return n_ready != 0;
+}
+
+inline std::size_t
+ReceiverSocketReader::queued_bytes() const noexcept
+{
+  int n_bytes = 0;
+  if (ioctl(m_socket.native_handle(), SIOCINQ, &n_bytes) != 0) {
+    return 0;
+  }
+  return n_bytes;
+}
+
+inline int64_t
+ReceiverSocketReader::realtime_ns() noexcept
+{
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_PLUGINS_RECEIVERSOCKETREADER_HPP_
@@ -0,0 +1,157 @@
+/**
+ * @file AtomicHistogram.hpp
+ *
+ * AtomicHistogram is a fixed-bucket histogram of unsigned values, filled by
+ * one thread and read by another without locks.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_ATOMICHISTOGRAM_HPP_
+#define CTBMODULES_SRC_ATOMICHISTOGRAM_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Single-writer log-linear histogram
+ *
+ * Values below 64 have their own bucket, larger values are resolved to 1/8 of
+ * their power of two. The writer only does relaxed loads and stores, so record()
+ * is wait-free and never contends with the reader. The reader keeps a copy of the
+ * counts it has already reported, so take_summary() describes the values recorded
+ * since its previous call. Percentiles and maximum are the upper edge of the
+ * bucket they fall in, which is exact below 64.
+ */
+class AtomicHistogram
+{
+public:
+  static constexpr std::size_t s_linear_buckets = 64;
+  static constexpr std::size_t s_sub_buckets = 8;
+  static constexpr std::size_t s_n_buckets = s_linear_buckets + (64 - 6) * s_sub_buckets;
+
+  struct Summary
+  {
+    uint64_t count = 0;
+    double mean = 0.;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+  };
+
+  AtomicHistogram() noexcept
+  {
+    for (auto& b : m_buckets) {
+      b.store(0, std::memory_order_relaxed);
+    }
+    m_reported.fill(0);
+  }
+
+  AtomicHistogram(const AtomicHistogram&) = delete;            ///< AtomicHistogram is not copy-constructible
+  AtomicHistogram& operator=(const AtomicHistogram&) = delete; ///< AtomicHistogram is not copy-assignable
+  AtomicHistogram(AtomicHistogram&&) = delete;                 ///< AtomicHistogram is not move-constructible
+  AtomicHistogram& operator=(AtomicHistogram&&) = delete;      ///< AtomicHistogram is not move-assignable
+
+  /// Writer side, must always be called from the same thread
+  void record(uint64_t value) noexcept
+  {
+    auto& bucket = m_buckets[bucket_index(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  /// Reader side: statistics of the values recorded since the previous call
+  Summary take_summary() noexcept
+  {
+    std::array<uint64_t, s_n_buckets> delta;
+    Summary summary;
+    for (std::size_t i = 0; i < s_n_buckets; ++i) {
+      const uint64_t current = m_buckets[i].load(std::memory_order_relaxed);
+      delta[i] = current - m_reported[i];
+      m_reported[i] = current;
+      summary.count += delta[i];
+    }
+
+    const uint64_t sum = m_sum.load(std::memory_order_relaxed);
+    const uint64_t sum_delta = sum - m_reported_sum;
+    m_reported_sum = sum;
+
+    if (summary.count == 0) {
+      return summary;
+    }
+
+    summary.mean = double(sum_delta) / summary.count;
+
+    const uint64_t p50_rank = (summary.count + 1) / 2;
+    const uint64_t p99_rank = summary.count - summary.count / 100;
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < s_n_buckets; ++i) {
+      if (delta[i] == 0) {
+        continue;
+      }
+      if (seen < p50_rank && seen + delta[i] >= p50_rank) {
+        summary.p50 = bucket_upper_edge(i);
+      }
+      if (seen < p99_rank && seen + delta[i] >= p99_rank) {
+        summary.p99 = bucket_upper_edge(i);
+      }
+      seen += delta[i];
+      summary.max = bucket_upper_edge(i);
+    }
+
+    return summary;
+  }
+
+  static constexpr std::size_t bucket_index(uint64_t value) noexcept
+  {
+    if (value < s_linear_buckets) {
+      return value;
+    }
+    const unsigned msb = 63 - __builtin_clzll(value);
+    return s_linear_buckets + (msb - 6) * s_sub_buckets + ((value >> (msb - 3)) & (s_sub_buckets - 1));
+  }
+
+  static constexpr uint64_t bucket_lower_edge(std::size_t index) noexcept
+  {
+    if (index < s_linear_buckets) {
+      return index;
+    }
+    const std::size_t octave = (index - s_linear_buckets) / s_sub_buckets;
+    const std::size_t sub = (index - s_linear_buckets) % s_sub_buckets;
+    return uint64_t(s_sub_buckets + sub) << (octave + 3);
+  }
+
+  static constexpr uint64_t bucket_upper_edge(std::size_t index) noexcept
+  {
+    return index + 1 < s_n_buckets ? bucket_lower_edge(index + 1) - 1 : std::numeric_limits<uint64_t>::max();
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, s_n_buckets> m_buckets;
+  std::atomic<uint64_t> m_sum{ 0 };
+
+  // reader only
+  std::array<uint64_t, s_n_buckets> m_reported;
+  uint64_t m_reported_sum = 0;
+};
+
+static_assert(AtomicHistogram::bucket_index(63) == 63, "linear region");
+static_assert(AtomicHistogram::bucket_index(64) == 64, "first log bucket");
+static_assert(AtomicHistogram::bucket_lower_edge(AtomicHistogram::bucket_index(1000)) <= 1000 &&
+                AtomicHistogram::bucket_upper_edge(AtomicHistogram::bucket_index(1000)) >= 1000,
+              "buckets contain their values");
+static_assert(AtomicHistogram::bucket_index(std::numeric_limits<uint64_t>::max()) == AtomicHistogram::s_n_buckets - 1,
+              "last bucket");
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_ATOMICHISTOGRAM_HPP_
@@ -0,0 +1,250 @@
+/**
+ * @file CTBControlClient.hpp
+ *
+ * CTBControlClient sends the JSON control messages to the CTB and waits for
+ * its JSON replies, with a deadline on every step.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CTBCONTROLCLIENT_HPP_
+#define CTBMODULES_SRC_CTBCONTROLCLIENT_HPP_
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Request/reply client of the CTB control port
+ *
+ * The board does not delimit its messages: a reply ends with its outermost
+ * JSON object, so JSONFramer scans the received bytes for it, across as many
+ * reads as needed, and the reply buffer grows to whatever size it takes.
+ *
+ * Every operation runs asynchronously on the io_service given to the client
+ * and is cancelled when its deadline passes. A request that could not be
+ * written because the connection was broken is sent again once on a new
+ * connection; one whose reply was lost is not, since the board may have acted
+ * on it, but the next request reconnects.
+ *
+ * Not thread safe: the CTBModule commands are serialized.
+ */
+class CTBControlClient
+{
+public:
+  using error_code = boost::system::error_code;
+  using tcp = boost::asio::ip::tcp;
+
+  /// Finds the end of the first JSON document in a byte stream
+  class JSONFramer
+  {
+  public:
+    /// Scans size bytes of data, continuing from the previous call; true when a document ended
+    bool scan(const char* data, std::size_t size) noexcept
+    {
+      for (; m_scanned < size; ++m_scanned) {
+        const char c = data[m_scanned];
+        if (m_in_string) {
+          if (m_escaped) {
+            m_escaped = false;
+          } else if (c == '\\') {
+            m_escaped = true;
+          } else if (c == '"') {
+            m_in_string = false;
+          }
+          continue;
+        }
+        if (c == '"') {
+          m_in_string = true;
+        } else if (c == '{' || c == '[') {
+          ++m_depth;
+        } else if ((c == '}' || c == ']') && m_depth > 0 && --m_depth == 0) {
+          ++m_scanned;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /// Bytes of the document once scan() returned true
+    std::size_t size() const noexcept { return m_scanned; }
+
+  private:
+    std::size_t m_scanned = 0; // bytes already scanned
+    unsigned m_depth = 0;
+    bool m_in_string = false;
+    bool m_escaped = false;
+  };
+
+  explicit CTBControlClient(boost::asio::io_service& ios)
+    : m_ios(ios)
+    , m_socket(ios)
+    , m_timer(ios)
+  {}
+
+  CTBControlClient(const CTBControlClient&) = delete;            ///< CTBControlClient is not copy-constructible
+  CTBControlClient& operator=(const CTBControlClient&) = delete; ///< CTBControlClient is not copy-assignable
+  CTBControlClient(CTBControlClient&&) = delete;                 ///< CTBControlClient is not move-constructible
+  CTBControlClient& operator=(CTBControlClient&&) = delete;      ///< CTBControlClient is not move-assignable
+
+  void set_endpoint(const tcp::endpoint& endpoint)
+  {
+    if (endpoint != m_endpoint) {
+      close();
+    }
+    m_endpoint = endpoint;
+  }
+
+  bool is_connected() const noexcept { return m_socket.is_open(); }
+
+  error_code connect(std::chrono::milliseconds timeout)
+  {
+    close();
+    error_code ec = run_until([this](auto handler) { m_socket.async_connect(m_endpoint, handler); },
+                              std::chrono::steady_clock::now() + timeout);
+    if (ec) {
+      close();
+    } else {
+      ++m_connections;
+    }
+    return ec;
+  }
+
+  void close() noexcept
+  {
+    error_code ignored;
+    m_socket.close(ignored);
+    m_pending.clear();
+  }
+
+  /// Sends request and fills reply with the whole JSON document sent back, within timeout
+  error_code transact(const std::string& request, std::string& reply, std::chrono::milliseconds timeout)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      if (!is_connected()) {
+        error_code ec = connect(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()));
+        if (ec) {
+          return ec;
+        }
+      }
+
+      error_code ec = run_until(
+        [this, &request](auto handler) { boost::asio::async_write(m_socket, boost::asio::buffer(request), handler); },
+        deadline);
+      if (ec == boost::asio::error::timed_out) {
+        close();
+        return ec;
+      }
+      if (ec) {
+        // nothing reached the board: try again on a new connection
+        close();
+        continue;
+      }
+
+      ec = read_reply(reply, deadline);
+      if (ec) {
+        close();
+      }
+      return ec;
+    }
+    return boost::asio::error::not_connected;
+  }
+
+  /// Number of connections made so far, reconnections included
+  uint64_t connections() const noexcept { return m_connections.load(); }
+
+  /// Number of operations cancelled by their deadline so far
+  uint64_t timeouts() const noexcept { return m_timeouts.load(); }
+
+private:
+  error_code read_reply(std::string& reply, std::chrono::steady_clock::time_point deadline)
+  {
+    JSONFramer framer;
+    while (!framer.scan(m_pending.data(), m_pending.size())) {
+      std::size_t n_read = 0;
+      error_code ec = run_until(
+        [this](auto handler) { m_socket.async_read_some(boost::asio::buffer(m_read_buffer), handler); },
+        deadline,
+        &n_read);
+      if (ec) {
+        return ec;
+      }
+      m_pending.append(m_read_buffer.data(), n_read);
+    }
+
+    reply.assign(m_pending, 0, framer.size());
+    m_pending.erase(0, framer.size());
+    return error_code();
+  }
+
+  /// Starts an operation and runs the io_service until it completes or the deadline passes
+  template<typename Start>
+  error_code run_until(Start start, std::chrono::steady_clock::time_point deadline, std::size_t* n_bytes = nullptr)
+  {
+    if (deadline <= std::chrono::steady_clock::now()) {
+      ++m_timeouts;
+      return boost::asio::error::timed_out;
+    }
+
+    bool done = false;
+    bool timed_out = false;
+    error_code result;
+
+    m_timer.expires_at(deadline);
+    m_timer.async_wait([this, &done, &timed_out](const error_code& ec) {
+      if (!ec && !done) {
+        timed_out = true;
+        error_code ignored;
+        m_socket.cancel(ignored);
+      }
+    });
+
+    start([this, &done, &result, n_bytes](const error_code& ec, auto... n) {
+      done = true;
+      result = ec;
+      if (n_bytes) {
+        std::size_t sizes[] = { 0, std::size_t(n)... };
+        *n_bytes = sizes[sizeof...(n)];
+      }
+      m_timer.cancel();
+    });
+
+    m_ios.restart();
+    m_ios.run();
+
+    if (timed_out) {
+      ++m_timeouts;
+      return boost::asio::error::timed_out;
+    }
+    return result;
+  }
+
+  boost::asio::io_service& m_ios;
+  tcp::socket m_socket;
+  boost::asio::steady_timer m_timer;
+  tcp::endpoint m_endpoint;
+
+  std::string m_pending; // received bytes not yet returned as a reply
+  std::array<char, 4096> m_read_buffer;
+
+  // read by get_info
+  std::atomic<uint64_t> m_connections{ 0 };
+  std::atomic<uint64_t> m_timeouts{ 0 };
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CTBCONTROLCLIENT_HPP_
@@ -34,6 +34,26 @@ ERS_DECLARE_ISSUE(ctbmodules,
                   " CTB Word Matching Error: " << descriptor, 
                   ((std::string)descriptor))
 
+ERS_DECLARE_ISSUE(ctbmodules, 
+                  CTBCalibrationStreamError, 
+                  " CTB Calibration Stream Error: " << descriptor, 
+                  ((std::string)descriptor))
+
+ERS_DECLARE_ISSUE(ctbmodules, 
+                  CTBFlightRecorderError, 
+                  " CTB Flight Recorder Error: " << descriptor, 
+                  ((std::string)descriptor))
+
+ERS_DECLARE_ISSUE(ctbmodules, 
+                  CTBSocketOptionWarning, 
+                  " Unable to set " << option << " on the CTB receiver socket: " << error, 
+                  ((std::string)option)((std::string)error))
+
+ERS_DECLARE_ISSUE(ctbmodules, 
+                  CTBRunSummaryError, 
+                  " Unable to write the run summary " << base_name << ".json/.bin", 
+                  ((std::string)base_name))
+
 ERS_DECLARE_ISSUE(ctbmodules,
                   CTBMessage,
                   " Mesage from CTB: " << descriptor,
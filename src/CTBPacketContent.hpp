@@ -12,6 +12,7 @@
 #ifndef CTBMODULES_SRC_CTBPACKETCONTENT_HPP_
 #define CTBMODULES_SRC_CTBPACKETCONTENT_HPP_ 
 
+#include <cstddef>
 #include <cstdint>
 
 namespace dunedaq {
@@ -49,6 +50,8 @@ namespace dunedaq {
     // NFB: Careful with unions. Setting one member and then accessing another
     // is undefined behavior in C++.
     // However, I have tested that they work on gcc on the PTB
+    // The readout decodes the words with the explicit layouts of CTBWordCodec.hpp,
+    // the structs below are kept as the documentation of the format
 
     typedef union tcp_header {
         tcp_header_t word;
@@ -0,0 +1,164 @@
+/**
+ * @file CTBReceiveBuffer.hpp
+ *
+ * CTBReceiveBuffer is the reusable byte buffer the CTBModule reads the
+ * readout socket into. Packets are decoded in place from this buffer.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CTBRECEIVEBUFFER_HPP_
+#define CTBMODULES_SRC_CTBRECEIVEBUFFER_HPP_
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Aligned receive buffer reused across packets
+ *
+ * Every receive call asks the socket for all the free space left in the buffer,
+ * so a single syscall can return several queued packets. The buffer grows to
+ * fit the largest packet requested and is never shrunk, so in steady state
+ * there are no allocations on the receive path.
+ */
+class CTBReceiveBuffer
+{
+public:
+  static constexpr std::size_t alignment = 64;
+
+  explicit CTBReceiveBuffer(std::size_t initial_capacity = 64 * 1024)
+  {
+    grow(initial_capacity);
+  }
+
+  ~CTBReceiveBuffer() { std::free(m_storage); }
+
+  CTBReceiveBuffer(const CTBReceiveBuffer&) = delete;            ///< CTBReceiveBuffer is not copy-constructible
+  CTBReceiveBuffer& operator=(const CTBReceiveBuffer&) = delete; ///< CTBReceiveBuffer is not copy-assignable
+  CTBReceiveBuffer(CTBReceiveBuffer&&) = delete;                 ///< CTBReceiveBuffer is not move-constructible
+  CTBReceiveBuffer& operator=(CTBReceiveBuffer&&) = delete;      ///< CTBReceiveBuffer is not move-assignable
+
+  const uint8_t* data() const noexcept { return m_storage + m_begin; } ///< first unread byte
+  std::size_t size() const noexcept { return m_end - m_begin; }       ///< number of unread bytes
+  std::size_t capacity() const noexcept { return m_capacity; }
+
+  void consume(std::size_t n_bytes) noexcept
+  {
+    m_begin += n_bytes;
+    if (m_begin >= m_end) {
+      m_begin = m_end = 0;
+    }
+  }
+
+  void clear() noexcept { m_begin = m_end = 0; }
+
+  /**
+   * @brief Make sure at least n_bytes unread bytes are in the buffer
+   *
+   * Receives from the stream until enough bytes are available.
+   * @return false if the stream reported an error, which is then stored in error
+   */
+  template<typename SyncReadStream>
+  bool fill(SyncReadStream& stream, std::size_t n_bytes, boost::system::error_code& error)
+  {
+    if (size() >= n_bytes) {
+      return true;
+    }
+
+    make_room(n_bytes);
+
+    while (size() < n_bytes) {
+      commit(stream.read_some(boost::asio::buffer(m_storage + m_end, m_capacity - m_end), error));
+      if (error) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /// For asynchronous reads: the free space, with room for n_bytes unread bytes in total
+  boost::asio::mutable_buffer prepare(std::size_t n_bytes)
+  {
+    make_room(std::max(n_bytes, size() + 1));
+    return boost::asio::buffer(m_storage + m_end, m_capacity - m_end);
+  }
+
+  /// Makes received bytes read into the space given by prepare() unread bytes
+  void commit(std::size_t received) noexcept
+  {
+    m_n_receives.fetch_add(1, std::memory_order_relaxed);
+    m_n_bytes.fetch_add(received, std::memory_order_relaxed);
+    m_end += received;
+  }
+
+  // counters since the last call, for monitoring
+  uint64_t take_receive_count() noexcept { return m_n_receives.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_received_bytes() noexcept { return m_n_bytes.exchange(0, std::memory_order_relaxed); }
+
+private:
+  // Ensures n_bytes contiguous bytes fit from m_begin, compacting and growing as needed
+  void make_room(std::size_t n_bytes)
+  {
+    if (m_begin + n_bytes <= m_capacity) {
+      return;
+    }
+
+    if (n_bytes > m_capacity) {
+      std::size_t new_capacity = m_capacity;
+      while (new_capacity < n_bytes) {
+        new_capacity *= 2;
+      }
+      grow(new_capacity);
+      return;
+    }
+
+    std::memmove(m_storage, m_storage + m_begin, size());
+    m_end -= m_begin;
+    m_begin = 0;
+  }
+
+  void grow(std::size_t new_capacity)
+  {
+    // aligned_alloc requires a multiple of the alignment
+    new_capacity = (new_capacity + alignment - 1) / alignment * alignment;
+    auto* new_storage = static_cast<uint8_t*>(std::aligned_alloc(alignment, new_capacity));
+    if (new_storage == nullptr) {
+      throw std::bad_alloc();
+    }
+
+    if (m_storage != nullptr) {
+      std::memcpy(new_storage, m_storage + m_begin, size());
+      std::free(m_storage);
+    }
+
+    m_end -= m_begin;
+    m_begin = 0;
+    m_storage = new_storage;
+    m_capacity = new_capacity;
+  }
+
+  uint8_t* m_storage = nullptr;
+  std::size_t m_capacity = 0;
+  std::size_t m_begin = 0;
+  std::size_t m_end = 0;
+
+  std::atomic<uint64_t> m_n_receives{ 0 };
+  std::atomic<uint64_t> m_n_bytes{ 0 };
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CTBRECEIVEBUFFER_HPP_
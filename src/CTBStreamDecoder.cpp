@@ -0,0 +1,181 @@
+/**
+ * @file CTBStreamDecoder.cpp CTBStreamDecoder class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBStreamDecoder.hpp"
+#include "CTBModuleIssues.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace dunedaq {
+namespace ctbmodules {
+
+void CTBStreamDecoder::ReportMatchFailure( const uint64_t trigger_ts, const MatchWindow &window, bool hlt_matching) noexcept {
+
+  std::stringstream msg;
+  if ( hlt_matching ) {
+    msg << "No LLT match found for HLT TS " << trigger_ts << " (LLT TS";
+  }
+  else {
+    msg << "No Channel Status match found for LLT TS " << trigger_ts << " (Channel Status TS";
+  }
+  if ( window.size() ) {
+    msg << " newest=" << window.newest().first << " oldest=" << window.oldest().first << ")";
+  }
+  else {
+    msg << " none received)";
+  }
+  ers::error(CTBWordMatchError(ERS_HERE, msg.str()));
+}
+
+CTBStreamDecoder::hsi_frame_t
+CTBStreamDecoder::make_hlt_frame(const codec::CTBWord& hlt, uint64_t llt_payload, uint32_t counter) noexcept
+{
+  hsi_frame_t hsi_struct;
+  hsi_struct[0] = (0x1 << 26) | (0x1 << 6) | 0x1; // DAQHeader, frame version: 1, det id: 1, link for low level 0, link for high level 1, leave slot and crate as 0
+  hsi_struct[1] = hlt.timestamp();     // ts low
+  hsi_struct[2] = hlt.timestamp() >> 32; // ts high
+  hsi_struct[3] = llt_payload;         // lower 32b
+  hsi_struct[4] = 0x0;                 // max 32 llts so these bits will always be 0x0
+  hsi_struct[5] = hlt.trigger_word();  // trigger_map;
+  hsi_struct[6] = counter;             // m_generated_counter;
+  return hsi_struct;
+}
+
+CTBStreamDecoder::hsi_frame_t
+CTBStreamDecoder::make_llt_frame(const codec::CTBWord& llt, uint64_t channel_payload, uint32_t counter) noexcept
+{
+  hsi_frame_t hsi_struct;
+  hsi_struct[0] = (0x1 << 6) | 0x1;     // DAQHeader, frame version: 1, det id: 1, link for low level 0, link for high level 1, leave slot and crate as 0
+  hsi_struct[1] = llt.timestamp();      // ts low
+  hsi_struct[2] = llt.timestamp() >> 32; // ts high
+  hsi_struct[3] = channel_payload;       // channel raw input lower 32b
+  hsi_struct[4] = channel_payload >> 32; // channelraw input upper 32b
+  hsi_struct[5] = llt.trigger_word();   // trigger_map;
+  hsi_struct[6] = counter;              // m_generated_counter;
+  return hsi_struct;
+}
+
+void
+CTBStreamDecoder::reset() noexcept
+{
+  m_prev_timestamp = 0;
+  m_channel_window.clear();
+  m_llt_window.clear();
+}
+
+void
+CTBStreamDecoder::prime(const uint8_t* data, std::size_t n_words) noexcept
+{
+  for (std::size_t i = 0; i < n_words; ++i) {
+    const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+    switch (word.word_type()) {
+      case content::word::t_ts:
+        m_prev_timestamp = word.timestamp();
+        break;
+      case content::word::t_lt:
+        m_llt_window.push({ word.timestamp(), (word.trigger_word() & 0xFFFFFFFF) });
+        break;
+      case content::word::t_ch:
+        m_channel_window.push({ ((m_prev_timestamp & 0xF000000000000000) | word.ch_timestamp()),
+                                ((word.ch_pds() << 48) | (word.ch_crt() << 16) | word.ch_beam()) });
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void
+CTBStreamDecoder::configure_matching(const MatchWindow::Config& config)
+{
+  m_channel_window.configure(config);
+  m_llt_window.configure(config);
+}
+
+namespace {
+
+// bits 61 to 63 of the second lane of a word
+inline void
+classify_scalar_range(const uint8_t* data, std::size_t first, std::size_t last, uint64_t planes[3]) noexcept
+{
+  for (std::size_t i = first; i < last; ++i) {
+    const unsigned type = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes).word_type();
+    for (unsigned b = 0; b < 3; ++b) {
+      planes[b] |= uint64_t((type >> b) & 0x1) << (i % 64);
+    }
+  }
+}
+
+#if defined(__x86_64__)
+// Four words per step: the second lanes are gathered in one register and the type
+// bits are shifted in turn into the sign bits, which movemask collects
+__attribute__((target("avx2"))) void
+classify_avx2(const uint8_t* data, std::size_t n_words, uint64_t* planes) noexcept
+{
+  for (std::size_t first = 0; first < n_words; first += 64, planes += 3) {
+    const std::size_t last = std::min<std::size_t>(first + 64, n_words);
+    planes[0] = planes[1] = planes[2] = 0;
+
+    std::size_t i = first;
+    for (; i + 4 <= last; i += 4) {
+      const uint8_t* w = data + i * codec::CTBWord::size_bytes;
+      const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w));      // words 0 and 1
+      const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + 32)); // words 2 and 3
+      const __m256i hi = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xD8);
+      const unsigned shift = i % 64;
+      planes[2] |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(hi))) << shift;
+      planes[1] |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(hi, 1)))) << shift;
+      planes[0] |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_slli_epi64(hi, 2)))) << shift;
+    }
+    classify_scalar_range(data, i, last, planes);
+  }
+}
+#endif
+
+} // namespace
+
+void
+CTBStreamDecoder::classify_scalar(const uint8_t* data, std::size_t n_words, uint64_t* planes) noexcept
+{
+  for (std::size_t first = 0; first < n_words; first += 64, planes += 3) {
+    planes[0] = planes[1] = planes[2] = 0;
+    classify_scalar_range(data, first, std::min<std::size_t>(first + 64, n_words), planes);
+  }
+}
+
+bool
+CTBStreamDecoder::has_avx2() noexcept
+{
+#if defined(__x86_64__)
+  static const bool s_has_avx2 = __builtin_cpu_supports("avx2");
+  return s_has_avx2;
+#else
+  return false;
+#endif
+}
+
+void
+CTBStreamDecoder::classify(const uint8_t* data, std::size_t n_words, uint64_t* planes) noexcept
+{
+#if defined(__x86_64__)
+  if (has_avx2()) {
+    classify_avx2(data, n_words, planes);
+    return;
+  }
+#endif
+  classify_scalar(data, n_words, planes);
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
@@ -0,0 +1,383 @@
+/**
+ * @file CTBStreamDecoder.hpp
+ *
+ * CTBStreamDecoder interprets the words received from the CTB: it keeps
+ * track of the recent LLT and channel status words, matches every trigger
+ * to the input that caused it and hands the results to a handler.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CTBSTREAMDECODER_HPP_
+#define CTBMODULES_SRC_CTBSTREAMDECODER_HPP_
+
+#include "CTBPacketContent.hpp"
+#include "CTBWordCodec.hpp"
+#include "MatchWindow.hpp"
+
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Decoding and matching state of one CTB word stream
+ *
+ * The decoder does not know about sockets or DAQ modules: it reads words from
+ * any byte buffer and calls, for each word, the matching member of the handler:
+ *   on_ts_word(const codec::CTBWord&)
+ *   on_feedback_word(const codec::CTBWord&)
+ *   on_hlt(const codec::CTBWord&, uint64_t llt_payload)
+ *   on_llt(const codec::CTBWord&, uint64_t channel_payload)
+ *   on_channel_status(const codec::CTBWord&)
+ * and stops early when handler.stop_requested() returns true.
+ *
+ * LLTs are matched to the channel status words and HLTs to the LLTs through a
+ * MatchWindow each; a trigger without a match is reported and gets a 0 payload.
+ *
+ * decode() walks the words one by one. decode_packet() first classifies all the
+ * words of a packet at once and matches all its triggers, then calls the handlers.
+ * With Dispatch::kGrouped each handler runs in its own loop: timestamp, feedback,
+ * channel status, LLT and HLT words, in that order; within a type the words keep
+ * their stream order. With Dispatch::kStreamOrder the handlers are called in the
+ * order of the words, as decode() does, for handlers that depend on it. Either
+ * way the matching gives the same results as decode(); checksum words are
+ * skipped without being read.
+ */
+class CTBStreamDecoder
+{
+public:
+  using hsi_frame_t = std::array<uint32_t, 7>;
+  using input_t = MatchWindow::input_t;
+
+  /// Order of the handler calls of decode_packet()
+  enum class Dispatch
+  {
+    kGrouped,    ///< by word type, causes before effects
+    kStreamOrder ///< as the words were received
+  };
+
+  /// Depth, tolerance and late arrival policy of both match windows, clears them
+  void configure_matching(const MatchWindow::Config& config);
+  MatchWindow& channel_window() noexcept { return m_channel_window; }
+  MatchWindow& llt_window() noexcept { return m_llt_window; }
+  static bool IsTSWord( const codec::CTBWord &w ) noexcept { return w.word_type() == content::word::t_ts; }
+  static bool IsFeedbackWord( const codec::CTBWord &w ) noexcept { return w.word_type() == content::word::t_fback; }
+
+  // HSI frames sent to the llt_output and hlt_output
+  static hsi_frame_t make_hlt_frame(const codec::CTBWord& hlt, uint64_t llt_payload, uint32_t counter) noexcept;
+  static hsi_frame_t make_llt_frame(const codec::CTBWord& llt, uint64_t channel_payload, uint32_t counter) noexcept;
+
+  /// Forget the stream history, to be called at the start of a run
+  void reset() noexcept;
+
+  /**
+   * @brief Takes n_words words as the history of the next ones to decode
+   *
+   * The channel status words and LLTs go to the match windows and the timestamp
+   * words set the timestamp history, but nothing is matched or passed to a
+   * handler. Used to start decoding in the middle of a stream, like a chunk of
+   * a calibration file.
+   */
+  void prime(const uint8_t* data, std::size_t n_words) noexcept;
+
+  /**
+   * @brief Word types of n_words words, as bit planes
+   *
+   * planes must hold 3 * ceil(n_words / 64) values: bit i of planes[3 * g + b] is
+   * bit b of the type of word 64 * g + i. Uses AVX2 when the CPU supports it.
+   */
+  static void classify(const uint8_t* data, std::size_t n_words, uint64_t* planes) noexcept;
+  static void classify_scalar(const uint8_t* data, std::size_t n_words, uint64_t* planes) noexcept;
+  static bool has_avx2() noexcept;
+
+  /// Inlined even when the build does not target a CPU with popcnt
+  static constexpr unsigned popcount(uint64_t x) noexcept
+  {
+#if defined(__POPCNT__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555);
+    x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0F;
+    return (x * 0x0101010101010101) >> 56;
+#endif
+  }
+
+  /// Words of one group of 64 with the given type, from the planes of the group
+  static uint64_t type_mask(const uint64_t* group_planes, unsigned type) noexcept
+  {
+    uint64_t mask = ~uint64_t(0);
+    for (unsigned b = 0; b < 3; ++b) {
+      mask &= ((type >> b) & 0x1) ? group_planes[b] : ~group_planes[b];
+    }
+    return mask;
+  }
+
+  /**
+   * @brief Decodes n_words consecutive words starting at data
+   * @return the number of words decoded, less than n_words if the handler requested to stop
+   */
+  template<typename Handler>
+  std::size_t decode(const uint8_t* data, std::size_t n_words, Handler& handler);
+
+  /**
+   * @brief Decodes the n_words words of a packet, calling the handlers in the dispatch order
+   *
+   * With Dispatch::kStreamOrder the handler is asked to stop between words, as with
+   * decode(); the match windows have then taken the whole packet all the same.
+   *
+   * @return n_words, 0 if the handler requested to stop before the packet, or with
+   * Dispatch::kStreamOrder the position of the first word it was not called for
+   */
+  template<typename Handler>
+  std::size_t decode_packet(const uint8_t* data, std::size_t n_words, Handler& handler, Dispatch dispatch = Dispatch::kGrouped);
+
+private:
+  // Find the word which caused the LLT or HLT and return its payload
+  static uint64_t MatchTriggerInput(const uint64_t trigger_ts, MatchWindow &window, bool hlt_matching) noexcept
+  {
+    uint64_t payload;
+    if ( window.match( trigger_ts, payload ) ) {
+      return payload;
+    }
+    ReportMatchFailure( trigger_ts, window, hlt_matching );
+    return 0;
+  }
+
+  static void ReportMatchFailure(const uint64_t trigger_ts, const MatchWindow &window, bool hlt_matching) noexcept;
+
+  uint64_t m_prev_timestamp = 0;
+  MatchWindow m_channel_window, m_llt_window;
+
+  // decode_packet work space, only grows to avoid allocations
+  static constexpr std::size_t s_n_sorted_types = 5; // timestamp, feedback, channel status, LLT, HLT
+  std::vector<uint64_t> m_planes;
+  std::vector<uint64_t> m_masks;     // per group of 64 words and type: the words of that type
+  std::vector<uint32_t> m_ranks;     // per group of 64 words and type: number of words of that type before the group
+  std::vector<uint32_t> m_positions; // word positions, by type
+  std::vector<uint64_t> m_timestamps;    // the last one before the packet, then those of the TS words
+  std::vector<input_t> m_channel_inputs;
+  std::vector<input_t> m_llt_inputs;
+  std::vector<uint64_t> m_payloads;      // matched payloads of the LLTs then of the HLTs
+};
+
+template<typename Handler>
+std::size_t
+CTBStreamDecoder::decode(const uint8_t* data, std::size_t n_words, Handler& handler)
+{
+  const std::size_t word_size = codec::CTBWord::size_bytes;
+
+  std::size_t i = 0;
+  for ( ; i < n_words ; ++i ) {
+
+    if ( handler.stop_requested() ) {
+      break;
+    }
+
+    const codec::CTBWord word = codec::CTBWord::load( data + i * word_size );
+
+    switch ( word.word_type() ) {
+
+    case content::word::t_ts:
+      m_prev_timestamp = word.timestamp();
+      handler.on_ts_word( word );
+      break;
+
+    case content::word::t_fback:
+      handler.on_feedback_word( word );
+      break;
+
+    case content::word::t_gt: {
+      // Now find the associated LLT
+      uint64_t llt_payload = MatchTriggerInput( word.timestamp(), m_llt_window, true );
+      handler.on_hlt( word, llt_payload );
+      break;
+    }
+
+    case content::word::t_lt: {
+      // Find the matching channel status word
+      uint64_t channel_payload = MatchTriggerInput( word.timestamp(), m_channel_window, false );
+      handler.on_llt( word, channel_payload );
+
+      // store the LLT so we can match to the HLT
+      m_llt_window.push( { word.timestamp(), (word.trigger_word() & 0xFFFFFFFF) } );
+      break;
+    }
+
+    case content::word::t_ch:
+      // The channel status only has 60b TS so complete the upper 4b
+      // from the TS Word. (fyi 60b rolls over >500yr @ 62.5MHz)
+      m_channel_window.push( { ((m_prev_timestamp & 0xF000000000000000) | word.ch_timestamp()),  ((word.ch_pds() << 48) | (word.ch_crt() << 16) | word.ch_beam()) } );
+      handler.on_channel_status( word );
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return i;
+}
+
+template<typename Handler>
+std::size_t
+CTBStreamDecoder::decode_packet(const uint8_t* data, std::size_t n_words, Handler& handler, Dispatch dispatch)
+{
+  if ( n_words == 0 || handler.stop_requested() ) {
+    return 0;
+  }
+
+  const std::size_t word_size = codec::CTBWord::size_bytes;
+  auto word_at = [data, word_size]( uint32_t i ) { return codec::CTBWord::load( data + i * word_size ); };
+
+  const std::size_t n_groups = ( n_words + 63 ) / 64;
+  if ( m_positions.size() < s_n_sorted_types * n_words ) {
+    m_planes.resize( 3 * n_groups );
+    m_masks.resize( s_n_sorted_types * n_groups );
+    m_ranks.resize( s_n_sorted_types * n_groups );
+    m_positions.resize( s_n_sorted_types * n_words );
+    m_timestamps.resize( n_words + 1 );
+    m_channel_inputs.resize( n_words );
+    m_llt_inputs.resize( n_words );
+    m_payloads.resize( n_words );
+  }
+
+  classify( data, n_words, m_planes.data() );
+
+  // positions of the words of each type, in stream order
+  static constexpr unsigned s_sorted_types[s_n_sorted_types] = { content::word::t_ts, content::word::t_fback, content::word::t_ch, content::word::t_lt, content::word::t_gt };
+  enum { kTS = 0, kFeedback, kChannel, kLLT, kHLT };
+  uint32_t* positions[s_n_sorted_types];
+  std::size_t counts[s_n_sorted_types] = {};
+  for ( std::size_t k = 0; k < s_n_sorted_types; ++k ) {
+    positions[k] = m_positions.data() + k * n_words;
+  }
+  for ( std::size_t g = 0; g < n_groups; ++g ) {
+    const std::size_t n = n_words - 64 * g;
+    const uint64_t valid = n >= 64 ? ~uint64_t(0) : ( uint64_t(1) << n ) - 1;
+    for ( std::size_t k = 0; k < s_n_sorted_types; ++k ) {
+      const uint64_t type_words = type_mask( & m_planes[3 * g], s_sorted_types[k] ) & valid;
+      m_masks[s_n_sorted_types * g + k] = type_words;
+      m_ranks[s_n_sorted_types * g + k] = counts[k];
+      uint32_t* out = positions[k];
+      std::size_t count = counts[k];
+      for ( uint64_t mask = type_words; mask; mask &= mask - 1 ) {
+        out[count++] = uint32_t( 64 * g + __builtin_ctzll( mask ) );
+      }
+      counts[k] = count;
+    }
+  }
+
+  // number of words of sorted type k before position p: the matching needs no search
+  auto rank = [this]( std::size_t k, uint32_t p ) -> std::size_t {
+    const std::size_t i = s_n_sorted_types * ( p / 64 ) + k;
+    return m_ranks[i] + popcount( m_masks[i] & ( ( uint64_t(1) << ( p % 64 ) ) - 1 ) );
+  };
+
+  const uint32_t* ts = positions[kTS];
+  const uint32_t* fb = positions[kFeedback];
+  const uint32_t* ch = positions[kChannel];
+  const uint32_t* lt = positions[kLLT];
+  const uint32_t* gt = positions[kHLT];
+  const std::size_t n_ts = counts[kTS], n_fb = counts[kFeedback], n_ch = counts[kChannel], n_lt = counts[kLLT], n_gt = counts[kHLT];
+
+  // The timestamp history starts with the last one of the previous packet
+  uint64_t* timestamps = m_timestamps.data();
+  input_t* channel_inputs = m_channel_inputs.data();
+  input_t* llt_inputs = m_llt_inputs.data();
+  timestamps[0] = m_prev_timestamp;
+
+  for ( std::size_t k = 0; k < n_ts; ++k ) {
+    timestamps[k + 1] = word_at( ts[k] ).timestamp();
+  }
+
+  // Channel status words: the upper 4b of the timestamp come from the last TS word before them
+  for ( std::size_t k = 0; k < n_ch; ++k ) {
+    const codec::CTBWord word = word_at( ch[k] );
+    const uint64_t prev_timestamp = timestamps[rank( kTS, ch[k] )];
+    channel_inputs[k] = { ((prev_timestamp & 0xF000000000000000) | word.ch_timestamp()),  ((word.ch_pds() << 48) | (word.ch_crt() << 16) | word.ch_beam()) };
+  }
+
+  // LLTs match the channel status words before them: each one sees the window
+  // filled up to its position, as in decode()
+  uint64_t* llt_payloads = m_payloads.data();
+  std::size_t pushed = 0;
+  for ( std::size_t k = 0; k < n_lt; ++k ) {
+    const codec::CTBWord word = word_at( lt[k] );
+    for ( const std::size_t r = rank( kChannel, lt[k] ); pushed < r; ++pushed ) {
+      m_channel_window.push( channel_inputs[pushed] );
+    }
+    llt_payloads[k] = MatchTriggerInput( word.timestamp(), m_channel_window, false );
+    llt_inputs[k] = { word.timestamp(), (word.trigger_word() & 0xFFFFFFFF) };
+  }
+  for ( ; pushed < n_ch; ++pushed ) {
+    m_channel_window.push( channel_inputs[pushed] );
+  }
+
+  // HLTs match the LLTs before them
+  uint64_t* hlt_payloads = m_payloads.data() + n_lt;
+  pushed = 0;
+  for ( std::size_t k = 0; k < n_gt; ++k ) {
+    for ( const std::size_t r = rank( kLLT, gt[k] ); pushed < r; ++pushed ) {
+      m_llt_window.push( llt_inputs[pushed] );
+    }
+    hlt_payloads[k] = MatchTriggerInput( word_at( gt[k] ).timestamp(), m_llt_window, true );
+  }
+  for ( ; pushed < n_lt; ++pushed ) {
+    m_llt_window.push( llt_inputs[pushed] );
+  }
+
+  m_prev_timestamp = timestamps[n_ts];
+
+  if ( dispatch == Dispatch::kStreamOrder ) {
+    // Handlers in the order of the words, the payloads taken in order within each trigger level
+    std::size_t i_lt = 0, i_gt = 0;
+    for ( std::size_t g = 0; g < n_groups; ++g ) {
+      const uint64_t* masks = & m_masks[s_n_sorted_types * g];
+      for ( uint64_t mask = masks[kTS] | masks[kFeedback] | masks[kChannel] | masks[kLLT] | masks[kHLT]; mask; mask &= mask - 1 ) {
+        const uint32_t i = uint32_t( 64 * g + __builtin_ctzll( mask ) );
+        if ( handler.stop_requested() ) {
+          return i;
+        }
+        const uint64_t bit = mask & ( ~mask + 1 );
+        const codec::CTBWord word = word_at( i );
+        if ( masks[kTS] & bit ) handler.on_ts_word( word );
+        else if ( masks[kFeedback] & bit ) handler.on_feedback_word( word );
+        else if ( masks[kChannel] & bit ) handler.on_channel_status( word );
+        else if ( masks[kLLT] & bit ) handler.on_llt( word, llt_payloads[i_lt++] );
+        else handler.on_hlt( word, hlt_payloads[i_gt++] );
+      }
+    }
+    return n_words;
+  }
+
+  // Handlers, causes before effects
+  for ( std::size_t k = 0; k < n_ts; ++k ) {
+    handler.on_ts_word( word_at( ts[k] ) );
+  }
+  for ( std::size_t k = 0; k < n_fb; ++k ) {
+    handler.on_feedback_word( word_at( fb[k] ) );
+  }
+  for ( std::size_t k = 0; k < n_ch; ++k ) {
+    handler.on_channel_status( word_at( ch[k] ) );
+  }
+  for ( std::size_t k = 0; k < n_lt; ++k ) {
+    handler.on_llt( word_at( lt[k] ), llt_payloads[k] );
+  }
+  for ( std::size_t k = 0; k < n_gt; ++k ) {
+    handler.on_hlt( word_at( gt[k] ), hlt_payloads[k] );
+  }
+
+  return n_words;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CTBSTREAMDECODER_HPP_
@@ -0,0 +1,218 @@
+/**
+ * @file CTBWordCodec.hpp
+ *
+ * Portable encoding and decoding of the 16 byte CTB words, with explicit
+ * shifts and masks instead of the bitfield structs of CTBPacketContent.hpp.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CTBWORDCODEC_HPP_
+#define CTBMODULES_SRC_CTBWORDCODEC_HPP_
+
+#include "CTBPacketContent.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace codec {
+
+/**
+ * A CTB word is sent as two little endian 64 bit lanes: lane 0 holds the bytes
+ * 0 to 7, lane 1 the bytes 8 to 15. A field is a contiguous group of bits of one
+ * lane; its position is checked at compile time.
+ */
+template<unsigned Lane, unsigned Shift, unsigned Width>
+struct Field
+{
+  static_assert(Lane < 2, "a CTB word has two 64 bit lanes");
+  static_assert(Width > 0 && Shift + Width <= 64, "a field must fit in its lane");
+
+  static constexpr unsigned lane = Lane;
+  static constexpr unsigned shift = Shift;
+  static constexpr unsigned width = Width;
+  static constexpr uint64_t mask = Width == 64 ? ~uint64_t(0) : (uint64_t(1) << Width) - 1;
+  static constexpr uint64_t lane_mask = mask << Shift;
+};
+
+/// true if the fields of Lane do not overlap and cover all its 64 bits
+template<unsigned Lane, typename... Fields>
+constexpr bool
+tiles_lane()
+{
+  uint64_t covered = 0;
+  bool overlap = false;
+  for (auto m : { (Fields::lane == Lane ? Fields::lane_mask : uint64_t(0))... }) {
+    overlap = overlap || (covered & m);
+    covered |= m;
+  }
+  return !overlap && covered == ~uint64_t(0);
+}
+
+template<typename... Fields>
+constexpr bool
+tiles_word()
+{
+  return tiles_lane<0, Fields...>() && tiles_lane<1, Fields...>();
+}
+
+// Layouts of the words, as documented in CTBPacketContent.hpp (lsb first)
+namespace layout {
+
+using word_type = Field<1, 61, 3>;
+
+// word_t, timestamp_t
+using timestamp = Field<0, 0, 64>;
+using payload = Field<1, 0, 61>;
+static_assert(tiles_word<timestamp, payload, word_type>(), "word_t layout");
+
+// trigger_t
+using trigger_word = Field<1, 0, 61>;
+static_assert(tiles_word<timestamp, trigger_word, word_type>(), "trigger_t layout");
+
+// feedback_t
+using feedback_code = Field<1, 0, 16>;
+using feedback_source = Field<1, 16, 16>;
+using feedback_padding = Field<1, 32, 29>;
+static_assert(tiles_word<timestamp, feedback_code, feedback_source, feedback_padding, word_type>(), "feedback_t layout");
+
+// ch_status_t, the timestamp is only 60 bits and the beam bits straddle the lanes
+using ch_timestamp = Field<0, 0, 60>;
+using ch_beam_lo = Field<0, 60, 4>;
+using ch_beam_hi = Field<1, 0, 12>;
+using ch_crt = Field<1, 12, 32>;
+using ch_pds = Field<1, 44, 17>;
+static_assert(tiles_word<ch_timestamp, ch_beam_lo, ch_beam_hi, ch_crt, ch_pds, word_type>(), "ch_status_t layout");
+
+} // namespace layout
+
+/**
+ * @brief Value type holding one CTB word
+ *
+ * load() and store() convert from and to the wire bytes with memcpy, so they
+ * accept any alignment; all the accessors are constexpr shifts and masks.
+ */
+class CTBWord
+{
+public:
+  static constexpr std::size_t size_bytes = 16;
+
+  constexpr CTBWord() noexcept = default;
+  constexpr CTBWord(uint64_t lane0, uint64_t lane1) noexcept
+    : m_lanes{ lane0, lane1 }
+  {}
+
+  static CTBWord load(const uint8_t* bytes) noexcept
+  {
+    CTBWord w;
+    std::memcpy(w.m_lanes, bytes, size_bytes);
+    w.m_lanes[0] = from_little_endian(w.m_lanes[0]);
+    w.m_lanes[1] = from_little_endian(w.m_lanes[1]);
+    return w;
+  }
+
+  void store(uint8_t* bytes) const noexcept
+  {
+    const uint64_t lanes[2] = { from_little_endian(m_lanes[0]), from_little_endian(m_lanes[1]) };
+    std::memcpy(bytes, lanes, size_bytes);
+  }
+
+  constexpr uint64_t lane(unsigned i) const noexcept { return m_lanes[i]; }
+
+  template<typename F>
+  constexpr uint64_t get() const noexcept
+  {
+    return (m_lanes[F::lane] >> F::shift) & F::mask;
+  }
+
+  template<typename F>
+  constexpr CTBWord& set(uint64_t value) noexcept
+  {
+    m_lanes[F::lane] = (m_lanes[F::lane] & ~F::lane_mask) | ((value & F::mask) << F::shift);
+    return *this;
+  }
+
+  // all words
+  constexpr unsigned word_type() const noexcept { return get<layout::word_type>(); }
+  constexpr uint64_t timestamp() const noexcept { return get<layout::timestamp>(); }
+  constexpr uint64_t payload() const noexcept { return get<layout::payload>(); }
+
+  // trigger words
+  constexpr uint64_t trigger_word() const noexcept { return get<layout::trigger_word>(); }
+
+  // feedback words
+  constexpr uint64_t feedback_code() const noexcept { return get<layout::feedback_code>(); }
+  constexpr uint64_t feedback_source() const noexcept { return get<layout::feedback_source>(); }
+  constexpr uint64_t feedback_padding() const noexcept { return get<layout::feedback_padding>(); }
+
+  // channel status words
+  constexpr uint64_t ch_timestamp() const noexcept { return get<layout::ch_timestamp>(); }
+  constexpr uint64_t ch_beam() const noexcept
+  {
+    return get<layout::ch_beam_hi>() << layout::ch_beam_lo::width | get<layout::ch_beam_lo>();
+  }
+  constexpr uint64_t ch_crt() const noexcept { return get<layout::ch_crt>(); }
+  constexpr uint64_t ch_pds() const noexcept { return get<layout::ch_pds>(); }
+
+  // Builders
+  static constexpr CTBWord make_ts(uint64_t timestamp) noexcept
+  {
+    return CTBWord().set<layout::timestamp>(timestamp).set<layout::word_type>(content::word::t_ts);
+  }
+
+  static constexpr CTBWord make_trigger(uint64_t timestamp, uint64_t trigger_word, bool hlt) noexcept
+  {
+    return CTBWord()
+      .set<layout::timestamp>(timestamp)
+      .set<layout::trigger_word>(trigger_word)
+      .set<layout::word_type>(hlt ? content::word::t_gt : content::word::t_lt);
+  }
+
+  static constexpr CTBWord make_channel_status(uint64_t timestamp, uint64_t beam, uint64_t crt, uint64_t pds) noexcept
+  {
+    return CTBWord()
+      .set<layout::ch_timestamp>(timestamp)
+      .set<layout::ch_beam_lo>(beam)
+      .set<layout::ch_beam_hi>(beam >> layout::ch_beam_lo::width)
+      .set<layout::ch_crt>(crt)
+      .set<layout::ch_pds>(pds)
+      .set<layout::word_type>(content::word::t_ch);
+  }
+
+  static constexpr CTBWord make_feedback(uint64_t timestamp, uint64_t code, uint64_t source) noexcept
+  {
+    return CTBWord()
+      .set<layout::timestamp>(timestamp)
+      .set<layout::feedback_code>(code)
+      .set<layout::feedback_source>(source)
+      .set<layout::word_type>(content::word::t_fback);
+  }
+
+private:
+  static uint64_t from_little_endian(uint64_t v) noexcept
+  {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap64(v);
+#else
+    return v;
+#endif
+  }
+
+  uint64_t m_lanes[2] = { 0, 0 };
+};
+
+static_assert(CTBWord::size_bytes == content::word::word_t::size_bytes, "CTB words are 16 bytes");
+static_assert(CTBWord::make_channel_status(0x123, 0xABCD, 0, 0).ch_beam() == 0xABCD, "beam bits straddle the lanes");
+static_assert(CTBWord::make_trigger(7, 0x4, true).word_type() == content::word::t_gt, "round trip");
+
+} // namespace codec
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CTBWORDCODEC_HPP_
@@ -0,0 +1,158 @@
+/**
+ * @file CTBWordGenerator.cpp CTBWordGenerator class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBWordGenerator.hpp"
+#include "CTBWordCodec.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+namespace {
+constexpr uint64_t s_never = std::numeric_limits<uint64_t>::max();
+constexpr uint64_t s_min_interval = 3; // a channel status, LLT, HLT sequence spans 3 ticks
+} // namespace
+
+CTBWordGenerator::CTBWordGenerator(const Config& config)
+  : m_config(config)
+  , m_random(config.seed)
+  , m_timestamp(config.start_timestamp)
+{
+  m_next_ts = m_timestamp + next_interval(m_config.ts_rate);
+  m_next_channel_status = m_timestamp + next_interval(m_config.channel_status_rate);
+  m_next_llt = m_timestamp + next_interval(m_config.llt_rate);
+}
+
+uint64_t
+CTBWordGenerator::next_interval(double rate)
+{
+  if (rate <= 0.) {
+    return s_never - m_timestamp;
+  }
+  std::exponential_distribution<double> interval(rate / s_clock_frequency);
+  return std::max<uint64_t>(s_min_interval, interval(m_random));
+}
+
+uint64_t
+CTBWordGenerator::random_bit(uint64_t mask)
+{
+  if (mask == 0) {
+    return 0;
+  }
+  const int n_bits = __builtin_popcountll(mask);
+  int pick = std::uniform_int_distribution<int>(0, n_bits - 1)(m_random);
+  while (pick-- > 0) {
+    mask &= mask - 1;
+  }
+  return mask & -mask;
+}
+
+void
+CTBWordGenerator::generate_until(uint64_t end_timestamp, std::vector<content::word::word_t>& words)
+{
+  while (std::min({ m_next_ts, m_next_channel_status, m_next_llt }) < end_timestamp) {
+    emit_next(words);
+  }
+}
+
+void
+CTBWordGenerator::generate(std::size_t n_words, std::vector<content::word::word_t>& words)
+{
+  const std::size_t target = words.size() + n_words;
+  while (words.size() < target) {
+    emit_next(words);
+  }
+  words.resize(target);
+}
+
+void
+CTBWordGenerator::emit_next(std::vector<content::word::word_t>& words)
+{
+  const uint64_t next = std::min({ m_next_ts, m_next_channel_status, m_next_llt });
+  if (next == s_never) {
+    return;
+  }
+  m_timestamp = next;
+
+  if (next == m_next_ts) {
+    words.push_back(make_ts_word(next));
+    m_next_ts += next_interval(m_config.ts_rate);
+    return;
+  }
+
+  std::uniform_int_distribution<uint64_t> payload;
+
+  if (next == m_next_channel_status) {
+    words.push_back(make_channel_status_word(next, payload(m_random), payload(m_random), payload(m_random)));
+    m_next_channel_status += next_interval(m_config.channel_status_rate);
+    return;
+  }
+
+  std::uniform_real_distribution<double> uniform;
+  const unsigned burst_size = std::max(m_config.burst_size, 1u);
+
+  for (unsigned b = 0; b < burst_size; ++b) {
+    if (uniform(m_random) >= m_config.match_failure_fraction) {
+      words.push_back(make_channel_status_word(next + b, payload(m_random), payload(m_random), payload(m_random)));
+    }
+  }
+
+  for (unsigned b = 0; b < burst_size; ++b) {
+    const uint64_t llt_ts = next + b + 1;
+    words.push_back(make_trigger_word(llt_ts, random_bit(m_config.llt_mask), false));
+    m_timestamp = std::max(m_timestamp, llt_ts);
+
+    if (m_config.llt_rate > 0. && uniform(m_random) * m_config.llt_rate < m_config.hlt_rate) {
+      // a failed match here is an HLT that does not follow its LLT by one tick
+      const uint64_t hlt_ts = uniform(m_random) >= m_config.match_failure_fraction ? llt_ts + 1 : llt_ts + 2;
+      words.push_back(make_trigger_word(hlt_ts, random_bit(m_config.hlt_mask), true));
+      m_timestamp = std::max(m_timestamp, hlt_ts);
+    }
+  }
+
+  m_next_llt += next_interval(m_config.llt_rate);
+
+  // keep the stream time ordered across the sequence just emitted
+  m_next_llt = std::max(m_next_llt, m_timestamp + 1);
+  m_next_ts = std::max(m_next_ts, m_timestamp + 1);
+  m_next_channel_status = std::max(m_next_channel_status, m_timestamp + 1);
+}
+
+namespace {
+content::word::word_t
+to_word(const codec::CTBWord& encoded) noexcept
+{
+  content::word::word_t word;
+  encoded.store(reinterpret_cast<uint8_t*>(&word));
+  return word;
+}
+} // namespace
+
+content::word::word_t
+CTBWordGenerator::make_ts_word(uint64_t timestamp) noexcept
+{
+  return to_word(codec::CTBWord::make_ts(timestamp));
+}
+
+content::word::word_t
+CTBWordGenerator::make_trigger_word(uint64_t timestamp, uint64_t trigger_word, bool hlt) noexcept
+{
+  return to_word(codec::CTBWord::make_trigger(timestamp, trigger_word, hlt));
+}
+
+content::word::word_t
+CTBWordGenerator::make_channel_status_word(uint64_t timestamp, uint64_t beam, uint64_t crt, uint64_t pds) noexcept
+{
+  return to_word(codec::CTBWord::make_channel_status(timestamp, beam, crt, pds));
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
@@ -0,0 +1,91 @@
+/**
+ * @file CTBWordGenerator.hpp
+ *
+ * CTBWordGenerator produces synthetic CTB word streams, with the same
+ * structure the board emits, for emulation and benchmarking.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CTBWORDGENERATOR_HPP_
+#define CTBMODULES_SRC_CTBWORDGENERATOR_HPP_
+
+#include "CTBPacketContent.hpp"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Synthetic CTB word stream
+ *
+ * Words come from independent Poisson processes running on the 62.5 MHz CTB clock:
+ *  - timestamp words (the heartbeat),
+ *  - standalone channel status words,
+ *  - LLTs, each preceded by the channel status word that caused it one tick earlier,
+ *  - HLTs, each one tick after the LLT that caused it.
+ * This reproduces the ordering and the ts + 1 offsets the readout matches on.
+ * With burst_size > 1, LLTs come in bursts on consecutive ticks and the channel
+ * status words of a burst are all emitted before its LLTs.
+ */
+class CTBWordGenerator
+{
+public:
+  static constexpr double s_clock_frequency = 62.5e6; ///< CTB ticks per second
+
+  struct Config
+  {
+    double ts_rate = 1000.;            ///< Hz
+    double channel_status_rate = 0.;   ///< Hz, on top of the ones emitted with the LLTs
+    double llt_rate = 100.;            ///< Hz
+    double hlt_rate = 10.;             ///< Hz, must not exceed llt_rate
+    uint64_t llt_mask = 0x7FFFFFE;     ///< LLT bits to draw from, LLT_1 to LLT_26
+    uint64_t hlt_mask = 0xFFFFE;       ///< HLT bits to draw from, HLT_1 to HLT_19
+    double match_failure_fraction = 0; ///< fraction of LLTs/HLTs emitted without their cause
+    unsigned burst_size = 1;           ///< LLTs emitted for each occurrence of the LLT process
+    uint64_t start_timestamp = 0;
+    uint32_t seed = 0;
+  };
+
+  explicit CTBWordGenerator(const Config& config);
+
+  /// Appends every word with a timestamp before end_timestamp, in stream order
+  void generate_until(uint64_t end_timestamp, std::vector<content::word::word_t>& words);
+
+  /// Appends n_words words, in stream order
+  void generate(std::size_t n_words, std::vector<content::word::word_t>& words);
+
+  uint64_t timestamp() const noexcept { return m_timestamp; }
+
+  // Builders for single words
+  static content::word::word_t make_ts_word(uint64_t timestamp) noexcept;
+  static content::word::word_t make_trigger_word(uint64_t timestamp, uint64_t trigger_word, bool hlt) noexcept;
+  static content::word::word_t make_channel_status_word(uint64_t timestamp,
+                                                        uint64_t beam,
+                                                        uint64_t crt,
+                                                        uint64_t pds) noexcept;
+
+private:
+  uint64_t next_interval(double rate);
+  uint64_t random_bit(uint64_t mask);
+  void emit_next(std::vector<content::word::word_t>& words);
+
+  Config m_config;
+  std::mt19937_64 m_random;
+  uint64_t m_timestamp;
+
+  // absolute timestamps of the next occurrence of each process
+  uint64_t m_next_ts;
+  uint64_t m_next_channel_status;
+  uint64_t m_next_llt;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CTBWORDGENERATOR_HPP_
@@ -0,0 +1,289 @@
+/**
+ * @file CalibrationCodec.cpp compact calibration stream encoding
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CalibrationCodec.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace calibration {
+
+namespace {
+
+constexpr uint64_t s_payload_mask = codec::layout::payload::mask;
+constexpr uint64_t s_ch_timestamp_mask = codec::layout::ch_timestamp::mask;
+constexpr unsigned s_ch_beam_shift = codec::layout::ch_beam_lo::shift;
+constexpr unsigned s_word_type_shift = codec::layout::word_type::shift;
+
+constexpr uint8_t s_escape_type = 6;
+constexpr uint8_t s_repeated = 0x8;
+
+inline uint64_t
+zigzag(uint64_t delta) noexcept
+{
+  return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+}
+
+inline uint64_t
+unzigzag(uint64_t value) noexcept
+{
+  return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+// longest encoding of a word: the tag and two varints of at most 10 bytes
+constexpr std::size_t s_max_word_bytes = 1 + 10 + 10;
+
+inline uint8_t*
+put_varint(uint8_t* p, uint64_t value) noexcept
+{
+  while (value >= 0x80) {
+    *p++ = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(value);
+  return p;
+}
+
+inline bool
+get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& value) noexcept
+{
+  value = 0;
+  for (unsigned shift = 0; shift < 64 && p < end; shift += 7) {
+    const uint8_t byte = *p++;
+    value |= uint64_t(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Decodes one block into n_words words at out; false if the block is not consistent
+bool
+decode_block(const uint8_t* p, const uint8_t* end, uint32_t n_words, uint8_t* out) noexcept
+{
+  uint8_t* const out_end = out + std::size_t(n_words) * codec::CTBWord::size_bytes;
+
+  uint64_t timestamp = 0;
+  uint64_t payloads[8] = {};
+  uint64_t lane0 = 0, lane1 = 0, delta = 0;
+  bool has_previous = false;
+
+  // the timestamp of the previous word moved by delta, with the rest of the previous word
+  auto next = [&]() noexcept {
+    if (lane1 >> s_word_type_shift == content::word::t_ch) {
+      const uint64_t ch_timestamp = ((timestamp & s_ch_timestamp_mask) + delta) & s_ch_timestamp_mask;
+      timestamp = (timestamp & ~s_ch_timestamp_mask) | ch_timestamp;
+      lane0 = (lane0 & ~s_ch_timestamp_mask) | ch_timestamp;
+    } else {
+      timestamp += delta;
+      lane0 = timestamp;
+    }
+    codec::CTBWord(lane0, lane1).store(out);
+    out += codec::CTBWord::size_bytes;
+  };
+
+  while (p < end) {
+    const uint8_t tag = *p++;
+    const uint8_t type = tag & 0x7;
+
+    if (type == s_escape_type) {
+      if (tag & s_repeated) {
+        // verbatim word
+        if (end - p < 16 || out == out_end) {
+          return false;
+        }
+        std::memcpy(out, p, codec::CTBWord::size_bytes);
+        p += codec::CTBWord::size_bytes;
+        out += codec::CTBWord::size_bytes;
+        has_previous = false;
+        continue;
+      }
+
+      uint64_t run;
+      if (!has_previous || !get_varint(p, end, run) || run > uint64_t(out_end - out) / codec::CTBWord::size_bytes) {
+        return false;
+      }
+      for (; run > 0; --run) {
+        next();
+      }
+      continue;
+    }
+
+    uint64_t value;
+    if (!get_varint(p, end, value)) {
+      return false;
+    }
+    delta = unzigzag(value);
+    if (!(tag & s_repeated) && !get_varint(p, end, payloads[type])) {
+      return false;
+    }
+    if (out == out_end) {
+      return false;
+    }
+
+    lane0 = uint64_t(tag >> 4) << s_ch_beam_shift;
+    lane1 = (payloads[type] & s_payload_mask) | uint64_t(type) << s_word_type_shift;
+    next();
+    has_previous = true;
+  }
+
+  return out == out_end;
+}
+
+} // namespace
+
+BlockEncoder::BlockEncoder(std::size_t max_block_words)
+  : m_max_block_words(std::max<std::size_t>(max_block_words, 1))
+  , m_block(m_max_block_words * 4)
+{}
+
+uint8_t*
+BlockEncoder::reserve(std::size_t n_bytes)
+{
+  if (m_block_size + n_bytes > m_block.size()) {
+    m_block.resize(std::max(2 * m_block.size(), m_block_size + n_bytes));
+  }
+  return m_block.data() + m_block_size;
+}
+
+void
+BlockEncoder::add(const uint8_t* data, std::size_t n_words, std::vector<uint8_t>& out)
+{
+  for (std::size_t i = 0; i < n_words; ++i) {
+    encode(codec::CTBWord::load(data + i * codec::CTBWord::size_bytes));
+    if (++m_header.n_words >= m_max_block_words) {
+      finish(out);
+    }
+  }
+}
+
+void
+BlockEncoder::encode(const codec::CTBWord& word)
+{
+  const uint8_t type = word.word_type();
+
+  if (type == s_escape_type) {
+    // not a word type of the board: kept as is
+    end_run();
+    uint8_t* p = reserve(1 + codec::CTBWord::size_bytes);
+    *p++ = s_escape_type | s_repeated;
+    word.store(p);
+    m_block_size += 1 + codec::CTBWord::size_bytes;
+    m_has_previous = false;
+    return;
+  }
+
+  const uint64_t lane0 = word.lane(0);
+  const uint64_t payload = word.payload();
+  uint64_t delta, timestamp;
+  uint8_t beam = 0;
+  if (type == content::word::t_ch) {
+    const uint64_t ch_timestamp = lane0 & s_ch_timestamp_mask;
+    delta = ch_timestamp - (m_timestamp & s_ch_timestamp_mask);
+    timestamp = (m_timestamp & ~s_ch_timestamp_mask) | ch_timestamp;
+    beam = lane0 >> s_ch_beam_shift;
+  } else {
+    delta = lane0 - m_timestamp;
+    timestamp = lane0;
+    if (m_header.first_timestamp == 0) {
+      m_header.first_timestamp = timestamp;
+    }
+  }
+
+  const bool repeated = payload == m_payloads[type];
+  m_timestamp = timestamp;
+
+  if (m_has_previous && repeated && type == m_previous_type && beam == m_previous_beam && delta == m_previous_delta) {
+    ++m_run;
+    return;
+  }
+
+  end_run();
+  uint8_t* const begin = reserve(s_max_word_bytes);
+  uint8_t* p = begin;
+  *p++ = type | (repeated ? s_repeated : 0) | beam << 4;
+  p = put_varint(p, zigzag(delta));
+  if (!repeated) {
+    p = put_varint(p, payload);
+    m_payloads[type] = payload;
+  }
+  m_block_size += p - begin;
+
+  m_previous_type = type;
+  m_previous_beam = beam;
+  m_previous_delta = delta;
+  m_has_previous = true;
+}
+
+void
+BlockEncoder::end_run()
+{
+  if (m_run > 0) {
+    uint8_t* const begin = reserve(s_max_word_bytes);
+    uint8_t* p = begin;
+    *p++ = s_escape_type;
+    p = put_varint(p, m_run);
+    m_block_size += p - begin;
+    m_run = 0;
+  }
+}
+
+void
+BlockEncoder::finish(std::vector<uint8_t>& out)
+{
+  if (m_header.n_words == 0) {
+    return;
+  }
+
+  end_run();
+  m_header.encoded_size = m_block_size;
+  const auto* header = reinterpret_cast<const uint8_t*>(&m_header);
+  out.insert(out.end(), header, header + sizeof(m_header));
+  out.insert(out.end(), m_block.begin(), m_block.begin() + m_block_size);
+
+  // every block starts from scratch
+  m_header = BlockHeader();
+  m_block_size = 0;
+  m_timestamp = 0;
+  std::fill(std::begin(m_payloads), std::end(m_payloads), 0);
+  m_has_previous = false;
+}
+
+std::size_t
+decode_blocks(const uint8_t* data, std::size_t size, std::vector<uint8_t>& words)
+{
+  std::size_t position = 0;
+
+  while (size - position >= sizeof(BlockHeader)) {
+    BlockHeader header;
+    std::memcpy(&header, data + position, sizeof(header));
+    if (header.magic != s_block_magic || header.encoded_size > size - position - sizeof(header)) {
+      break;
+    }
+
+    const std::size_t first = words.size();
+    words.resize(first + std::size_t(header.n_words) * codec::CTBWord::size_bytes);
+    const uint8_t* begin = data + position + sizeof(header);
+    if (!decode_block(begin, begin + header.encoded_size, header.n_words, words.data() + first)) {
+      words.resize(first);
+      break;
+    }
+
+    position += sizeof(header) + header.encoded_size;
+  }
+
+  return position;
+}
+
+} // namespace calibration
+} // namespace ctbmodules
+} // namespace dunedaq
@@ -0,0 +1,99 @@
+/**
+ * @file CalibrationCodec.hpp
+ *
+ * Compact encoding of the CTB words of the calibration stream, in
+ * independently decodable blocks.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CALIBRATIONCODEC_HPP_
+#define CTBMODULES_SRC_CALIBRATIONCODEC_HPP_
+
+#include "CTBWordCodec.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace calibration {
+
+constexpr uint32_t s_block_magic = 0x4b4c4243; // "CBLK" in little endian
+
+/**
+ * A block is a BlockHeader followed by encoded_size bytes of words. Each word is a
+ * tag byte (bits 0-2 word type, bit 3 payload repeated, bits 4-7 the beam bits of
+ * lane 0 of a channel status word) followed by the zigzag varint of the timestamp
+ * difference with the previous word, and by the varint of the 61 bit payload
+ * unless it is the same as the one of the previous word of that type.
+ * Two tags with the unused word type 6 are escapes: a run of words repeating the
+ * previous one with the same timestamp difference (bit 3 clear, varint count),
+ * and a word copied verbatim (bit 3 set, 16 bytes).
+ * Channel status words only carry 60 timestamp bits, their difference is taken
+ * with the 60 low bits of the previous timestamp.
+ */
+struct BlockHeader
+{
+  uint32_t magic = s_block_magic;
+  uint32_t encoded_size = 0; ///< bytes after the header
+  uint32_t n_words = 0;
+  uint32_t reserved = 0;
+  uint64_t first_timestamp = 0; ///< timestamp of the first word that is not a channel status word, 0 if none
+};
+static_assert(sizeof(BlockHeader) == 24, "BlockHeader must stay 24 bytes");
+
+/**
+ * @brief Streaming encoder: words go in as they are received, whole blocks come out
+ */
+class BlockEncoder
+{
+public:
+  explicit BlockEncoder(std::size_t max_block_words = 4096);
+
+  /// Encodes n_words words into the current block, complete blocks are appended to out
+  void add(const uint8_t* data, std::size_t n_words, std::vector<uint8_t>& out);
+
+  /// Appends the current block to out, if it has any word
+  void finish(std::vector<uint8_t>& out);
+
+  std::size_t block_words() const noexcept { return m_header.n_words; }
+
+private:
+  void encode(const codec::CTBWord& word);
+  void end_run();
+  uint8_t* reserve(std::size_t n_bytes); ///< @return where to write the next n_bytes of the block
+
+  std::size_t m_max_block_words;
+  BlockHeader m_header;
+  std::vector<uint8_t> m_block; // grown, never shrunk
+  std::size_t m_block_size = 0;
+
+  // state of the current block
+  uint64_t m_timestamp = 0;
+  uint64_t m_payloads[8] = {};
+  uint8_t m_previous_type = 0;
+  uint8_t m_previous_beam = 0;
+  uint64_t m_previous_delta = 0;
+  bool m_has_previous = false;
+  uint64_t m_run = 0;
+};
+
+/**
+ * @brief Decodes the blocks in size bytes of data
+ *
+ * Appends the words, 16 bytes each as written by the board, to words. Stops at the
+ * first incomplete or invalid block, like the last block of a file still being
+ * written. @return the number of bytes of data decoded
+ */
+std::size_t
+decode_blocks(const uint8_t* data, std::size_t size, std::vector<uint8_t>& words);
+
+} // namespace calibration
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CALIBRATIONCODEC_HPP_
@@ -0,0 +1,92 @@
+/**
+ * @file CalibrationFileFormat.hpp
+ *
+ * On-disk layout of the CTB calibration stream files.
+ *
+ * A file is made of a FileHeader, the CTB words as received from the board,
+ * the sparse timestamp index and a FileTrailer pointing back to the index.
+ * Depending on the encoding of the header, the words are stored verbatim or in
+ * the compact blocks of CalibrationCodec.hpp, in which case the index entries
+ * point at the beginning of blocks.
+ * While a file is being written its index entries are also appended to a
+ * sidecar file (same name + ".idx"), so files that were never finalized can
+ * still be seeked. The sidecar is removed once the file is finalized.
+ *
+ * Files written before the header was introduced contain only words; readers
+ * recognise them by the missing magic number.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CALIBRATIONFILEFORMAT_HPP_
+#define CTBMODULES_SRC_CALIBRATIONFILEFORMAT_HPP_
+
+#include <cstdint>
+#include <string>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace calibration {
+
+constexpr uint64_t s_file_magic = 0x42494c4143425443;    // "CTBCALIB" in little endian
+constexpr uint64_t s_trailer_magic = 0x5844494c41434243; // "CBCALIDX" in little endian
+constexpr uint16_t s_container_version = 1;
+constexpr const char* s_index_sidecar_suffix = ".idx";
+
+enum class Encoding : uint8_t
+{
+  kRawWords = 0,     ///< word_t as received from the board
+  kCompactBlocks = 1 ///< delta encoded blocks, see CalibrationCodec.hpp
+};
+
+struct FileHeader
+{
+  uint64_t magic = s_file_magic;
+  uint16_t container_version = s_container_version;
+  uint8_t packet_format_version = 0; ///< tcp_header_t::format_version of the stream
+  uint8_t encoding = static_cast<uint8_t>(Encoding::kRawWords);
+  uint32_t run_number = 0;
+  uint64_t config_hash = 0;    ///< config_hash() of the board configuration
+  uint64_t creation_time = 0;  ///< seconds since the epoch
+  uint64_t index_stride = 0;   ///< bytes of data between two index entries
+  uint8_t reserved[24] = {};
+};
+static_assert(sizeof(FileHeader) == 64, "FileHeader must stay 64 bytes");
+
+struct IndexEntry
+{
+  uint64_t timestamp; ///< CTB timestamp of the word at offset
+  uint64_t offset;    ///< from the beginning of the file
+};
+static_assert(sizeof(IndexEntry) == 16, "IndexEntry must stay 16 bytes");
+
+struct FileTrailer
+{
+  uint64_t index_offset = 0; ///< from the beginning of the file, also the end of the data
+  uint64_t n_index_entries = 0;
+  uint64_t n_words = 0;
+  uint64_t first_timestamp = 0;
+  uint64_t last_timestamp = 0;
+  uint64_t magic = s_trailer_magic;
+};
+static_assert(sizeof(FileTrailer) == 48, "FileTrailer must stay 48 bytes");
+
+/// FNV-1a hash, stable across builds and platforms unlike std::hash
+inline uint64_t
+config_hash(const std::string& config) noexcept
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : config) {
+    hash ^= c;
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+} // namespace calibration
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CALIBRATIONFILEFORMAT_HPP_
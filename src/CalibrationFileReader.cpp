@@ -0,0 +1,182 @@
+/**
+ * @file CalibrationFileReader.cpp CalibrationFileReader class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CalibrationFileReader.hpp"
+#include "CalibrationCodec.hpp"
+#include "CTBModuleIssues.hpp"
+#include "CTBPacketContent.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+CalibrationFileReader::CalibrationFileReader(const std::string& file_name)
+  : m_file_name(file_name)
+{
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw CTBCalibrationStreamError(ERS_HERE, "Unable to open " + file_name + ": " + std::strerror(errno));
+  }
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) != 0) {
+    ::close(fd);
+    throw CTBCalibrationStreamError(ERS_HERE, "Unable to stat " + file_name + ": " + std::strerror(errno));
+  }
+  m_map_size = file_stat.st_size;
+
+  if (m_map_size > 0) {
+    void* map = ::mmap(nullptr, m_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      ::close(fd);
+      throw CTBCalibrationStreamError(ERS_HERE, "Unable to map " + file_name + ": " + std::strerror(errno));
+    }
+    m_map = static_cast<const uint8_t*>(map);
+    ::madvise(map, m_map_size, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+
+  m_data_end = m_map_size;
+
+  if (m_map_size >= sizeof(calibration::FileHeader)) {
+    std::memcpy(&m_header, m_map, sizeof(m_header));
+    m_has_header = m_header.magic == calibration::s_file_magic;
+  }
+
+  if (!m_has_header) {
+    // legacy file: words only
+    m_header = calibration::FileHeader();
+    return;
+  }
+
+  m_data_begin = sizeof(calibration::FileHeader);
+
+  if (m_map_size >= m_data_begin + sizeof(calibration::FileTrailer)) {
+    std::memcpy(&m_trailer, m_map + m_map_size - sizeof(m_trailer), sizeof(m_trailer));
+    const std::size_t index_bytes = m_trailer.n_index_entries * sizeof(calibration::IndexEntry);
+    m_is_finalized = m_trailer.magic == calibration::s_trailer_magic && m_trailer.index_offset >= m_data_begin &&
+                     m_trailer.index_offset + index_bytes + sizeof(m_trailer) == m_map_size;
+  }
+
+  if (m_is_finalized) {
+    m_data_end = m_trailer.index_offset;
+    m_index.resize(m_trailer.n_index_entries);
+    std::memcpy(m_index.data(), m_map + m_trailer.index_offset, m_index.size() * sizeof(calibration::IndexEntry));
+  } else {
+    // still being written, or never closed; decode() stops at an incomplete block by itself
+    m_trailer = calibration::FileTrailer();
+    if (encoding() == calibration::Encoding::kRawWords) {
+      m_data_end = m_data_begin + (m_map_size - m_data_begin) / content::word::word_t::size_bytes *
+                                    content::word::word_t::size_bytes;
+    }
+    read_sidecar_index();
+  }
+}
+
+CalibrationFileReader::~CalibrationFileReader()
+{
+  if (m_map != nullptr) {
+    ::munmap(const_cast<uint8_t*>(m_map), m_map_size);
+  }
+}
+
+void
+CalibrationFileReader::read_sidecar_index()
+{
+  std::ifstream sidecar(m_file_name + calibration::s_index_sidecar_suffix, std::ios::binary);
+  calibration::IndexEntry entry;
+  while (sidecar.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+    // the sidecar can point past what made it to the data file
+    if (entry.offset >= m_data_end) {
+      break;
+    }
+    m_index.push_back(entry);
+  }
+}
+
+std::size_t
+CalibrationFileReader::seek(uint64_t timestamp) const noexcept
+{
+  // last entry at or before timestamp
+  auto it = std::upper_bound(m_index.begin(), m_index.end(), timestamp, [](uint64_t ts, const calibration::IndexEntry& e) {
+    return ts < e.timestamp;
+  });
+
+  if (it == m_index.begin()) {
+    return 0;
+  }
+  return std::prev(it)->offset - m_data_begin;
+}
+
+std::size_t
+CalibrationFileReader::decode(std::size_t offset, std::size_t n_bytes, std::vector<uint8_t>& words) const
+{
+  if (offset >= size()) {
+    return 0;
+  }
+  n_bytes = std::min(n_bytes, size() - offset);
+
+  if (encoding() == calibration::Encoding::kCompactBlocks) {
+    return calibration::decode_blocks(data() + offset, n_bytes, words);
+  }
+
+  n_bytes -= n_bytes % content::word::word_t::size_bytes;
+  words.insert(words.end(), data() + offset, data() + offset + n_bytes);
+  return n_bytes;
+}
+
+std::vector<std::size_t>
+CalibrationFileReader::split(std::size_t stride) const
+{
+  std::vector<std::size_t> offsets(1, 0);
+
+  if (encoding() == calibration::Encoding::kCompactBlocks) {
+    // only the block headers are read
+    std::size_t offset = 0;
+    calibration::BlockHeader block;
+    while (offset + sizeof(block) <= size()) {
+      std::memcpy(&block, data() + offset, sizeof(block));
+      if (block.magic != calibration::s_block_magic || block.encoded_size > size() - offset - sizeof(block)) {
+        break;
+      }
+      offset += sizeof(block) + block.encoded_size;
+      if (offset - offsets.back() >= stride) {
+        offsets.push_back(offset);
+      }
+    }
+    if (offset != offsets.back()) {
+      offsets.push_back(offset);
+    }
+    return offsets;
+  }
+
+  const std::size_t word_size = content::word::word_t::size_bytes;
+  const std::size_t end = size() - size() % word_size;
+  stride = std::max(stride - stride % word_size, word_size);
+  for (std::size_t offset = stride; offset < end; offset += stride) {
+    offsets.push_back(offset);
+  }
+  if (end != offsets.back()) {
+    offsets.push_back(end);
+  }
+  return offsets;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
@@ -0,0 +1,110 @@
+/**
+ * @file CalibrationFileReader.hpp
+ *
+ * CalibrationFileReader gives memory mapped, random access to a CTB
+ * calibration stream file.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CALIBRATIONFILEREADER_HPP_
+#define CTBMODULES_SRC_CALIBRATIONFILEREADER_HPP_
+
+#include "CalibrationFileFormat.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Read access to a calibration file
+ *
+ * The whole file is mapped in memory. The timestamp index is taken from the
+ * file itself when it was finalized, from the sidecar index otherwise, so seeking
+ * by time is a binary search followed by a scan of at most one index stride.
+ * Files without a header (written before the format was versioned) are read as
+ * plain words, without an index. With the compact encoding, data() holds the
+ * encoded blocks and the words are obtained with decode().
+ */
+class CalibrationFileReader
+{
+public:
+  /// Throws CTBCalibrationStreamError if the file cannot be mapped
+  explicit CalibrationFileReader(const std::string& file_name);
+  ~CalibrationFileReader();
+
+  CalibrationFileReader(const CalibrationFileReader&) = delete;            ///< not copy-constructible
+  CalibrationFileReader& operator=(const CalibrationFileReader&) = delete; ///< not copy-assignable
+  CalibrationFileReader(CalibrationFileReader&&) = delete;                 ///< not move-constructible
+  CalibrationFileReader& operator=(CalibrationFileReader&&) = delete;      ///< not move-assignable
+
+  const std::string& file_name() const noexcept { return m_file_name; }
+
+  bool has_header() const noexcept { return m_has_header; }
+  bool is_finalized() const noexcept { return m_is_finalized; }
+  const calibration::FileHeader& header() const noexcept { return m_header; }
+  calibration::Encoding encoding() const noexcept { return static_cast<calibration::Encoding>(m_header.encoding); }
+
+  /// The stored words, or blocks with the compact encoding
+  const uint8_t* data() const noexcept { return m_map + m_data_begin; }
+  std::size_t size() const noexcept { return m_data_end - m_data_begin; }
+
+  const std::vector<calibration::IndexEntry>& index() const noexcept { return m_index; }
+
+  /// Offset in data() of an entry of index()
+  std::size_t offset_of(const calibration::IndexEntry& entry) const noexcept { return entry.offset - m_data_begin; }
+
+  /**
+   * @brief Where to start reading to find the words at or after timestamp
+   * @return offset in data(), the first word of the data if the index is empty
+   */
+  std::size_t seek(uint64_t timestamp) const noexcept;
+
+  /**
+   * @brief Appends to words the words stored in data() from offset on, up to n_bytes of data
+   *
+   * Only whole words, or whole blocks, are read: offset must be one of a word or
+   * of a block, like the ones returned by seek(). @return the bytes of data read,
+   * 0 when n_bytes does not hold a whole block
+   */
+  std::size_t decode(std::size_t offset, std::size_t n_bytes, std::vector<uint8_t>& words) const;
+
+  /**
+   * @brief Offsets in data() where decode() can start, about stride bytes apart
+   *
+   * Whole words, or whole blocks with the compact encoding, so that the data
+   * between two offsets can be decoded independently. The first offset is 0 and
+   * the last one size(), or the end of the last complete block.
+   */
+  std::vector<std::size_t> split(std::size_t stride) const;
+
+  /// First and last full timestamps of the file, 0 if unknown (file not finalized)
+  uint64_t first_timestamp() const noexcept { return m_trailer.first_timestamp; }
+  uint64_t last_timestamp() const noexcept { return m_trailer.last_timestamp; }
+
+private:
+  void read_sidecar_index();
+
+  std::string m_file_name;
+  const uint8_t* m_map = nullptr;
+  std::size_t m_map_size = 0;
+
+  bool m_has_header = false;
+  bool m_is_finalized = false;
+  calibration::FileHeader m_header;
+  calibration::FileTrailer m_trailer;
+  std::size_t m_data_begin = 0;
+  std::size_t m_data_end = 0;
+
+  std::vector<calibration::IndexEntry> m_index;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CALIBRATIONFILEREADER_HPP_
@@ -0,0 +1,352 @@
+/**
+ * @file CalibrationQuery.cpp CalibrationQuery class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CalibrationQuery.hpp"
+#include "CTBModuleIssues.hpp"
+#include "CTBPacketContent.hpp"
+#include "CalibrationCodec.hpp"
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <queue>
+#include <utility>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+namespace {
+
+constexpr uint64_t s_timestamp_high_bits = 0xF000000000000000; // not in the channel status words
+
+/// The words of reader.data() from begin to end, decoded into buffer with the compact encoding
+std::pair<const uint8_t*, std::size_t>
+words_of(const CalibrationFileReader& reader, std::size_t begin, std::size_t end, std::vector<uint8_t>& buffer)
+{
+  if (reader.encoding() != calibration::Encoding::kCompactBlocks) {
+    return { reader.data() + begin, (end - begin) / codec::CTBWord::size_bytes };
+  }
+  buffer.clear();
+  reader.decode(begin, end - begin, buffer);
+  return { buffer.data(), buffer.size() / codec::CTBWord::size_bytes };
+}
+
+/// Timestamp of a word, channel status words are completed with the last full timestamp
+uint64_t
+timestamp_of(const codec::CTBWord& word, uint64_t& last_timestamp) noexcept
+{
+  if (word.word_type() == content::word::t_ch) {
+    return (last_timestamp & s_timestamp_high_bits) | word.ch_timestamp();
+  }
+  if (word.word_type() == content::word::t_ts) {
+    last_timestamp = word.timestamp();
+  }
+  return word.timestamp();
+}
+
+/**
+ * The oldest timestamp of the data from offset on, given the timestamp of its first
+ * word that is not a channel status word: the channel status words before that
+ * one can be older.
+ */
+uint64_t
+oldest_timestamp(const CalibrationFileReader& reader, std::size_t offset, std::size_t end, uint64_t timestamp)
+{
+  std::vector<uint8_t> buffer;
+  uint64_t oldest = timestamp;
+  while (offset < end) {
+    // a block, or as many raw words, at a time
+    std::size_t n_bytes = std::min(end - offset, std::size_t(4096) * codec::CTBWord::size_bytes);
+    if (reader.encoding() == calibration::Encoding::kCompactBlocks) {
+      calibration::BlockHeader header;
+      if (end - offset < sizeof(header)) {
+        break;
+      }
+      std::memcpy(&header, reader.data() + offset, sizeof(header));
+      n_bytes = std::min(end - offset, sizeof(header) + header.encoded_size);
+    }
+    const auto [data, n_words] = words_of(reader, offset, offset + n_bytes, buffer);
+    if (n_words == 0) {
+      break;
+    }
+    for (std::size_t i = 0; i < n_words; ++i) {
+      const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+      if (word.word_type() != content::word::t_ch) {
+        return oldest;
+      }
+      oldest = std::min(oldest, (timestamp & s_timestamp_high_bits) | word.ch_timestamp());
+    }
+    offset += n_bytes;
+  }
+  return oldest;
+}
+
+/// First and last timestamps of a file that was not finalized, from its index and the data after it
+std::pair<uint64_t, uint64_t>
+scan_time_range(const CalibrationFileReader& reader)
+{
+  const auto& index = reader.index();
+  const std::vector<std::size_t> units = reader.split(1 << 20);
+  std::vector<uint8_t> buffer;
+
+  uint64_t first = index.empty() ? 0 : index.front().timestamp;
+  for (std::size_t u = 0; first == 0 && u + 1 < units.size(); ++u) {
+    const auto [data, n_words] = words_of(reader, units[u], units[u + 1], buffer);
+    for (std::size_t i = 0; i < n_words; ++i) {
+      const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+      if (word.word_type() != content::word::t_ch) {
+        first = word.timestamp();
+        break;
+      }
+    }
+  }
+
+  uint64_t last = index.empty() ? first : index.back().timestamp;
+  const std::size_t tail = index.empty() ? 0 : reader.offset_of(index.back());
+  const auto [data, n_words] = words_of(reader, tail, reader.size(), buffer);
+  for (std::size_t i = 0; i < n_words; ++i) {
+    const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+    if (word.word_type() != content::word::t_ch) {
+      last = std::max(last, word.timestamp());
+    }
+  }
+  return { first, last };
+}
+
+} // namespace
+
+bool
+calibration::Query::accepts(const codec::CTBWord& word, uint64_t timestamp) const noexcept
+{
+  if (timestamp < begin || timestamp > end || !((word_types >> word.word_type()) & 0x1)) {
+    return false;
+  }
+  if (word.word_type() == content::word::t_gt) {
+    return hlt_bits == 0 || (word.trigger_word() & hlt_bits);
+  }
+  if (word.word_type() == content::word::t_lt) {
+    return llt_bits == 0 || (word.trigger_word() & llt_bits);
+  }
+  return true;
+}
+
+std::vector<std::string>
+CalibrationQuery::list_files(const std::string& directory, const std::string& prefix)
+{
+  std::vector<std::string> file_names;
+  std::error_code error;
+  for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+    const std::string name = entry.path().filename().string();
+    // the hidden files are the ones the writer prepares
+    if (entry.is_regular_file() && entry.path().extension() == ".calib" && name.front() != '.' &&
+        name.compare(0, prefix.size(), prefix) == 0) {
+      file_names.push_back(entry.path().string());
+    }
+  }
+  if (error) {
+    throw CTBCalibrationStreamError(ERS_HERE, "Unable to list " + directory + ": " + error.message());
+  }
+  std::sort(file_names.begin(), file_names.end());
+  return file_names;
+}
+
+CalibrationQuery::CalibrationQuery(const std::vector<std::string>& file_names)
+{
+  for (const auto& file_name : file_names) {
+    File file;
+    try {
+      file.reader = std::make_unique<CalibrationFileReader>(file_name);
+    } catch (const CTBCalibrationStreamError& e) {
+      ers::warning(e);
+      continue;
+    }
+
+    if (file.reader->is_finalized()) {
+      file.first_timestamp = file.reader->first_timestamp();
+      file.last_timestamp = file.reader->last_timestamp();
+    } else {
+      std::tie(file.first_timestamp, file.last_timestamp) = scan_time_range(*file.reader);
+    }
+    file.first_timestamp = oldest_timestamp(*file.reader, 0, file.reader->size(), file.first_timestamp);
+    m_files.push_back(std::move(file));
+  }
+}
+
+CalibrationQuery::~CalibrationQuery() = default;
+
+std::vector<CalibrationQuery::Task>
+CalibrationQuery::plan(const calibration::Query& query, Stats& stats) const
+{
+  std::vector<Task> tasks;
+  for (std::size_t f = 0; f < m_files.size(); ++f) {
+    const File& file = m_files[f];
+    if (file.last_timestamp < query.begin || file.first_timestamp > query.end || file.reader->size() == 0) {
+      ++stats.files_skipped;
+      continue;
+    }
+    ++stats.files_scanned;
+
+    // from the last index entry at or before the beginning to the first one after the end
+    const auto& index = file.reader->index();
+    auto by_timestamp = [](uint64_t ts, const calibration::IndexEntry& e) { return ts < e.timestamp; };
+    // a task starts at the oldest timestamp of its data, which can be the one of a channel status word
+    auto oldest = [&file](const calibration::IndexEntry& e) {
+      return oldest_timestamp(*file.reader, file.reader->offset_of(e), file.reader->size(), e.timestamp);
+    };
+    auto first = std::upper_bound(index.begin(), index.end(), query.begin, by_timestamp);
+    auto last = std::upper_bound(first, index.end(), query.end, by_timestamp);
+    while (last != index.end() && oldest(*last) <= query.end) {
+      ++last;
+    }
+
+    Task task{ f, 0, 0, file.first_timestamp };
+    if (first != index.begin()) {
+      --first;
+      task.begin = file.reader->offset_of(*first);
+      task.timestamp = oldest(*first);
+      ++first;
+    }
+    const std::size_t end = last == index.end() ? file.reader->size() : file.reader->offset_of(*last);
+
+    for (auto it = first; it != last; ++it) {
+      const std::size_t offset = file.reader->offset_of(*it);
+      if (offset - task.begin >= s_task_bytes) {
+        task.end = offset;
+        tasks.push_back(task);
+        task.begin = offset;
+        task.timestamp = oldest(*it);
+      }
+    }
+    if (end > task.begin) {
+      task.end = end;
+      tasks.push_back(task);
+    }
+  }
+
+  // the merge relies on the tasks starting in timestamp order
+  std::stable_sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) { return a.timestamp < b.timestamp; });
+  for (const auto& task : tasks) {
+    stats.bytes_scanned += task.end - task.begin;
+  }
+  stats.tasks = tasks.size();
+  return tasks;
+}
+
+void
+CalibrationQuery::scan(const calibration::Query& query, const Task& task, std::vector<calibration::Match>& matches) const
+{
+  std::vector<uint8_t> buffer;
+  const auto [data, n_words] = words_of(*m_files[task.file].reader, task.begin, task.end, buffer);
+
+  uint64_t last_timestamp = task.timestamp;
+  for (std::size_t i = 0; i < n_words; ++i) {
+    const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+    const uint64_t timestamp = timestamp_of(word, last_timestamp);
+    if (query.accepts(word, timestamp)) {
+      matches.push_back({ timestamp, word, task.file });
+    }
+  }
+}
+
+CalibrationQuery::Stats
+CalibrationQuery::run(const calibration::Query& query,
+                      std::size_t n_threads,
+                      const std::function<bool(const calibration::Match&)>& callback) const
+{
+  Stats stats;
+  const std::vector<Task> tasks = plan(query, stats);
+
+  std::vector<std::vector<calibration::Match>> results(tasks.size());
+  std::vector<bool> done(tasks.size(), false);
+  std::size_t next = 0; // first task not merged yet
+  std::atomic<bool> cancelled{ false };
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  WorkStealingPool pool(n_threads);
+  const std::size_t ahead = s_tasks_ahead * pool.n_threads();
+  pool.start(tasks.size(), [&](std::size_t t) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return t < next + ahead || cancelled.load(); });
+    }
+    std::vector<calibration::Match> matches;
+    if (!cancelled.load()) {
+      scan(query, tasks[t], matches);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      results[t] = std::move(matches);
+      done[t] = true;
+    }
+    cv.notify_all();
+  });
+
+  auto cancel = [&] {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      cancelled.store(true);
+    }
+    cv.notify_all();
+    pool.wait();
+  };
+
+  // matches waiting for the tasks that could start before them, by timestamp then in file order
+  struct Pending
+  {
+    uint64_t sequence;
+    calibration::Match match;
+    bool operator>(const Pending& other) const noexcept
+    {
+      return match.timestamp != other.match.timestamp ? match.timestamp > other.match.timestamp
+                                                      : sequence > other.sequence;
+    }
+  };
+  std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+  uint64_t sequence = 0;
+
+  try {
+    for (std::size_t t = 0; t < tasks.size(); ++t) {
+      std::vector<calibration::Match> matches;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return done[t]; });
+        matches = std::move(results[t]);
+        next = t + 1;
+      }
+      cv.notify_all();
+
+      for (auto& match : matches) {
+        pending.push({ sequence++, match });
+      }
+      const uint64_t watermark = t + 1 < tasks.size() ? tasks[t + 1].timestamp : ~uint64_t(0);
+      while (!pending.empty() && (pending.top().match.timestamp < watermark || t + 1 == tasks.size())) {
+        ++stats.matches;
+        if (!callback(pending.top().match)) {
+          cancel();
+          return stats;
+        }
+        pending.pop();
+      }
+    }
+  } catch (...) {
+    cancel();
+    throw;
+  }
+
+  pool.wait();
+  return stats;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
@@ -0,0 +1,132 @@
+/**
+ * @file CalibrationQuery.hpp
+ *
+ * CalibrationQuery finds the words of a time range in a set of CTB calibration
+ * stream files, scanning them in parallel.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CALIBRATIONQUERY_HPP_
+#define CTBMODULES_SRC_CALIBRATIONQUERY_HPP_
+
+#include "CTBWordCodec.hpp"
+#include "CalibrationFileReader.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace calibration {
+
+/// Words of [begin, end] in CTB time with one of word_types, trigger words with one of their bits
+struct Query
+{
+  uint64_t begin = 0;
+  uint64_t end = ~uint64_t(0);
+  uint8_t word_types = 0xFF; ///< bit t for the words of type t
+  uint64_t hlt_bits = 0;     ///< HLTs with any of these bits, 0 for all
+  uint64_t llt_bits = 0;     ///< LLTs with any of these bits, 0 for all
+
+  bool accepts(const codec::CTBWord& word, uint64_t timestamp) const noexcept;
+};
+
+struct Match
+{
+  uint64_t timestamp; ///< full timestamp, completed from the timestamp words for channel status words
+  codec::CTBWord word;
+  std::size_t file; ///< see CalibrationQuery::file_name()
+};
+
+} // namespace calibration
+
+/**
+ * @brief Time range queries over calibration files
+ *
+ * The files are mapped when the query object is made, and their time range is
+ * taken from their trailer; a file that was not finalized is scanned from its
+ * last index entry on. A query skips the files out of its range, and the index
+ * of the others gives the part of the data to scan.
+ *
+ * That data is cut at index entries into tasks of a few MB, scanned by a
+ * WorkStealingPool. The matches of the tasks are merged by timestamp on the
+ * calling thread: a match is given to the callback once no task still to come
+ * can start before it, so the results stream out in timestamp order while the
+ * scan goes on. A task starts at its oldest word, which can be one of the channel
+ * status words ahead of the timestamp of its index entry.
+ */
+class CalibrationQuery
+{
+public:
+  struct Stats
+  {
+    std::size_t files_scanned = 0;
+    std::size_t files_skipped = 0; ///< out of the time range
+    std::size_t tasks = 0;
+    uint64_t bytes_scanned = 0;
+    uint64_t matches = 0;
+  };
+
+  /// The calibration files of directory whose name starts with prefix, sorted, without the hidden ones
+  static std::vector<std::string> list_files(const std::string& directory, const std::string& prefix = "");
+
+  /// Files that cannot be read are reported as CTBCalibrationStreamError warnings and left out
+  explicit CalibrationQuery(const std::vector<std::string>& file_names);
+  ~CalibrationQuery();
+
+  CalibrationQuery(const CalibrationQuery&) = delete;            ///< CalibrationQuery is not copy-constructible
+  CalibrationQuery& operator=(const CalibrationQuery&) = delete; ///< CalibrationQuery is not copy-assignable
+  CalibrationQuery(CalibrationQuery&&) = delete;                 ///< CalibrationQuery is not move-constructible
+  CalibrationQuery& operator=(CalibrationQuery&&) = delete;      ///< CalibrationQuery is not move-assignable
+
+  std::size_t n_files() const noexcept { return m_files.size(); }
+  const std::string& file_name(std::size_t file) const noexcept { return m_files[file].reader->file_name(); }
+  uint64_t first_timestamp(std::size_t file) const noexcept { return m_files[file].first_timestamp; }
+  uint64_t last_timestamp(std::size_t file) const noexcept { return m_files[file].last_timestamp; }
+
+  /**
+   * @brief Calls callback for each word of the query, in timestamp order
+   *
+   * The callback runs on the calling thread and stops the query by returning false.
+   */
+  Stats run(const calibration::Query& query,
+            std::size_t n_threads,
+            const std::function<bool(const calibration::Match&)>& callback) const;
+
+private:
+  struct File
+  {
+    std::unique_ptr<CalibrationFileReader> reader;
+    uint64_t first_timestamp = 0;
+    uint64_t last_timestamp = 0;
+  };
+
+  /// Data of a file from begin to end, with no word older than timestamp
+  struct Task
+  {
+    std::size_t file;
+    std::size_t begin;
+    std::size_t end;
+    uint64_t timestamp;
+  };
+
+  static constexpr std::size_t s_task_bytes = 4 << 20;
+  static constexpr std::size_t s_tasks_ahead = 4; ///< tasks per thread scanned ahead of the callback
+
+  std::vector<Task> plan(const calibration::Query& query, Stats& stats) const;
+  void scan(const calibration::Query& query, const Task& task, std::vector<calibration::Match>& matches) const;
+
+  std::vector<File> m_files;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CALIBRATIONQUERY_HPP_
@@ -0,0 +1,535 @@
+/**
+ * @file CalibrationWriter.cpp CalibrationWriter class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CalibrationWriter.hpp"
+#include "CTBModuleIssues.hpp"
+#include "CTBPacketContent.hpp"
+#include "CTBWordCodec.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+
+/**
+ * @brief Name used by TRACE TLOG calls from this source file
+ */
+#define TRACE_NAME "CalibrationWriter" // NOLINT
+
+namespace dunedaq {
+namespace ctbmodules {
+
+CalibrationWriter::SyncPolicy
+CalibrationWriter::parse_sync_policy(const std::string& policy)
+{
+  if (policy == "never")
+    return SyncPolicy::kNever;
+  if (policy == "always")
+    return SyncPolicy::kAlways;
+  if (policy == "interval")
+    return SyncPolicy::kInterval;
+
+  throw CTBCalibrationStreamError(ERS_HERE, "Unknown fsync policy: " + policy);
+}
+
+calibration::Encoding
+CalibrationWriter::parse_encoding(const std::string& encoding)
+{
+  if (encoding == "raw")
+    return calibration::Encoding::kRawWords;
+  if (encoding == "compact")
+    return calibration::Encoding::kCompactBlocks;
+
+  throw CTBCalibrationStreamError(ERS_HERE, "Unknown calibration stream encoding: " + encoding);
+}
+
+CalibrationWriter::CalibrationWriter(std::size_t queue_size,
+                                     SyncPolicy sync_policy,
+                                     std::chrono::milliseconds sync_interval,
+                                     std::size_t index_stride,
+                                     calibration::Encoding encoding)
+  : m_queue(queue_size)
+  , m_sync_policy(sync_policy)
+  , m_sync_interval(sync_interval)
+  , m_index_stride(index_stride)
+  , m_encoding(encoding)
+  , m_thread(std::bind(&CalibrationWriter::do_work, this, std::placeholders::_1))
+{
+  m_write_buffer.reserve(s_max_write_bytes);
+  m_header.index_stride = m_index_stride;
+  m_header.encoding = static_cast<uint8_t>(m_encoding);
+}
+
+CalibrationWriter::~CalibrationWriter()
+{
+  stop();
+}
+
+void
+CalibrationWriter::set_run_info(uint32_t run_number, uint64_t config_hash)
+{
+  m_header.run_number = run_number;
+  m_header.config_hash = config_hash;
+}
+
+void
+CalibrationWriter::set_output(const std::string& directory, const std::string& prefix)
+{
+  m_directory = directory;
+  m_prefix = prefix;
+}
+
+void
+CalibrationWriter::start()
+{
+  if (!m_thread.thread_running()) {
+    m_thread.start_working_thread("ctb-calib");
+  }
+}
+
+void
+CalibrationWriter::stop()
+{
+  if (m_thread.thread_running()) {
+    m_thread.stop_working_thread();
+  }
+}
+
+bool
+CalibrationWriter::write(const uint8_t* data, std::size_t n_bytes, uint8_t format_version)
+{
+  Item* item = m_queue.write_slot();
+  if (item == nullptr) {
+    m_dropped_packets.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  item->format_version = format_version;
+  item->bytes.assign(data, data + n_bytes);
+  m_queue.commit_write();
+  return true;
+}
+
+void
+CalibrationWriter::do_work(std::atomic<bool>& running_flag)
+{
+  m_open_failed = false;
+
+  while (running_flag.load()) {
+    if (!drain()) {
+      // a block is only readable once complete, so it does not stay open while the stream is quiet
+      if (m_encoder.block_words() > 0 && std::chrono::steady_clock::now() - m_block_start > s_max_block_age) {
+        finish_block();
+      }
+      flush();
+      // the next file is ready before it is needed
+      if (m_fd >= 0 && m_next_fd < 0) {
+        prepare_next_file();
+      }
+      std::this_thread::sleep_for(s_idle_wait);
+    }
+  }
+
+  // the producer is stopped by now: write out what is left
+  while (drain()) {
+  }
+  close_file();
+  discard_next_file();
+}
+
+bool
+CalibrationWriter::drain()
+{
+  bool dequeued = false;
+
+  while (Item* item = m_queue.read_slot()) {
+    dequeued = true;
+
+    if ((m_fd < 0 && !m_open_failed) || rotation_due()) {
+      rotate();
+    }
+    append(*item);
+
+    m_queue.commit_read();
+  }
+
+  return dequeued;
+}
+
+bool
+CalibrationWriter::rotation_due() const noexcept
+{
+  if (m_fd < 0) {
+    return false;
+  }
+  if (m_rotation.max_file_bytes > 0 && m_file_offset >= m_rotation.max_file_bytes) {
+    return true;
+  }
+
+  // the time of the data rather than the clock: no clock reading per packet
+  return m_rotation.interval_ticks > 0 && m_trailer.first_timestamp != 0 &&
+         m_trailer.last_timestamp - m_trailer.first_timestamp >= m_rotation.interval_ticks;
+}
+
+void
+CalibrationWriter::rotate()
+{
+  close_file();
+
+  const std::string file_name = next_file_name();
+  if (m_next_fd >= 0) {
+    const std::string next_name = m_directory + "." + m_prefix + "next.calib";
+    if (::rename(next_name.c_str(), file_name.c_str()) == 0) {
+      ::rename((next_name + calibration::s_index_sidecar_suffix).c_str(),
+               (file_name + calibration::s_index_sidecar_suffix).c_str());
+      m_fd = m_next_fd;
+      m_index_fd = m_next_index_fd;
+      m_next_fd = m_next_index_fd = -1;
+    } else {
+      ers::warning(CTBCalibrationStreamError(ERS_HERE, "Unable to rename " + next_name + ": " + std::strerror(errno)));
+      discard_next_file();
+    }
+  }
+  if (m_fd < 0 && !open_files(file_name, m_fd, m_index_fd)) {
+    m_open_failed = true;
+    return;
+  }
+
+  m_file_name = file_name;
+  m_header.creation_time = std::time(nullptr);
+  m_header_written = false;
+  m_file_offset = 0;
+  m_index.clear();
+  m_trailer = calibration::FileTrailer();
+  m_last_sync = std::chrono::steady_clock::now();
+  m_files.push_back(WrittenFile{ file_name, 0 });
+  m_files_opened.fetch_add(1, std::memory_order_relaxed);
+  TLOG_DEBUG(0) << "New Calibration Stream file: " << file_name;
+
+  apply_retention();
+}
+
+bool
+CalibrationWriter::open_files(const std::string& file_name, int& fd, int& index_fd) const
+{
+  fd = ::open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    ers::error(CTBCalibrationStreamError(ERS_HERE, "Unable to open " + file_name + ": " + std::strerror(errno)));
+    return false;
+  }
+
+  const std::string index_name = file_name + calibration::s_index_sidecar_suffix;
+  index_fd = ::open(index_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (index_fd < 0) {
+    ers::warning(CTBCalibrationStreamError(ERS_HERE, "Unable to open " + index_name + ": " + std::strerror(errno)));
+  }
+  return true;
+}
+
+void
+CalibrationWriter::prepare_next_file()
+{
+  // hidden, so that it is not taken for a calibration file
+  open_files(m_directory + "." + m_prefix + "next.calib", m_next_fd, m_next_index_fd);
+}
+
+void
+CalibrationWriter::discard_next_file()
+{
+  if (m_next_fd < 0) {
+    return;
+  }
+
+  const std::string next_name = m_directory + "." + m_prefix + "next.calib";
+  ::close(m_next_fd);
+  ::unlink(next_name.c_str());
+  if (m_next_index_fd >= 0) {
+    ::close(m_next_index_fd);
+    ::unlink((next_name + calibration::s_index_sidecar_suffix).c_str());
+  }
+  m_next_fd = m_next_index_fd = -1;
+}
+
+std::string
+CalibrationWriter::next_file_name()
+{
+  char date[64] = "";
+  const time_t now = std::time(nullptr);
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+  strftime(date, sizeof(date), "%F_%H.%M.%S", &timeinfo);
+
+  // size based rotation can open several files within a second; the numbers keep
+  // growing even when retention removed the earlier files, so names stay in order
+  const std::string base = m_directory + m_prefix + date;
+  m_name_sequence = base == m_last_name_base ? m_name_sequence + 1 : 0;
+  m_last_name_base = base;
+
+  auto numbered = [&base](unsigned n) { return n == 0 ? base + ".calib" : base + "_" + std::to_string(n) + ".calib"; };
+  std::string file_name = numbered(m_name_sequence);
+  while (::access(file_name.c_str(), F_OK) == 0) {
+    file_name = numbered(++m_name_sequence);
+  }
+  return file_name;
+}
+
+void
+CalibrationWriter::apply_retention()
+{
+  // the current file is never removed
+  while (m_files.size() > 1 && ((m_rotation.max_files > 0 && m_files.size() > m_rotation.max_files) ||
+                                (m_rotation.max_total_bytes > 0 && m_total_bytes > m_rotation.max_total_bytes))) {
+    const WrittenFile& oldest = m_files.front();
+    if (::unlink(oldest.name.c_str()) == 0) {
+      m_files_removed.fetch_add(1, std::memory_order_relaxed);
+      TLOG_DEBUG(0) << "Removed Calibration Stream file: " << oldest.name;
+    } else if (errno != ENOENT) {
+      ers::warning(CTBCalibrationStreamError(ERS_HERE, "Unable to remove " + oldest.name + ": " + std::strerror(errno)));
+    }
+    m_total_bytes -= oldest.size;
+    m_files.pop_front();
+  }
+}
+
+void
+CalibrationWriter::close_file()
+{
+  if (m_fd < 0) {
+    m_write_buffer.clear();
+    return;
+  }
+
+  // finalize: the index and the trailer go after the data
+  if (!m_header_written) {
+    append(Item());
+  }
+  finish_block();
+  m_trailer.index_offset = m_file_offset;
+  m_trailer.n_index_entries = m_index.size();
+
+  flush();
+  const auto* index = reinterpret_cast<const uint8_t*>(m_index.data());
+  m_write_buffer.assign(index, index + m_index.size() * sizeof(calibration::IndexEntry));
+  const auto* trailer = reinterpret_cast<const uint8_t*>(&m_trailer);
+  m_write_buffer.insert(m_write_buffer.end(), trailer, trailer + sizeof(m_trailer));
+  flush();
+
+  if (m_sync_policy != SyncPolicy::kNever) {
+    ::fsync(m_fd);
+  }
+  ::close(m_fd);
+  m_fd = -1;
+
+  const uint64_t file_size = m_trailer.index_offset + m_index.size() * sizeof(calibration::IndexEntry) + sizeof(m_trailer);
+  if (!m_files.empty() && m_files.back().name == m_file_name) {
+    m_files.back().size = file_size;
+    m_total_bytes += file_size;
+  }
+
+  // the file now carries its own index
+  if (m_index_fd >= 0) {
+    ::close(m_index_fd);
+    m_index_fd = -1;
+    ::unlink((m_file_name + calibration::s_index_sidecar_suffix).c_str());
+  }
+}
+
+void
+CalibrationWriter::append(const Item& item)
+{
+  if (m_fd < 0) {
+    // data received before any file was opened has nowhere to go
+    return;
+  }
+
+  if (!m_header_written) {
+    m_header.packet_format_version = item.format_version;
+    const auto* header = reinterpret_cast<const uint8_t*>(&m_header);
+    m_write_buffer.insert(m_write_buffer.end(), header, header + sizeof(m_header));
+    m_file_offset += sizeof(m_header);
+    m_header_written = true;
+  }
+
+  if (m_write_buffer.size() + item.bytes.size() > s_max_write_bytes) {
+    flush();
+  }
+
+  m_bytes_received.fetch_add(item.bytes.size(), std::memory_order_relaxed);
+  update_index(item.bytes.data(), item.bytes.size());
+
+  if (m_encoding == calibration::Encoding::kCompactBlocks) {
+    if (m_encoder.block_words() == 0) {
+      m_block_start = std::chrono::steady_clock::now();
+    }
+    m_encoder.add(item.bytes.data(), item.bytes.size() / content::word::word_t::size_bytes, m_encoded);
+    append_blocks();
+    return;
+  }
+
+  m_write_buffer.insert(m_write_buffer.end(), item.bytes.begin(), item.bytes.end());
+  m_file_offset += item.bytes.size();
+}
+
+void
+CalibrationWriter::finish_block()
+{
+  if (m_fd < 0) {
+    return;
+  }
+
+  m_encoder.finish(m_encoded);
+  append_blocks();
+}
+
+void
+CalibrationWriter::append_blocks()
+{
+  if (m_encoded.empty()) {
+    return;
+  }
+
+  if (m_write_buffer.size() + m_encoded.size() > s_max_write_bytes) {
+    flush();
+  }
+
+  // index the beginning of the blocks, blocks are decoded as a whole
+  std::size_t position = 0;
+  while (position < m_encoded.size()) {
+    calibration::BlockHeader header;
+    std::memcpy(&header, m_encoded.data() + position, sizeof(header));
+    if (header.first_timestamp != 0 && (m_index.empty() || header.first_timestamp >= m_index.back().timestamp)) {
+      add_index_entry(header.first_timestamp, m_file_offset + position);
+    }
+    position += sizeof(header) + header.encoded_size;
+  }
+
+  m_write_buffer.insert(m_write_buffer.end(), m_encoded.begin(), m_encoded.end());
+  m_file_offset += m_encoded.size();
+  m_encoded.clear();
+
+  if (m_encoder.block_words() > 0) {
+    m_block_start = std::chrono::steady_clock::now();
+  }
+}
+
+void
+CalibrationWriter::update_index(const uint8_t* data, std::size_t n_bytes)
+{
+  const std::size_t word_size = content::word::word_t::size_bytes;
+  const std::size_t n_words = n_bytes / word_size;
+
+  for (std::size_t i = 0; i < n_words; ++i) {
+    const codec::CTBWord word = codec::CTBWord::load(data + i * word_size);
+
+    // channel status words only carry 60 bits of the timestamp
+    if (word.word_type() == content::word::t_ch) {
+      continue;
+    }
+
+    const uint64_t timestamp = word.timestamp();
+    if (m_trailer.first_timestamp == 0) {
+      m_trailer.first_timestamp = timestamp;
+    }
+    if (timestamp < m_trailer.last_timestamp) {
+      continue;
+    }
+    m_trailer.last_timestamp = timestamp;
+
+    // compact files are indexed by block
+    if (m_encoding == calibration::Encoding::kRawWords) {
+      add_index_entry(timestamp, m_file_offset + i * word_size);
+    }
+  }
+
+  m_trailer.n_words += n_words;
+}
+
+void
+CalibrationWriter::add_index_entry(uint64_t timestamp, uint64_t offset)
+{
+  if (!m_index.empty() && offset - m_index.back().offset < m_index_stride) {
+    return;
+  }
+
+  calibration::IndexEntry entry{ timestamp, offset };
+  m_index.push_back(entry);
+  if (m_index_fd >= 0 && ::write(m_index_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+    ers::warning(CTBCalibrationStreamError(ERS_HERE, "Unable to extend the index of " + m_file_name));
+  }
+}
+
+void
+CalibrationWriter::flush()
+{
+  if (m_write_buffer.empty()) {
+    return;
+  }
+
+  if (m_fd < 0) {
+    // data received before any file was opened has nowhere to go
+    m_write_buffer.clear();
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  const uint8_t* data = m_write_buffer.data();
+  std::size_t remaining = m_write_buffer.size();
+  while (remaining > 0) {
+    ssize_t written = ::write(m_fd, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ers::error(CTBCalibrationStreamError(ERS_HERE, std::string("Write failure: ") + std::strerror(errno)));
+      break;
+    }
+    data += written;
+    remaining -= written;
+  }
+
+  m_bytes_written.fetch_add(m_write_buffer.size() - remaining, std::memory_order_relaxed);
+  m_write_buffer.clear();
+
+  sync();
+
+  uint64_t elapsed =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  m_num_writes.fetch_add(1, std::memory_order_relaxed);
+  m_write_time_ns.fetch_add(elapsed, std::memory_order_relaxed);
+  if (elapsed > m_max_write_time_ns.load(std::memory_order_relaxed)) {
+    m_max_write_time_ns.store(elapsed, std::memory_order_relaxed);
+  }
+}
+
+void
+CalibrationWriter::sync()
+{
+  if (m_sync_policy == SyncPolicy::kNever) {
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (m_sync_policy == SyncPolicy::kInterval && now - m_last_sync < m_sync_interval) {
+    return;
+  }
+
+  ::fsync(m_fd);
+  m_last_sync = now;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
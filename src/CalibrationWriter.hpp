@@ -0,0 +1,212 @@
+/**
+ * @file CalibrationWriter.hpp
+ *
+ * CalibrationWriter writes the CTB calibration stream to disk on its own
+ * thread, so that file I/O never stalls the socket receiving the data.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CALIBRATIONWRITER_HPP_
+#define CTBMODULES_SRC_CALIBRATIONWRITER_HPP_
+
+#include "CalibrationCodec.hpp"
+#include "CalibrationFileFormat.hpp"
+#include "SPSCRing.hpp"
+
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Batched writer for the calibration stream
+ *
+ * The receiver thread hands whole packets over through a bounded lock-free queue.
+ * The writer thread coalesces them into large sequential writes and calls fsync
+ * according to the configured policy. When the queue is full, packets are dropped
+ * and counted rather than blocking the receiver.
+ *
+ * Files follow the layout in CalibrationFileFormat.hpp: the timestamp index grows
+ * with the file and is appended to it when the file is closed. With the compact
+ * encoding, the words are encoded on the writer thread; a block is written out
+ * when it is full, or when the stream has been idle for s_max_block_age.
+ *
+ * The writer thread also names, rotates and removes the files, so the receiver
+ * only ever queues data. Files are rotated at packet boundaries, once their data
+ * spans the rotation interval in CTB time or they reach the maximum size. The next
+ * file is opened in advance under a hidden temporary name while the stream is
+ * idle, and renamed when it takes over. Retention only removes files this writer
+ * created, oldest first.
+ */
+class CalibrationWriter
+{
+public:
+  enum class SyncPolicy
+  {
+    kNever,   ///< leave it to the kernel
+    kAlways,  ///< after every write
+    kInterval ///< at most once per sync interval
+  };
+
+  /// Converts "never", "always" or "interval"; throws CTBCalibrationStreamError otherwise
+  static SyncPolicy parse_sync_policy(const std::string& policy);
+
+  /// Converts "raw" or "compact"; throws CTBCalibrationStreamError otherwise
+  static calibration::Encoding parse_encoding(const std::string& encoding);
+
+  struct Rotation
+  {
+    uint64_t interval_ticks = 0;  ///< CTB clock ticks of data per file, 0 for no time based rotation
+    uint64_t max_file_bytes = 0;  ///< 0 for no size based rotation
+    std::size_t max_files = 0;    ///< files kept, the current one included; 0 keeps them all
+    uint64_t max_total_bytes = 0; ///< bytes kept over the closed files; 0 keeps them all
+  };
+
+  CalibrationWriter(std::size_t queue_size,
+                    SyncPolicy sync_policy,
+                    std::chrono::milliseconds sync_interval,
+                    std::size_t index_stride,
+                    calibration::Encoding encoding = calibration::Encoding::kRawWords);
+  ~CalibrationWriter();
+
+  CalibrationWriter(const CalibrationWriter&) = delete;            ///< CalibrationWriter is not copy-constructible
+  CalibrationWriter& operator=(const CalibrationWriter&) = delete; ///< CalibrationWriter is not copy-assignable
+  CalibrationWriter(CalibrationWriter&&) = delete;                 ///< CalibrationWriter is not move-constructible
+  CalibrationWriter& operator=(CalibrationWriter&&) = delete;      ///< CalibrationWriter is not move-assignable
+
+  /// Call while the writer is stopped
+  void configure_rotation(const Rotation& rotation) { m_rotation = rotation; }
+
+  /// Header content of the files opened from now on; call while the writer is stopped
+  void set_run_info(uint32_t run_number, uint64_t config_hash);
+
+  /**
+   * @brief Where the files opened from now on go; call while the writer is stopped
+   *
+   * Files are named directory/prefix<date>_<time>.calib, after the local time at
+   * which they take over. directory must end with a '/'.
+   */
+  void set_output(const std::string& directory, const std::string& prefix);
+
+  /// The first file is opened with the first packet
+  void start();
+  /// Writes out whatever is still queued and closes the current file
+  void stop();
+
+  // Producer side, to be called from a single thread
+
+  /// @return false if the packet was dropped because the queue is full
+  bool write(const uint8_t* data, std::size_t n_bytes, uint8_t format_version);
+
+  // Monitoring
+
+  std::size_t queue_depth() const noexcept { return m_queue.size(); }
+  std::size_t queue_capacity() const noexcept { return m_queue.capacity(); }
+
+  // counters since the last call
+  uint64_t take_bytes_written() noexcept { return m_bytes_written.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_bytes_received() noexcept { return m_bytes_received.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_num_writes() noexcept { return m_num_writes.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_write_time_ns() noexcept { return m_write_time_ns.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_max_write_time_ns() noexcept { return m_max_write_time_ns.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_dropped_packets() noexcept { return m_dropped_packets.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_files_opened() noexcept { return m_files_opened.exchange(0, std::memory_order_relaxed); }
+  uint64_t take_files_removed() noexcept { return m_files_removed.exchange(0, std::memory_order_relaxed); }
+
+private:
+  struct Item
+  {
+    uint8_t format_version = 0;
+    std::vector<uint8_t> bytes;
+  };
+
+  static constexpr std::size_t s_max_write_bytes = 1 << 20;
+  static constexpr std::chrono::microseconds s_idle_wait{ 500 };
+  static constexpr std::chrono::seconds s_max_block_age{ 1 };
+
+  // Consumer side
+  void do_work(std::atomic<bool>& running_flag);
+  bool drain(); ///< @return true if anything was dequeued
+  bool rotation_due() const noexcept;
+  void rotate();
+  bool open_files(const std::string& file_name, int& fd, int& index_fd) const;
+  void prepare_next_file();
+  void discard_next_file();
+  std::string next_file_name();
+  void apply_retention();
+  void close_file();
+  void append(const Item& item);
+  void update_index(const uint8_t* data, std::size_t n_bytes);
+  void add_index_entry(uint64_t timestamp, uint64_t offset);
+  void finish_block();
+  void append_blocks(); ///< moves the complete blocks of m_encoded to the write buffer
+  void flush();
+  void sync();
+
+  SPSCRing<Item> m_queue;
+  const SyncPolicy m_sync_policy;
+  const std::chrono::milliseconds m_sync_interval;
+
+  int m_fd = -1;
+  std::vector<uint8_t> m_write_buffer;
+  std::chrono::steady_clock::time_point m_last_sync;
+
+  // file naming, rotation and retention
+  std::string m_directory;
+  std::string m_prefix;
+  Rotation m_rotation;
+  bool m_open_failed = false; // not tried again before the next start
+  int m_next_fd = -1;         // pre-opened under a temporary name
+  int m_next_index_fd = -1;
+  struct WrittenFile
+  {
+    std::string name;
+    uint64_t size;
+  };
+  std::string m_last_name_base; // names of files opened within the same second are numbered
+  unsigned m_name_sequence = 0;
+  std::deque<WrittenFile> m_files; // the current one last
+  uint64_t m_total_bytes = 0;      // of m_files
+
+  // current file layout
+  const std::size_t m_index_stride;
+  calibration::FileHeader m_header;
+  bool m_header_written = false;
+  std::string m_file_name;
+  int m_index_fd = -1; // sidecar index
+  uint64_t m_file_offset = 0;
+  std::vector<calibration::IndexEntry> m_index;
+  calibration::FileTrailer m_trailer;
+
+  // compact encoding
+  const calibration::Encoding m_encoding;
+  calibration::BlockEncoder m_encoder;
+  std::vector<uint8_t> m_encoded;
+  std::chrono::steady_clock::time_point m_block_start;
+
+  dunedaq::utilities::WorkerThread m_thread;
+
+  std::atomic<uint64_t> m_bytes_written{ 0 };
+  std::atomic<uint64_t> m_bytes_received{ 0 }; ///< before encoding
+  std::atomic<uint64_t> m_num_writes{ 0 };
+  std::atomic<uint64_t> m_write_time_ns{ 0 };
+  std::atomic<uint64_t> m_max_write_time_ns{ 0 };
+  std::atomic<uint64_t> m_dropped_packets{ 0 };
+  std::atomic<uint64_t> m_files_opened{ 0 };
+  std::atomic<uint64_t> m_files_removed{ 0 };
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CALIBRATIONWRITER_HPP_
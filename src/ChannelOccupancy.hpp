@@ -0,0 +1,219 @@
+/**
+ * @file ChannelOccupancy.hpp
+ *
+ * ChannelOccupancy counts how often each input channel of the CTB is set in the
+ * channel status words, for the monitoring.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_CHANNELOCCUPANCY_HPP_
+#define CTBMODULES_SRC_CHANNELOCCUPANCY_HPP_
+
+#include "CTBWordCodec.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace occupancy {
+
+/// Channels are numbered beam 0-15, CRT 16-47, PDS 48-64
+struct Subsystem
+{
+  const char* name;
+  std::size_t first;
+  std::size_t size;
+
+  constexpr uint64_t mask() const noexcept { return size == 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1; }
+};
+
+constexpr Subsystem s_beam = { "beam", 0, codec::layout::ch_beam_lo::width + codec::layout::ch_beam_hi::width };
+constexpr Subsystem s_crt = { "crt", s_beam.first + s_beam.size, codec::layout::ch_crt::width };
+constexpr Subsystem s_pds = { "pds", s_crt.first + s_crt.size, codec::layout::ch_pds::width };
+constexpr std::array<Subsystem, 3> s_subsystems = { s_beam, s_crt, s_pds };
+constexpr std::size_t s_n_channels = s_pds.first + s_pds.size;
+
+// lane 1 holds the channels from the fifth beam bit on, in order: its bit j is channel j + 4
+static_assert(codec::layout::ch_beam_lo::lane == 0 && codec::layout::ch_beam_lo::shift + codec::layout::ch_beam_lo::width == 64,
+              "the low beam bits end lane 0");
+static_assert(codec::layout::ch_beam_hi::lane == 1 && codec::layout::ch_beam_hi::shift == 0, "lane 1 starts with the beam bits");
+static_assert(codec::layout::ch_crt::shift + codec::layout::ch_beam_lo::width == s_crt.first, "CRT bits follow the beam bits");
+static_assert(codec::layout::ch_pds::shift + codec::layout::ch_beam_lo::width == s_pds.first, "PDS bits follow the CRT bits");
+
+} // namespace occupancy
+
+/**
+ * @brief Per-channel occupancy of the channel status words
+ *
+ * The readout thread adds each channel status word to bit-sliced counters: plane
+ * k holds bit k of the count of every channel of a lane, so a word is added with
+ * a ripple of ANDs and XORs over the planes, whatever the number of channels set.
+ * The planes are flushed to per-channel monotonic counters every 255 words, and
+ * on timestamp words with flush() so that a slow stream is not held back.
+ *
+ * Interval and per-run counts are differences against baselines kept on the
+ * reader side, as for TriggerCounters.
+ */
+class ChannelOccupancy
+{
+public:
+  struct Snapshot
+  {
+    uint64_t interval_words = 0; ///< channel status words since the previous take_snapshot()
+    uint64_t run_words = 0;      ///< channel status words since start_run()
+    std::array<uint64_t, occupancy::s_n_channels> interval = {};
+    std::array<uint64_t, occupancy::s_n_channels> run = {};
+
+    /// Channels of the subsystem set in every word of the interval, bit i for its channel i
+    uint64_t stuck_on(const occupancy::Subsystem& subsystem, uint64_t min_words) const noexcept
+    {
+      uint64_t mask = 0;
+      for (std::size_t i = 0; interval_words >= min_words && i < subsystem.size; ++i) {
+        mask |= uint64_t(interval[subsystem.first + i] == interval_words) << i;
+      }
+      return mask;
+    }
+
+    /// Channels of the subsystem, among enabled, never set during the interval
+    uint64_t stuck_off(const occupancy::Subsystem& subsystem, uint64_t enabled, uint64_t min_words) const noexcept
+    {
+      uint64_t mask = 0;
+      for (std::size_t i = 0; interval_words >= min_words && i < subsystem.size; ++i) {
+        mask |= uint64_t(interval[subsystem.first + i] == 0) << i;
+      }
+      return mask & enabled;
+    }
+  };
+
+  ChannelOccupancy() noexcept
+  {
+    for (auto& c : m_counts) {
+      c.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ChannelOccupancy(const ChannelOccupancy&) = delete;            ///< ChannelOccupancy is not copy-constructible
+  ChannelOccupancy& operator=(const ChannelOccupancy&) = delete; ///< ChannelOccupancy is not copy-assignable
+  ChannelOccupancy(ChannelOccupancy&&) = delete;                 ///< ChannelOccupancy is not move-constructible
+  ChannelOccupancy& operator=(ChannelOccupancy&&) = delete;      ///< ChannelOccupancy is not move-assignable
+
+  // Writer side, must always be called from the same thread
+
+  void count(const codec::CTBWord& word) noexcept
+  {
+    m_low.add(word.lane(0) >> codec::layout::ch_beam_lo::shift);
+    m_high.add(word.lane(1) & s_high_mask);
+    if (++m_pending == s_max_pending) {
+      flush();
+    }
+  }
+
+  void flush() noexcept
+  {
+    if (m_pending == 0) {
+      return;
+    }
+    m_low.flush(m_counts.data());
+    m_high.flush(m_counts.data() + codec::layout::ch_beam_lo::width);
+    m_words.store(m_words.load(std::memory_order_relaxed) + m_pending, std::memory_order_relaxed);
+    m_pending = 0;
+  }
+
+  // Reader side
+
+  /// Starts the per-run counts from the current values
+  void start_run() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_reader_mutex);
+    read(m_run_start_words, m_run_start);
+  }
+
+  /// Interval and run counts, from one read of the counters. Starts a new interval
+  Snapshot take_snapshot() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_reader_mutex);
+    uint64_t words;
+    std::array<uint64_t, occupancy::s_n_channels> counts;
+    read(words, counts);
+
+    Snapshot snapshot;
+    snapshot.run_words = words - m_run_start_words;
+    snapshot.interval_words = words - m_interval_start_words;
+    for (std::size_t i = 0; i < occupancy::s_n_channels; ++i) {
+      snapshot.run[i] = counts[i] - m_run_start[i];
+      snapshot.interval[i] = counts[i] - m_interval_start[i];
+    }
+    m_interval_start_words = words;
+    m_interval_start = counts;
+    return snapshot;
+  }
+
+private:
+  static constexpr uint64_t s_high_mask = codec::layout::ch_beam_hi::lane_mask | codec::layout::ch_crt::lane_mask |
+                                          codec::layout::ch_pds::lane_mask;
+  static constexpr unsigned s_n_planes = 8;
+  static constexpr unsigned s_max_pending = (1u << s_n_planes) - 1;
+
+  /// Counts up to 255 per bit of a 64 bit lane
+  struct Planes
+  {
+    std::array<uint64_t, s_n_planes> planes = {};
+
+    void add(uint64_t bits) noexcept
+    {
+      for (unsigned k = 0; k < s_n_planes; ++k) {
+        const uint64_t carry = planes[k] & bits;
+        planes[k] ^= bits;
+        bits = carry;
+      }
+    }
+
+    /// Adds the counts to the counters of the channels of bits 0 to 63, and clears them
+    void flush(std::atomic<uint64_t>* counts) noexcept
+    {
+      for (unsigned k = 0; k < s_n_planes; ++k) {
+        for (uint64_t bits = planes[k]; bits; bits &= bits - 1) {
+          auto& c = counts[__builtin_ctzll(bits)];
+          c.store(c.load(std::memory_order_relaxed) + (uint64_t(1) << k), std::memory_order_relaxed);
+        }
+        planes[k] = 0;
+      }
+    }
+  };
+
+  void read(uint64_t& words, std::array<uint64_t, occupancy::s_n_channels>& counts) const noexcept
+  {
+    words = m_words.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < occupancy::s_n_channels; ++i) {
+      counts[i] = m_counts[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  // readout thread only
+  Planes m_low;  // beam bits 0 to 3, in bits 0 to 3
+  Planes m_high; // channels 4 to 64, in bits 0 to 60
+  unsigned m_pending = 0;
+
+  // written by the readout thread only
+  alignas(64) std::array<std::atomic<uint64_t>, occupancy::s_n_channels> m_counts;
+  std::atomic<uint64_t> m_words{ 0 };
+
+  // reader side
+  std::mutex m_reader_mutex; // between get_info and the run commands, never taken by count()
+  uint64_t m_run_start_words = 0;
+  uint64_t m_interval_start_words = 0;
+  std::array<uint64_t, occupancy::s_n_channels> m_run_start = {};
+  std::array<uint64_t, occupancy::s_n_channels> m_interval_start = {};
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_CHANNELOCCUPANCY_HPP_
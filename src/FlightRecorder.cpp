@@ -0,0 +1,164 @@
+/**
+ * @file FlightRecorder.cpp FlightRecorder class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "FlightRecorder.hpp"
+#include "CTBModuleIssues.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+namespace flight {
+
+const char*
+to_string(Event event) noexcept
+{
+  switch (event) {
+    case Event::kPacket:
+      return "packet";
+    case Event::kTimestamp:
+      return "timestamp";
+    case Event::kFeedback:
+      return "feedback";
+    case Event::kChannelStatus:
+      return "channel_status";
+    case Event::kLLT:
+      return "llt";
+    case Event::kHLT:
+      return "hlt";
+  }
+  return "unknown";
+}
+
+const char*
+to_string(Reason reason) noexcept
+{
+  switch (reason) {
+    case Reason::kOnDemand:
+      return "on_demand";
+    case Reason::kFeedback:
+      return "feedback";
+    case Reason::kMatchError:
+      return "match_error";
+    case Reason::kSocketError:
+      return "socket_error";
+  }
+  return "unknown";
+}
+
+} // namespace flight
+
+FlightRecorder::FlightRecorder(std::size_t capacity)
+{
+  resize(capacity);
+}
+
+void
+FlightRecorder::resize(std::size_t capacity)
+{
+  std::size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  std::vector<std::array<std::atomic<uint64_t>, 4>> slots(size);
+  for (auto& slot : slots) {
+    for (auto& field : slot) {
+      field.store(0, std::memory_order_relaxed);
+    }
+  }
+  m_slots.swap(slots);
+  m_mask = size - 1;
+  m_head.store(0, std::memory_order_relaxed);
+}
+
+std::vector<flight::Record>
+FlightRecorder::snapshot() const
+{
+  const uint64_t head = m_head.load(std::memory_order_acquire);
+  const uint64_t first = head > m_slots.size() ? head - m_slots.size() : 0;
+
+  std::vector<flight::Record> records(head - first);
+  for (uint64_t s = first; s < head; ++s) {
+    const auto& slot = m_slots[s & m_mask];
+    auto& record = records[s - first];
+    record.lanes[0] = slot[0].load(std::memory_order_relaxed);
+    record.lanes[1] = slot[1].load(std::memory_order_relaxed);
+    record.value = slot[2].load(std::memory_order_relaxed);
+    record.tag = slot[3].load(std::memory_order_relaxed);
+  }
+
+  // records the writer reached while we were copying may be torn: any field it
+  // changed makes the head it published before visible here
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint64_t end = m_head.load(std::memory_order_relaxed);
+  const uint64_t first_valid = end >= m_slots.size() ? end - m_slots.size() + 1 : 0;
+
+  std::size_t n_valid = 0;
+  for (uint64_t s = first; s < head; ++s) {
+    const flight::Record& record = records[s - first];
+    if (s >= first_valid && record.tag != s_no_tag && record.sequence() == s) {
+      records[n_valid++] = record;
+    }
+  }
+  records.resize(n_valid);
+  return records;
+}
+
+bool
+FlightRecorder::dump(const std::string& file_name, flight::Reason reason, uint32_t run_number) const
+{
+  const std::vector<flight::Record> records = snapshot();
+
+  flight::DumpHeader header;
+  header.reason = static_cast<uint16_t>(reason);
+  header.run_number = run_number;
+  header.n_records = records.size();
+  header.creation_time = std::time(nullptr);
+
+  std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(flight::Record));
+  out.close();
+
+  if (!out) {
+    ers::warning(CTBFlightRecorderError(ERS_HERE, "Unable to write " + file_name + ": " + std::strerror(errno)));
+    return false;
+  }
+  return true;
+}
+
+std::vector<flight::Record>
+FlightRecorder::read_dump(const std::string& file_name, flight::DumpHeader& header)
+{
+  std::ifstream in(file_name, std::ios::binary);
+  if (!in) {
+    throw CTBFlightRecorderError(ERS_HERE, "Unable to open " + file_name + ": " + std::strerror(errno));
+  }
+
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!in || header.magic != flight::s_dump_magic) {
+    throw CTBFlightRecorderError(ERS_HERE, file_name + " is not a flight recorder dump");
+  }
+  if (header.version != flight::s_dump_version || header.record_size != sizeof(flight::Record)) {
+    throw CTBFlightRecorderError(ERS_HERE, "Unsupported flight recorder dump version in " + file_name);
+  }
+
+  std::vector<flight::Record> records(header.n_records);
+  in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(flight::Record));
+  records.resize(in.gcount() / sizeof(flight::Record));
+  return records;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
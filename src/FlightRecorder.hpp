@@ -0,0 +1,143 @@
+/**
+ * @file FlightRecorder.hpp
+ *
+ * FlightRecorder keeps the last words received from the CTB and what the
+ * readout made of them, as fixed size binary records, to be dumped to a file
+ * when something goes wrong.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_FLIGHTRECORDER_HPP_
+#define CTBMODULES_SRC_FLIGHTRECORDER_HPP_
+
+#include "CTBWordCodec.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace flight {
+
+constexpr uint64_t s_dump_magic = 0x5448474c46425443; // "CTBFLGHT" in little endian
+constexpr uint16_t s_dump_version = 1;
+
+enum class Event : uint16_t
+{
+  kPacket = 1,    ///< start of a packet, value is its number of words
+  kTimestamp,     ///< timestamp word
+  kFeedback,      ///< feedback word
+  kChannelStatus, ///< channel status word
+  kLLT,           ///< LLT, value is the matched channel status payload
+  kHLT            ///< HLT, value is the matched LLT payload
+};
+
+enum class Reason : uint16_t
+{
+  kOnDemand = 0,
+  kFeedback,
+  kMatchError,
+  kSocketError
+};
+
+const char* to_string(Event event) noexcept;
+const char* to_string(Reason reason) noexcept;
+
+struct Record
+{
+  uint64_t lanes[2] = { 0, 0 }; ///< the CTB word, as codec::CTBWord lanes
+  uint64_t value = 0;
+  uint64_t tag = 0; ///< sequence number << 16 | event
+
+  uint64_t sequence() const noexcept { return tag >> 16; }
+  Event event() const noexcept { return static_cast<Event>(tag & 0xFFFF); }
+  codec::CTBWord word() const noexcept { return codec::CTBWord(lanes[0], lanes[1]); }
+};
+static_assert(sizeof(Record) == 32, "Record must stay 32 bytes");
+
+struct DumpHeader
+{
+  uint64_t magic = s_dump_magic;
+  uint16_t version = s_dump_version;
+  uint16_t record_size = sizeof(Record);
+  uint16_t reason = 0;
+  uint16_t reserved0 = 0;
+  uint32_t run_number = 0;
+  uint32_t n_records = 0;
+  uint64_t creation_time = 0; ///< seconds since the epoch
+  uint8_t reserved[32] = {};
+};
+static_assert(sizeof(DumpHeader) == 64, "DumpHeader must stay 64 bytes");
+
+} // namespace flight
+
+/**
+ * @brief Lock-free ring of the last decoded words
+ *
+ * record() is called by the thread that decodes the words: it invalidates the
+ * tag of the slot, stores the four 64 bit fields of the record with relaxed
+ * stores and publishes it by bumping the sequence number, so it costs a few
+ * stores and a fence and never formats anything.
+ *
+ * snapshot() and dump() can be called from any thread at any time. Records that
+ * the writer may have overwritten while they were being copied are discarded,
+ * the oldest one included, as the next record may be under way in its slot: a
+ * full ring gives capacity - 1 records, a few less during data taking.
+ */
+class FlightRecorder
+{
+public:
+  explicit FlightRecorder(std::size_t capacity);
+
+  FlightRecorder(const FlightRecorder&) = delete;            ///< FlightRecorder is not copy-constructible
+  FlightRecorder& operator=(const FlightRecorder&) = delete; ///< FlightRecorder is not copy-assignable
+  FlightRecorder(FlightRecorder&&) = delete;                 ///< FlightRecorder is not move-constructible
+  FlightRecorder& operator=(FlightRecorder&&) = delete;      ///< FlightRecorder is not move-assignable
+
+  /// Rounded up to a power of two; clears the records, not to be called while recording
+  void resize(std::size_t capacity);
+  std::size_t capacity() const noexcept { return m_slots.size(); }
+
+  /// Writer side, must always be called from the same thread
+  void record(flight::Event event, const codec::CTBWord& word, uint64_t value = 0) noexcept
+  {
+    const uint64_t sequence = m_head.load(std::memory_order_relaxed);
+    auto& slot = m_slots[sequence & m_mask];
+    // the fence orders the new fields after the head that published the record they replace
+    slot[3].store(s_no_tag, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot[0].store(word.lane(0), std::memory_order_relaxed);
+    slot[1].store(word.lane(1), std::memory_order_relaxed);
+    slot[2].store(value, std::memory_order_relaxed);
+    slot[3].store(sequence << 16 | static_cast<uint16_t>(event), std::memory_order_relaxed);
+    m_head.store(sequence + 1, std::memory_order_release);
+  }
+
+  /// The records still in the ring, oldest first, at most capacity() - 1
+  std::vector<flight::Record> snapshot() const;
+
+  /// Writes a snapshot to file_name, false (and a warning) if the file could not be written
+  bool dump(const std::string& file_name, flight::Reason reason, uint32_t run_number) const;
+
+  /// Reads a dump back, throws CTBFlightRecorderError if it is not one
+  static std::vector<flight::Record> read_dump(const std::string& file_name, flight::DumpHeader& header);
+
+private:
+  static constexpr uint64_t s_no_tag = ~uint64_t(0); // tag of a slot being written
+
+  std::vector<std::array<std::atomic<uint64_t>, 4>> m_slots;
+  uint64_t m_mask = 0;
+  std::atomic<uint64_t> m_head{ 0 }; // sequence number of the next record
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_FLIGHTRECORDER_HPP_
@@ -0,0 +1,173 @@
+/**
+ * @file HSIFrameBatcher.hpp
+ *
+ * HSIFrameBatcher accumulates the HSI frames of one output of the CTBModule
+ * and hands them over in batches, by count or by deadline.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_HSIFRAMEBATCHER_HPP_
+#define CTBMODULES_SRC_HSIFRAMEBATCHER_HPP_
+
+#include "AtomicHistogram.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Count and deadline based batching of HSI frames
+ *
+ * add() returns true when the batch reached max_frames. A batch is also due
+ * when its first frame is older than max_ticks in CTB time, checked against the
+ * timestamp of any later word, or older than max_delay in wall time, checked
+ * by the caller between packets. flush() hands the frames in timestamp order to
+ * a send function; a frame older than one already flushed is still sent, and
+ * counted as late.
+ *
+ * add(), due() and flush() must always be called from the same thread;
+ * take_stats() can be called from any other one.
+ */
+class HSIFrameBatcher
+{
+public:
+  using hsi_frame_t = std::array<uint32_t, 7>;
+  using clock = std::chrono::steady_clock;
+
+  struct Config
+  {
+    std::size_t max_frames = 1;                    ///< 1 sends every frame right away
+    uint64_t max_ticks = 62500;                    ///< CTB clock ticks, 1 ms
+    std::chrono::microseconds max_delay{ 1000 };
+  };
+
+  struct Stats
+  {
+    uint64_t late_frames = 0;
+    AtomicHistogram::Summary batch_sizes;
+    AtomicHistogram::Summary flush_latencies; ///< from the first frame of a batch to its flush, ns
+  };
+
+  static uint64_t timestamp(const hsi_frame_t& frame) noexcept { return frame[1] | uint64_t(frame[2]) << 32; }
+
+  HSIFrameBatcher() = default;
+
+  HSIFrameBatcher(const HSIFrameBatcher&) = delete;            ///< HSIFrameBatcher is not copy-constructible
+  HSIFrameBatcher& operator=(const HSIFrameBatcher&) = delete; ///< HSIFrameBatcher is not copy-assignable
+  HSIFrameBatcher(HSIFrameBatcher&&) = delete;                 ///< HSIFrameBatcher is not move-constructible
+  HSIFrameBatcher& operator=(HSIFrameBatcher&&) = delete;      ///< HSIFrameBatcher is not move-assignable
+
+  /// Not to be called with frames pending
+  void configure(const Config& config)
+  {
+    m_config = config;
+    m_config.max_frames = std::max<std::size_t>(m_config.max_frames, 1);
+    m_frames.clear();
+    m_frames.reserve(m_config.max_frames);
+    m_last_flushed_timestamp = 0;
+  }
+
+  bool empty() const noexcept { return m_frames.empty(); }
+  std::size_t size() const noexcept { return m_frames.size(); }
+
+  /// Adds a frame, true if the batch is full and must be flushed
+  bool add(const hsi_frame_t& frame)
+  {
+    const uint64_t ts = timestamp(frame);
+    if (m_frames.empty()) {
+      m_first_timestamp = ts;
+      m_first_time = clock::now();
+    } else if (ts < m_last_timestamp) {
+      m_sorted = false;
+    }
+    m_last_timestamp = ts;
+    m_frames.push_back(frame);
+    return m_frames.size() >= m_config.max_frames;
+  }
+
+  /// true if the first frame is more than max_ticks before ctb_timestamp
+  bool due(uint64_t ctb_timestamp) const noexcept
+  {
+    return !m_frames.empty() && ctb_timestamp > m_first_timestamp + m_config.max_ticks;
+  }
+
+  /// true if the first frame was added more than max_delay before now
+  bool due(clock::time_point now) const noexcept { return !m_frames.empty() && now - m_first_time > m_config.max_delay; }
+
+  /// When a non empty batch becomes due by wall time
+  clock::time_point deadline() const noexcept { return m_first_time + m_config.max_delay; }
+
+  /// Calls send(frame) for each frame of the batch, in timestamp order, and empties it
+  template<typename Send>
+  std::size_t flush(Send&& send)
+  {
+    const std::size_t n = m_frames.size();
+    if (n == 0) {
+      return 0;
+    }
+
+    if (!m_sorted) {
+      std::stable_sort(m_frames.begin(), m_frames.end(), [](const hsi_frame_t& a, const hsi_frame_t& b) {
+        return timestamp(a) < timestamp(b);
+      });
+      m_sorted = true;
+    }
+
+    uint64_t late = 0;
+    for (const auto& frame : m_frames) {
+      late += timestamp(frame) < m_last_flushed_timestamp;
+      send(frame);
+    }
+    m_last_flushed_timestamp = std::max(m_last_flushed_timestamp, timestamp(m_frames.back()));
+    m_frames.clear();
+
+    m_late_frames.store(m_late_frames.load(std::memory_order_relaxed) + late, std::memory_order_relaxed);
+    m_batch_sizes.record(n);
+    m_flush_latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_first_time).count());
+    return n;
+  }
+
+  /// Reader side: statistics of the batches flushed since the previous call
+  Stats take_stats() noexcept
+  {
+    Stats stats;
+    const uint64_t late_frames = m_late_frames.load(std::memory_order_relaxed);
+    stats.late_frames = late_frames - m_reported_late_frames;
+    m_reported_late_frames = late_frames;
+    stats.batch_sizes = m_batch_sizes.take_summary();
+    stats.flush_latencies = m_flush_latencies.take_summary();
+    return stats;
+  }
+
+private:
+  Config m_config;
+  std::vector<hsi_frame_t> m_frames;
+  bool m_sorted = true;
+  uint64_t m_first_timestamp = 0;
+  uint64_t m_last_timestamp = 0;
+  uint64_t m_last_flushed_timestamp = 0;
+  clock::time_point m_first_time;
+
+  // written by the flushing thread only
+  std::atomic<uint64_t> m_late_frames{ 0 };
+  AtomicHistogram m_batch_sizes;
+  AtomicHistogram m_flush_latencies;
+
+  // reader only
+  uint64_t m_reported_late_frames = 0;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_HSIFRAMEBATCHER_HPP_
@@ -0,0 +1,224 @@
+/**
+ * @file HSIFrameMerger.hpp
+ *
+ * HSIFrameMerger merges the HSI frames of several CTBs into a single stream
+ * ordered by CTB timestamp.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_HSIFRAMEMERGER_HPP_
+#define CTBMODULES_SRC_HSIFRAMEMERGER_HPP_
+
+#include "AtomicHistogram.hpp"
+#include "HSIFrameBatcher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Time-ordered merge of the HSI frames of several sources, with a bounded reorder window
+ *
+ * Each source reports how far its stream went, with the timestamps of its
+ * frames and of its timestamp words. A frame is released once every source went
+ * past it, so the output is in timestamp order as long as each source is.
+ * A source that is late or silent only holds the others back for a while: a
+ * frame is also released when it is more than window_ticks older than the
+ * newest timestamp seen, when it waited for more than max_delay, or when more
+ * than max_frames are waiting. Such releases are counted as forced, and a frame
+ * released after a newer one is still sent, and counted as late.
+ *
+ * push(), advance(), release() and drain() must always be called from the same
+ * thread; take_stats() and lag() can be called from any other one.
+ */
+class HSIFrameMerger
+{
+public:
+  using hsi_frame_t = HSIFrameBatcher::hsi_frame_t;
+  using clock = std::chrono::steady_clock;
+
+  struct Config
+  {
+    uint64_t window_ticks = 62500; ///< CTB clock ticks, 1 ms
+    std::size_t max_frames = 4096;
+    std::chrono::microseconds max_delay{ 10000 };
+  };
+
+  struct Stats
+  {
+    uint64_t forced_frames = 0;
+    uint64_t late_frames = 0;
+    AtomicHistogram::Summary delays; ///< from push to release, ns
+  };
+
+  HSIFrameMerger() = default;
+
+  HSIFrameMerger(const HSIFrameMerger&) = delete;            ///< HSIFrameMerger is not copy-constructible
+  HSIFrameMerger& operator=(const HSIFrameMerger&) = delete; ///< HSIFrameMerger is not copy-assignable
+  HSIFrameMerger(HSIFrameMerger&&) = delete;                 ///< HSIFrameMerger is not move-constructible
+  HSIFrameMerger& operator=(HSIFrameMerger&&) = delete;      ///< HSIFrameMerger is not move-assignable
+
+  /// Clears the frames, not to be called while merging
+  void configure(std::size_t n_sources, const Config& config)
+  {
+    m_config = config;
+    m_config.max_frames = std::max<std::size_t>(m_config.max_frames, 1);
+    m_frames = queue_t();
+    m_progress = std::vector<std::atomic<uint64_t>>(n_sources);
+    m_newest.store(0, std::memory_order_relaxed);
+    m_last_released_timestamp = 0;
+    m_sequence = 0;
+  }
+
+  std::size_t n_sources() const noexcept { return m_progress.size(); }
+  bool empty() const noexcept { return m_frames.empty(); }
+  std::size_t size() const noexcept { return m_frames.size(); }
+
+  /// Source will not send frames older than timestamp any more
+  void advance(std::size_t source, uint64_t timestamp) noexcept
+  {
+    if (timestamp > m_progress[source].load(std::memory_order_relaxed)) {
+      m_progress[source].store(timestamp, std::memory_order_relaxed);
+      if (timestamp > m_newest.load(std::memory_order_relaxed)) {
+        m_newest.store(timestamp, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(std::size_t source, const hsi_frame_t& frame)
+  {
+    const uint64_t ts = HSIFrameBatcher::timestamp(frame);
+    m_frames.push(Entry{ ts, m_sequence++, clock::now(), frame });
+    advance(source, ts);
+  }
+
+  /// Calls send(frame) for each frame that can be released, in timestamp order
+  template<typename Send>
+  std::size_t release(Send&& send, clock::time_point now = clock::now())
+  {
+    if (m_frames.empty()) {
+      return 0;
+    }
+
+    uint64_t watermark = m_newest.load(std::memory_order_relaxed);
+    for (const auto& progress : m_progress) {
+      watermark = std::min(watermark, progress.load(std::memory_order_relaxed));
+    }
+    const uint64_t newest = m_newest.load(std::memory_order_relaxed);
+
+    std::size_t n = 0;
+    while (!m_frames.empty()) {
+      const Entry& entry = m_frames.top();
+      if (entry.timestamp > watermark) {
+        const bool forced = entry.timestamp + m_config.window_ticks < newest || m_frames.size() > m_config.max_frames ||
+                            now - entry.time > m_config.max_delay;
+        if (!forced) {
+          break;
+        }
+        bump(m_forced_frames);
+      }
+      pop(send, now);
+      ++n;
+    }
+    return n;
+  }
+
+  /// Calls send(frame) for all the frames, in timestamp order
+  template<typename Send>
+  std::size_t drain(Send&& send)
+  {
+    const auto now = clock::now();
+    std::size_t n = 0;
+    for (; !m_frames.empty(); ++n) {
+      pop(send, now);
+    }
+    return n;
+  }
+
+  /// Reader side: CTB ticks source is behind the newest timestamp seen
+  uint64_t lag(std::size_t source) const noexcept
+  {
+    const uint64_t progress = m_progress[source].load(std::memory_order_relaxed);
+    const uint64_t newest = m_newest.load(std::memory_order_relaxed);
+    return newest > progress ? newest - progress : 0;
+  }
+
+  /// Reader side: statistics of the frames released since the previous call
+  Stats take_stats() noexcept
+  {
+    Stats stats;
+    const uint64_t forced = m_forced_frames.load(std::memory_order_relaxed);
+    const uint64_t late = m_late_frames.load(std::memory_order_relaxed);
+    stats.forced_frames = forced - m_reported_forced_frames;
+    stats.late_frames = late - m_reported_late_frames;
+    m_reported_forced_frames = forced;
+    m_reported_late_frames = late;
+    stats.delays = m_delays.take_summary();
+    return stats;
+  }
+
+private:
+  struct Entry
+  {
+    uint64_t timestamp;
+    uint64_t sequence; // frames with the same timestamp keep their arrival order
+    clock::time_point time;
+    hsi_frame_t frame;
+
+    bool operator>(const Entry& other) const noexcept
+    {
+      return timestamp != other.timestamp ? timestamp > other.timestamp : sequence > other.sequence;
+    }
+  };
+  using queue_t = std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>;
+
+  static void bump(std::atomic<uint64_t>& counter) noexcept
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  template<typename Send>
+  void pop(Send& send, clock::time_point now)
+  {
+    const Entry& entry = m_frames.top();
+    if (entry.timestamp < m_last_released_timestamp) {
+      bump(m_late_frames);
+    }
+    m_last_released_timestamp = std::max(m_last_released_timestamp, entry.timestamp);
+    m_delays.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - entry.time).count());
+    send(entry.frame);
+    m_frames.pop();
+  }
+
+  Config m_config;
+  queue_t m_frames;
+  uint64_t m_last_released_timestamp = 0;
+  uint64_t m_sequence = 0;
+
+  // written by the merging thread only
+  std::vector<std::atomic<uint64_t>> m_progress; // newest timestamp of each source
+  std::atomic<uint64_t> m_newest{ 0 };
+  std::atomic<uint64_t> m_forced_frames{ 0 };
+  std::atomic<uint64_t> m_late_frames{ 0 };
+  AtomicHistogram m_delays;
+
+  // reader only
+  uint64_t m_reported_forced_frames = 0;
+  uint64_t m_reported_late_frames = 0;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_HSIFRAMEMERGER_HPP_
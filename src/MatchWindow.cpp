@@ -0,0 +1,98 @@
+/**
+ * @file MatchWindow.cpp MatchWindow class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "MatchWindow.hpp"
+#include "CTBModuleIssues.hpp"
+
+namespace dunedaq {
+namespace ctbmodules {
+
+MatchWindow::LatePolicy
+MatchWindow::parse_late_policy(const std::string& policy)
+{
+  if (policy == "insert")
+    return LatePolicy::kInsert;
+  if (policy == "drop")
+    return LatePolicy::kDrop;
+
+  throw CTBWordMatchError(ERS_HERE, "Unknown late arrival policy: " + policy);
+}
+
+MatchWindow::MatchWindow()
+  : MatchWindow(Config())
+{}
+
+MatchWindow::MatchWindow(const Config& config)
+{
+  configure(config);
+}
+
+void
+MatchWindow::configure(const Config& config)
+{
+  if (config.depth == 0) {
+    throw CTBWordMatchError(ERS_HERE, "The match window must hold at least one input");
+  }
+
+  std::size_t capacity = 1;
+  while (capacity < config.depth) {
+    capacity <<= 1;
+  }
+
+  m_config = config;
+  m_ring.assign(capacity, input_t());
+  m_mask = capacity - 1;
+  clear();
+}
+
+void
+MatchWindow::push_late(const input_t& input) noexcept
+{
+  const bool full = m_size == m_config.depth;
+  if (m_config.late_policy == LatePolicy::kDrop || (full && input.first < oldest().first)) {
+    bump(m_late_dropped);
+    return;
+  }
+
+  // shift the newer inputs up by one, a full window loses its oldest input
+  const uint64_t first = m_end - m_size;
+  uint64_t j = m_end;
+  for (; j != first && m_ring[(j - 1) & m_mask].first > input.first; --j) {
+    m_ring[j & m_mask] = m_ring[(j - 1) & m_mask];
+  }
+  m_ring[j & m_mask] = input;
+  ++m_end;
+  if (!full) {
+    ++m_size;
+  }
+  bump(m_late_inserted);
+}
+
+MatchWindow::Stats
+MatchWindow::take_stats() noexcept
+{
+  Stats current;
+  current.matched = m_matched.load(std::memory_order_relaxed);
+  current.unmatched = m_unmatched.load(std::memory_order_relaxed);
+  current.late_inserted = m_late_inserted.load(std::memory_order_relaxed);
+  current.late_dropped = m_late_dropped.load(std::memory_order_relaxed);
+
+  Stats stats;
+  stats.matched = current.matched - m_reported.matched;
+  stats.unmatched = current.unmatched - m_reported.unmatched;
+  stats.late_inserted = current.late_inserted - m_reported.late_inserted;
+  stats.late_dropped = current.late_dropped - m_reported.late_dropped;
+  stats.offsets = m_offsets.take_summary();
+
+  m_reported = current;
+  return stats;
+}
+
+} // namespace ctbmodules
+} // namespace dunedaq
@@ -0,0 +1,164 @@
+/**
+ * @file MatchWindow.hpp
+ *
+ * MatchWindow keeps the recent inputs of one trigger level (channel status
+ * words for the LLTs, LLTs for the HLTs) ordered by timestamp, and finds the
+ * input that caused a trigger.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_MATCHWINDOW_HPP_
+#define CTBMODULES_SRC_MATCHWINDOW_HPP_
+
+#include "AtomicHistogram.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Timestamp ordered ring of the last inputs of a trigger level
+ *
+ * The board time-stamps a trigger one tick after its input, so match() looks
+ * for the most recent input older than the trigger and accepts it if the
+ * offset is at most 1 + tolerance. Inputs newer than the trigger, as found in
+ * bursts, are skipped. The scan starts from the newest input and stops at the
+ * first older one, so it usually touches one or two entries.
+ *
+ * Inputs normally arrive in timestamp order. One that is older than the newest
+ * input is a late arrival: with LatePolicy::kInsert it is moved to its place
+ * in the window, with LatePolicy::kDrop it is discarded. Inputs older than the
+ * whole window are always discarded.
+ *
+ * push() and match() must always be called from the same thread; take_stats()
+ * can be called from any other one.
+ */
+class MatchWindow
+{
+public:
+  using input_t = std::pair<uint64_t, uint64_t>; // pair<timestamp, trigger_payload>
+
+  enum class LatePolicy
+  {
+    kInsert, ///< late inputs are inserted at their place
+    kDrop    ///< late inputs are discarded
+  };
+
+  static LatePolicy parse_late_policy(const std::string& policy);
+
+  struct Config
+  {
+    std::size_t depth = 16;                      ///< inputs kept, the oldest are overwritten
+    uint64_t tolerance = 0;                      ///< ticks a trigger may come later than input + 1
+    LatePolicy late_policy = LatePolicy::kInsert;
+  };
+
+  struct Stats
+  {
+    uint64_t matched = 0;
+    uint64_t unmatched = 0;
+    uint64_t late_inserted = 0;
+    uint64_t late_dropped = 0;
+    AtomicHistogram::Summary offsets; ///< trigger timestamp - input timestamp of the matches
+  };
+
+  MatchWindow();
+  explicit MatchWindow(const Config& config);
+
+  MatchWindow(const MatchWindow&) = delete;            ///< MatchWindow is not copy-constructible
+  MatchWindow& operator=(const MatchWindow&) = delete; ///< MatchWindow is not copy-assignable
+  MatchWindow(MatchWindow&&) = delete;                 ///< MatchWindow is not move-constructible
+  MatchWindow& operator=(MatchWindow&&) = delete;      ///< MatchWindow is not move-assignable
+
+  /// Resizes the window and clears it, not to be called while decoding
+  void configure(const Config& config);
+  const Config& config() const noexcept { return m_config; }
+
+  /// Forgets the inputs, the statistics are kept
+  void clear() noexcept
+  {
+    m_end = 0;
+    m_size = 0;
+  }
+
+  std::size_t size() const noexcept { return m_size; }
+  const input_t& newest() const noexcept { return m_ring[(m_end - 1) & m_mask]; }
+  const input_t& oldest() const noexcept { return m_ring[(m_end - m_size) & m_mask]; }
+
+  void push(const input_t& input) noexcept
+  {
+    if (m_size && input.first < newest().first) {
+      push_late(input);
+      return;
+    }
+    m_ring[m_end++ & m_mask] = input;
+    if (m_size < m_config.depth) {
+      ++m_size;
+    }
+  }
+
+  /// Payload of the input that caused a trigger at trigger_ts, false if there is none
+  bool match(uint64_t trigger_ts, uint64_t& payload) noexcept
+  {
+    for (uint64_t j = m_end; j != m_end - m_size;) {
+      const input_t& input = m_ring[--j & m_mask];
+      if (input.first >= trigger_ts) {
+        continue;
+      }
+      const uint64_t offset = trigger_ts - input.first;
+      if (offset > 1 + m_config.tolerance) {
+        break;
+      }
+      m_offsets.record(offset);
+      bump(m_matched);
+      payload = input.second;
+      return true;
+    }
+    bump(m_unmatched);
+    return false;
+  }
+
+  /// Triggers without a match so far, can be read from any thread
+  uint64_t total_unmatched() const noexcept { return m_unmatched.load(std::memory_order_relaxed); }
+
+  /// Reader side: counts and offsets since the previous call
+  Stats take_stats() noexcept;
+
+private:
+  static void bump(std::atomic<uint64_t>& counter) noexcept
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void push_late(const input_t& input) noexcept;
+
+  Config m_config;
+  std::vector<input_t> m_ring; // power of two size, at least depth
+  uint64_t m_mask = 0;
+  uint64_t m_end = 0;     // position after the newest input
+  std::size_t m_size = 0; // inputs in the window, at most depth
+
+  // written by the decoding thread only
+  std::atomic<uint64_t> m_matched{ 0 };
+  std::atomic<uint64_t> m_unmatched{ 0 };
+  std::atomic<uint64_t> m_late_inserted{ 0 };
+  std::atomic<uint64_t> m_late_dropped{ 0 };
+  AtomicHistogram m_offsets;
+
+  // reader only
+  Stats m_reported;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_MATCHWINDOW_HPP_
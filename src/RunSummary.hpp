@@ -0,0 +1,315 @@
+/**
+ * @file RunSummary.hpp
+ *
+ * RunSummary accumulates the trigger summary of a run while it is taken, and
+ * writes it at the end of the run as JSON and in a compact binary form.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_RUNSUMMARY_HPP_
+#define CTBMODULES_SRC_RUNSUMMARY_HPP_
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace dunedaq {
+namespace ctbmodules {
+namespace run_summary {
+
+constexpr uint64_t s_magic = 0x4d534e5552425443; // "CTBRUNSM" in little endian
+constexpr uint16_t s_version = 1;
+constexpr uint64_t s_ticks_per_second = 62500000;
+constexpr uint64_t s_ticks_per_bin = 60 * s_ticks_per_second; // one minute
+constexpr std::size_t s_max_bins = 1440;                      // later words go to the last bin
+
+/// Words of one minute of CTB time
+struct Bin
+{
+  uint32_t hlts = 0;
+  uint32_t llts = 0;
+  uint32_t spill_hlts = 0; ///< HLTs while the spill gate was open
+  uint32_t channel_status = 0;
+};
+static_assert(sizeof(Bin) == 16, "Bin must stay 16 bytes");
+
+/// Binary form: a Header, the Totals and n_bins Bins, all little endian
+struct Header
+{
+  uint64_t magic = s_magic;
+  uint16_t version = s_version;
+  uint16_t n_hlt_bits = 0;
+  uint16_t n_llt_bits = 0;
+  uint16_t reserved = 0;
+  uint32_t run_number = 0;
+  uint32_t n_bins = 0;
+  uint64_t ticks_per_bin = s_ticks_per_bin;
+  uint64_t spill_mask = 0;
+};
+static_assert(sizeof(Header) == 40, "Header must stay 40 bytes");
+
+} // namespace run_summary
+
+/**
+ * @brief Fixed size per-run trigger summary
+ *
+ * The readout thread feeds it the words as they are decoded: counting a word is
+ * a few increments in arrays sized at compile time, and nothing is ever
+ * allocated or rescanned, so writing the summary at the end of the run does not
+ * depend on the length of the run.
+ *
+ * The spill gate is open while the beam bits of the channel status words match
+ * spill_mask; its duration is measured with the full timestamps of the other words.
+ *
+ * All the methods but the writing ones are called from the readout thread; the
+ * summary is written once that thread has stopped.
+ */
+template<std::size_t NHlt, std::size_t NLlt>
+class RunSummary
+{
+public:
+  struct Totals
+  {
+    uint64_t first_timestamp = 0;
+    uint64_t last_timestamp = 0;
+    uint64_t ts_words = 0;
+    uint64_t channel_status_words = 0;
+    uint64_t feedback_words = 0;
+    uint64_t hlt_words = 0;
+    uint64_t llt_words = 0;
+    uint64_t spill_hlt_words = 0;
+    uint64_t spill_llt_words = 0;
+    uint64_t spill_ticks = 0;
+    uint64_t n_spills = 0;
+    uint64_t unmatched_hlts = 0; ///< HLTs without their LLT
+    uint64_t unmatched_llts = 0; ///< LLTs without their channel status word
+    std::array<uint64_t, NHlt> hlt = {};
+    std::array<uint64_t, NHlt> spill_hlt = {};
+    std::array<uint64_t, NLlt> llt = {};
+    std::array<uint64_t, NLlt> spill_llt = {};
+  };
+
+  RunSummary() = default;
+
+  RunSummary(const RunSummary&) = delete;            ///< RunSummary is not copy-constructible
+  RunSummary& operator=(const RunSummary&) = delete; ///< RunSummary is not copy-assignable
+  RunSummary(RunSummary&&) = delete;                 ///< RunSummary is not move-constructible
+  RunSummary& operator=(RunSummary&&) = delete;      ///< RunSummary is not move-assignable
+
+  /// Clears the summary, before the readout thread starts
+  void start_run(uint32_t run_number, uint64_t spill_mask) noexcept
+  {
+    m_run_number = run_number;
+    m_spill_mask = spill_mask;
+    m_totals = Totals();
+    m_bins.fill(run_summary::Bin());
+    m_n_bins = 0;
+    m_in_spill = false;
+    m_spill_start = 0;
+  }
+
+  // Readout thread
+
+  void on_timestamp(uint64_t timestamp) noexcept
+  {
+    ++m_totals.ts_words;
+    note(timestamp);
+  }
+
+  void on_feedback(uint64_t timestamp) noexcept
+  {
+    ++m_totals.feedback_words;
+    note(timestamp);
+  }
+
+  void on_hlt(uint64_t timestamp, uint64_t trigger_word) noexcept
+  {
+    note(timestamp);
+    auto& bin = bin_of(timestamp);
+    ++m_totals.hlt_words;
+    ++bin.hlts;
+    count(trigger_word, m_totals.hlt);
+    if (m_in_spill) {
+      ++m_totals.spill_hlt_words;
+      ++bin.spill_hlts;
+      count(trigger_word, m_totals.spill_hlt);
+    }
+  }
+
+  void on_llt(uint64_t timestamp, uint64_t trigger_word) noexcept
+  {
+    note(timestamp);
+    ++m_totals.llt_words;
+    ++bin_of(timestamp).llts;
+    count(trigger_word, m_totals.llt);
+    if (m_in_spill) {
+      ++m_totals.spill_llt_words;
+      count(trigger_word, m_totals.spill_llt);
+    }
+  }
+
+  /// Channel status words only carry 60 timestamp bits: they are placed at the last full timestamp
+  void on_channel_status(uint64_t beam) noexcept
+  {
+    ++m_totals.channel_status_words;
+    ++bin_of(m_totals.last_timestamp).channel_status;
+
+    const bool in_spill = m_spill_mask != 0 && (beam & m_spill_mask) == m_spill_mask;
+    if (in_spill == m_in_spill) {
+      return;
+    }
+    m_in_spill = in_spill;
+    if (in_spill) {
+      ++m_totals.n_spills;
+      m_spill_start = m_totals.last_timestamp;
+    } else {
+      m_totals.spill_ticks += m_totals.last_timestamp - m_spill_start;
+    }
+  }
+
+  // Once the readout thread stopped
+
+  void set_unmatched(uint64_t unmatched_hlts, uint64_t unmatched_llts) noexcept
+  {
+    m_totals.unmatched_hlts = unmatched_hlts;
+    m_totals.unmatched_llts = unmatched_llts;
+  }
+
+  /// Totals of the run, a spill still open is counted up to the last timestamp
+  Totals totals() const noexcept
+  {
+    Totals totals = m_totals;
+    if (m_in_spill) {
+      totals.spill_ticks += totals.last_timestamp - m_spill_start;
+    }
+    return totals;
+  }
+
+  std::size_t n_bins() const noexcept { return m_n_bins; }
+
+  /// The triggers are named after their bit, like the ids of the board configuration
+  nlohmann::json to_json() const
+  {
+    const Totals t = totals();
+    const double duration = double(t.last_timestamp - t.first_timestamp) / run_summary::s_ticks_per_second;
+    const double spill = double(t.spill_ticks) / run_summary::s_ticks_per_second;
+
+    auto rate = [](uint64_t count, double seconds) { return seconds > 0 ? count / seconds : 0.; };
+    auto level = [&](const char* prefix,
+                     uint64_t words,
+                     uint64_t spill_words,
+                     uint64_t unmatched,
+                     const auto& counts,
+                     const auto& spill_counts) {
+      nlohmann::json j;
+      j["total"] = words;
+      j["in_spill"] = spill_words;
+      j["unmatched"] = unmatched;
+      j["rate"] = rate(words, duration);
+      j["in_spill_rate"] = rate(spill_words, spill);
+      j["off_spill_rate"] = rate(words - spill_words, duration - spill);
+      nlohmann::json triggers = nlohmann::json::object();
+      for (std::size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] == 0) {
+          continue;
+        }
+        triggers[prefix + std::to_string(i)] = { { "bit", i },
+                           { "count", counts[i] },
+                           { "in_spill", spill_counts[i] },
+                           { "rate", rate(counts[i], duration) },
+                           { "in_spill_rate", rate(spill_counts[i], spill) } };
+      }
+      j["triggers"] = triggers;
+      return j;
+    };
+
+    nlohmann::json j;
+    j["run"] = m_run_number;
+    j["first_timestamp"] = t.first_timestamp;
+    j["last_timestamp"] = t.last_timestamp;
+    j["duration"] = duration;
+    j["words"] = { { "timestamp", t.ts_words },
+                   { "channel_status", t.channel_status_words },
+                   { "feedback", t.feedback_words } };
+    j["spill"] = { { "mask", m_spill_mask }, { "count", t.n_spills }, { "duration", spill } };
+    j["hlt"] = level("HLT_", t.hlt_words, t.spill_hlt_words, t.unmatched_hlts, t.hlt, t.spill_hlt);
+    j["llt"] = level("LLT_", t.llt_words, t.spill_llt_words, t.unmatched_llts, t.llt, t.spill_llt);
+
+    // one column per quantity, one entry per minute
+    nlohmann::json bins;
+    bins["seconds"] = run_summary::s_ticks_per_bin / run_summary::s_ticks_per_second;
+    for (const char* column : { "hlt", "llt", "spill_hlt", "channel_status" }) {
+      bins[column] = nlohmann::json::array();
+    }
+    for (std::size_t i = 0; i < m_n_bins; ++i) {
+      bins["hlt"].push_back(m_bins[i].hlts);
+      bins["llt"].push_back(m_bins[i].llts);
+      bins["spill_hlt"].push_back(m_bins[i].spill_hlts);
+      bins["channel_status"].push_back(m_bins[i].channel_status);
+    }
+    j["minutes"] = bins;
+    return j;
+  }
+
+  void write_binary(std::ostream& out) const
+  {
+    run_summary::Header header;
+    header.n_hlt_bits = NHlt;
+    header.n_llt_bits = NLlt;
+    header.run_number = m_run_number;
+    header.n_bins = m_n_bins;
+    header.spill_mask = m_spill_mask;
+    const Totals t = totals();
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&t), sizeof(t));
+    out.write(reinterpret_cast<const char*>(m_bins.data()), m_n_bins * sizeof(run_summary::Bin));
+  }
+
+private:
+  void note(uint64_t timestamp) noexcept
+  {
+    if (m_totals.first_timestamp == 0) {
+      m_totals.first_timestamp = timestamp;
+    }
+    m_totals.last_timestamp = std::max(m_totals.last_timestamp, timestamp);
+  }
+
+  run_summary::Bin& bin_of(uint64_t timestamp) noexcept
+  {
+    const uint64_t elapsed = timestamp > m_totals.first_timestamp ? timestamp - m_totals.first_timestamp : 0;
+    const std::size_t i = std::min<uint64_t>(elapsed / run_summary::s_ticks_per_bin, run_summary::s_max_bins - 1);
+    m_n_bins = std::max(m_n_bins, i + 1);
+    return m_bins[i];
+  }
+
+  template<std::size_t N>
+  static void count(uint64_t trigger_word, std::array<uint64_t, N>& counts) noexcept
+  {
+    constexpr uint64_t mask = N >= 64 ? ~uint64_t(0) : (uint64_t(1) << N) - 1;
+    for (uint64_t bits = trigger_word & mask; bits; bits &= bits - 1) {
+      ++counts[__builtin_ctzll(bits)];
+    }
+  }
+
+  uint32_t m_run_number = 0;
+  uint64_t m_spill_mask = 0;
+  Totals m_totals;
+  std::array<run_summary::Bin, run_summary::s_max_bins> m_bins = {};
+  std::size_t m_n_bins = 0;
+  bool m_in_spill = false;
+  uint64_t m_spill_start = 0;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_RUNSUMMARY_HPP_
@@ -0,0 +1,122 @@
+/**
+ * @file SPSCRing.hpp
+ *
+ * SPSCRing is a bounded, lock-free, single-producer single-consumer ring of
+ * preallocated slots, used to hand data between the CTBModule threads.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_SPSCRING_HPP_
+#define CTBMODULES_SRC_SPSCRING_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Bounded single-producer single-consumer ring
+ *
+ * Slots are constructed once and handed out in place: the producer fills the slot
+ * returned by write_slot() and publishes it with commit_write(), the consumer
+ * reads the slot returned by read_slot() and releases it with commit_read().
+ * Slots keep their state across uses, so slots holding containers keep their
+ * capacity and the steady state does not allocate.
+ */
+template<typename T>
+class SPSCRing
+{
+public:
+  explicit SPSCRing(std::size_t capacity)
+    : m_slots(round_up(capacity))
+    , m_mask(m_slots.size() - 1)
+  {}
+
+  SPSCRing(const SPSCRing&) = delete;            ///< SPSCRing is not copy-constructible
+  SPSCRing& operator=(const SPSCRing&) = delete; ///< SPSCRing is not copy-assignable
+  SPSCRing(SPSCRing&&) = delete;                 ///< SPSCRing is not move-constructible
+  SPSCRing& operator=(SPSCRing&&) = delete;      ///< SPSCRing is not move-assignable
+
+  // Producer side
+
+  /// @return the next free slot, or nullptr if the ring is full
+  T* write_slot() noexcept
+  {
+    const std::size_t write_index = m_write_index.load(std::memory_order_relaxed);
+    if (write_index - m_cached_read_index > m_mask) {
+      m_cached_read_index = m_read_index.load(std::memory_order_acquire);
+      if (write_index - m_cached_read_index > m_mask) {
+        return nullptr;
+      }
+    }
+    return &m_slots[write_index & m_mask];
+  }
+
+  void commit_write() noexcept
+  {
+    m_write_index.store(m_write_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumer side
+
+  /// @return the oldest filled slot, or nullptr if the ring is empty
+  T* read_slot() noexcept
+  {
+    const std::size_t read_index = m_read_index.load(std::memory_order_relaxed);
+    if (read_index == m_cached_write_index) {
+      m_cached_write_index = m_write_index.load(std::memory_order_acquire);
+      if (read_index == m_cached_write_index) {
+        return nullptr;
+      }
+    }
+    return &m_slots[read_index & m_mask];
+  }
+
+  void commit_read() noexcept
+  {
+    m_read_index.store(m_read_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Either side, approximate while the other side is active
+
+  std::size_t size() const noexcept
+  {
+    // the read index first: the consumer only moves it up to a write index it saw, so the
+    // write index loaded after it is never behind; the producer may have gone on meanwhile
+    const std::size_t read_index = m_read_index.load(std::memory_order_acquire);
+    const std::size_t write_index = m_write_index.load(std::memory_order_acquire);
+    return std::min(write_index - read_index, capacity());
+  }
+
+  std::size_t capacity() const noexcept { return m_slots.size(); }
+
+private:
+  static std::size_t round_up(std::size_t capacity) noexcept
+  {
+    std::size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    return n;
+  }
+
+  std::vector<T> m_slots;
+  const std::size_t m_mask;
+
+  alignas(64) std::atomic<std::size_t> m_write_index{ 0 };
+  std::size_t m_cached_read_index = 0; // producer only
+
+  alignas(64) std::atomic<std::size_t> m_read_index{ 0 };
+  std::size_t m_cached_write_index = 0; // consumer only
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_SPSCRING_HPP_
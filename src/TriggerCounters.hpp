@@ -0,0 +1,151 @@
+/**
+ * @file TriggerCounters.hpp
+ *
+ * TriggerCounters counts the trigger words received by the CTBModule, per
+ * trigger bit, for the monitoring and for the run trigger report.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_TRIGGERCOUNTERS_HPP_
+#define CTBMODULES_SRC_TRIGGERCOUNTERS_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Dense per-bit trigger counters
+ *
+ * The readout thread calls count() for each trigger word: it only visits the
+ * bits set in the word, and bumps one monotonic counter per bit with relaxed
+ * loads and stores. The counters of consecutive bits share cache lines and the
+ * whole block is aligned to a cache line.
+ *
+ * Interval and per-run counts are differences against baselines kept on the
+ * reader side: take_snapshot() returns both from the same read of the counters
+ * and starts a new interval, run_snapshot() leaves the interval untouched.
+ */
+template<std::size_t NBits>
+class TriggerCounters
+{
+  static_assert(NBits > 0 && NBits <= 64, "trigger words have at most 64 bits");
+
+public:
+  static constexpr std::size_t s_n_bits = NBits;
+
+  struct Snapshot
+  {
+    uint64_t interval_words = 0; ///< trigger words since the previous take_snapshot()
+    uint64_t run_words = 0;      ///< trigger words since start_run()
+    std::array<uint64_t, NBits> interval = {};
+    std::array<uint64_t, NBits> run = {};
+  };
+
+  TriggerCounters() noexcept
+  {
+    for (auto& c : m_counts) {
+      c.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  TriggerCounters(const TriggerCounters&) = delete;            ///< TriggerCounters is not copy-constructible
+  TriggerCounters& operator=(const TriggerCounters&) = delete; ///< TriggerCounters is not copy-assignable
+  TriggerCounters(TriggerCounters&&) = delete;                 ///< TriggerCounters is not move-constructible
+  TriggerCounters& operator=(TriggerCounters&&) = delete;      ///< TriggerCounters is not move-assignable
+
+  /// Bits reported by the monitoring, the others are still counted
+  void set_enabled(uint64_t mask) noexcept { m_enabled.store(mask & s_bit_mask, std::memory_order_relaxed); }
+  uint64_t enabled() const noexcept { return m_enabled.load(std::memory_order_relaxed); }
+  bool is_enabled(std::size_t bit) const noexcept { return (enabled() >> bit) & 0x1; }
+
+  /// Writer side, must always be called from the same thread
+  void count(uint64_t trigger_word) noexcept
+  {
+    m_words.store(m_words.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    for (uint64_t bits = trigger_word & s_bit_mask; bits; bits &= bits - 1) {
+      auto& c = m_counts[__builtin_ctzll(bits)];
+      c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+  }
+
+  /// Starts the per-run counts from the current values
+  void start_run() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_reader_mutex);
+    read(m_run_start_words, m_run_start);
+  }
+
+  /// Interval and run counts, from one read of the counters. Starts a new interval
+  Snapshot take_snapshot() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_reader_mutex);
+    uint64_t words;
+    std::array<uint64_t, NBits> counts;
+    read(words, counts);
+
+    Snapshot snapshot = make_run_snapshot(words, counts);
+    snapshot.interval_words = words - m_interval_start_words;
+    for (std::size_t i = 0; i < NBits; ++i) {
+      snapshot.interval[i] = counts[i] - m_interval_start[i];
+    }
+    m_interval_start_words = words;
+    m_interval_start = counts;
+    return snapshot;
+  }
+
+  /// Run counts only, the interval counts are left to the next take_snapshot()
+  Snapshot run_snapshot() noexcept
+  {
+    std::lock_guard<std::mutex> lock(m_reader_mutex);
+    uint64_t words;
+    std::array<uint64_t, NBits> counts;
+    read(words, counts);
+    return make_run_snapshot(words, counts);
+  }
+
+private:
+  static constexpr uint64_t s_bit_mask = NBits == 64 ? ~uint64_t(0) : (uint64_t(1) << NBits) - 1;
+
+  void read(uint64_t& words, std::array<uint64_t, NBits>& counts) const noexcept
+  {
+    words = m_words.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < NBits; ++i) {
+      counts[i] = m_counts[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  Snapshot make_run_snapshot(uint64_t words, const std::array<uint64_t, NBits>& counts) const noexcept
+  {
+    Snapshot snapshot;
+    snapshot.run_words = words - m_run_start_words;
+    for (std::size_t i = 0; i < NBits; ++i) {
+      snapshot.run[i] = counts[i] - m_run_start[i];
+    }
+    return snapshot;
+  }
+
+  // written by the readout thread only
+  alignas(64) std::array<std::atomic<uint64_t>, NBits> m_counts;
+  std::atomic<uint64_t> m_words{ 0 };
+
+  // reader side
+  alignas(64) std::atomic<uint64_t> m_enabled{ 0 };
+  std::mutex m_reader_mutex; // between get_info and the run commands, never taken by count()
+  uint64_t m_run_start_words = 0;
+  uint64_t m_interval_start_words = 0;
+  std::array<uint64_t, NBits> m_run_start = {};
+  std::array<uint64_t, NBits> m_interval_start = {};
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_TRIGGERCOUNTERS_HPP_
@@ -0,0 +1,295 @@
+/**
+ * @file TriggerRates.hpp
+ *
+ * TriggerRates estimates the rate of each trigger bit over sliding windows of
+ * CTB time, for the monitoring.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_TRIGGERRATES_HPP_
+#define CTBMODULES_SRC_TRIGGERRATES_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Sliding window trigger rates in CTB time
+ *
+ * The trigger words are counted in a ring of buckets of 100 ms of CTB time, each
+ * tagged with the number of the period it holds. The rates are sums over the last
+ * complete buckets divided by their duration, so they do not depend on when they
+ * are read. Timestamp words move the time forward when there are no triggers.
+ *
+ * Per spill, the counts of the current spill restart when the spill gate opens
+ * and are kept with its duration when it closes.
+ *
+ * count(), advance() and on_channel_status() must always be called from the same
+ * thread; rates() can be called from any other one, without locks: a bucket that
+ * is recycled while it is read is detected with its tag and left out.
+ */
+template<std::size_t NBits>
+class TriggerRates
+{
+  static_assert(NBits > 0 && NBits <= 64, "trigger words have at most 64 bits");
+
+public:
+  static constexpr uint64_t s_bucket_ticks = 6250000; ///< 100 ms of the 62.5 MHz CTB clock
+  static constexpr std::size_t s_n_buckets = 640;
+  static constexpr std::size_t s_max_window_buckets = s_n_buckets - 2; // one filling, one being recycled
+
+  /// In Hz; bit NBits is the trigger words themselves
+  struct Rates
+  {
+    double instantaneous = 0.; ///< last complete bucket
+    double short_window = 0.;
+    double long_window = 0.;
+    double last_spill = 0.; ///< over the last complete spill
+  };
+  using Snapshot = std::array<Rates, NBits + 1>;
+
+  TriggerRates() { clear(); }
+
+  TriggerRates(const TriggerRates&) = delete;            ///< TriggerRates is not copy-constructible
+  TriggerRates& operator=(const TriggerRates&) = delete; ///< TriggerRates is not copy-assignable
+  TriggerRates(TriggerRates&&) = delete;                 ///< TriggerRates is not move-constructible
+  TriggerRates& operator=(TriggerRates&&) = delete;      ///< TriggerRates is not move-assignable
+
+  /// Windows are rounded to whole buckets; clears the counts, not to be called while counting
+  void configure(std::chrono::milliseconds short_window, std::chrono::milliseconds long_window, uint64_t spill_mask)
+  {
+    m_short_buckets = buckets_of(short_window);
+    m_long_buckets = std::max(buckets_of(long_window), m_short_buckets);
+    m_spill_mask = spill_mask;
+    clear();
+  }
+
+  /// Clears the counts, not to be called while counting
+  void clear() noexcept
+  {
+    for (auto& bucket : m_buckets) {
+      bucket.tag.store(s_no_tag, std::memory_order_relaxed);
+      for (auto& c : bucket.counts) {
+        c.store(0, std::memory_order_relaxed);
+      }
+    }
+    for (auto& c : m_spill_counts) {
+      c = 0;
+    }
+    for (auto& c : m_last_spill_counts) {
+      c.store(0, std::memory_order_relaxed);
+    }
+    m_last_spill_ticks.store(0, std::memory_order_relaxed);
+    m_now.store(0, std::memory_order_relaxed);
+    m_first_bucket.store(s_no_tag, std::memory_order_relaxed);
+    m_in_spill = false;
+  }
+
+  // Writer side
+
+  void advance(uint64_t timestamp) noexcept
+  {
+    if (timestamp > m_now.load(std::memory_order_relaxed)) {
+      m_now.store(timestamp, std::memory_order_relaxed);
+      if (m_first_bucket.load(std::memory_order_relaxed) == s_no_tag) {
+        m_first_bucket.store(timestamp / s_bucket_ticks, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void count(uint64_t timestamp, uint64_t trigger_word) noexcept
+  {
+    advance(timestamp);
+
+    // too late for any window
+    const uint64_t period = timestamp / s_bucket_ticks;
+    if (period + s_max_window_buckets < m_now.load(std::memory_order_relaxed) / s_bucket_ticks) {
+      return;
+    }
+
+    auto& counts = bucket(period).counts;
+    const uint64_t bits = (trigger_word & s_bit_mask) | uint64_t(1) << NBits;
+    for (uint64_t b = bits; b; b &= b - 1) {
+      auto& c = counts[__builtin_ctzll(b)];
+      c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    if (m_in_spill) {
+      for (uint64_t b = bits; b; b &= b - 1) {
+        ++m_spill_counts[__builtin_ctzll(b)];
+      }
+    }
+  }
+
+  /// Channel status words carry the spill gate in their beam bits; the time is the last full timestamp
+  void on_channel_status(uint64_t beam) noexcept
+  {
+    const bool in_spill = m_spill_mask != 0 && (beam & m_spill_mask) == m_spill_mask;
+    if (in_spill == m_in_spill) {
+      return;
+    }
+    m_in_spill = in_spill;
+
+    const uint64_t now = m_now.load(std::memory_order_relaxed);
+    if (in_spill) {
+      m_spill_start = now;
+      m_spill_counts.fill(0);
+      return;
+    }
+
+    // a seqlock: odd while the last spill is being replaced
+    m_spill_sequence.store(m_spill_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i <= NBits; ++i) {
+      m_last_spill_counts[i].store(m_spill_counts[i], std::memory_order_relaxed);
+    }
+    m_last_spill_ticks.store(now - m_spill_start, std::memory_order_relaxed);
+    m_spill_sequence.store(m_spill_sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Reader side
+
+  Snapshot rates() const noexcept
+  {
+    Snapshot snapshot;
+    const uint64_t now = m_now.load(std::memory_order_relaxed) / s_bucket_ticks;
+    const uint64_t first = m_first_bucket.load(std::memory_order_relaxed);
+    if (first == s_no_tag || now <= first) {
+      return snapshot;
+    }
+
+    // complete buckets only, and none from before the data started
+    const std::size_t available = std::min<uint64_t>(now - first, s_max_window_buckets);
+    const std::size_t n_short = std::min(m_short_buckets, available);
+    const std::size_t n_long = std::min(m_long_buckets, available);
+
+    std::array<uint64_t, NBits + 1> counts;
+    std::array<uint64_t, NBits + 1> sums = {};
+    for (std::size_t n = 1; n <= n_long; ++n) {
+      if (read_bucket(now - n, counts)) {
+        for (std::size_t i = 0; i <= NBits; ++i) {
+          sums[i] += counts[i];
+        }
+      }
+      if (n == 1 || n == n_short) {
+        for (std::size_t i = 0; i <= NBits; ++i) {
+          (n == 1 ? snapshot[i].instantaneous : snapshot[i].short_window) = sums[i] / s_bucket_seconds / n;
+        }
+      }
+      if (n == 1 && n_short == 1) {
+        for (std::size_t i = 0; i <= NBits; ++i) {
+          snapshot[i].short_window = snapshot[i].instantaneous;
+        }
+      }
+    }
+    for (std::size_t i = 0; i <= NBits; ++i) {
+      snapshot[i].long_window = sums[i] / s_bucket_seconds / n_long;
+    }
+
+    uint64_t spill_ticks;
+    std::array<uint64_t, NBits + 1> spill_counts;
+    uint64_t before, after;
+    do {
+      before = m_spill_sequence.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i <= NBits; ++i) {
+        spill_counts[i] = m_last_spill_counts[i].load(std::memory_order_relaxed);
+      }
+      spill_ticks = m_last_spill_ticks.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = m_spill_sequence.load(std::memory_order_relaxed);
+    } while (before != after || (before & 1));
+    if (spill_ticks > 0) {
+      for (std::size_t i = 0; i <= NBits; ++i) {
+        snapshot[i].last_spill = spill_counts[i] * s_ticks_per_second / double(spill_ticks);
+      }
+    }
+
+    return snapshot;
+  }
+
+  std::chrono::milliseconds short_window() const noexcept { return duration_of(m_short_buckets); }
+  std::chrono::milliseconds long_window() const noexcept { return duration_of(m_long_buckets); }
+
+private:
+  static constexpr uint64_t s_bit_mask = NBits == 64 ? ~uint64_t(0) : (uint64_t(1) << NBits) - 1;
+  static constexpr uint64_t s_no_tag = ~uint64_t(0);
+  static constexpr double s_ticks_per_second = 62.5e6;
+  static constexpr double s_bucket_seconds = s_bucket_ticks / s_ticks_per_second;
+
+  struct alignas(64) Bucket
+  {
+    std::atomic<uint64_t> tag; // period held, s_no_tag while it is recycled
+    std::array<std::atomic<uint64_t>, NBits + 1> counts;
+  };
+
+  static std::size_t buckets_of(std::chrono::milliseconds window) noexcept
+  {
+    const auto n = std::chrono::duration_cast<std::chrono::milliseconds>(window).count() * 62500 / int64_t(s_bucket_ticks);
+    return std::clamp<int64_t>(n, 1, s_max_window_buckets);
+  }
+
+  static std::chrono::milliseconds duration_of(std::size_t n_buckets) noexcept
+  {
+    return std::chrono::milliseconds(n_buckets * s_bucket_ticks / 62500);
+  }
+
+  Bucket& bucket(uint64_t period) noexcept
+  {
+    Bucket& b = m_buckets[period % s_n_buckets];
+    if (b.tag.load(std::memory_order_relaxed) != period) {
+      b.tag.store(s_no_tag, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (auto& c : b.counts) {
+        c.store(0, std::memory_order_relaxed);
+      }
+      b.tag.store(period, std::memory_order_release);
+    }
+    return b;
+  }
+
+  /// @return false if the bucket does not hold period, the counts are then zero
+  bool read_bucket(uint64_t period, std::array<uint64_t, NBits + 1>& counts) const noexcept
+  {
+    const Bucket& b = m_buckets[period % s_n_buckets];
+    const uint64_t before = b.tag.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i <= NBits; ++i) {
+      counts[i] = b.counts[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (before != period || b.tag.load(std::memory_order_relaxed) != period) {
+      counts.fill(0);
+      return false;
+    }
+    return true;
+  }
+
+  std::size_t m_short_buckets = 10;
+  std::size_t m_long_buckets = 100;
+  uint64_t m_spill_mask = 0;
+
+  std::vector<Bucket> m_buckets = std::vector<Bucket>(s_n_buckets);
+  std::atomic<uint64_t> m_now{ 0 };
+  std::atomic<uint64_t> m_first_bucket{ s_no_tag };
+
+  // spills: the current one belongs to the writer, the last one is shared
+  bool m_in_spill = false;
+  uint64_t m_spill_start = 0;
+  std::array<uint64_t, NBits + 1> m_spill_counts = {};
+  std::atomic<uint64_t> m_spill_sequence{ 0 };
+  std::array<std::atomic<uint64_t>, NBits + 1> m_last_spill_counts;
+  std::atomic<uint64_t> m_last_spill_ticks{ 0 };
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_TRIGGERRATES_HPP_
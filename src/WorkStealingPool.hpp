@@ -0,0 +1,131 @@
+/**
+ * @file WorkStealingPool.hpp
+ *
+ * WorkStealingPool runs a numbered list of tasks on a fixed number of threads,
+ * the idle threads taking work from the busy ones.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef CTBMODULES_SRC_WORKSTEALINGPOOL_HPP_
+#define CTBMODULES_SRC_WORKSTEALINGPOOL_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dunedaq {
+namespace ctbmodules {
+
+/**
+ * @brief Pool of threads with one task queue each
+ *
+ * start() deals the task numbers round robin to the queues of the threads. Each
+ * thread takes the tasks of its own queue from the front; once it is empty, it
+ * steals the front task of the longest other queue. The lowest numbered tasks
+ * are therefore always the next ones started, which lets a consumer of the
+ * results take them in order while the tasks have very different durations.
+ *
+ * The threads live from start() to wait(). The tasks must not throw.
+ */
+class WorkStealingPool
+{
+public:
+  explicit WorkStealingPool(std::size_t n_threads)
+    : m_queues(std::max<std::size_t>(n_threads, 1))
+  {}
+
+  ~WorkStealingPool() { wait(); }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;            ///< WorkStealingPool is not copy-constructible
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete; ///< WorkStealingPool is not copy-assignable
+  WorkStealingPool(WorkStealingPool&&) = delete;                 ///< WorkStealingPool is not move-constructible
+  WorkStealingPool& operator=(WorkStealingPool&&) = delete;      ///< WorkStealingPool is not move-assignable
+
+  std::size_t n_threads() const noexcept { return m_queues.size(); }
+
+  /// Runs task(i) for i from 0 to n_tasks - 1, returns at once
+  void start(std::size_t n_tasks, std::function<void(std::size_t)> task)
+  {
+    wait();
+    m_task = std::move(task);
+    for (std::size_t i = 0; i < n_tasks; ++i) {
+      m_queues[i % m_queues.size()].tasks.push_back(i);
+    }
+    for (std::size_t t = 0; t < m_queues.size(); ++t) {
+      m_threads.emplace_back([this, t] { work(t); });
+    }
+  }
+
+  /// Returns once all the tasks ran
+  void wait()
+  {
+    for (auto& thread : m_threads) {
+      thread.join();
+    }
+    m_threads.clear();
+  }
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<std::size_t> tasks;
+  };
+
+  void work(std::size_t own)
+  {
+    std::size_t task;
+    while (take(own, task) || steal(own, task)) {
+      m_task(task);
+    }
+  }
+
+  bool take(std::size_t queue, std::size_t& task)
+  {
+    std::lock_guard<std::mutex> lock(m_queues[queue].mutex);
+    if (m_queues[queue].tasks.empty()) {
+      return false;
+    }
+    task = m_queues[queue].tasks.front();
+    m_queues[queue].tasks.pop_front();
+    return true;
+  }
+
+  bool steal(std::size_t own, std::size_t& task)
+  {
+    // tasks are never added while the threads run: once all the queues are seen empty, the work is done
+    while (true) {
+      std::size_t victim = own;
+      std::size_t longest = 0;
+      for (std::size_t q = 0; q < m_queues.size(); ++q) {
+        std::lock_guard<std::mutex> lock(m_queues[q].mutex);
+        if (q != own && m_queues[q].tasks.size() > longest) {
+          victim = q;
+          longest = m_queues[q].tasks.size();
+        }
+      }
+      if (longest == 0) {
+        return false;
+      }
+      if (take(victim, task)) {
+        return true;
+      }
+    }
+  }
+
+  std::vector<Queue> m_queues;
+  std::vector<std::thread> m_threads;
+  std::function<void(std::size_t)> m_task;
+};
+
+} // namespace ctbmodules
+} // namespace dunedaq
+
+#endif // CTBMODULES_SRC_WORKSTEALINGPOOL_HPP_
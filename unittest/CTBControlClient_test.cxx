@@ -0,0 +1,136 @@
+/**
+ * @file CTBControlClient_test.cxx Test the framing of the CTB control replies
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBControlClient.hpp"
+
+#define BOOST_TEST_MODULE CTBControlClient_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+
+namespace {
+
+/// Scans prefixes of text of increasing length, as successive reads into a growing buffer would
+std::size_t
+frame_in_steps(const std::string& text, std::size_t step)
+{
+  CTBControlClient::JSONFramer framer;
+  for (std::size_t size = std::min(step, text.size());; size = std::min(size + step, text.size())) {
+    if (framer.scan(text.data(), size)) {
+      return framer.size();
+    }
+    if (size == text.size()) {
+      return 0;
+    }
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(CTBControlClient_test)
+
+BOOST_AUTO_TEST_CASE(WholeDocument)
+{
+  const std::string reply = R"({"feedback":[{"type":"info","message":"Run started"}]})";
+  CTBControlClient::JSONFramer framer;
+  BOOST_REQUIRE(framer.scan(reply.data(), reply.size()));
+  BOOST_CHECK_EQUAL(framer.size(), reply.size());
+}
+
+BOOST_AUTO_TEST_CASE(BracesInsideStrings)
+{
+  const std::string reply = R"({"feedback":[{"type":"error","message":"bad value } in { field ] of [ config"}]})";
+  const std::string next = R"({"feedback":[]})";
+  CTBControlClient::JSONFramer framer;
+  const std::string stream = reply + next;
+  BOOST_REQUIRE(framer.scan(stream.data(), stream.size()));
+  BOOST_CHECK_EQUAL(framer.size(), reply.size());
+}
+
+BOOST_AUTO_TEST_CASE(EscapedQuotes)
+{
+  const std::string reply = R"({"message":"the \"}\" is quoted, so is \\","type":"warning"})";
+  CTBControlClient::JSONFramer framer;
+  const std::string stream = reply + "{}";
+  BOOST_REQUIRE(framer.scan(stream.data(), stream.size()));
+  BOOST_CHECK_EQUAL(framer.size(), reply.size());
+}
+
+BOOST_AUTO_TEST_CASE(LeadingBytes)
+{
+  const std::string reply = R"({"a":[1,2,{"b":3}]})";
+  const std::string stream = " \r\n" + reply;
+  CTBControlClient::JSONFramer framer;
+  BOOST_REQUIRE(framer.scan(stream.data(), stream.size()));
+  BOOST_CHECK_EQUAL(framer.size(), stream.size());
+}
+
+BOOST_AUTO_TEST_CASE(SplitAcrossReads)
+{
+  // every split point, inside strings and escapes included
+  const std::string reply = R"({"feedback":[{"type":"info","message":"a \"{\" and a \\"},{"type":"info","message":"]"}]})";
+  const std::string stream = reply + R"({"x":1})";
+  for (std::size_t step = 1; step <= stream.size(); ++step) {
+    BOOST_CHECK_EQUAL(frame_in_steps(stream, step), reply.size());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(IncompleteDocument)
+{
+  const std::string partial = R"({"feedback":[{"message":"}"})";
+  CTBControlClient::JSONFramer framer;
+  BOOST_CHECK(!framer.scan(partial.data(), partial.size()));
+}
+
+BOOST_AUTO_TEST_CASE(ReplySplitBySender)
+{
+  using tcp = boost::asio::ip::tcp;
+  boost::asio::io_service server_ios;
+  tcp::acceptor acceptor(server_ios, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+  const tcp::endpoint endpoint = acceptor.local_endpoint();
+
+  const std::string first = R"({"feedback":[{"type":"info","message":"configured {ok}"}]})";
+  const std::string second = R"({"feedback":[{"type":"info","message":"started"}]})";
+
+  // the first reply in three writes, the second one in the same write as the end of the first
+  std::thread server([&] {
+    tcp::socket socket(server_ios);
+    acceptor.accept(socket);
+    std::vector<char> request(256);
+    socket.read_some(boost::asio::buffer(request));
+    boost::asio::write(socket, boost::asio::buffer(first.substr(0, 10)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    boost::asio::write(socket, boost::asio::buffer(first.substr(10, 30)));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    boost::asio::write(socket, boost::asio::buffer(first.substr(40) + second));
+    socket.read_some(boost::asio::buffer(request));
+  });
+
+  boost::asio::io_service ios;
+  CTBControlClient client(ios);
+  client.set_endpoint(endpoint);
+  std::string reply;
+  BOOST_REQUIRE(!client.transact(R"({"command":"config"})", reply, std::chrono::milliseconds(2000)));
+  BOOST_CHECK_EQUAL(reply, first);
+  BOOST_REQUIRE(!client.transact(R"({"command":"StartRun"})", reply, std::chrono::milliseconds(2000)));
+  BOOST_CHECK_EQUAL(reply, second);
+  BOOST_CHECK_EQUAL(client.connections(), 1u);
+  BOOST_CHECK_EQUAL(client.timeouts(), 0u);
+
+  server.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,148 @@
+/**
+ * @file CTBStreamDecoder_test.cxx Test the handler calls of the word by word and per packet decoding
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBStreamDecoder.hpp"
+#include "CTBWordGenerator.hpp"
+
+#define BOOST_TEST_MODULE CTBStreamDecoder_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <tuple>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+
+namespace {
+
+/// Records every call: word type, both lanes and the matched payload
+struct RecordingHandler
+{
+  using call_t = std::tuple<unsigned, uint64_t, uint64_t, uint64_t>;
+  std::vector<call_t> calls;
+  std::size_t stop_after = ~std::size_t(0); // number of calls after which a stop is requested
+
+  bool stop_requested() const { return calls.size() >= stop_after; }
+  void on_ts_word(const codec::CTBWord& w) { add(w, 0); }
+  void on_feedback_word(const codec::CTBWord& w) { add(w, 0); }
+  void on_channel_status(const codec::CTBWord& w) { add(w, 0); }
+  void on_llt(const codec::CTBWord& w, uint64_t channel_payload) { add(w, channel_payload); }
+  void on_hlt(const codec::CTBWord& w, uint64_t llt_payload) { add(w, llt_payload); }
+
+  void add(const codec::CTBWord& w, uint64_t payload) { calls.emplace_back(w.word_type(), w.lane(0), w.lane(1), payload); }
+};
+
+std::vector<content::word::word_t>
+stream(uint32_t seed)
+{
+  CTBWordGenerator::Config config;
+  config.seed = seed;
+  config.channel_status_rate = 5000;
+  config.llt_rate = 20000;
+  config.hlt_rate = 5000;
+  config.match_failure_fraction = 0.1;
+  config.burst_size = 3;
+  std::vector<content::word::word_t> words;
+  CTBWordGenerator(config).generate(50000, words);
+  return words;
+}
+
+RecordingHandler
+run(const std::vector<content::word::word_t>& words, std::size_t packet_words, bool batch, CTBStreamDecoder::Dispatch dispatch)
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(words.data());
+  CTBStreamDecoder decoder;
+  RecordingHandler handler;
+  for (std::size_t first = 0; first < words.size(); first += packet_words) {
+    const std::size_t n = std::min(packet_words, words.size() - first);
+    if (batch) {
+      decoder.decode_packet(data + first * codec::CTBWord::size_bytes, n, handler, dispatch);
+    } else {
+      decoder.decode(data + first * codec::CTBWord::size_bytes, n, handler);
+    }
+  }
+  return handler;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(CTBStreamDecoder_test)
+
+BOOST_AUTO_TEST_CASE(StreamOrderDispatchIsWordByWord)
+{
+  const auto words = stream(1);
+  const auto expected = run(words, 4096, false, CTBStreamDecoder::Dispatch::kGrouped).calls;
+  for (std::size_t packet_words : { 1, 63, 64, 65, 1000, 4096 }) {
+    BOOST_CHECK(run(words, packet_words, true, CTBStreamDecoder::Dispatch::kStreamOrder).calls == expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(StreamOrderDispatchOfAnyWords)
+{
+  // every word type, checksum and unused ones included
+  auto words = stream(2);
+  std::mt19937_64 random(2);
+  for (auto& w : words) {
+    const uint64_t lanes[2] = { random() & 0xFFFFFFFFFF, random() };
+    std::memcpy(&w, lanes, sizeof(lanes));
+  }
+  const auto expected = run(words, 1000, false, CTBStreamDecoder::Dispatch::kGrouped).calls;
+  BOOST_CHECK(run(words, 1000, true, CTBStreamDecoder::Dispatch::kStreamOrder).calls == expected);
+}
+
+BOOST_AUTO_TEST_CASE(StreamOrderDispatchStopsBetweenWords)
+{
+  const auto words = stream(4);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(words.data());
+  for (std::size_t stop_after : { 0, 1, 63, 64, 100, 4095 }) {
+    CTBStreamDecoder decoder;
+    RecordingHandler expected;
+    expected.stop_after = stop_after;
+    const std::size_t n_expected = decoder.decode(data, 4096, expected);
+
+    CTBStreamDecoder batch_decoder;
+    RecordingHandler handler;
+    handler.stop_after = stop_after;
+    BOOST_CHECK_EQUAL(batch_decoder.decode_packet(data, 4096, handler, CTBStreamDecoder::Dispatch::kStreamOrder), n_expected);
+    BOOST_CHECK_EQUAL(handler.calls.size(), stop_after);
+    BOOST_CHECK(handler.calls == expected.calls);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(GroupedDispatchKeepsOrderWithinTypes)
+{
+  const auto words = stream(3);
+  const std::size_t packet_words = 500;
+  const auto expected = run(words, packet_words, false, CTBStreamDecoder::Dispatch::kGrouped).calls;
+  const auto grouped = run(words, packet_words, true, CTBStreamDecoder::Dispatch::kGrouped).calls;
+  // the generator only sends handled word types: one call per word
+  BOOST_REQUIRE_EQUAL(expected.size(), words.size());
+  BOOST_REQUIRE_EQUAL(grouped.size(), words.size());
+
+  // same calls, payloads included, but sorted by type within each packet
+  auto type_rank = [](const RecordingHandler::call_t& c) {
+    switch (std::get<0>(c)) {
+      case content::word::t_ts: return 0;
+      case content::word::t_fback: return 1;
+      case content::word::t_ch: return 2;
+      case content::word::t_lt: return 3;
+      default: return 4;
+    }
+  };
+  for (std::size_t first = 0; first < words.size(); first += packet_words) {
+    const std::size_t last = std::min(words.size(), first + packet_words);
+    std::vector<RecordingHandler::call_t> packet(expected.begin() + first, expected.begin() + last);
+    std::stable_sort(packet.begin(), packet.end(), [&](const auto& a, const auto& b) { return type_rank(a) < type_rank(b); });
+    BOOST_CHECK(std::equal(packet.begin(), packet.end(), grouped.begin() + first));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,244 @@
+/**
+ * @file CalibrationCodec_test.cxx Test the compact encoding of the calibration stream
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CalibrationCodec.hpp"
+
+#define BOOST_TEST_MODULE CalibrationCodec_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+using codec::CTBWord;
+
+namespace {
+
+std::vector<uint8_t>
+to_bytes(const std::vector<CTBWord>& words)
+{
+  std::vector<uint8_t> bytes(words.size() * CTBWord::size_bytes);
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    words[i].store(bytes.data() + i * CTBWord::size_bytes);
+  }
+  return bytes;
+}
+
+/// Encodes the words handed to the encoder in pieces of at most chunk words, as the packets of the board would be
+std::vector<uint8_t>
+encode(const std::vector<uint8_t>& words, std::size_t max_block_words = 4096, std::size_t chunk = 100)
+{
+  calibration::BlockEncoder encoder(max_block_words);
+  std::vector<uint8_t> out;
+  const std::size_t n_words = words.size() / CTBWord::size_bytes;
+  for (std::size_t i = 0; i < n_words; i += chunk) {
+    encoder.add(words.data() + i * CTBWord::size_bytes, std::min(chunk, n_words - i), out);
+  }
+  encoder.finish(out);
+  BOOST_CHECK_EQUAL(encoder.block_words(), 0u);
+  return out;
+}
+
+std::vector<uint8_t>
+decode(const std::vector<uint8_t>& encoded)
+{
+  std::vector<uint8_t> words;
+  BOOST_CHECK_EQUAL(calibration::decode_blocks(encoded.data(), encoded.size(), words), encoded.size());
+  return words;
+}
+
+calibration::BlockHeader
+header_at(const std::vector<uint8_t>& encoded, std::size_t offset)
+{
+  calibration::BlockHeader header;
+  std::memcpy(&header, encoded.data() + offset, sizeof(header));
+  return header;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(CalibrationCodec_test)
+
+BOOST_AUTO_TEST_CASE(RandomWords)
+{
+  // any 128 bits, every word type included
+  std::mt19937_64 random(11);
+  for (std::size_t chunk : { 1, 7, 1000 }) {
+    std::vector<CTBWord> words;
+    for (int i = 0; i < 5000; ++i) {
+      words.emplace_back(random(), random());
+    }
+    const auto bytes = to_bytes(words);
+    BOOST_CHECK(decode(encode(bytes, 4096, chunk)) == bytes);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TypicalStream)
+{
+  std::mt19937_64 random(3);
+  std::vector<CTBWord> words;
+  uint64_t ts = 0x1234567890;
+  for (int i = 0; i < 20000; ++i) {
+    ts += random() % 200;
+    switch (random() % 5) {
+      case 0: words.push_back(CTBWord::make_ts(ts)); break;
+      case 1: words.push_back(CTBWord::make_channel_status(ts, random() & 0xFFFF, random() & 0xFFFFFFFF, 0)); break;
+      case 2: words.push_back(CTBWord::make_trigger(ts, uint64_t(1) << (random() % 26), false)); break;
+      case 3: words.push_back(CTBWord::make_trigger(ts, uint64_t(1) << (random() % 19), true)); break;
+      default: words.push_back(CTBWord::make_feedback(ts, random() % 4, random() % 3)); break;
+    }
+  }
+  const auto bytes = to_bytes(words);
+  const auto encoded = encode(bytes);
+  BOOST_CHECK(decode(encoded) == bytes);
+  BOOST_CHECK(encoded.size() < bytes.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(Runs)
+{
+  // timestamp words every 62500 ticks take a few bytes for the whole run
+  std::vector<CTBWord> words;
+  for (uint64_t i = 0; i < 3000; ++i) {
+    words.push_back(CTBWord::make_ts(1000 + i * 62500));
+  }
+  auto bytes = to_bytes(words);
+  auto encoded = encode(bytes);
+  BOOST_CHECK(decode(encoded) == bytes);
+  BOOST_CHECK(encoded.size() < sizeof(calibration::BlockHeader) + 32);
+
+  // runs broken by a change of spacing, of payload, of beam bits and of type
+  words.clear();
+  uint64_t ts = 500;
+  for (int repeat = 0; repeat < 20; ++repeat) {
+    for (int i = 0; i < 50; ++i) {
+      words.push_back(CTBWord::make_channel_status(ts += 10, 0x3, 0xF0, 0x1));
+    }
+    for (int i = 0; i < 50; ++i) {
+      words.push_back(CTBWord::make_channel_status(ts += 12, 0x3, 0xF0, 0x1));
+    }
+    for (int i = 0; i < 30; ++i) {
+      words.push_back(CTBWord::make_channel_status(ts += 12, 0x3 | (repeat & 1) << 2, 0xF0 + repeat, 0x1));
+    }
+    for (int i = 0; i < 30; ++i) {
+      words.push_back(CTBWord::make_trigger(ts += 12, 0x2, true));
+    }
+  }
+  bytes = to_bytes(words);
+  encoded = encode(bytes, 4096, 33);
+  BOOST_CHECK(decode(encoded) == bytes);
+  BOOST_CHECK(encoded.size() < bytes.size() / 20);
+}
+
+BOOST_AUTO_TEST_CASE(VerbatimWords)
+{
+  // words of the escape type are copied, runs before and after them included
+  std::vector<CTBWord> words;
+  for (int i = 0; i < 10; ++i) {
+    words.push_back(CTBWord::make_ts(100 + i * 10));
+  }
+  const CTBWord escape(0xDEADBEEF, uint64_t(6) << 61 | 0x123456789);
+  words.push_back(escape);
+  words.push_back(escape);
+  for (int i = 10; i < 20; ++i) {
+    words.push_back(CTBWord::make_ts(100 + i * 10));
+  }
+  words.push_back(CTBWord(~uint64_t(0), ~uint64_t(0) & ~(uint64_t(1) << 61)));
+  words.push_back(CTBWord::make_ts(300));
+
+  const auto bytes = to_bytes(words);
+  for (std::size_t chunk : { 1, 5, 100 }) {
+    BOOST_CHECK(decode(encode(bytes, 4096, chunk)) == bytes);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ChannelStatusTimestampWrap)
+{
+  // the 60 bit timestamp of the channel status words wraps while the full timestamp goes on
+  const uint64_t wrap = uint64_t(1) << 60;
+  std::vector<CTBWord> words;
+  words.push_back(CTBWord::make_ts(3 * wrap - 40));
+  for (uint64_t t = 3 * wrap - 30; t < 3 * wrap + 30; t += 7) {
+    words.push_back(CTBWord::make_channel_status(t, 0xA5A5, 0x1, 0x2));
+  }
+  words.push_back(CTBWord::make_ts(3 * wrap + 40));
+  // a channel status word older than the word before it, across the wrap
+  words.push_back(CTBWord::make_channel_status(3 * wrap - 5, 0x1, 0, 0));
+  words.push_back(CTBWord::make_trigger(3 * wrap + 50, 0x4, false));
+  // and a stream that starts with one
+  words.push_back(CTBWord::make_channel_status(wrap - 1, 0xFFFF, 0xFFFFFFFF, 0x1FFFF));
+
+  const auto bytes = to_bytes(words);
+  for (std::size_t max_block_words : { 1, 3, 4096 }) {
+    const auto decoded = decode(encode(bytes, max_block_words, 4));
+    BOOST_REQUIRE(decoded == bytes);
+  }
+  const auto decoded = decode(encode(bytes));
+  // the first one past the wrap
+  const CTBWord after_wrap = CTBWord::load(decoded.data() + 6 * CTBWord::size_bytes);
+  BOOST_CHECK_EQUAL(after_wrap.ch_timestamp(), (3 * wrap + 5) & (wrap - 1));
+  BOOST_CHECK_EQUAL(after_wrap.ch_beam(), 0xA5A5u);
+}
+
+BOOST_AUTO_TEST_CASE(BlockBoundaries)
+{
+  std::vector<CTBWord> words;
+  for (uint64_t i = 0; i < 1000; ++i) {
+    words.push_back(i % 3 ? CTBWord::make_channel_status(5000 + i, i, 0, 0) : CTBWord::make_ts(5000 + i));
+  }
+  const auto bytes = to_bytes(words);
+  const auto encoded = encode(bytes, 64, 50);
+  BOOST_CHECK(decode(encoded) == bytes);
+
+  // every block decodes on its own, with the timestamp of its first word in the header
+  std::size_t offset = 0;
+  std::size_t n_words = 0;
+  while (offset < encoded.size()) {
+    const auto header = header_at(encoded, offset);
+    BOOST_REQUIRE_EQUAL(header.magic, calibration::s_block_magic);
+    BOOST_CHECK(header.n_words <= 64u);
+    BOOST_CHECK_EQUAL(header.first_timestamp, 5000 + n_words + (n_words % 3 ? 3 - n_words % 3 : 0));
+    const std::size_t block_size = sizeof(header) + header.encoded_size;
+    std::vector<uint8_t> block_words;
+    BOOST_CHECK_EQUAL(calibration::decode_blocks(encoded.data() + offset, block_size, block_words), block_size);
+    BOOST_CHECK(std::equal(block_words.begin(), block_words.end(), bytes.begin() + n_words * CTBWord::size_bytes));
+    n_words += header.n_words;
+    offset += block_size;
+  }
+  BOOST_CHECK_EQUAL(n_words, words.size());
+}
+
+BOOST_AUTO_TEST_CASE(IncompleteAndInvalidBlocks)
+{
+  std::vector<CTBWord> words;
+  for (uint64_t i = 0; i < 300; ++i) {
+    words.push_back(CTBWord::make_trigger(100 + i * 3, i, i & 1));
+  }
+  const auto bytes = to_bytes(words);
+  const auto encoded = encode(bytes, 100);
+  const std::size_t first_block = sizeof(calibration::BlockHeader) + header_at(encoded, 0).encoded_size;
+
+  // a file still being written: only the complete blocks are decoded
+  for (std::size_t size : { std::size_t(0), std::size_t(10), first_block - 1, first_block, first_block + 30 }) {
+    std::vector<uint8_t> decoded;
+    const std::size_t used = calibration::decode_blocks(encoded.data(), size, decoded);
+    BOOST_CHECK_EQUAL(used, size < first_block ? 0 : first_block);
+    BOOST_CHECK_EQUAL(decoded.size(), size < first_block ? 0 : 100 * CTBWord::size_bytes);
+  }
+
+  // a corrupted block stops the decoding
+  auto corrupted = encoded;
+  corrupted[first_block] ^= 0xFF;
+  std::vector<uint8_t> decoded;
+  BOOST_CHECK_EQUAL(calibration::decode_blocks(corrupted.data(), corrupted.size(), decoded), first_block);
+  BOOST_CHECK(std::equal(decoded.begin(), decoded.end(), bytes.begin()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
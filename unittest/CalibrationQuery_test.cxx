@@ -0,0 +1,278 @@
+/**
+ * @file CalibrationQuery_test.cxx Test the time range queries over calibration files
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBWordGenerator.hpp"
+#include "CalibrationFileReader.hpp"
+#include "CalibrationQuery.hpp"
+#include "CalibrationWriter.hpp"
+
+#define BOOST_TEST_MODULE CalibrationQuery_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+
+namespace {
+
+using key_t = std::tuple<uint64_t, uint64_t, uint64_t>; // timestamp, lanes
+
+key_t
+key(uint64_t timestamp, const codec::CTBWord& word)
+{
+  return { timestamp, word.lane(0), word.lane(1) };
+}
+
+/// Two runs, one raw and one compact, over the same time range, each in several files
+struct CalibrationFiles
+{
+  std::filesystem::path directory;
+  std::vector<key_t> words; // every word written, with its full timestamp
+  uint64_t first_timestamp = ~uint64_t(0);
+  uint64_t last_timestamp = 0;
+
+  CalibrationFiles()
+    : directory(std::filesystem::temp_directory_path() /
+                ("CalibrationQuery_test_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())))
+  {
+    std::filesystem::create_directories(directory);
+    write("run1_", 1, calibration::Encoding::kRawWords, 6 << 20);
+    write("run2_", 2, calibration::Encoding::kCompactBlocks, 1 << 20);
+    std::sort(words.begin(), words.end());
+  }
+
+  ~CalibrationFiles()
+  {
+    std::error_code error;
+    std::filesystem::remove_all(directory, error);
+  }
+
+  void write(const std::string& prefix, uint32_t seed, calibration::Encoding encoding, uint64_t max_file_bytes)
+  {
+    CTBWordGenerator::Config config;
+    config.ts_rate = 100000.;
+    config.channel_status_rate = 200000.;
+    config.llt_rate = 100000.;
+    config.hlt_rate = 20000.;
+    config.start_timestamp = 1000000 + seed * 1000;
+    config.seed = seed;
+    std::vector<content::word::word_t> generated;
+    CTBWordGenerator(config).generate(600000, generated);
+
+    CalibrationWriter writer(1024, CalibrationWriter::SyncPolicy::kNever, std::chrono::milliseconds(1000), 1 << 16, encoding);
+    CalibrationWriter::Rotation rotation;
+    rotation.max_file_bytes = max_file_bytes;
+    writer.configure_rotation(rotation);
+    writer.set_output(directory.string() + "/", prefix);
+    writer.start();
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(generated.data());
+    const std::size_t packet_words = 512;
+    for (std::size_t first = 0; first < generated.size(); first += packet_words) {
+      const std::size_t n = std::min(packet_words, generated.size() - first);
+      while (!writer.write(data + first * codec::CTBWord::size_bytes, n * codec::CTBWord::size_bytes, 1)) {
+        std::this_thread::yield();
+      }
+    }
+    writer.stop();
+
+    uint64_t last_ts = 0;
+    for (std::size_t i = 0; i < generated.size(); ++i) {
+      const codec::CTBWord word = codec::CTBWord::load(data + i * codec::CTBWord::size_bytes);
+      uint64_t timestamp = word.timestamp();
+      if (word.word_type() == content::word::t_ch) {
+        timestamp = (last_ts & 0xF000000000000000) | word.ch_timestamp();
+      } else {
+        first_timestamp = std::min(first_timestamp, timestamp);
+        last_timestamp = std::max(last_timestamp, timestamp);
+        if (word.word_type() == content::word::t_ts) {
+          last_ts = timestamp;
+        }
+      }
+      words.push_back(key(timestamp, word));
+    }
+  }
+
+  /// The words of the query, by a scan of everything written
+  std::vector<key_t> expected(const calibration::Query& query) const
+  {
+    std::vector<key_t> selected;
+    for (const auto& k : words) {
+      if (query.accepts(codec::CTBWord(std::get<1>(k), std::get<2>(k)), std::get<0>(k))) {
+        selected.push_back(k);
+      }
+    }
+    return selected;
+  }
+};
+
+struct Results
+{
+  std::vector<key_t> matches;
+  CalibrationQuery::Stats stats;
+};
+
+Results
+run(const CalibrationQuery& query_files, const calibration::Query& query, std::size_t n_threads, std::size_t limit = ~std::size_t(0))
+{
+  Results results;
+  results.stats = query_files.run(query, n_threads, [&](const calibration::Match& match) {
+    results.matches.push_back(key(match.timestamp, match.word));
+    return results.matches.size() < limit;
+  });
+  return results;
+}
+
+bool
+in_timestamp_order(const std::vector<key_t>& matches)
+{
+  return std::is_sorted(matches.begin(), matches.end(), [](const key_t& a, const key_t& b) { return std::get<0>(a) < std::get<0>(b); });
+}
+
+/// Same words, equal timestamps in any order
+bool
+same_words(std::vector<key_t> matches, const std::vector<key_t>& expected)
+{
+  std::sort(matches.begin(), matches.end());
+  return matches == expected;
+}
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(CalibrationQuery_test, CalibrationFiles)
+
+BOOST_AUTO_TEST_CASE(EverythingInTimestampOrder)
+{
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string()));
+  BOOST_REQUIRE(query_files.n_files() > 4);
+
+  const calibration::Query query;
+  for (std::size_t n_threads : { 1, 4 }) {
+    const auto results = run(query_files, query, n_threads);
+    BOOST_CHECK(in_timestamp_order(results.matches));
+    BOOST_CHECK(same_words(results.matches, words));
+    BOOST_CHECK_EQUAL(results.stats.matches, words.size());
+    BOOST_CHECK_EQUAL(results.stats.files_skipped, 0u);
+    // the raw files of 6 MB are cut in several tasks
+    BOOST_CHECK(results.stats.tasks > query_files.n_files());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TimeRangeAcrossOverlappingFiles)
+{
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string()));
+
+  calibration::Query query;
+  const uint64_t span = last_timestamp - first_timestamp;
+  query.begin = first_timestamp + span / 3;
+  query.end = first_timestamp + span / 3 + span / 10;
+  const auto expected = this->expected(query);
+  BOOST_REQUIRE(!expected.empty());
+
+  const auto results = run(query_files, query, 3);
+  BOOST_CHECK(in_timestamp_order(results.matches));
+  BOOST_CHECK(same_words(results.matches, expected));
+  BOOST_CHECK(results.stats.files_skipped > 0);
+  BOOST_CHECK(results.stats.files_scanned >= 2);
+
+  // word types and trigger bits
+  query.word_types = 1 << content::word::t_gt | 1 << content::word::t_ch;
+  query.hlt_bits = 0x6;
+  const auto selected = run(query_files, query, 2);
+  BOOST_CHECK(in_timestamp_order(selected.matches));
+  BOOST_CHECK(same_words(selected.matches, this->expected(query)));
+}
+
+BOOST_AUTO_TEST_CASE(ManyTimeRanges)
+{
+  // ranges starting and ending anywhere, next to file, task and index boundaries included
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string()));
+  std::mt19937_64 random(5);
+  const uint64_t span = last_timestamp - first_timestamp;
+  for (int i = 0; i < 20; ++i) {
+    calibration::Query query;
+    query.begin = first_timestamp - 1000 + random() % (span + 2000);
+    query.end = query.begin + random() % (i % 2 ? span / 50 : span / 2);
+    const auto results = run(query_files, query, 1 + i % 4);
+    BOOST_CHECK(in_timestamp_order(results.matches));
+    BOOST_CHECK(same_words(results.matches, this->expected(query)));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ChannelStatusWordsAheadOfIndexEntries)
+{
+  // compact blocks are indexed by their first full timestamp, the channel status words before it are older
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string()));
+  std::size_t n_ranges = 0;
+  for (const auto& file_name : CalibrationQuery::list_files(directory.string(), "run2_")) {
+    const CalibrationFileReader reader(file_name);
+    const auto& index = reader.index();
+    for (std::size_t e = 1; e + 1 < index.size() && n_ranges < 10; ++e) {
+      std::vector<uint8_t> block;
+      reader.decode(reader.offset_of(index[e]), reader.offset_of(index[e + 1]) - reader.offset_of(index[e]), block);
+      const codec::CTBWord word = codec::CTBWord::load(block.data());
+      if (word.word_type() != content::word::t_ch || word.ch_timestamp() >= index[e].timestamp) {
+        continue;
+      }
+      // a range that ends with that word
+      calibration::Query query;
+      query.end = word.ch_timestamp();
+      query.begin = query.end - 200;
+      const auto results = run(query_files, query, 2);
+      BOOST_CHECK(in_timestamp_order(results.matches));
+      BOOST_CHECK(same_words(results.matches, this->expected(query)));
+      ++n_ranges;
+    }
+  }
+  BOOST_CHECK(n_ranges > 0);
+}
+
+BOOST_AUTO_TEST_CASE(OneRun)
+{
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string(), "run2_"));
+  BOOST_REQUIRE(query_files.n_files() > 1);
+  const auto results = run(query_files, calibration::Query(), 2);
+  BOOST_CHECK(in_timestamp_order(results.matches));
+  BOOST_CHECK_EQUAL(results.matches.size(), words.size() / 2);
+}
+
+BOOST_AUTO_TEST_CASE(EarlyCancel)
+{
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string()));
+  const calibration::Query query;
+  const auto expected = this->expected(query);
+
+  for (std::size_t limit : { 1, 10, 100000 }) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto results = run(query_files, query, 4, limit);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+    BOOST_REQUIRE_EQUAL(results.matches.size(), limit);
+    BOOST_CHECK_EQUAL(results.stats.matches, limit);
+    // the first words in timestamp order
+    BOOST_CHECK(in_timestamp_order(results.matches));
+    BOOST_CHECK_EQUAL(std::get<0>(results.matches.back()), std::get<0>(expected[limit - 1]));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(NoFiles)
+{
+  const CalibrationQuery query_files(CalibrationQuery::list_files(directory.string(), "run3_"));
+  BOOST_CHECK_EQUAL(query_files.n_files(), 0u);
+  const auto results = run(query_files, calibration::Query(), 2);
+  BOOST_CHECK(results.matches.empty());
+  BOOST_CHECK_EQUAL(results.stats.tasks, 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
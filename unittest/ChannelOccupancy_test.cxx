@@ -0,0 +1,260 @@
+/**
+ * @file ChannelOccupancy_test.cxx Test the bit-sliced channel counters against a plain count
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "ChannelOccupancy.hpp"
+
+#define BOOST_TEST_MODULE ChannelOccupancy_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <array>
+#include <random>
+
+using namespace dunedaq::ctbmodules;
+using codec::CTBWord;
+
+namespace {
+
+using counts_t = std::array<uint64_t, occupancy::s_n_channels>;
+
+/// Channel numbers from the fields of the word, one bit at a time
+void
+add(const CTBWord& word, counts_t& counts)
+{
+  const uint64_t fields[3] = { word.ch_beam(), word.ch_crt(), word.ch_pds() };
+  for (std::size_t s = 0; s < occupancy::s_subsystems.size(); ++s) {
+    const auto& subsystem = occupancy::s_subsystems[s];
+    for (std::size_t i = 0; i < subsystem.size; ++i) {
+      counts[subsystem.first + i] += fields[s] >> i & 1;
+    }
+  }
+}
+
+/// Channel c set with probability c / 64, so that some are nearly always on and some nearly always off
+CTBWord
+random_word(std::mt19937_64& random)
+{
+  uint64_t channels[3] = { 0, 0, 0 };
+  for (std::size_t s = 0; s < occupancy::s_subsystems.size(); ++s) {
+    const auto& subsystem = occupancy::s_subsystems[s];
+    for (std::size_t i = 0; i < subsystem.size; ++i) {
+      channels[s] |= uint64_t(random() % 64 < subsystem.first + i) << i;
+    }
+  }
+  return CTBWord::make_channel_status(random(), channels[0], channels[1], channels[2]);
+}
+
+/// The word with only that channel set
+CTBWord
+channel_word(std::size_t channel)
+{
+  uint64_t channels[3] = { 0, 0, 0 };
+  for (std::size_t s = 0; s < occupancy::s_subsystems.size(); ++s) {
+    const auto& subsystem = occupancy::s_subsystems[s];
+    if (channel >= subsystem.first && channel < subsystem.first + subsystem.size) {
+      channels[s] = uint64_t(1) << (channel - subsystem.first);
+    }
+  }
+  return CTBWord::make_channel_status(0x123456789, channels[0], channels[1], channels[2]);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(ChannelOccupancy_test)
+
+BOOST_AUTO_TEST_CASE(RandomWords)
+{
+  ChannelOccupancy channel_occupancy;
+  channel_occupancy.start_run();
+  std::mt19937_64 random(7);
+  counts_t run = {};
+  uint64_t run_words = 0;
+
+  // intervals of any length, across several flushes of the planes
+  for (uint64_t n_words : { 1, 100, 254, 255, 256, 300, 510, 511, 1000, 5000 }) {
+    counts_t interval = {};
+    for (uint64_t w = 0; w < n_words; ++w) {
+      const CTBWord word = random_word(random);
+      channel_occupancy.count(word);
+      add(word, interval);
+      add(word, run);
+    }
+    run_words += n_words;
+    // as on the timestamp word that ends the interval
+    channel_occupancy.flush();
+
+    const auto snapshot = channel_occupancy.take_snapshot();
+    BOOST_CHECK_EQUAL(snapshot.interval_words, n_words);
+    BOOST_CHECK_EQUAL(snapshot.run_words, run_words);
+    BOOST_CHECK(snapshot.interval == interval);
+    BOOST_CHECK(snapshot.run == run);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(AnyLanes)
+{
+  // the timestamp and word type bits are not channels
+  ChannelOccupancy channel_occupancy;
+  std::mt19937_64 random(8);
+  counts_t counts = {};
+  for (int w = 0; w < 3000; ++w) {
+    const CTBWord word(random(), random());
+    channel_occupancy.count(word);
+    add(word, counts);
+  }
+  channel_occupancy.flush();
+  const auto snapshot = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 3000u);
+  BOOST_CHECK(snapshot.interval == counts);
+}
+
+BOOST_AUTO_TEST_CASE(CountsCrossing255)
+{
+  // every channel set in every word: the counts go through each power of two of the planes
+  const CTBWord all = CTBWord::make_channel_status(0, 0xFFFF, 0xFFFFFFFF, 0x1FFFF);
+  ChannelOccupancy channel_occupancy;
+  uint64_t total = 0;
+  for (uint64_t n_words : { 254, 1, 1, 255, 256, 1024, 3 }) {
+    for (uint64_t w = 0; w < n_words; ++w) {
+      channel_occupancy.count(all);
+    }
+    channel_occupancy.flush();
+    total += n_words;
+    const auto snapshot = channel_occupancy.take_snapshot();
+    BOOST_CHECK_EQUAL(snapshot.interval_words, n_words);
+    for (std::size_t c = 0; c < occupancy::s_n_channels; ++c) {
+      BOOST_CHECK_EQUAL(snapshot.interval[c], n_words);
+      BOOST_CHECK_EQUAL(snapshot.run[c], total);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(FlushOnTimestampWords)
+{
+  ChannelOccupancy channel_occupancy;
+  const CTBWord word = channel_word(20);
+
+  // the planes hold up to 254 words
+  for (int w = 0; w < 254; ++w) {
+    channel_occupancy.count(word);
+  }
+  auto snapshot = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 0u);
+  BOOST_CHECK_EQUAL(snapshot.interval[20], 0u);
+
+  // and are flushed by the 255th
+  channel_occupancy.count(word);
+  snapshot = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 255u);
+  BOOST_CHECK_EQUAL(snapshot.interval[20], 255u);
+
+  // or by a timestamp word, a second one has nothing to add
+  for (int w = 0; w < 3; ++w) {
+    channel_occupancy.count(word);
+  }
+  channel_occupancy.flush();
+  channel_occupancy.flush();
+  snapshot = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 3u);
+  BOOST_CHECK_EQUAL(snapshot.interval[20], 3u);
+  BOOST_CHECK_EQUAL(snapshot.run[20], 258u);
+
+  // words counted after a snapshot belong to the next interval
+  channel_occupancy.count(word);
+  snapshot = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 0u);
+  channel_occupancy.flush();
+  snapshot = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 1u);
+  BOOST_CHECK_EQUAL(snapshot.interval[20], 1u);
+}
+
+BOOST_AUTO_TEST_CASE(ChannelMapping)
+{
+  // beam 0-15, CRT 16-47, PDS 48-64; lane 0 holds the beam channels 0-3, lane 1 the channels from 4 on
+  BOOST_CHECK_EQUAL(occupancy::s_n_channels, 65u);
+  BOOST_CHECK_EQUAL(occupancy::s_crt.first, 16u);
+  BOOST_CHECK_EQUAL(occupancy::s_pds.first, 48u);
+  for (std::size_t channel = 0; channel < occupancy::s_n_channels; ++channel) {
+    const CTBWord word = channel_word(channel);
+    if (channel < 4) {
+      BOOST_CHECK_EQUAL(word.lane(0) >> 60, uint64_t(1) << channel);
+      BOOST_CHECK_EQUAL(word.lane(1) & ~(uint64_t(0x7) << 61), 0u);
+    } else {
+      BOOST_CHECK_EQUAL(word.lane(0) >> 60, 0u);
+      BOOST_CHECK_EQUAL(word.lane(1) & ~(uint64_t(0x7) << 61), uint64_t(1) << (channel - 4));
+    }
+
+    ChannelOccupancy channel_occupancy;
+    channel_occupancy.count(word);
+    channel_occupancy.flush();
+    const auto snapshot = channel_occupancy.take_snapshot();
+    for (std::size_t c = 0; c < occupancy::s_n_channels; ++c) {
+      BOOST_CHECK_EQUAL(snapshot.interval[c], c == channel ? 1u : 0u);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(StuckChannels)
+{
+  ChannelOccupancy channel_occupancy;
+  std::mt19937_64 random(9);
+  // beam channel 3 and PDS channel 16 always on, CRT channels 5 and 31 never on
+  const uint64_t crt_off = uint64_t(1) << 5 | uint64_t(1) << 31;
+  for (int w = 0; w < 1000; ++w) {
+    const uint64_t beam = random() | 0x8;
+    const uint64_t crt = random() & ~crt_off;
+    const uint64_t pds = random() | 0x10000;
+    channel_occupancy.count(CTBWord::make_channel_status(w, beam, crt, pds));
+  }
+  channel_occupancy.flush();
+  const auto snapshot = channel_occupancy.take_snapshot();
+
+  // random bits: the other channels are neither, bar an unlucky seed
+  BOOST_CHECK_EQUAL(snapshot.stuck_on(occupancy::s_beam, 100), 0x8u);
+  BOOST_CHECK_EQUAL(snapshot.stuck_on(occupancy::s_crt, 100), 0u);
+  BOOST_CHECK_EQUAL(snapshot.stuck_on(occupancy::s_pds, 100), 0x10000u);
+  BOOST_CHECK_EQUAL(snapshot.stuck_off(occupancy::s_crt, occupancy::s_crt.mask(), 100), crt_off);
+  BOOST_CHECK_EQUAL(snapshot.stuck_off(occupancy::s_beam, occupancy::s_beam.mask(), 100), 0u);
+  // only among the enabled channels
+  BOOST_CHECK_EQUAL(snapshot.stuck_off(occupancy::s_crt, uint64_t(1) << 5, 100), uint64_t(1) << 5);
+
+  // too few words to tell
+  BOOST_CHECK_EQUAL(snapshot.stuck_on(occupancy::s_beam, 1001), 0u);
+  BOOST_CHECK_EQUAL(snapshot.stuck_off(occupancy::s_crt, occupancy::s_crt.mask(), 1001), 0u);
+  BOOST_CHECK_EQUAL(snapshot.stuck_on(occupancy::s_beam, 1000), 0x8u);
+
+  // an empty interval has neither, with at least one word required
+  const auto empty = channel_occupancy.take_snapshot();
+  BOOST_CHECK_EQUAL(empty.interval_words, 0u);
+  BOOST_CHECK_EQUAL(empty.stuck_on(occupancy::s_beam, 1), 0u);
+  BOOST_CHECK_EQUAL(empty.stuck_off(occupancy::s_crt, occupancy::s_crt.mask(), 1), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(RunCounts)
+{
+  ChannelOccupancy channel_occupancy;
+  const CTBWord word = channel_word(64);
+  for (int w = 0; w < 10; ++w) {
+    channel_occupancy.count(word);
+  }
+  channel_occupancy.flush();
+  channel_occupancy.start_run();
+  for (int w = 0; w < 4; ++w) {
+    channel_occupancy.count(word);
+  }
+  channel_occupancy.flush();
+  const auto snapshot = channel_occupancy.take_snapshot();
+  // the interval goes back to the previous snapshot, the run to start_run()
+  BOOST_CHECK_EQUAL(snapshot.interval_words, 14u);
+  BOOST_CHECK_EQUAL(snapshot.run_words, 4u);
+  BOOST_CHECK_EQUAL(snapshot.interval[64], 14u);
+  BOOST_CHECK_EQUAL(snapshot.run[64], 4u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,185 @@
+/**
+ * @file FlightRecorder_test.cxx Test the ring of the last decoded words and its dumps
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "CTBModuleIssues.hpp"
+#include "FlightRecorder.hpp"
+
+#define BOOST_TEST_MODULE FlightRecorder_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+
+namespace {
+
+/// Every field of record s follows from s, so that a torn record shows
+void
+record(FlightRecorder& recorder, uint64_t s)
+{
+  const auto event = static_cast<flight::Event>(1 + s % 6);
+  recorder.record(event, codec::CTBWord(s, ~s), s * 3);
+}
+
+bool
+is_record(const flight::Record& r, uint64_t s)
+{
+  return r.sequence() == s && r.event() == static_cast<flight::Event>(1 + s % 6) && r.lanes[0] == s && r.lanes[1] == ~s &&
+         r.value == s * 3;
+}
+
+std::string
+temp_file(const std::string& name)
+{
+  return (std::filesystem::temp_directory_path() /
+          (name + "_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())))
+    .string();
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(FlightRecorder_test)
+
+BOOST_AUTO_TEST_CASE(WrapAroundOrder)
+{
+  FlightRecorder recorder(8);
+  BOOST_CHECK(recorder.snapshot().empty());
+
+  // not full yet
+  for (uint64_t s = 0; s < 5; ++s) {
+    record(recorder, s);
+  }
+  auto records = recorder.snapshot();
+  BOOST_REQUIRE_EQUAL(records.size(), 5u);
+  for (uint64_t s = 0; s < 5; ++s) {
+    BOOST_CHECK(is_record(records[s], s));
+  }
+
+  // several turns: the last 7, oldest first, the slot of the next record is never read
+  for (uint64_t s = 5; s < 21; ++s) {
+    record(recorder, s);
+  }
+  records = recorder.snapshot();
+  BOOST_REQUIRE_EQUAL(records.size(), 7u);
+  for (uint64_t i = 0; i < 7; ++i) {
+    BOOST_CHECK(is_record(records[i], 14 + i));
+  }
+  BOOST_CHECK_EQUAL(records.front().word().lane(0), 14u);
+}
+
+BOOST_AUTO_TEST_CASE(ResizeCapacity)
+{
+  FlightRecorder recorder(5);
+  BOOST_CHECK_EQUAL(recorder.capacity(), 8u);
+  for (std::size_t capacity : { 0, 1, 2, 3, 1000, 1024, 1025 }) {
+    recorder.resize(capacity);
+    std::size_t expected = 1;
+    while (expected < capacity) {
+      expected *= 2;
+    }
+    BOOST_CHECK_EQUAL(recorder.capacity(), expected);
+  }
+
+  // and clears the records
+  for (uint64_t s = 0; s < 100; ++s) {
+    record(recorder, s);
+  }
+  recorder.resize(16);
+  BOOST_CHECK(recorder.snapshot().empty());
+  record(recorder, 0);
+  const auto records = recorder.snapshot();
+  BOOST_REQUIRE_EQUAL(records.size(), 1u);
+  BOOST_CHECK(is_record(records[0], 0));
+}
+
+BOOST_AUTO_TEST_CASE(DumpRoundTrip)
+{
+  FlightRecorder recorder(64);
+  for (uint64_t s = 0; s < 100; ++s) {
+    record(recorder, s);
+  }
+  const std::string file_name = temp_file("FlightRecorder_test");
+  BOOST_REQUIRE(recorder.dump(file_name, flight::Reason::kMatchError, 42));
+  BOOST_CHECK_EQUAL(std::filesystem::file_size(file_name), sizeof(flight::DumpHeader) + 63 * sizeof(flight::Record));
+
+  flight::DumpHeader header;
+  const auto records = FlightRecorder::read_dump(file_name, header);
+  BOOST_CHECK_EQUAL(header.magic, flight::s_dump_magic);
+  BOOST_CHECK_EQUAL(header.version, flight::s_dump_version);
+  BOOST_CHECK_EQUAL(header.reason, uint16_t(flight::Reason::kMatchError));
+  BOOST_CHECK_EQUAL(header.run_number, 42u);
+  BOOST_CHECK_EQUAL(header.n_records, 63u);
+  BOOST_CHECK(header.creation_time > 0);
+  BOOST_REQUIRE_EQUAL(records.size(), 63u);
+  for (uint64_t i = 0; i < 63; ++i) {
+    BOOST_CHECK(is_record(records[i], 37 + i));
+  }
+
+  // a truncated dump gives the complete records
+  std::filesystem::resize_file(file_name, sizeof(flight::DumpHeader) + 10 * sizeof(flight::Record) + 5);
+  BOOST_CHECK_EQUAL(FlightRecorder::read_dump(file_name, header).size(), 10u);
+
+  // anything else is refused
+  {
+    std::ofstream out(file_name, std::ios::binary | std::ios::trunc);
+    out << "not a flight recorder dump, but long enough for a header of 64 bytes";
+  }
+  BOOST_CHECK_THROW(FlightRecorder::read_dump(file_name, header), CTBFlightRecorderError);
+  std::filesystem::remove(file_name);
+  BOOST_CHECK_THROW(FlightRecorder::read_dump(file_name, header), CTBFlightRecorderError);
+
+  // a dump that cannot be written is a warning
+  BOOST_CHECK(!recorder.dump(file_name + "/no_such_directory/dump", flight::Reason::kOnDemand, 42));
+}
+
+BOOST_AUTO_TEST_CASE(SnapshotsWhileRecording)
+{
+  // a small ring turns many times during each copy: the records it overwrote must be left out
+  FlightRecorder recorder(256);
+  std::atomic<bool> done{ false };
+  std::thread writer([&] {
+    for (uint64_t s = 0; s < 5000000; ++s) {
+      record(recorder, s);
+    }
+    done = true;
+  });
+
+  std::size_t n_snapshots = 0;
+  std::size_t n_short = 0;
+  while (!done) {
+    const auto records = recorder.snapshot();
+    BOOST_CHECK(records.size() < recorder.capacity());
+    n_short += records.size() < recorder.capacity() - 1;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+      if (!is_record(records[i], records.front().sequence() + i)) {
+        BOOST_CHECK(is_record(records[i], records.front().sequence() + i));
+        break;
+      }
+    }
+    ++n_snapshots;
+  }
+  writer.join();
+  BOOST_TEST_MESSAGE(n_snapshots << " snapshots while recording, " << n_short << " of them with records left out");
+  BOOST_CHECK(n_snapshots > 0);
+
+  // once the writer is done, nothing is left out
+  const auto records = recorder.snapshot();
+  BOOST_REQUIRE_EQUAL(records.size(), recorder.capacity() - 1);
+  for (std::size_t i = 0; i < records.size(); ++i) {
+    BOOST_CHECK(is_record(records[i], records.front().sequence() + i));
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
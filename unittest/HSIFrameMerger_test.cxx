@@ -0,0 +1,236 @@
+/**
+ * @file HSIFrameMerger_test.cxx Test the time-ordered merge of the HLT frames of several boards
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "HSIFrameMerger.hpp"
+
+#define BOOST_TEST_MODULE HSIFrameMerger_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+
+namespace {
+
+HSIFrameMerger::hsi_frame_t
+frame(uint64_t timestamp, uint32_t id = 0)
+{
+  HSIFrameMerger::hsi_frame_t f{};
+  f[1] = timestamp & 0xFFFFFFFF;
+  f[2] = timestamp >> 32;
+  f[6] = id;
+  return f;
+}
+
+/// Nothing is forced unless a test asks for it
+HSIFrameMerger::Config
+patient()
+{
+  HSIFrameMerger::Config config;
+  config.window_ticks = uint64_t(1) << 40;
+  config.max_frames = 1 << 20;
+  config.max_delay = std::chrono::hours(1);
+  return config;
+}
+
+struct Output
+{
+  std::vector<uint64_t> timestamps;
+  std::vector<uint32_t> ids;
+  void operator()(const HSIFrameMerger::hsi_frame_t& f)
+  {
+    timestamps.push_back(HSIFrameBatcher::timestamp(f));
+    ids.push_back(f[6]);
+  }
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(HSIFrameMerger_test)
+
+BOOST_AUTO_TEST_CASE(ReleasedOnceEverySourcePassed)
+{
+  HSIFrameMerger merger;
+  merger.configure(2, patient());
+  Output out;
+
+  merger.push(0, frame(100));
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 0u);
+  merger.advance(1, 99);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 0u);
+  merger.advance(1, 150);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 1u);
+  BOOST_REQUIRE_EQUAL(out.timestamps.size(), 1u);
+  BOOST_CHECK_EQUAL(out.timestamps[0], 100u);
+
+  const auto stats = merger.take_stats();
+  BOOST_CHECK_EQUAL(stats.forced_frames, 0u);
+  BOOST_CHECK_EQUAL(stats.late_frames, 0u);
+  BOOST_CHECK_EQUAL(stats.delays.count, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(TimestampOrderAcrossSources)
+{
+  const std::size_t n_sources = 3;
+  HSIFrameMerger merger;
+  merger.configure(n_sources, patient());
+  Output out;
+
+  std::mt19937_64 random(7);
+  std::vector<uint64_t> clocks(n_sources, 1000);
+  uint32_t id = 0;
+  for (int i = 0; i < 10000; ++i) {
+    const std::size_t source = random() % n_sources;
+    // a few equal timestamps across sources, which keep their arrival order
+    clocks[source] += random() % 4 == 0 ? 0 : random() % 50;
+    if (random() % 3 == 0) {
+      merger.advance(source, clocks[source]);
+    } else {
+      merger.push(source, frame(clocks[source], ++id));
+    }
+    merger.release(std::ref(out));
+  }
+  const uint64_t end = *std::max_element(clocks.begin(), clocks.end()) + 1;
+  for (std::size_t s = 0; s < n_sources; ++s) {
+    merger.advance(s, end);
+  }
+  merger.release(std::ref(out));
+
+  BOOST_CHECK(merger.empty());
+  BOOST_CHECK_EQUAL(out.timestamps.size(), id);
+  BOOST_CHECK(std::is_sorted(out.timestamps.begin(), out.timestamps.end()));
+  for (std::size_t i = 1; i < out.ids.size(); ++i) {
+    if (out.timestamps[i] == out.timestamps[i - 1]) {
+      BOOST_CHECK(out.ids[i] > out.ids[i - 1]);
+    }
+  }
+  const auto stats = merger.take_stats();
+  BOOST_CHECK_EQUAL(stats.forced_frames, 0u);
+  BOOST_CHECK_EQUAL(stats.late_frames, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(ForcedByWindow)
+{
+  auto config = patient();
+  config.window_ticks = 1000;
+  HSIFrameMerger merger;
+  merger.configure(2, config);
+  Output out;
+
+  // source 1 is silent
+  merger.push(0, frame(100));
+  merger.push(0, frame(600));
+  merger.advance(0, 1000);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 0u);
+  BOOST_CHECK_EQUAL(merger.lag(1), 1000u);
+  merger.advance(0, 1200);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 1u);
+  BOOST_CHECK_EQUAL(out.timestamps.back(), 100u);
+  BOOST_CHECK_EQUAL(merger.take_stats().forced_frames, 1u);
+  BOOST_CHECK_EQUAL(merger.take_stats().forced_frames, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(ForcedByMaxFrames)
+{
+  auto config = patient();
+  config.max_frames = 2;
+  HSIFrameMerger merger;
+  merger.configure(2, config);
+  Output out;
+
+  for (uint64_t ts : { 10, 20, 30, 40 }) {
+    merger.push(0, frame(ts));
+  }
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 2u);
+  BOOST_CHECK_EQUAL(merger.size(), 2u);
+  BOOST_CHECK(out.timestamps == std::vector<uint64_t>({ 10, 20 }));
+  BOOST_CHECK_EQUAL(merger.take_stats().forced_frames, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(ForcedByDelay)
+{
+  auto config = patient();
+  config.max_delay = std::chrono::microseconds(100);
+  HSIFrameMerger merger;
+  merger.configure(2, config);
+  Output out;
+
+  merger.push(0, frame(10));
+  merger.push(0, frame(20));
+  const auto now = HSIFrameMerger::clock::now();
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out), now - std::chrono::seconds(1)), 0u);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out), now + std::chrono::seconds(1)), 2u);
+  BOOST_CHECK_EQUAL(merger.take_stats().forced_frames, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(LateFramesAreSentAndCounted)
+{
+  auto config = patient();
+  config.window_ticks = 100;
+  HSIFrameMerger merger;
+  merger.configure(2, config);
+  Output out;
+
+  // source 1 is behind by more than the window: the frame of source 0 is forced out
+  merger.push(0, frame(1000));
+  merger.advance(0, 1200);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 1u);
+
+  // then source 1 catches up with an older frame
+  merger.push(1, frame(500));
+  merger.advance(1, 1300);
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 1u);
+  BOOST_CHECK(out.timestamps == std::vector<uint64_t>({ 1000, 500 }));
+
+  const auto stats = merger.take_stats();
+  BOOST_CHECK_EQUAL(stats.forced_frames, 1u);
+  BOOST_CHECK_EQUAL(stats.late_frames, 1u);
+  BOOST_CHECK_EQUAL(stats.delays.count, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(DrainReleasesEverything)
+{
+  HSIFrameMerger merger;
+  merger.configure(3, patient());
+  Output out;
+
+  // source 2 is silent
+  merger.push(1, frame(30));
+  merger.push(0, frame(10));
+  merger.push(1, frame(20));
+  BOOST_CHECK_EQUAL(merger.release(std::ref(out)), 0u);
+  BOOST_CHECK_EQUAL(merger.drain(std::ref(out)), 3u);
+  BOOST_CHECK(out.timestamps == std::vector<uint64_t>({ 10, 20, 30 }));
+  BOOST_CHECK(merger.empty());
+
+  const auto stats = merger.take_stats();
+  BOOST_CHECK_EQUAL(stats.forced_frames, 0u);
+  BOOST_CHECK_EQUAL(stats.late_frames, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(ConfigureStartsOver)
+{
+  HSIFrameMerger merger;
+  merger.configure(2, patient());
+  Output out;
+  merger.push(0, frame(10));
+  merger.advance(1, 50);
+
+  merger.configure(4, patient());
+  BOOST_CHECK_EQUAL(merger.n_sources(), 4u);
+  BOOST_CHECK(merger.empty());
+  BOOST_CHECK_EQUAL(merger.lag(1), 0u);
+  BOOST_CHECK_EQUAL(merger.drain(std::ref(out)), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
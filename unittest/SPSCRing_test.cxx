@@ -0,0 +1,150 @@
+/**
+ * @file SPSCRing_test.cxx Test the single-producer single-consumer ring
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "SPSCRing.hpp"
+
+#define BOOST_TEST_MODULE SPSCRing_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::ctbmodules;
+
+BOOST_AUTO_TEST_SUITE(SPSCRing_test)
+
+BOOST_AUTO_TEST_CASE(Capacity)
+{
+  BOOST_CHECK_EQUAL(SPSCRing<int>(0).capacity(), 1u);
+  BOOST_CHECK_EQUAL(SPSCRing<int>(1).capacity(), 1u);
+  BOOST_CHECK_EQUAL(SPSCRing<int>(5).capacity(), 8u);
+  BOOST_CHECK_EQUAL(SPSCRing<int>(1024).capacity(), 1024u);
+}
+
+BOOST_AUTO_TEST_CASE(OrderAcrossWrap)
+{
+  SPSCRing<std::vector<uint64_t>> ring(4);
+  BOOST_CHECK(ring.read_slot() == nullptr);
+
+  uint64_t next_write = 0;
+  uint64_t next_read = 0;
+  // uneven batches, so that the indices wrap at every place of the ring
+  for (int turn = 0; turn < 50; ++turn) {
+    for (int w = 0; w < 1 + turn % 4; ++w) {
+      auto* slot = ring.write_slot();
+      if (slot == nullptr) {
+        BOOST_CHECK_EQUAL(ring.size(), ring.capacity());
+        break;
+      }
+      slot->assign(1 + next_write % 5, next_write);
+      ring.commit_write();
+      ++next_write;
+    }
+    BOOST_CHECK_EQUAL(ring.size(), next_write - next_read);
+    for (int r = 0; r < 1 + (turn + 2) % 3; ++r) {
+      auto* slot = ring.read_slot();
+      if (slot == nullptr) {
+        BOOST_CHECK_EQUAL(ring.size(), 0u);
+        break;
+      }
+      BOOST_CHECK(*slot == std::vector<uint64_t>(1 + next_read % 5, next_read));
+      ring.commit_read();
+      ++next_read;
+    }
+    BOOST_CHECK_EQUAL(ring.size(), next_write - next_read);
+  }
+  BOOST_CHECK(next_read > 2 * ring.capacity());
+
+  // full: one more write is refused
+  while (auto* slot = ring.write_slot()) {
+    slot->clear();
+    ring.commit_write();
+  }
+  BOOST_CHECK_EQUAL(ring.size(), ring.capacity());
+  BOOST_CHECK(ring.write_slot() == nullptr);
+
+  // slots keep what they held, containers keep their capacity
+  const auto* slot = ring.read_slot();
+  BOOST_REQUIRE(slot != nullptr);
+  BOOST_CHECK(slot->capacity() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(ProducerConsumer)
+{
+  struct Item
+  {
+    uint64_t sequence = 0;
+    uint64_t check = 0;
+  };
+  SPSCRing<Item> ring(64);
+  const uint64_t n_items = 2000000;
+  std::atomic<bool> done{ false };
+  std::atomic<std::size_t> n_failures{ 0 };
+  std::atomic<uint64_t> n_written{ 0 }; // at most one behind the write index
+  std::atomic<uint64_t> n_read{ 0 };    // at most one behind the read index
+
+  std::thread producer([&] {
+    for (uint64_t s = 0; s < n_items;) {
+      Item* item = ring.write_slot();
+      if (item == nullptr) {
+        std::this_thread::yield();
+        continue;
+      }
+      // the read index only goes up, so a free slot means at most capacity - 1 used
+      if (ring.size() >= ring.capacity()) {
+        ++n_failures;
+      }
+      item->sequence = s;
+      item->check = ~s;
+      ring.commit_write();
+      n_written = ++s;
+    }
+  });
+
+  std::thread consumer([&] {
+    for (uint64_t s = 0; s < n_items;) {
+      const Item* item = ring.read_slot();
+      if (item == nullptr) {
+        std::this_thread::yield();
+        continue;
+      }
+      // the write index only goes up, so a filled slot means at least one used
+      if (ring.size() == 0 || item->sequence != s || item->check != ~s) {
+        ++n_failures;
+      }
+      ring.commit_read();
+      n_read = ++s;
+    }
+    done = true;
+  });
+
+  // and from a third thread, never more than the capacity nor than what can be in the ring
+  std::size_t n_sizes = 0;
+  while (!done) {
+    const uint64_t read_before = n_read;
+    const std::size_t size = ring.size();
+    const uint64_t written_after = n_written;
+    if (size > ring.capacity() || size > written_after + 1 - read_before) {
+      ++n_failures;
+    }
+    ++n_sizes;
+    std::this_thread::yield();
+  }
+  producer.join();
+  consumer.join();
+
+  BOOST_TEST_MESSAGE(n_sizes << " sizes read while both threads were running");
+  BOOST_CHECK_EQUAL(n_failures.load(), 0u);
+  BOOST_CHECK_EQUAL(ring.size(), 0u);
+  BOOST_CHECK(ring.read_slot() == nullptr);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,325 @@
+/**
+ * @file TriggerRates_test.cxx Test the sliding window and spill trigger rates
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "TriggerRates.hpp"
+
+#define BOOST_TEST_MODULE TriggerRates_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <random>
+#include <thread>
+
+using namespace dunedaq::ctbmodules;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr std::size_t n_bits = 8;
+using Rates = TriggerRates<n_bits>;
+constexpr uint64_t bucket_ticks = Rates::s_bucket_ticks;
+constexpr double bucket_seconds = 0.1;
+constexpr double tolerance = 1e-9; // percent
+
+/// The counts of every bucket, by a plain count of the words
+struct Counts
+{
+  std::map<uint64_t, std::array<uint64_t, n_bits + 1>> periods;
+
+  void add(uint64_t timestamp, uint64_t trigger_word)
+  {
+    auto& counts = periods[timestamp / bucket_ticks];
+    for (std::size_t i = 0; i < n_bits; ++i) {
+      counts[i] += trigger_word >> i & 1;
+    }
+    ++counts[n_bits];
+  }
+
+  /// Rate of a bit over the n buckets before period now
+  double rate(std::size_t bit, uint64_t now, std::size_t n) const
+  {
+    uint64_t sum = 0;
+    for (uint64_t period = now - n; period < now; ++period) {
+      const auto it = periods.find(period);
+      sum += it == periods.end() ? 0 : it->second[bit];
+    }
+    return sum / bucket_seconds / n;
+  }
+};
+
+/// The windows are cut to the buckets since the first word
+void
+check_rates(const Rates& rates, const Counts& counts, uint64_t first_period, uint64_t now_timestamp)
+{
+  const auto snapshot = rates.rates();
+  const uint64_t now = now_timestamp / bucket_ticks;
+  const std::size_t available = std::min<uint64_t>(now - first_period, Rates::s_max_window_buckets);
+  const std::size_t n_short = std::min<std::size_t>(rates.short_window() / 100ms, available);
+  const std::size_t n_long = std::min<std::size_t>(rates.long_window() / 100ms, available);
+  for (std::size_t bit = 0; bit <= n_bits; ++bit) {
+    if (available == 0) {
+      BOOST_CHECK_EQUAL(snapshot[bit].long_window, 0.);
+      continue;
+    }
+    BOOST_CHECK_CLOSE(snapshot[bit].instantaneous, counts.rate(bit, now, 1), tolerance);
+    BOOST_CHECK_CLOSE(snapshot[bit].short_window, counts.rate(bit, now, n_short), tolerance);
+    BOOST_CHECK_CLOSE(snapshot[bit].long_window, counts.rate(bit, now, n_long), tolerance);
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(TriggerRates_test)
+
+BOOST_AUTO_TEST_CASE(WindowRounding)
+{
+  Rates rates;
+  rates.configure(150ms, 1050ms, 0);
+  BOOST_CHECK_EQUAL(rates.short_window().count(), 100);
+  BOOST_CHECK_EQUAL(rates.long_window().count(), 1000);
+
+  // at least one bucket, at most the ones that are never recycled
+  rates.configure(0ms, 10min, 0);
+  BOOST_CHECK_EQUAL(rates.short_window().count(), 100);
+  BOOST_CHECK_EQUAL(rates.long_window().count(), int64_t(Rates::s_max_window_buckets * 100));
+
+  // the long window is never shorter than the short one
+  rates.configure(2s, 500ms, 0);
+  BOOST_CHECK_EQUAL(rates.short_window().count(), 2000);
+  BOOST_CHECK_EQUAL(rates.long_window().count(), 2000);
+}
+
+BOOST_AUTO_TEST_CASE(KnownStream)
+{
+  Rates rates;
+  rates.configure(1s, 10s, 0);
+  Counts counts;
+  std::mt19937_64 random(1);
+
+  const uint64_t first_period = 1000;
+  uint64_t timestamp = first_period * bucket_ticks + 12345;
+  check_rates(rates, counts, first_period, timestamp);
+  for (int i = 0; i < 12000; ++i) {
+    // bursts and quiet buckets
+    timestamp += i % 1000 < 900 ? random() % (bucket_ticks / 20) : random() % (2 * bucket_ticks);
+    const uint64_t trigger_word = random() & 0x1FF; // bit 8 is not counted
+    rates.count(timestamp, trigger_word);
+    counts.add(timestamp, trigger_word);
+    if (i % 50 == 0) {
+      check_rates(rates, counts, first_period, timestamp);
+    }
+  }
+  BOOST_REQUIRE(timestamp / bucket_ticks - first_period > 100);
+  check_rates(rates, counts, first_period, timestamp);
+
+  // timestamp words move the windows without triggers
+  for (int i = 0; i < 30; ++i) {
+    timestamp += bucket_ticks / 2;
+    rates.advance(timestamp);
+    check_rates(rates, counts, first_period, timestamp);
+  }
+  const auto snapshot = rates.rates();
+  BOOST_CHECK_EQUAL(snapshot[n_bits].short_window, 0.);
+  BOOST_CHECK(snapshot[n_bits].long_window > 0.);
+}
+
+BOOST_AUTO_TEST_CASE(BucketWrapAround)
+{
+  // several turns of the ring, with the long window over almost all of it
+  Rates rates;
+  rates.configure(3s, 60s, 0);
+  Counts counts;
+  std::mt19937_64 random(2);
+
+  const uint64_t first_period = 5;
+  rates.advance(first_period * bucket_ticks);
+  for (uint64_t period = first_period; period < first_period + 2000; ++period) {
+    const std::size_t n_words = period % 13 == 0 ? 0 : random() % 6;
+    for (std::size_t w = 0; w < n_words; ++w) {
+      const uint64_t timestamp = period * bucket_ticks + random() % bucket_ticks;
+      const uint64_t trigger_word = uint64_t(1) << (random() % n_bits);
+      rates.count(timestamp, trigger_word);
+      counts.add(timestamp, trigger_word);
+    }
+    rates.advance((period + 1) * bucket_ticks);
+    if (period % 7 == 0) {
+      check_rates(rates, counts, first_period, (period + 1) * bucket_ticks);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(TaggedBucketRecycling)
+{
+  Rates rates;
+  rates.configure(1s, 60s, 0);
+  const uint64_t first_period = 1000;
+  for (uint64_t period = first_period; period < first_period + 100; ++period) {
+    for (int w = 0; w < 10; ++w) {
+      rates.count(period * bucket_ticks + w, 0x1);
+    }
+  }
+
+  // more than a turn later, the buckets of the window still hold the old periods and are left out
+  const uint64_t now = first_period + Rates::s_n_buckets + 150;
+  rates.advance(now * bucket_ticks);
+  for (const auto& r : rates.rates()) {
+    BOOST_CHECK_EQUAL(r.instantaneous, 0.);
+    BOOST_CHECK_EQUAL(r.long_window, 0.);
+  }
+
+  // a word in the bucket of an old period starts it from zero
+  const uint64_t recycled = first_period + Rates::s_n_buckets + 49;
+  for (int w = 0; w < 3; ++w) {
+    rates.count(recycled * bucket_ticks + w, 0x2);
+  }
+  const auto snapshot = rates.rates();
+  BOOST_CHECK_CLOSE(snapshot[n_bits].long_window, 3 / bucket_seconds / 600, tolerance);
+  BOOST_CHECK_CLOSE(snapshot[1].long_window, 3 / bucket_seconds / 600, tolerance);
+  BOOST_CHECK_EQUAL(snapshot[0].long_window, 0.);
+  BOOST_CHECK_EQUAL(snapshot[n_bits].instantaneous, 0.);
+}
+
+BOOST_AUTO_TEST_CASE(LateWords)
+{
+  Rates rates;
+  rates.configure(1s, 10min, 0);
+  const uint64_t now = 2000;
+  rates.advance((now - 700) * bucket_ticks);
+  for (int w = 0; w < 5; ++w) {
+    rates.count(now * bucket_ticks + w, 0x1);
+  }
+
+  // the oldest bucket of the longest window still counts
+  rates.count((now - Rates::s_max_window_buckets) * bucket_ticks, 0x2);
+  // older ones would recycle the buckets of the next periods, the current one included
+  rates.count((now - Rates::s_max_window_buckets - 1) * bucket_ticks, 0x4);
+  rates.count((now - Rates::s_n_buckets) * bucket_ticks, 0x4);
+
+  rates.advance((now + 1) * bucket_ticks);
+  const auto snapshot = rates.rates();
+  BOOST_CHECK_CLOSE(snapshot[0].instantaneous, 5 / bucket_seconds, tolerance);
+  BOOST_CHECK_CLOSE(snapshot[n_bits].instantaneous, 5 / bucket_seconds, tolerance);
+  // the oldest bucket of the window is now - 637, the word of now - 638 slid out
+  BOOST_CHECK_EQUAL(snapshot[1].long_window, 0.);
+  BOOST_CHECK_EQUAL(snapshot[2].long_window, 0.);
+
+  Rates before_advance;
+  before_advance.configure(1s, 10min, 0);
+  before_advance.advance((now - 700) * bucket_ticks);
+  before_advance.advance(now * bucket_ticks);
+  before_advance.count((now - Rates::s_max_window_buckets) * bucket_ticks, 0x2);
+  const auto late_snapshot = before_advance.rates();
+  BOOST_CHECK_CLOSE(late_snapshot[1].long_window, 1 / bucket_seconds / Rates::s_max_window_buckets, tolerance);
+}
+
+BOOST_AUTO_TEST_CASE(Spills)
+{
+  Rates rates;
+  rates.configure(1s, 10s, 0x6);
+  const uint64_t start = 100 * bucket_ticks;
+  rates.advance(start);
+
+  // every bit of the mask must be set
+  rates.on_channel_status(0x2);
+  rates.count(start, 0x1);
+  rates.on_channel_status(0x7);
+  for (uint64_t w = 0; w < 500; ++w) {
+    rates.count(start + 1000 + w * 1000, w % 5 ? 0x1 : 0x3);
+  }
+  // half a second of spill, no spill rate before it closes
+  rates.advance(start + 31250000);
+  auto snapshot = rates.rates();
+  BOOST_CHECK_EQUAL(snapshot[n_bits].last_spill, 0.);
+  rates.on_channel_status(0x4);
+  rates.count(start + 31250001, 0x1);
+
+  snapshot = rates.rates();
+  BOOST_CHECK_CLOSE(snapshot[n_bits].last_spill, 1000., tolerance);
+  BOOST_CHECK_CLOSE(snapshot[0].last_spill, 1000., tolerance);
+  BOOST_CHECK_CLOSE(snapshot[1].last_spill, 200., tolerance);
+  BOOST_CHECK_EQUAL(snapshot[2].last_spill, 0.);
+
+  // the next spill restarts the counts, the last one is kept until it closes
+  rates.advance(start + 40000000);
+  rates.on_channel_status(0x6);
+  for (uint64_t w = 0; w < 10; ++w) {
+    rates.count(start + 40000000 + w, 0x1);
+  }
+  rates.advance(start + 40000000 + 6250000);
+  snapshot = rates.rates();
+  BOOST_CHECK_CLOSE(snapshot[n_bits].last_spill, 1000., tolerance);
+  rates.on_channel_status(0);
+  snapshot = rates.rates();
+  BOOST_CHECK_CLOSE(snapshot[n_bits].last_spill, 10 / 0.1, tolerance);
+  BOOST_CHECK_EQUAL(snapshot[1].last_spill, 0.);
+
+  // no mask, no spill
+  Rates no_spill;
+  no_spill.configure(1s, 10s, 0);
+  no_spill.advance(start);
+  no_spill.on_channel_status(0xFFFF);
+  no_spill.count(start + 1000, 0x1);
+  no_spill.advance(start + 2000);
+  no_spill.on_channel_status(0);
+  snapshot = no_spill.rates();
+  BOOST_CHECK_EQUAL(snapshot[n_bits].last_spill, 0.);
+}
+
+BOOST_AUTO_TEST_CASE(ConcurrentReads)
+{
+  // every word has bits 0 and 1: any bucket or spill read across an update would show different rates
+  Rates rates;
+  rates.configure(200ms, 2s, 0x1);
+  std::atomic<bool> done{ false };
+
+  std::thread writer([&] {
+    uint64_t timestamp = 1000 * bucket_ticks;
+    for (uint64_t spill = 1; spill < 100000; ++spill) {
+      // spills of spill % 50 + 1 words 1000 ticks apart, all at the same rate
+      rates.advance(timestamp);
+      rates.on_channel_status(0x1);
+      const uint64_t n_words = spill % 50 + 1;
+      for (uint64_t w = 1; w <= n_words; ++w) {
+        rates.count(timestamp + w * 1000, 0x3);
+      }
+      rates.advance(timestamp + n_words * 1000);
+      rates.on_channel_status(0);
+      // and a new bucket every few spills, so that the ring turns quickly
+      timestamp += spill % 3 ? n_words * 1000 : bucket_ticks;
+    }
+    done = true;
+  });
+
+  std::size_t n_reads = 0;
+  std::size_t n_spills = 0;
+  while (!done) {
+    const auto snapshot = rates.rates();
+    for (std::size_t bit : { std::size_t(1), n_bits }) {
+      BOOST_CHECK_EQUAL(snapshot[bit].instantaneous, snapshot[0].instantaneous);
+      BOOST_CHECK_EQUAL(snapshot[bit].short_window, snapshot[0].short_window);
+      BOOST_CHECK_EQUAL(snapshot[bit].long_window, snapshot[0].long_window);
+      BOOST_CHECK_EQUAL(snapshot[bit].last_spill, snapshot[0].last_spill);
+    }
+    BOOST_CHECK_EQUAL(snapshot[2].long_window, 0.);
+    if (snapshot[0].last_spill > 0.) {
+      BOOST_CHECK_CLOSE(snapshot[0].last_spill, 62500., tolerance);
+      ++n_spills;
+    }
+    ++n_reads;
+  }
+  writer.join();
+  BOOST_TEST_MESSAGE("Rates read " << n_reads << " times while writing, " << n_spills << " with a spill");
+  BOOST_CHECK(n_reads > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()